@@ -0,0 +1,86 @@
+#pragma once
+
+#include "Types.h"
+#include "Win32Def.h"
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <chrono>
+
+//The sequence of [offset,length] section requests a payload made during one boot,
+//saved next to the ini so later boots can warm exactly those ranges up front
+class AccessProfile
+{
+public:
+	struct Entry
+	{
+		std::string section;
+		u32 offset = 0;
+		u32 length = 0;
+		u32 elapsedMs = 0;
+	};
+
+	AccessProfile() : startTime(std::chrono::steady_clock::now()) {}
+
+	//one entry per line: section offset length elapsedMs, returns number of entries loaded or -1 if the file couldn't be opened
+	int load(const TCHAR* filename)
+	{
+		std::ifstream inputFile(filename);
+		if (!inputFile.is_open())
+			return -1;
+
+		entries.clear();
+		std::string currLine;
+		while (std::getline(inputFile, currLine))
+		{
+			if (currLine.length() == 0 || currLine[0] == ';')
+				continue;
+
+			std::istringstream lineStream(currLine);
+			Entry newEntry;
+			lineStream >> newEntry.section >> std::hex >> newEntry.offset >> newEntry.length >> std::dec >> newEntry.elapsedMs;
+			if (lineStream.fail() || newEntry.section.length() == 0)
+				continue;
+
+			entries.emplace_back(std::move(newEntry));
+		}
+
+		return (int)entries.size();
+	}
+
+	bool save(const TCHAR* filename) const
+	{
+		std::ofstream outputFile(filename, std::ios::trunc);
+		if (!outputFile.is_open())
+			return false;
+
+		outputFile << "; section offset length elapsedMs" << std::endl;
+		outputFile << std::setfill('0');
+		for (const auto& currEntry : entries)
+		{
+			outputFile << currEntry.section << std::hex << " 0x" << std::setw(8) << currEntry.offset << " 0x" << std::setw(8) << currEntry.length
+						<< std::dec << ' ' << currEntry.elapsedMs << '\n';
+		}
+
+		return outputFile.good();
+	}
+
+	//elapsed times are relative to this point (the smash)
+	void restartClock() { startTime = std::chrono::steady_clock::now(); }
+
+	void record(const std::string& section, u32 offset, u32 length)
+	{
+		Entry newEntry;
+		newEntry.section = section;
+		newEntry.offset = offset;
+		newEntry.length = length;
+		newEntry.elapsedMs = (u32)std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - startTime).count();
+		entries.emplace_back(std::move(newEntry));
+	}
+
+	const vector<Entry>& getEntries() const { return entries; }
+	bool empty() const { return entries.empty(); }
+protected:
+	vector<Entry> entries;
+	std::chrono::steady_clock::time_point startTime;
+};
\ No newline at end of file
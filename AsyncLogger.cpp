@@ -0,0 +1,222 @@
+#include "AsyncLogger.h"
+#include <tchar.h>
+#include <stdio.h>
+#include <algorithm>
+
+AsyncLogger& AsyncLogger::instance()
+{
+	static AsyncLogger theLogger;
+	return theLogger;
+}
+
+void AsyncLogger::start(LogLevel maxLevel)
+{
+	setMaxLevel(maxLevel);
+	if (running.load())
+		return;
+
+	wakeEvent = CreateEvent(nullptr, FALSE, FALSE, nullptr);
+	if (wakeEvent.get() == nullptr || wakeEvent.get() == INVALID_HANDLE_VALUE)
+	{
+		const auto errorCode = GetLastError();
+		_ftprintf(stderr, TEXT("Couldn't start the log writer (win32 error %u), printing directly\n"), errorCode);
+		return;
+	}
+
+	stopping = false;
+	writerThread = std::thread(&AsyncLogger::drainLoop, this);
+	running.store(true, std::memory_order_release);
+}
+
+void AsyncLogger::stop()
+{
+	if (!running.exchange(false))
+		return;
+
+	{
+		std::lock_guard<std::mutex> flushLock(flushMutex);
+		stopping = true;
+	}
+	SetEvent(wakeEvent.get());
+	writerThread.join();
+
+	// whatever got queued while the writer was on its way out
+	writeQueued();
+	flushCond.notify_all();
+
+	const auto totalDropped = numDropped.load();
+	if (totalDropped > 0)
+		_ftprintf(stderr, TEXT("Dropped %llu log lines in total because the console couldn't keep up\n"), (unsigned long long)totalDropped);
+}
+
+void AsyncLogger::flush()
+{
+	if (!running.load(std::memory_order_acquire))
+		return;
+
+	const u64 flushedCount = numQueued.load();
+	SetEvent(wakeEvent.get());
+
+	std::unique_lock<std::mutex> flushLock(flushMutex);
+	flushCond.wait(flushLock, [this, flushedCount]() { return numWritten.load() >= flushedCount || stopping; });
+}
+
+void AsyncLogger::setOutput(LogOutputFunc newFunc, void* userData)
+{
+	outputUserData.store(userData);
+	outputFunc.store(newFunc);
+}
+
+void AsyncLogger::printV(LogLevel level, const TCHAR* fmtStr, va_list args)
+{
+	if (!wants(level))
+		return;
+
+	const bool printNow = !running.load(std::memory_order_acquire);
+	if (printNow && outputFunc.load() == nullptr)
+	{
+		FILE* outStream = (level == LogLevel::Error) ? stderr : stdout;
+		_vftprintf(outStream, fmtStr, args);
+		return;
+	}
+
+	Line newLine;
+	newLine.level = level;
+	newLine.narrow = false;
+	const int numChars = _vsntprintf_s(newLine.text, LINE_CHARS, _TRUNCATE, fmtStr, args);
+	if (numChars < 0 || numChars >= int(LINE_CHARS))
+	{
+		// cut short, but still ending the line
+		newLine.length = (u16)(LINE_CHARS-1);
+		newLine.text[LINE_CHARS-2] = '\n';
+		newLine.text[LINE_CHARS-1] = 0;
+	}
+	else
+		newLine.length = (u16)numChars;
+
+	if (printNow)
+		writeLine(newLine);
+	else
+		enqueue(newLine);
+}
+
+void AsyncLogger::printNarrow(LogLevel level, const char* textBytes, size_t numBytes)
+{
+	if (!wants(level) || numBytes == 0)
+		return;
+
+	if (!running.load(std::memory_order_acquire))
+	{
+		WinString printMe(textBytes, textBytes+numBytes);
+		writeText(level, printMe.c_str(), printMe.length());
+		return;
+	}
+
+	Line newLine;
+	newLine.level = level;
+	newLine.narrow = true;
+	for (size_t bytesDone=0; bytesDone<numBytes; )
+	{
+		const size_t partBytes = std::min(numBytes-bytesDone, sizeof(newLine.narrowText));
+		memcpy(newLine.narrowText, &textBytes[bytesDone], partBytes);
+		newLine.length = (u16)partBytes;
+		enqueue(newLine);
+
+		bytesDone += partBytes;
+	}
+}
+
+void AsyncLogger::enqueue(const Line& newLine)
+{
+	if (!lines.push(newLine))
+	{
+		numDropped.fetch_add(1, std::memory_order_relaxed);
+		return;
+	}
+
+	numQueued.fetch_add(1);
+	SetEvent(wakeEvent.get());
+}
+
+void AsyncLogger::writeText(LogLevel level, const TCHAR* text, size_t numChars)
+{
+	const auto currFunc = outputFunc.load();
+	if (currFunc != nullptr)
+	{
+		currFunc(outputUserData.load(), level, text, numChars);
+		return;
+	}
+
+	FILE* outStream = (level == LogLevel::Error) ? stderr : stdout;
+	_ftprintf(outStream, TEXT("%.*Ts"), (int)numChars, text);
+}
+
+void AsyncLogger::writeLine(const Line& currLine)
+{
+	if (currLine.narrow)
+	{
+		WinString printMe(&currLine.narrowText[0], &currLine.narrowText[currLine.length]);
+		writeText(currLine.level, printMe.c_str(), printMe.length());
+	}
+	else
+		writeText(currLine.level, currLine.text, currLine.length);
+}
+
+void AsyncLogger::writeQueued()
+{
+	Line currLine;
+	bool wroteAny = false;
+	while (lines.pop(currLine))
+	{
+		writeLine(currLine);
+		numWritten.fetch_add(1);
+		wroteAny = true;
+	}
+
+	// noted where it happened, the total comes again when the logger stops
+	const auto droppedNow = numDropped.load(std::memory_order_relaxed);
+	if (droppedNow != numReportedDropped)
+	{
+		TCHAR droppedMsg[96];
+		const int numChars = _stprintf_s(droppedMsg, TEXT("[%llu log lines dropped, the console couldn't keep up]\n"), (unsigned long long)(droppedNow-numReportedDropped));
+		writeText(LogLevel::Error, droppedMsg, (numChars > 0) ? size_t(numChars) : 0);
+		numReportedDropped = droppedNow;
+		wroteAny = true;
+	}
+
+	if (wroteAny)
+	{
+		fflush(stdout);
+		fflush(stderr);
+	}
+}
+
+void AsyncLogger::drainLoop()
+{
+	for (;;)
+	{
+		WaitForSingleObject(wakeEvent.get(), 100);
+		writeQueued();
+
+		bool stopNow = false;
+		{
+			std::lock_guard<std::mutex> flushLock(flushMutex);
+			stopNow = stopping;
+		}
+		flushCond.notify_all();
+		if (stopNow)
+			break;
+	}
+}
+
+void LogPrint(LogLevel level, const TCHAR* fmtStr, ...)
+{
+	auto& theLogger = AsyncLogger::instance();
+	if (!theLogger.wants(level))
+		return;
+
+	va_list args;
+	va_start(args, fmtStr);
+	theLogger.printV(level, fmtStr, args);
+	va_end(args);
+}
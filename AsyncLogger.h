@@ -0,0 +1,88 @@
+#pragma once
+
+#include "Types.h"
+#include "WinHandle.h"
+#include "MpmcQueue.h"
+#include <stdarg.h>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+//Lower levels are more important, a line gets printed if its level is at or below the configured one
+enum class LogLevel : u8
+{
+	Error = 0,	//to stderr
+	Info,
+	Verbose		//a line for every request the payload makes
+};
+
+//Where lines go instead of the console once set, text is one or more whole lines (or raw device output) and not zero terminated
+typedef void (*LogOutputFunc)(void* userData, LogLevel level, const TCHAR* text, size_t numChars);
+
+//Process-wide console output for device sessions. Once started, printing a line only formats it into a lock-free
+//ring buffer and a background thread writes it out, so a slow terminal or a captured pipe never stalls a transfer.
+//When the buffer is full the line is dropped and counted instead of waiting. Not started, lines get printed right away
+class AsyncLogger
+{
+public:
+	static AsyncLogger& instance();
+
+	void start(LogLevel maxLevel);
+	//Writes out everything still queued, then prints directly again
+	void stop();
+	//Returns once everything queued before the call has been written, for handing the console back to direct prints
+	void flush();
+
+	void setMaxLevel(LogLevel maxLevel) { maxLogLevel.store((int)maxLevel, std::memory_order_relaxed); }
+	//Not even errors get printed until the next setMaxLevel
+	void silence() { maxLogLevel.store(-1, std::memory_order_relaxed); }
+	bool wants(LogLevel level) const { return (int)level <= maxLogLevel.load(std::memory_order_relaxed); }
+
+	//nullptr goes back to stdout/stderr. Set it before any session starts printing, lines already queued go to whichever is set when they get written
+	void setOutput(LogOutputFunc outputFunc, void* userData);
+
+	void printV(LogLevel level, const TCHAR* fmtStr, va_list args);
+	//Text the device sent, converted to TCHARs on the writer thread. Long messages get split over several lines
+	void printNarrow(LogLevel level, const char* textBytes, size_t numBytes);
+
+	u64 getDroppedCount() const { return numDropped.load(std::memory_order_relaxed); }
+protected:
+	AsyncLogger() : maxLogLevel((int)LogLevel::Verbose), outputFunc(nullptr), outputUserData(nullptr), running(false), numQueued(0), numWritten(0), numDropped(0), numReportedDropped(0), stopping(false) {}
+
+	static constexpr size_t LINE_CHARS = 480;
+	static constexpr size_t QUEUE_LINES = 1024;
+	struct Line
+	{
+		LogLevel level;
+		bool narrow;
+		u16 length; //in TCHARs, or bytes when narrow
+		union
+		{
+			TCHAR text[LINE_CHARS];
+			char narrowText[LINE_CHARS*sizeof(TCHAR)];
+		};
+	};
+
+	void enqueue(const Line& newLine);
+	void writeText(LogLevel level, const TCHAR* text, size_t numChars);
+	void writeLine(const Line& currLine);
+	void drainLoop();
+	void writeQueued();
+
+	std::atomic<int> maxLogLevel; //-1 when silenced
+	std::atomic<LogOutputFunc> outputFunc;
+	std::atomic<void*> outputUserData;
+	MpmcQueue<Line, QUEUE_LINES> lines;
+	std::atomic<bool> running;
+	std::atomic<u64> numQueued, numWritten, numDropped;
+	u64 numReportedDropped; //only touched by the writer
+	WinHandle wakeEvent;
+	std::thread writerThread;
+	std::mutex flushMutex; //the writer takes it after every batch, so flush can wait on flushCond
+	std::condition_variable flushCond;
+	bool stopping; //guarded by flushMutex
+};
+
+//printf into the session log: LogLevel::Error goes to stderr, everything else to stdout
+void LogPrint(LogLevel level, const TCHAR* fmtStr, ...);
@@ -0,0 +1,40 @@
+#pragma once
+
+#include "Types.h"
+#include "Win32Def.h"
+#include <memory>
+
+//Loaded file contents, immutable once loaded so any number of sessions can send from the same buffer
+typedef std::shared_ptr<const ByteVector> SharedBytes;
+
+//A block of data memloader gets sent, either named (served on request) or by address (sent with RECV)
+struct LoadDataItem
+{
+	std::string name;
+	WinString filename;
+	size_t offset = 0;
+	size_t maxCount = 0;
+	size_t address = 0;
+	bool reloaded = false;
+	SharedBytes dataBytes;
+
+	size_t dataSize() const { return (dataBytes != nullptr) ? dataBytes->size() : 0; }
+	const u8* dataPtr(size_t offset = 0) const { return &(*dataBytes)[offset]; }
+};
+
+struct CopyDataItem
+{
+	std::string name;
+	size_t srcaddr = 0;
+	size_t srclen = 0;
+	size_t dstaddr = 0;
+	size_t dstlen = 0;
+	u32 copyType = 0;
+};
+
+struct BootDataItem
+{
+	std::string name;
+	WinString filename;
+	size_t pc = 0;
+};
\ No newline at end of file
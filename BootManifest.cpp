@@ -0,0 +1,280 @@
+#include "BootManifest.h"
+#include "WinHandle.h"
+#include "ScopeGuard.h"
+
+namespace
+{
+	constexpr u32 MANIFEST_MAGIC = 0x4D535254; //TRSM
+	constexpr u32 MANIFEST_VERSION = 1;
+
+	struct ManifestHeader
+	{
+		u32 magic;
+		u32 version;
+		u32 charSize;
+		u32 argsHash;
+		u64 sourceSize;
+		u64 sourceWriteTime;
+		u32 numLoads;
+		u32 numCopies;
+		u32 numBoots;
+		u32 reserved;
+	};
+
+	struct LoadRecord
+	{
+		u64 offset;
+		u64 maxCount;
+		u64 address;
+		u64 fileSize;
+		u64 fileWriteTime;
+		u32 nameLen;
+		u32 filenameLen;
+	};
+
+	struct CopyRecord
+	{
+		u64 srcaddr;
+		u64 srclen;
+		u64 dstaddr;
+		u64 dstlen;
+		u32 copyType;
+		u32 nameLen;
+	};
+
+	struct BootRecord
+	{
+		u64 pc;
+		u32 nameLen;
+		u32 filenameLen;
+	};
+
+	class ManifestWriter
+	{
+	public:
+		template<typename T>
+		void put(const T& theValue)
+		{
+			const auto valueBytes = (const u8*)&theValue;
+			outBytes.insert(outBytes.end(), valueBytes, valueBytes+sizeof(theValue));
+		}
+		void putChars(const void* charBytes, size_t numBytes)
+		{
+			outBytes.insert(outBytes.end(), (const u8*)charBytes, (const u8*)charBytes+numBytes);
+			outBytes.resize(align_up(outBytes.size(), sizeof(u64)), 0);
+		}
+
+		ByteVector outBytes;
+	};
+
+	class ManifestReader
+	{
+	public:
+		ManifestReader(const u8* inBytes_, size_t numBytes_) : inBytes(inBytes_), numBytes(numBytes_), currPos(0) {}
+
+		template<typename T>
+		const T* get()
+		{
+			if (currPos + sizeof(T) > numBytes)
+				return nullptr;
+
+			const auto outPtr = (const T*)&inBytes[currPos];
+			currPos += sizeof(T);
+			return outPtr;
+		}
+		const void* getChars(size_t charBytes)
+		{
+			if (currPos + charBytes > numBytes)
+				return nullptr;
+
+			const auto outPtr = &inBytes[currPos];
+			currPos = align_up(currPos + charBytes, sizeof(u64));
+			return outPtr;
+		}
+	protected:
+		const u8* inBytes;
+		size_t numBytes;
+		size_t currPos;
+	};
+}
+
+bool GetFileStamp(const TCHAR* filename, FileStamp& outStamp)
+{
+	WIN32_FILE_ATTRIBUTE_DATA fileAttrs;
+	memset(&fileAttrs, 0, sizeof(fileAttrs));
+	if (filename == nullptr || GetFileAttributesEx(filename, GetFileExInfoStandard, &fileAttrs) == FALSE)
+	{
+		outStamp = FileStamp();
+		return false;
+	}
+
+	outStamp.size = (u64(fileAttrs.nFileSizeHigh) << 32) | u64(fileAttrs.nFileSizeLow);
+	outStamp.writeTime = (u64(fileAttrs.ftLastWriteTime.dwHighDateTime) << 32) | u64(fileAttrs.ftLastWriteTime.dwLowDateTime);
+	return true;
+}
+
+bool WriteBootManifest(const TCHAR* manifestFilename, const FileStamp& sourceStamp, u32 argsHash,
+						const vector<LoadDataItem>& loadData, const vector<CopyDataItem>& copyData, const vector<BootDataItem>& bootData)
+{
+	ManifestWriter writer;
+
+	ManifestHeader header;
+	memset(&header, 0, sizeof(header));
+	header.magic = MANIFEST_MAGIC;
+	header.version = MANIFEST_VERSION;
+	header.charSize = sizeof(TCHAR);
+	header.argsHash = argsHash;
+	header.sourceSize = sourceStamp.size;
+	header.sourceWriteTime = sourceStamp.writeTime;
+	header.numLoads = (u32)loadData.size();
+	header.numCopies = (u32)copyData.size();
+	header.numBoots = (u32)bootData.size();
+	writer.put(header);
+
+	for (const auto& currData : loadData)
+	{
+		FileStamp fileStamp;
+		GetFileStamp(currData.filename.c_str(), fileStamp);
+
+		LoadRecord currRecord;
+		memset(&currRecord, 0, sizeof(currRecord));
+		currRecord.offset = currData.offset;
+		currRecord.maxCount = currData.maxCount;
+		currRecord.address = currData.address;
+		currRecord.fileSize = fileStamp.size;
+		currRecord.fileWriteTime = fileStamp.writeTime;
+		currRecord.nameLen = (u32)currData.name.length();
+		currRecord.filenameLen = (u32)currData.filename.length();
+		writer.put(currRecord);
+		writer.putChars(currData.name.data(), currData.name.length());
+		writer.putChars(currData.filename.data(), currData.filename.length()*sizeof(TCHAR));
+	}
+	for (const auto& currData : copyData)
+	{
+		CopyRecord currRecord;
+		memset(&currRecord, 0, sizeof(currRecord));
+		currRecord.srcaddr = currData.srcaddr;
+		currRecord.srclen = currData.srclen;
+		currRecord.dstaddr = currData.dstaddr;
+		currRecord.dstlen = currData.dstlen;
+		currRecord.copyType = currData.copyType;
+		currRecord.nameLen = (u32)currData.name.length();
+		writer.put(currRecord);
+		writer.putChars(currData.name.data(), currData.name.length());
+	}
+	for (const auto& currData : bootData)
+	{
+		BootRecord currRecord;
+		memset(&currRecord, 0, sizeof(currRecord));
+		currRecord.pc = currData.pc;
+		currRecord.nameLen = (u32)currData.name.length();
+		currRecord.filenameLen = (u32)currData.filename.length();
+		writer.put(currRecord);
+		writer.putChars(currData.name.data(), currData.name.length());
+		writer.putChars(currData.filename.data(), currData.filename.length()*sizeof(TCHAR));
+	}
+
+	WinHandle fileHandle = CreateFile(manifestFilename, GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (fileHandle.get() == INVALID_HANDLE_VALUE)
+		return false;
+
+	DWORD bytesWritten = 0;
+	if (WriteFile(fileHandle.get(), &writer.outBytes[0], (DWORD)writer.outBytes.size(), &bytesWritten, nullptr) == FALSE)
+		return false;
+
+	return bytesWritten == (DWORD)writer.outBytes.size();
+}
+
+int ReadBootManifest(const TCHAR* manifestFilename, const FileStamp& sourceStamp, u32 argsHash,
+						vector<LoadDataItem>& loadData, vector<CopyDataItem>& copyData, vector<BootDataItem>& bootData)
+{
+	WinHandle fileHandle = CreateFile(manifestFilename, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (fileHandle.get() == INVALID_HANDLE_VALUE)
+		return -1;
+
+	LARGE_INTEGER fileSize;
+	if (GetFileSizeEx(fileHandle.get(), &fileSize) == FALSE || fileSize.QuadPart < (LONGLONG)sizeof(ManifestHeader))
+		return -2;
+
+	//CreateFileMapping returns NULL on failure, not INVALID_HANDLE_VALUE
+	WinHandle mappingHandle = CreateFileMapping(fileHandle.get(), nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if (mappingHandle.get() == nullptr)
+	{
+		mappingHandle.release();
+		return -2;
+	}
+
+	const auto mappedBytes = (const u8*)MapViewOfFile(mappingHandle.get(), FILE_MAP_READ, 0, 0, 0);
+	if (mappedBytes == nullptr)
+		return -2;
+
+	auto viewGuard = MakeScopeGuard([mappedBytes]() { UnmapViewOfFile(mappedBytes); });
+
+	ManifestReader reader(mappedBytes, (size_t)fileSize.QuadPart);
+	const auto header = reader.get<ManifestHeader>();
+	if (header == nullptr || header->magic != MANIFEST_MAGIC || header->version != MANIFEST_VERSION || header->charSize != sizeof(TCHAR))
+		return -3;
+
+	if (header->argsHash != argsHash || header->sourceSize != sourceStamp.size || header->sourceWriteTime != sourceStamp.writeTime)
+		return 0;
+
+	vector<LoadDataItem> newLoads(header->numLoads);
+	for (auto& currData : newLoads)
+	{
+		const auto currRecord = reader.get<LoadRecord>();
+		if (currRecord == nullptr)
+			return -3;
+
+		const auto nameChars = (const char*)reader.getChars(currRecord->nameLen);
+		const auto filenameChars = (const TCHAR*)reader.getChars(currRecord->filenameLen*sizeof(TCHAR));
+		if (nameChars == nullptr || filenameChars == nullptr)
+			return -3;
+
+		currData.name.assign(nameChars, currRecord->nameLen);
+		currData.filename.assign(filenameChars, currRecord->filenameLen);
+		currData.offset = (size_t)currRecord->offset;
+		currData.maxCount = (size_t)currRecord->maxCount;
+		currData.address = (size_t)currRecord->address;
+	}
+
+	vector<CopyDataItem> newCopies(header->numCopies);
+	for (auto& currData : newCopies)
+	{
+		const auto currRecord = reader.get<CopyRecord>();
+		if (currRecord == nullptr)
+			return -3;
+
+		const auto nameChars = (const char*)reader.getChars(currRecord->nameLen);
+		if (nameChars == nullptr)
+			return -3;
+
+		currData.name.assign(nameChars, currRecord->nameLen);
+		currData.srcaddr = (size_t)currRecord->srcaddr;
+		currData.srclen = (size_t)currRecord->srclen;
+		currData.dstaddr = (size_t)currRecord->dstaddr;
+		currData.dstlen = (size_t)currRecord->dstlen;
+		currData.copyType = currRecord->copyType;
+	}
+
+	vector<BootDataItem> newBoots(header->numBoots);
+	for (auto& currData : newBoots)
+	{
+		const auto currRecord = reader.get<BootRecord>();
+		if (currRecord == nullptr)
+			return -3;
+
+		const auto nameChars = (const char*)reader.getChars(currRecord->nameLen);
+		const auto filenameChars = (const TCHAR*)reader.getChars(currRecord->filenameLen*sizeof(TCHAR));
+		if (nameChars == nullptr || filenameChars == nullptr)
+			return -3;
+
+		currData.name.assign(nameChars, currRecord->nameLen);
+		currData.filename.assign(filenameChars, currRecord->filenameLen);
+		currData.pc = (size_t)currRecord->pc;
+	}
+
+	loadData = std::move(newLoads);
+	copyData = std::move(newCopies);
+	bootData = std::move(newBoots);
+	return 1;
+}
\ No newline at end of file
@@ -0,0 +1,23 @@
+#pragma once
+
+#include "BootData.h"
+
+//Identifies a version of a file on disk without reading it
+struct FileStamp
+{
+	u64 size = 0;
+	u64 writeTime = 0;
+
+	bool operator==(const FileStamp& other) const { return size == other.size && writeTime == other.writeTime; }
+	bool operator!=(const FileStamp& other) const { return !(*this == other); }
+};
+bool GetFileStamp(const TCHAR* filename, FileStamp& outStamp);
+
+//A compiled form of the ini and data arguments: absolute paths, final load order and resolved BOOT addresses.
+//sourceStamp and argsHash describe what it was built from, so a stale manifest is never used.
+bool WriteBootManifest(const TCHAR* manifestFilename, const FileStamp& sourceStamp, u32 argsHash,
+						const vector<LoadDataItem>& loadData, const vector<CopyDataItem>& copyData, const vector<BootDataItem>& bootData);
+
+//Returns 1 if the manifest was loaded, 0 if it is out of date, negative if it is missing or unreadable
+int ReadBootManifest(const TCHAR* manifestFilename, const FileStamp& sourceStamp, u32 argsHash,
+						vector<LoadDataItem>& loadData, vector<CopyDataItem>& copyData, vector<BootDataItem>& bootData);
\ No newline at end of file
@@ -0,0 +1,216 @@
+#include "BootMetrics.h"
+#include "AsyncLogger.h"
+#include <tchar.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <assert.h>
+#include <algorithm>
+
+namespace
+{
+	//in microseconds, from a fast USB 3 upload to a payload that takes its time
+	const u64 DURATION_BOUNDS[] = { 1000, 2500, 5000, 10000, 25000, 50000, 100000, 250000, 500000, 1000000, 2500000, 5000000, 10000000, 30000000 };
+	const u64 SIZE_BOUNDS[] = { 4096, 16384, 65536, 262144, 1048576, 4194304, 16777216, 67108864, 268435456, 1073741824 };
+
+	void AppendFormat(std::string& outStr, const char* fmtStr, ...)
+	{
+		char lineBuf[512];
+		va_list args;
+		va_start(args, fmtStr);
+		const int numChars = vsnprintf(lineBuf, sizeof(lineBuf), fmtStr, args);
+		va_end(args);
+
+		if (numChars > 0)
+			outStr.append(lineBuf, std::min((size_t)numChars, sizeof(lineBuf)-1));
+	}
+}
+
+BootMetrics::Histogram::Histogram(const u64* bounds_, size_t numBounds_) : bounds(bounds_), numBounds(numBounds_), sum(0)
+{
+	assert(numBounds <= MAX_BUCKETS);
+	for (auto& currCount : bucketCounts)
+		currCount = 0;
+}
+
+void BootMetrics::Histogram::observe(u64 value)
+{
+	size_t bucketIdx = 0;
+	while (bucketIdx < numBounds && value > bounds[bucketIdx])
+		bucketIdx++;
+
+	bucketCounts[bucketIdx].fetch_add(1, std::memory_order_relaxed);
+	sum.fetch_add(value, std::memory_order_relaxed);
+}
+
+void BootMetrics::Histogram::format(std::string& outStr, const char* name, const char* help, double unitScale) const
+{
+	AppendFormat(outStr, "# HELP %s %s\n# TYPE %s histogram\n", name, help, name);
+
+	// a scrape can land between the bucket and sum updates, buckets stay consistent with the count they add up to
+	u64 cumulativeCount = 0;
+	for (size_t i=0; i<=numBounds; i++)
+	{
+		cumulativeCount += bucketCounts[i].load(std::memory_order_relaxed);
+		if (i < numBounds)
+			AppendFormat(outStr, "%s_bucket{le=\"%g\"} %llu\n", name, bounds[i]*unitScale, (unsigned long long)cumulativeCount);
+		else
+			AppendFormat(outStr, "%s_bucket{le=\"+Inf\"} %llu\n", name, (unsigned long long)cumulativeCount);
+	}
+
+	AppendFormat(outStr, "%s_sum %.6f\n%s_count %llu\n", name, sum.load(std::memory_order_relaxed)*unitScale, name, (unsigned long long)cumulativeCount);
+}
+
+BootMetrics::BootMetrics() : bootsAttempted(0), bootsSucceeded(0), recoveredTransfers(0), restartedBoots(0), uploadTime(DURATION_BOUNDS, array_countof(DURATION_BOUNDS)),
+	smashTime(DURATION_BOUNDS, array_countof(DURATION_BOUNDS)), sectionServeTime(DURATION_BOUNDS, array_countof(DURATION_BOUNDS)),
+	sectionBytes(SIZE_BOUNDS, array_countof(SIZE_BOUNDS)), exportIntervalMs(0), exportStopping(false)
+{
+	for (auto& currCount : bootsFailed)
+		currCount = 0;
+}
+
+void BootMetrics::sessionStarted()
+{
+	bootsAttempted.fetch_add(1, std::memory_order_relaxed);
+}
+
+void BootMetrics::sessionFinished(int result, RcmSmashPhase_t failedPhase)
+{
+	// steps inside a phase count as that phase failing, so the counters line up with the session result codes
+	if (failedPhase == RCMSMASH_PHASE_DRIVER_VERSION)
+		failedPhase = RCMSMASH_PHASE_OPEN;
+	else if (failedPhase == RCMSMASH_PHASE_UPLOAD_CHUNK)
+		failedPhase = RCMSMASH_PHASE_UPLOAD;
+
+	if (result == 0)
+		bootsSucceeded.fetch_add(1, std::memory_order_relaxed);
+	else if (size_t(failedPhase) < array_countof(bootsFailed))
+		bootsFailed[failedPhase].fetch_add(1, std::memory_order_relaxed);
+	else
+		bootsFailed[RCMSMASH_PHASE_SESSION].fetch_add(1, std::memory_order_relaxed);
+}
+
+void BootMetrics::phaseFinished(RcmSmashPhase_t phase, int result, double durationMs, u64 numBytes)
+{
+	// failed phases only count towards the failure counters, their durations would skew the histograms
+	if (result != 0)
+		return;
+
+	const u64 durationUs = u64(durationMs*1000.0);
+	switch (phase)
+	{
+	case RCMSMASH_PHASE_UPLOAD:
+		uploadTime.observe(durationUs);
+		break;
+	case RCMSMASH_PHASE_SMASH:
+		smashTime.observe(durationUs);
+		break;
+	case RCMSMASH_PHASE_SECTION:
+		sectionServeTime.observe(durationUs);
+		sectionBytes.observe(numBytes);
+		break;
+	default:
+		break;
+	}
+}
+
+void BootMetrics::transfersFinished(u32 transfersRecovered, u32 transfersFailed)
+{
+	recoveredTransfers.fetch_add(transfersRecovered, std::memory_order_relaxed);
+	if (transfersFailed > 0)
+		restartedBoots.fetch_add(1, std::memory_order_relaxed);
+}
+
+std::string BootMetrics::format() const
+{
+	std::string outStr;
+	outStr.reserve(8192);
+
+	AppendFormat(outStr, "# HELP rcmsmash_boots_attempted_total Device sessions started.\n# TYPE rcmsmash_boots_attempted_total counter\n");
+	AppendFormat(outStr, "rcmsmash_boots_attempted_total %llu\n", (unsigned long long)bootsAttempted.load(std::memory_order_relaxed));
+	AppendFormat(outStr, "# HELP rcmsmash_boots_succeeded_total Device sessions that completed without an error.\n# TYPE rcmsmash_boots_succeeded_total counter\n");
+	AppendFormat(outStr, "rcmsmash_boots_succeeded_total %llu\n", (unsigned long long)bootsSucceeded.load(std::memory_order_relaxed));
+	AppendFormat(outStr, "# HELP rcmsmash_boots_failed_total Device sessions that failed, by the phase that failed.\n# TYPE rcmsmash_boots_failed_total counter\n");
+	for (size_t i=0; i<array_countof(bootsFailed); i++)
+		AppendFormat(outStr, "rcmsmash_boots_failed_total{phase=\"%s\"} %llu\n", rcmsmash_phase_name((RcmSmashPhase_t)i), (unsigned long long)bootsFailed[i].load(std::memory_order_relaxed));
+	AppendFormat(outStr, "# HELP rcmsmash_transfers_recovered_total Short or failed writes that got resumed and completed.\n# TYPE rcmsmash_transfers_recovered_total counter\n");
+	AppendFormat(outStr, "rcmsmash_transfers_recovered_total %llu\n", (unsigned long long)recoveredTransfers.load(std::memory_order_relaxed));
+	AppendFormat(outStr, "# HELP rcmsmash_boots_restarted_total Device sessions with a transfer that couldn't be recovered, so the device needs another smash.\n# TYPE rcmsmash_boots_restarted_total counter\n");
+	AppendFormat(outStr, "rcmsmash_boots_restarted_total %llu\n", (unsigned long long)restartedBoots.load(std::memory_order_relaxed));
+
+	uploadTime.format(outStr, "rcmsmash_upload_duration_seconds", "Time to send the RCM image.", 1e-6);
+	smashTime.format(outStr, "rcmsmash_smash_duration_seconds", "Time for the control request that smashes the stack.", 1e-6);
+	sectionServeTime.format(outStr, "rcmsmash_section_serve_duration_seconds", "Time spent serving one section to memloader.", 1e-6);
+	sectionBytes.format(outStr, "rcmsmash_section_bytes", "Bytes sent for one section.", 1.0);
+
+	return outStr;
+}
+
+bool BootMetrics::writeFile() const
+{
+	const std::string outStr = format();
+	const WinString tempFilename = exportFilename + TEXT(".tmp");
+	{
+		WinHandle fileHandle = CreateFile(tempFilename.c_str(), GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+		if (fileHandle.get() == INVALID_HANDLE_VALUE)
+			return false;
+
+		DWORD bytesWritten = 0;
+		if (WriteFile(fileHandle.get(), outStr.data(), (DWORD)outStr.size(), &bytesWritten, nullptr) == FALSE || bytesWritten != (DWORD)outStr.size())
+			return false;
+	}
+
+	return MoveFileEx(tempFilename.c_str(), exportFilename.c_str(), MOVEFILE_REPLACE_EXISTING) != FALSE;
+}
+
+int BootMetrics::startExport(const TCHAR* filename, u32 intervalMs)
+{
+	stopExport();
+
+	exportFilename = filename;
+	exportIntervalMs = std::max(intervalMs, 100u);
+	if (!writeFile())
+	{
+		const auto errorCode = GetLastError();
+		LogPrint(LogLevel::Error, TEXT("Couldn't write metrics file '%Ts' (win32 error %u)\n"), filename, errorCode);
+		return -2;
+	}
+
+	exportStopping = false;
+	exportThread = std::thread(&BootMetrics::exportLoop, this);
+	return 0;
+}
+
+void BootMetrics::stopExport()
+{
+	if (!exportThread.joinable())
+		return;
+
+	{
+		std::lock_guard<std::mutex> exportLock(exportMutex);
+		exportStopping = true;
+	}
+	exportCond.notify_all();
+	exportThread.join();
+
+	// whatever happened since the last tick
+	writeFile();
+}
+
+void BootMetrics::exportLoop()
+{
+	bool reportedFailure = false;
+	std::unique_lock<std::mutex> exportLock(exportMutex);
+	while (!exportCond.wait_for(exportLock, std::chrono::milliseconds(exportIntervalMs), [this]() { return exportStopping; }))
+	{
+		exportLock.unlock();
+		const bool fileWritten = writeFile();
+		if (!fileWritten && !reportedFailure)
+		{
+			const auto errorCode = GetLastError();
+			LogPrint(LogLevel::Error, TEXT("Couldn't update metrics file '%Ts' (win32 error %u)\n"), exportFilename.c_str(), errorCode);
+		}
+
+		reportedFailure = !fileWritten;
+		exportLock.lock();
+	}
+}
@@ -0,0 +1,72 @@
+#pragma once
+
+#include "Types.h"
+#include "WinHandle.h"
+#include "RcmSmash.h"
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+
+//Aggregate counters and histograms over every session that reports to it, updated with relaxed atomics
+//so sessions on any number of threads can feed one instance. Exported in the Prometheus text format
+class BootMetrics
+{
+public:
+	BootMetrics();
+	~BootMetrics() { stopExport(); }
+
+	BootMetrics(const BootMetrics&) = delete;
+	BootMetrics& operator=(const BootMetrics&) = delete;
+
+	void sessionStarted();
+	//failedPhase is the innermost phase that ended with a failure, ignored when the result is 0
+	void sessionFinished(int result, RcmSmashPhase_t failedPhase);
+	void phaseFinished(RcmSmashPhase_t phase, int result, double durationMs, u64 numBytes);
+	//From the device's transfer stats once a session is done with it. A session that had an unrecoverable
+	//transfer counts as a restarted boot, as only a power cycle and another smash gets that device going again
+	void transfersFinished(u32 transfersRecovered, u32 transfersFailed);
+
+	std::string format() const;
+
+	//Rewrites the file every intervalMs and once more on stop, through a temporary file so readers
+	//like the node exporter textfile collector never see a partial one
+	int startExport(const TCHAR* filename, u32 intervalMs);
+	void stopExport();
+protected:
+	//Fixed buckets over integer units (microseconds, bytes), counts are per bucket and summed up when formatted
+	class Histogram
+	{
+	public:
+		static constexpr size_t MAX_BUCKETS = 16;
+
+		Histogram(const u64* bounds_, size_t numBounds_);
+		void observe(u64 value);
+		void format(std::string& outStr, const char* name, const char* help, double unitScale) const;
+	protected:
+		const u64* bounds;
+		size_t numBounds;
+		std::atomic<u64> bucketCounts[MAX_BUCKETS+1]; //last one is +Inf
+		std::atomic<u64> sum;
+	};
+
+	bool writeFile() const;
+	void exportLoop();
+
+	std::atomic<u64> bootsAttempted;
+	std::atomic<u64> bootsSucceeded;
+	std::atomic<u64> bootsFailed[RCMSMASH_PHASE_CAPTURE+1];
+	std::atomic<u64> recoveredTransfers;
+	std::atomic<u64> restartedBoots;
+	Histogram uploadTime;
+	Histogram smashTime;
+	Histogram sectionServeTime;
+	Histogram sectionBytes;
+
+	WinString exportFilename;
+	u32 exportIntervalMs;
+	std::thread exportThread;
+	std::mutex exportMutex;
+	std::condition_variable exportCond;
+	bool exportStopping;
+};
@@ -0,0 +1,98 @@
+#include "CaptureWriter.h"
+#include "AsyncLogger.h"
+#include <tchar.h>
+#include <stdio.h>
+
+int CaptureWriter::open(const TCHAR* filename)
+{
+	close();
+
+	fileHandle = CreateFile(filename, GENERIC_WRITE, FILE_SHARE_READ, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL|FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+	if (fileHandle.get() == INVALID_HANDLE_VALUE)
+	{
+		const auto errorCode = GetLastError();
+		LogPrint(LogLevel::Error, TEXT("Couldn't open capture file '%Ts' for writing (win32 error %u)\n"), filename, errorCode);
+		return -2;
+	}
+
+	filling.clear();
+	filling.reserve(BATCH_BYTES);
+	closing = false;
+	writeFailed = false;
+	writeError = 0;
+	bytesWritten = 0;
+	numWrites = 0;
+	writerThread = std::thread(&CaptureWriter::writeLoop, this);
+	return 0;
+}
+
+void CaptureWriter::append(const u8* bytes, size_t numBytes)
+{
+	std::unique_lock<std::mutex> batchLock(batchMutex);
+
+	// captured bytes are never dropped, if the disk is that far behind the reads wait for it
+	batchCond.wait(batchLock, [this]() { return filling.size() < MAX_PENDING_BYTES || writeFailed; });
+	if (writeFailed)
+		return;
+
+	filling.insert(filling.end(), bytes, bytes+numBytes);
+	if (filling.size() >= BATCH_BYTES)
+		batchCond.notify_all();
+}
+
+int CaptureWriter::close()
+{
+	if (!writerThread.joinable())
+		return 0;
+
+	{
+		std::lock_guard<std::mutex> batchLock(batchMutex);
+		closing = true;
+	}
+	batchCond.notify_all();
+	writerThread.join();
+	fileHandle = WinHandle();
+
+	return writeFailed ? -int(writeError) : 0;
+}
+
+void CaptureWriter::writeLoop()
+{
+	ByteVector writing;
+	writing.reserve(BATCH_BYTES);
+
+	std::unique_lock<std::mutex> batchLock(batchMutex);
+	for (;;)
+	{
+		// a partial batch still goes out now and then, so the file keeps up with a slow trickle of output
+		batchCond.wait_for(batchLock, std::chrono::milliseconds(250), [this]() { return filling.size() >= BATCH_BYTES || closing; });
+		if (filling.size() == 0)
+		{
+			if (closing)
+				break;
+
+			continue;
+		}
+
+		writing.swap(filling);
+		batchCond.notify_all();
+		batchLock.unlock();
+
+		DWORD batchWritten = 0;
+		const bool wroteBatch = WriteFile(fileHandle.get(), writing.data(), (DWORD)writing.size(), &batchWritten, nullptr) != FALSE && batchWritten == (DWORD)writing.size();
+		const auto errorCode = wroteBatch ? 0 : GetLastError();
+		writing.clear();
+
+		batchLock.lock();
+		bytesWritten += batchWritten;
+		numWrites++;
+		if (!wroteBatch)
+		{
+			writeFailed = true;
+			writeError = (errorCode != 0) ? errorCode : ERROR_WRITE_FAULT;
+			filling.clear();
+			batchCond.notify_all();
+			break;
+		}
+	}
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+#include "Types.h"
+#include "WinHandle.h"
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+//Writes a stream of received bytes to a file from its own thread. Appending only copies into the batch being
+//filled, the writer thread takes whole batches and writes each one with a single WriteFile
+class CaptureWriter
+{
+public:
+	static constexpr size_t BATCH_BYTES = 1024*1024;
+	static constexpr size_t MAX_PENDING_BYTES = 64*1024*1024; //appending waits for the disk past this
+
+	CaptureWriter() : closing(false), writeFailed(false), writeError(0), bytesWritten(0), numWrites(0) {}
+	~CaptureWriter() { close(); }
+
+	//Creates (or truncates) the file and starts the writer thread
+	int open(const TCHAR* filename);
+	void append(const u8* bytes, size_t numBytes);
+	//Writes out whatever is left and closes the file, returns 0 or the negative win32 error of the first failed write
+	int close();
+
+	u64 getBytesWritten() const { return bytesWritten; }
+	u32 getNumWrites() const { return numWrites; }
+
+	CaptureWriter(const CaptureWriter&) = delete;
+	CaptureWriter& operator=(const CaptureWriter&) = delete;
+protected:
+	void writeLoop();
+
+	WinHandle fileHandle;
+	std::thread writerThread;
+	std::mutex batchMutex; //guards everything below
+	std::condition_variable batchCond;
+	ByteVector filling;
+	bool closing;
+	bool writeFailed;
+	DWORD writeError;
+	u64 bytesWritten;
+	u32 numWrites;
+};
@@ -0,0 +1,56 @@
+#pragma once
+
+#include "BootData.h"
+
+//The COPY and BOOT commands memloader gets after READY., encoded back to back into one buffer before any of them goes out.
+//memloader reads every tag and every argument block with a request of its own, and a short packet is what ends a request,
+//so each message still has to be a transfer of its own, but they can all be queued on the pipe at once
+class CommandBatch
+{
+public:
+	static constexpr size_t TAG_LENGTH = 4;
+
+	struct Message
+	{
+		size_t offset;
+		size_t length;
+		size_t command; //index of the command this message belongs to
+	};
+
+	//Both return the index of the added command
+	size_t addCopy(const CopyDataItem& currData)
+	{
+		const u32 copyArgs[] = { _byteswap_ulong((u32)currData.copyType),
+			_byteswap_ulong((u32)currData.srcaddr), _byteswap_ulong((u32)currData.srclen),
+			_byteswap_ulong((u32)currData.dstaddr), _byteswap_ulong((u32)currData.dstlen) };
+
+		return addCommand("COPY", copyArgs, sizeof(copyArgs));
+	}
+	size_t addBoot(const BootDataItem& currData)
+	{
+		const u32 bootArgs[] = { _byteswap_ulong((u32)currData.pc) };
+		return addCommand("BOOT", bootArgs, sizeof(bootArgs));
+	}
+
+	size_t getNumCommands() const { return numCommands; }
+	size_t getNumBytes() const { return bytes.size(); }
+	const vector<Message>& getMessages() const { return messages; }
+	//Only valid until the next command is added
+	const u8* messageBytes(const Message& currMsg) const { return &bytes[currMsg.offset]; }
+protected:
+	size_t addCommand(const char* tagStr, const void* argBytes, size_t numArgBytes)
+	{
+		addMessage(tagStr, TAG_LENGTH);
+		addMessage(argBytes, numArgBytes);
+		return numCommands++;
+	}
+	void addMessage(const void* msgBytes, size_t numMsgBytes)
+	{
+		messages.push_back(Message{ bytes.size(), numMsgBytes, numCommands });
+		bytes.insert(bytes.end(), (const u8*)msgBytes, (const u8*)msgBytes+numMsgBytes);
+	}
+
+	ByteVector bytes;
+	vector<Message> messages;
+	size_t numCommands = 0;
+};
@@ -0,0 +1,398 @@
+#include "ControlServer.h"
+#include "DeviceRouter.h"
+#include "AsyncLogger.h"
+#include <tchar.h>
+#include <stdio.h>
+
+namespace
+{
+	constexpr DWORD PIPE_BUFFER_SIZE = 64*1024;
+	constexpr size_t MAX_REQUEST_LENGTH = 64*1024;
+
+	void FormatDeviceId(const u8* deviceId, char (&outStr)[0x10*2+1])
+	{
+		for (size_t i=0; i<0x10; i++)
+			sprintf_s(&outStr[i*2], sizeof(outStr)-i*2, "%02X", (u32)deviceId[i]);
+	}
+}
+
+void ControlServer::Connection::sendLine(const std::string& outLine)
+{
+	std::lock_guard<std::mutex> writeLock(writeMutex);
+	const std::string lineBytes = outLine + "\n";
+
+	// a client that went away just stops getting events, its jobs still run
+	DWORD bytesWritten = 0;
+	WriteFile(pipeHandle.get(), lineBytes.data(), (DWORD)lineBytes.size(), &bytesWritten, nullptr);
+}
+
+ControlServer::ControlServer(const ByteVector& defaultMezzo_, bool readbackUsb_, BootMetrics* metrics_) : defaultMezzo(defaultMezzo_), readbackUsb(readbackUsb_), metrics(metrics_), stopping(false), nextSequence(0) {}
+
+int ControlServer::start(const TCHAR* pipeName_)
+{
+	pipeName = pipeName_;
+
+	// the first instance gets created here so a name that's already taken fails right away
+	WinHandle pipeHandle = CreateNamedPipe(pipeName.c_str(), PIPE_ACCESS_DUPLEX, PIPE_TYPE_BYTE | PIPE_READMODE_BYTE | PIPE_WAIT,
+											PIPE_UNLIMITED_INSTANCES, PIPE_BUFFER_SIZE, PIPE_BUFFER_SIZE, 0, nullptr);
+	if (pipeHandle.get() == INVALID_HANDLE_VALUE)
+	{
+		const auto errorCode = GetLastError();
+		LogPrint(LogLevel::Error, TEXT("Couldn't create control pipe '%Ts' (win32 error %u)\n"), pipeName.c_str(), errorCode);
+		return -4;
+	}
+
+	acceptThread = std::thread(&ControlServer::acceptConnections, this, std::move(pipeHandle));
+	LogPrint(LogLevel::Info, TEXT("Accepting jobs on '%Ts'\n"), pipeName.c_str());
+	return 0;
+}
+
+void ControlServer::stop()
+{
+	if (stopping.exchange(true))
+		return;
+
+	// ConnectNamedPipe only returns once somebody connects, so connect to ourselves
+	if (acceptThread.joinable())
+	{
+		WinHandle wakeHandle = CreateFile(pipeName.c_str(), GENERIC_READ | GENERIC_WRITE, 0, nullptr, OPEN_EXISTING, 0, nullptr);
+		acceptThread.join();
+	}
+
+	vector<std::unique_ptr<DeviceWorker>> stoppedWorkers;
+	vector<std::shared_ptr<Connection>> stoppedConnections;
+	{
+		std::lock_guard<std::mutex> stateLock(stateMutex);
+		jobAdded.notify_all();
+		stoppedWorkers = std::move(workers);
+		stoppedConnections = std::move(connections);
+	}
+
+	// devices waiting for a job return right away, the ones in a session can't be interrupted
+	u32 numAbandoned = 0;
+	for (auto& currWorker : stoppedWorkers)
+	{
+		bool inSession = false;
+		{
+			std::lock_guard<std::mutex> stateLock(stateMutex);
+			inSession = (currWorker->currJob != nullptr && !currWorker->finished);
+		}
+
+		if (!inSession)
+			currWorker->thread.join();
+		else
+		{
+			currWorker->thread.detach();
+			currWorker.release();
+			numAbandoned++;
+		}
+	}
+	if (numAbandoned > 0)
+		LogPrint(LogLevel::Error, TEXT("Left %u device sessions running\n"), numAbandoned);
+
+	for (auto& currConn : stoppedConnections)
+	{
+		CancelSynchronousIo((HANDLE)currConn->reader.native_handle());
+		DisconnectNamedPipe(currConn->pipeHandle.get());
+		currConn->reader.join();
+	}
+}
+
+void ControlServer::acceptConnections(WinHandle pipeHandle)
+{
+	while (!stopping)
+	{
+		if (pipeHandle.get() == INVALID_HANDLE_VALUE)
+		{
+			pipeHandle = CreateNamedPipe(pipeName.c_str(), PIPE_ACCESS_DUPLEX, PIPE_TYPE_BYTE | PIPE_READMODE_BYTE | PIPE_WAIT,
+											PIPE_UNLIMITED_INSTANCES, PIPE_BUFFER_SIZE, PIPE_BUFFER_SIZE, 0, nullptr);
+			if (pipeHandle.get() == INVALID_HANDLE_VALUE)
+			{
+				const auto errorCode = GetLastError();
+				LogPrint(LogLevel::Error, TEXT("Couldn't create control pipe instance (win32 error %u), retrying\n"), errorCode);
+				Sleep(1000);
+				continue;
+			}
+		}
+
+		if (ConnectNamedPipe(pipeHandle.get(), nullptr) == FALSE && GetLastError() != ERROR_PIPE_CONNECTED)
+		{
+			pipeHandle = WinHandle();
+			continue;
+		}
+		if (stopping)
+			break;
+
+		auto newConn = std::make_shared<Connection>();
+		newConn->pipeHandle = std::move(pipeHandle);
+
+		std::lock_guard<std::mutex> stateLock(stateMutex);
+		reapFinished();
+		newConn->reader = std::thread(&ControlServer::serveConnection, this, newConn);
+		connections.push_back(std::move(newConn));
+	}
+}
+
+void ControlServer::serveConnection(std::shared_ptr<Connection> conn)
+{
+	std::string pendingBytes;
+	char readBuf[4096];
+	for (;;)
+	{
+		DWORD bytesRead = 0;
+		if (ReadFile(conn->pipeHandle.get(), readBuf, sizeof(readBuf), &bytesRead, nullptr) == FALSE || bytesRead == 0)
+			break;
+
+		pendingBytes.append(readBuf, bytesRead);
+		size_t lineEnd = 0;
+		while ((lineEnd = pendingBytes.find('\n')) != std::string::npos)
+		{
+			std::string currLine = pendingBytes.substr(0, lineEnd);
+			pendingBytes.erase(0, lineEnd+1);
+			if (currLine.length() > 0 && currLine.back() == '\r')
+				currLine.pop_back();
+
+			vector<std::string> lineArgs;
+			SplitArguments(currLine, lineArgs);
+			if (lineArgs.size() == 0)
+				continue;
+
+			if (stricmp(lineArgs[0].c_str(), "SUBMIT") == 0)
+				handleSubmit(lineArgs, conn);
+			else
+				conn->sendLine("ERROR unknown request " + lineArgs[0]);
+		}
+
+		if (pendingBytes.length() > MAX_REQUEST_LENGTH)
+		{
+			conn->sendLine("ERROR request too long");
+			break;
+		}
+	}
+
+	conn->finished = true;
+}
+
+void ControlServer::handleSubmit(const vector<std::string>& lineArgs, const std::shared_ptr<Connection>& conn)
+{
+	const std::string jobTag = (lineArgs.size() > 1) ? lineArgs[1] : std::string("-");
+	auto Reject = [&conn, &jobTag](int result, const char* reason)
+	{
+		char resultStr[16];
+		sprintf_s(resultStr, "%d", result);
+		conn->sendLine("REJECTED " + jobTag + " " + resultStr + " " + reason);
+	};
+	if (lineArgs.size() < 2)
+		return Reject(-1, "missing job tag");
+
+	std::unique_ptr<Job> newJob(new Job());
+	newJob->tag = jobTag;
+	newJob->conn = conn;
+
+	ByteVector mezzoBuf = defaultMezzo;
+	bool usingNoMezzo = (defaultMezzo.size() == 0);
+	for (size_t i=2; i<lineArgs.size(); i++)
+	{
+		const auto& currArg = lineArgs[i];
+		const auto eqPos = currArg.find('=');
+		if (eqPos == std::string::npos)
+			return Reject(-1, "argument without a value");
+
+		const std::string argName = currArg.substr(0, eqPos);
+		const std::string argValue = currArg.substr(eqPos+1);
+		if (stricmp(argName.c_str(), "payload") == 0)
+			newJob->profile.payloadFilename = WidenUtf8(argValue);
+		else if (stricmp(argName.c_str(), "ini") == 0)
+			newJob->profile.iniFilename = WidenUtf8(argValue);
+		else if (stricmp(argName.c_str(), "relocator") == 0)
+		{
+			usingNoMezzo = (stricmp(argValue.c_str(), "none") == 0);
+			if (usingNoMezzo)
+				mezzoBuf.clear();
+			else
+			{
+				const auto readFileRes = ReadFileToBuf(mezzoBuf, TEXT("relocator"), WidenUtf8(argValue).c_str(), 0, 0, false);
+				if (readFileRes != 0)
+					return Reject(readFileRes, "couldn't read relocator");
+			}
+		}
+		else if (stricmp(argName.c_str(), "data") == 0)
+		{
+			if (ParseDataArgument(WidenUtf8(argValue).c_str(), newJob->profile.loadData, newJob->profile.bootData) != 0)
+				return Reject(-1, "invalid data argument");
+		}
+		else if (stricmp(argName.c_str(), "device") == 0)
+		{
+			if (stricmp(argValue.c_str(), "any") != 0 && !DeviceRouter::ParseIdPattern(argValue, newJob->targetId, newJob->targetDigits))
+				return Reject(-1, "invalid device id");
+		}
+		else if (stricmp(argName.c_str(), "priority") == 0)
+			newJob->priority = (s32)strtol(argValue.c_str(), nullptr, 0);
+		else
+			return Reject(-1, "unknown argument");
+	}
+	if (newJob->profile.payloadFilename.length() == 0)
+		return Reject(-1, "no payload");
+
+	// everything gets loaded and built now, so a device picking the job up goes straight to the upload
+	const auto buildRes = BuildBootProfile(newJob->profile, mezzoBuf, usingNoMezzo);
+	if (buildRes != 0)
+		return Reject(buildRes, "couldn't load job inputs");
+
+	// QUEUED goes out before any device can take the job, so it always comes before STARTED
+	size_t queueDepth = 0;
+	{
+		std::lock_guard<std::mutex> stateLock(stateMutex);
+		queueDepth = pendingJobs.size()+1;
+	}
+	char depthStr[16];
+	sprintf_s(depthStr, "%u", (u32)queueDepth);
+	conn->sendLine("QUEUED " + jobTag + " " + depthStr);
+	LogPrint(LogLevel::Info, TEXT("Queued job '%hs' with priority %d\n"), jobTag.c_str(), newJob->priority);
+
+	std::lock_guard<std::mutex> stateLock(stateMutex);
+	newJob->sequence = nextSequence++;
+	pendingJobs.push_back(std::move(newJob));
+	jobAdded.notify_all();
+}
+
+void ControlServer::deviceAttached(const KLST_DEVINFO& deviceInfo)
+{
+	std::lock_guard<std::mutex> stateLock(stateMutex);
+	reapFinished();
+	if (stopping)
+		return;
+
+	for (const auto& currWorker : workers)
+	{
+		if (strcmp(currWorker->deviceInfo.DevicePath, deviceInfo.DevicePath) == 0)
+			return;
+	}
+
+	std::unique_ptr<DeviceWorker> newWorker(new DeviceWorker(*this, deviceInfo));
+	newWorker->thread = std::thread(&DeviceWorker::run, newWorker.get());
+	workers.push_back(std::move(newWorker));
+}
+
+void ControlServer::deviceDetached(const KLST_DEVINFO& deviceInfo)
+{
+	std::lock_guard<std::mutex> stateLock(stateMutex);
+	for (const auto& currWorker : workers)
+	{
+		if (strcmp(currWorker->deviceInfo.DevicePath, deviceInfo.DevicePath) == 0)
+			currWorker->detached = true;
+	}
+	jobAdded.notify_all();
+}
+
+void ControlServer::reapFinished()
+{
+	for (size_t i=0; i<workers.size();)
+	{
+		if (workers[i]->finished)
+		{
+			workers[i]->thread.join();
+			workers.erase(workers.begin()+i);
+		}
+		else
+			i++;
+	}
+	for (size_t i=0; i<connections.size();)
+	{
+		if (connections[i]->finished)
+		{
+			connections[i]->reader.join();
+			connections.erase(connections.begin()+i);
+		}
+		else
+			i++;
+	}
+}
+
+bool ControlServer::DeviceWorker::select(const u8* deviceId, BootProfile*& outProfile)
+{
+	char idStr[0x10*2+1];
+	FormatDeviceId(deviceId, idStr);
+	LogPrint(LogLevel::Info, TEXT("Device %hs is waiting for a job\n"), idStr);
+
+	{
+		std::unique_lock<std::mutex> stateLock(server.stateMutex);
+		for (;;)
+		{
+			if (server.stopping || detached)
+				return false;
+
+			auto bestIt = server.pendingJobs.end();
+			for (auto jobIt=server.pendingJobs.begin(); jobIt!=server.pendingJobs.end(); ++jobIt)
+			{
+				const auto& currJob = **jobIt;
+				if (currJob.targetDigits > 0 && !DeviceRouter::IdMatches(deviceId, currJob.targetId, currJob.targetDigits))
+					continue;
+
+				if (bestIt == server.pendingJobs.end() || currJob.priority > (*bestIt)->priority ||
+					(currJob.priority == (*bestIt)->priority && currJob.sequence < (*bestIt)->sequence))
+					bestIt = jobIt;
+			}
+
+			if (bestIt != server.pendingJobs.end())
+			{
+				currJob = std::move(*bestIt);
+				server.pendingJobs.erase(bestIt);
+				break;
+			}
+
+			server.jobAdded.wait(stateLock);
+		}
+	}
+
+	jobStart = std::chrono::steady_clock::now();
+	LogPrint(LogLevel::Info, TEXT("Device %hs took job '%hs'\n"), idStr, currJob->tag.c_str());
+	currJob->conn->sendLine("STARTED " + currJob->tag + " " + idStr);
+	outProfile = &currJob->profile;
+	return true;
+}
+
+void ControlServer::DeviceWorker::run()
+{
+	// the job brings the image and data, the session has none of its own
+	vector<LoadDataItem> noLoads;
+	vector<CopyDataItem> noCopies;
+	vector<BootDataItem> noBoots;
+	RcmImage noImage;
+	SessionReport sessionReport;
+
+	SessionContext session = { noLoads, noCopies, noBoots, server.readbackUsb, nullptr, &sessionReport, ForwardProgress, this };
+	session.selector = this;
+	session.metrics = server.metrics;
+	const auto sessionRes = RunDeviceSession(&deviceInfo, noImage, session);
+
+	if (currJob != nullptr)
+	{
+		char idStr[0x10*2+1];
+		FormatDeviceId(sessionReport.deviceId, idStr);
+
+		char lineBuf[128];
+		sprintf_s(lineBuf, " %d %s %.2f", sessionRes, idStr, MillisecondsSince(jobStart));
+		currJob->conn->sendLine("DONE " + currJob->tag + lineBuf);
+		LogPrint(LogLevel::Info, TEXT("Job '%hs' finished with result %d\n"), currJob->tag.c_str(), sessionRes);
+	}
+
+	finished = true;
+}
+
+void ControlServer::ForwardProgress(void* userData, const RcmSmashProgress_t* progress)
+{
+	const auto worker = (DeviceWorker*)userData;
+	if (worker->currJob == nullptr || progress->phase == RCMSMASH_PHASE_SESSION)
+		return;
+
+	char lineBuf[256];
+	sprintf_s(lineBuf, " %s %s %d %.2f %.2f %llu", rcmsmash_phase_name(progress->phase), progress->finished ? "end" : "begin",
+		progress->result, progress->elapsedMs, progress->durationMs, (unsigned long long)progress->numBytes);
+
+	std::string outLine = "PROGRESS " + worker->currJob->tag + lineBuf;
+	if (progress->name != nullptr && progress->name[0] != 0)
+		outLine += std::string(" ") + progress->name;
+
+	worker->currJob->conn->sendLine(outLine);
+}
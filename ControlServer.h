@@ -0,0 +1,90 @@
+#pragma once
+
+#include "RcmSession.h"
+#include "WinHandle.h"
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <memory>
+
+//Takes smash jobs over a named pipe and runs them on attached devices. Both directions are one line per message:
+//  SUBMIT <tag> payload=<file> [relocator=<file>|none] [ini=<file>] [data=<argument>]... [device=<id|id prefix*>] [priority=<n>]
+//gets answered with QUEUED <tag> <jobs waiting> or REJECTED <tag> <result> <reason>, then once a device takes the job
+//  STARTED <tag> <device id>
+//  PROGRESS <tag> <phase> <begin|end> <result> <elapsed ms> <duration ms> <bytes> [name]
+//  DONE <tag> <result> <device id> <total ms>
+//Clients can send any number of requests without waiting for the replies. Every attached device gets opened and its
+//id read right away, then it waits for the highest priority (oldest first among equals) job that targets it.
+class ControlServer
+{
+public:
+	//Jobs that don't name a relocator use defaultMezzo, an empty one means they go without
+	ControlServer(const ByteVector& defaultMezzo_, bool readbackUsb_, BootMetrics* metrics_ = nullptr);
+	~ControlServer() { stop(); }
+
+	ControlServer(const ControlServer&) = delete;
+	ControlServer& operator=(const ControlServer&) = delete;
+
+	int start(const TCHAR* pipeName_);
+	void stop();
+
+	void deviceAttached(const KLST_DEVINFO& deviceInfo);
+	void deviceDetached(const KLST_DEVINFO& deviceInfo);
+protected:
+	struct Connection
+	{
+		WinHandle pipeHandle;
+		std::thread reader;
+		std::mutex writeMutex;
+		std::atomic<bool> finished{false};
+
+		void sendLine(const std::string& outLine);
+	};
+	struct Job
+	{
+		std::string tag;
+		s32 priority = 0;
+		u64 sequence = 0;
+		u8 targetId[0x10] = {};
+		u32 targetDigits = 0; //0 runs on any device
+		BootProfile profile;
+		std::shared_ptr<Connection> conn;
+	};
+	class DeviceWorker : public ProfileSelector
+	{
+	public:
+		DeviceWorker(ControlServer& server_, const KLST_DEVINFO& deviceInfo_) : server(server_), deviceInfo(deviceInfo_) {}
+
+		bool select(const u8* deviceId, BootProfile*& outProfile) override;
+		void run();
+
+		ControlServer& server;
+		KLST_DEVINFO deviceInfo;
+		std::unique_ptr<Job> currJob;
+		std::chrono::steady_clock::time_point jobStart;
+		std::atomic<bool> detached{false};
+		std::atomic<bool> finished{false};
+		std::thread thread;
+	};
+
+	void acceptConnections(WinHandle pipeHandle);
+	void serveConnection(std::shared_ptr<Connection> conn);
+	void handleSubmit(const vector<std::string>& lineArgs, const std::shared_ptr<Connection>& conn);
+	void reapFinished(); //call with stateMutex held
+	static void ForwardProgress(void* userData, const RcmSmashProgress_t* progress);
+
+	ByteVector defaultMezzo;
+	bool readbackUsb;
+	BootMetrics* metrics;
+	WinString pipeName;
+	std::thread acceptThread;
+	std::atomic<bool> stopping;
+
+	std::mutex stateMutex; //guards everything below
+	std::condition_variable jobAdded;
+	vector<std::unique_ptr<Job>> pendingJobs;
+	u64 nextSequence;
+	vector<std::shared_ptr<Connection>> connections;
+	vector<std::unique_ptr<DeviceWorker>> workers;
+};
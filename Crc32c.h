@@ -0,0 +1,177 @@
+#pragma once
+
+#include "Types.h"
+#include <cstring>
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define CRC32C_HAVE_HW 1
+#include <nmmintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define CRC32C_HW_FUNC
+#else
+#include <cpuid.h>
+#define CRC32C_HW_FUNC __attribute__((target("sse4.2")))
+#endif
+#else
+#define CRC32C_HAVE_HW 0
+#endif
+
+//Running CRC32C (Castagnoli), uses the SSE4.2 crc32 instruction when the cpu has it and a lookup table otherwise
+class Crc32c
+{
+public:
+	Crc32c() : crc(~0u) {}
+
+	void reset() { crc = ~0u; }
+	void update(const u8* data, size_t dataLen)
+	{
+		if (data == nullptr || dataLen == 0)
+			return;
+
+		crc = hwSupported() ? updateHw(crc, data, dataLen) : updateSw(crc, data, dataLen);
+	}
+	u32 value() const { return ~crc; }
+
+	static u32 compute(const u8* data, size_t dataLen)
+	{
+		Crc32c calc;
+		calc.update(data, dataLen);
+		return calc.value();
+	}
+	//The crc of A followed by B, from the crcs of both and the length of B, without going over the data again
+	static u32 combine(u32 crcA, u32 crcB, u64 lengthB)
+	{
+		if (lengthB == 0)
+			return crcA;
+
+		// appending a zero bit is a linear operator over GF(2), square it up to whole bytes and apply the powers lengthB is made of
+		u32 evenOp[32], oddOp[32];
+		oddOp[0] = 0x82F63B78u;
+		for (u32 i=1, row=1; i<32; i++, row<<=1)
+			oddOp[i] = row;
+
+		Gf2MatrixSquare(evenOp, oddOp); //2 zero bits
+		Gf2MatrixSquare(oddOp, evenOp); //4 zero bits
+		for (;;)
+		{
+			Gf2MatrixSquare(evenOp, oddOp);
+			if (lengthB & 1)
+				crcA = Gf2MatrixTimes(evenOp, crcA);
+			lengthB >>= 1;
+			if (lengthB == 0)
+				break;
+
+			Gf2MatrixSquare(oddOp, evenOp);
+			if (lengthB & 1)
+				crcA = Gf2MatrixTimes(oddOp, crcA);
+			lengthB >>= 1;
+			if (lengthB == 0)
+				break;
+		}
+
+		return crcA ^ crcB;
+	}
+protected:
+	static u32 Gf2MatrixTimes(const u32* matrix, u32 vec)
+	{
+		u32 sum = 0;
+		for (; vec != 0; vec >>= 1, matrix++)
+		{
+			if (vec & 1)
+				sum ^= *matrix;
+		}
+		return sum;
+	}
+	static void Gf2MatrixSquare(u32* outSquare, const u32* matrix)
+	{
+		for (int i=0; i<32; i++)
+			outSquare[i] = Gf2MatrixTimes(matrix, matrix[i]);
+	}
+
+	static bool hwSupported()
+	{
+#if CRC32C_HAVE_HW
+		static const bool supported = []() -> bool
+		{
+#ifdef _MSC_VER
+			int cpuInfo[4] = { 0, 0, 0, 0 };
+			__cpuid(cpuInfo, 1);
+			return (cpuInfo[2] & (1 << 20)) != 0;
+#else
+			unsigned int eax = 0, ebx = 0, ecx = 0, edx = 0;
+			if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx))
+				return false;
+
+			return (ecx & (1u << 20)) != 0;
+#endif
+		}();
+		return supported;
+#else
+		return false;
+#endif
+	}
+
+#if CRC32C_HAVE_HW
+	CRC32C_HW_FUNC static u32 updateHw(u32 currCrc, const u8* data, size_t dataLen)
+	{
+		while (dataLen > 0 && (uptr(data) & 7) != 0)
+		{
+			currCrc = _mm_crc32_u8(currCrc, *data++);
+			dataLen--;
+		}
+#if _WIN64 || __x86_64__
+		u64 wideCrc = currCrc;
+		while (dataLen >= sizeof(u64))
+		{
+			u64 currWord;
+			memcpy(&currWord, data, sizeof(currWord));
+			wideCrc = _mm_crc32_u64(wideCrc, currWord);
+			data += sizeof(u64);
+			dataLen -= sizeof(u64);
+		}
+		currCrc = (u32)wideCrc;
+#endif
+		while (dataLen >= sizeof(u32))
+		{
+			u32 currWord;
+			memcpy(&currWord, data, sizeof(currWord));
+			currCrc = _mm_crc32_u32(currCrc, currWord);
+			data += sizeof(u32);
+			dataLen -= sizeof(u32);
+		}
+		while (dataLen > 0)
+		{
+			currCrc = _mm_crc32_u8(currCrc, *data++);
+			dataLen--;
+		}
+
+		return currCrc;
+	}
+#else
+	static u32 updateHw(u32 currCrc, const u8* data, size_t dataLen) { return updateSw(currCrc, data, dataLen); }
+#endif
+
+	static u32 updateSw(u32 currCrc, const u8* data, size_t dataLen)
+	{
+		static const array<u32, 256> crcTable = []()
+		{
+			array<u32, 256> outTable;
+			for (u32 i=0; i<256; i++)
+			{
+				u32 currVal = i;
+				for (int bit=0; bit<8; bit++)
+					currVal = (currVal & 1) ? (currVal >> 1) ^ 0x82F63B78u : (currVal >> 1);
+
+				outTable[i] = currVal;
+			}
+			return outTable;
+		}();
+
+		for (size_t i=0; i<dataLen; i++)
+			currCrc = crcTable[(currCrc ^ data[i]) & 0xFF] ^ (currCrc >> 8);
+
+		return currCrc;
+	}
+
+	u32 crc;
+};
\ No newline at end of file
@@ -0,0 +1,81 @@
+#include "DataCache.h"
+#include <atomic>
+
+namespace
+{
+	//plain atomics rather than members, buffers can outlive anything they would be a member of
+	std::atomic<u64> liveBuffers(0);
+	std::atomic<u64> liveBytes(0);
+}
+
+DataCache& DataCache::instance()
+{
+	static DataCache theCache;
+	return theCache;
+}
+
+SharedBytes DataCache::adopt(ByteVector&& srcBytes)
+{
+	const u64 numBytes = srcBytes.size();
+	liveBuffers++;
+	liveBytes += numBytes;
+
+	return SharedBytes(new ByteVector(std::move(srcBytes)), [numBytes](const ByteVector* freeMe)
+	{
+		liveBuffers--;
+		liveBytes -= numBytes;
+		delete freeMe;
+	});
+}
+
+int DataCache::get(const WinString& filename, size_t offset, size_t maxCount, size_t padTo, SharedBytes& outBytes, bool& wasRead, const ReadFunc& readFunc)
+{
+	Key theKey = { filename, offset, maxCount, padTo };
+	FileStamp currStamp;
+	GetFileStamp(filename.c_str(), currStamp);
+	{
+		std::lock_guard<std::mutex> lock(cacheMutex);
+		auto it = entries.find(theKey);
+		if (it != entries.end() && it->second.stamp == currStamp && it->second.dataBytes != nullptr)
+		{
+			numHits++;
+			outBytes = it->second.dataBytes;
+			wasRead = false;
+			return 0;
+		}
+		numMisses++;
+	}
+
+	//read without holding the lock, two sessions racing for the same file just both read it
+	ByteVector fileBytes;
+	const auto readRes = readFunc(fileBytes);
+	if (readRes != 0)
+		return readRes;
+
+	if (fileBytes.size() < padTo)
+		fileBytes.resize(padTo, 0);
+
+	auto newBytes = adopt(std::move(fileBytes));
+	{
+		std::lock_guard<std::mutex> lock(cacheMutex);
+		auto& currEntry = entries[std::move(theKey)];
+		currEntry.stamp = currStamp;
+		currEntry.dataBytes = newBytes;
+	}
+
+	outBytes = std::move(newBytes);
+	wasRead = true;
+	return 0;
+}
+
+DataCache::Usage DataCache::getUsage() const
+{
+	Usage outUsage;
+	std::lock_guard<std::mutex> lock(cacheMutex);
+	outUsage.numEntries = (u32)entries.size();
+	outUsage.liveBuffers = liveBuffers;
+	outUsage.liveBytes = liveBytes;
+	outUsage.numHits = numHits;
+	outUsage.numMisses = numMisses;
+	return outUsage;
+}
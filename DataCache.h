@@ -0,0 +1,64 @@
+#pragma once
+
+#include "BootData.h"
+#include "BootManifest.h"
+#include <functional>
+#include <mutex>
+
+//Process-wide store of loaded file contents. Buffers never change once loaded, so every session and
+//item asking for the same file range and version shares one copy instead of holding its own.
+//A buffer replaced by a newer version of its file stays alive until the last session using it lets go.
+class DataCache
+{
+public:
+	static DataCache& instance();
+
+	typedef std::function<int(ByteVector& outBuf)> ReadFunc;
+	//hands out the cached bytes if the file is unchanged on disk, otherwise calls readFunc and caches the result
+	//padded with zeroes to padTo bytes. wasRead tells which one happened, returns what readFunc returned
+	int get(const WinString& filename, size_t offset, size_t maxCount, size_t padTo, SharedBytes& outBytes, bool& wasRead, const ReadFunc& readFunc);
+	//takes ownership of a buffer that isn't backed by one file (like an assembled RCM image) so it is counted too
+	static SharedBytes adopt(ByteVector&& srcBytes);
+
+	struct Usage
+	{
+		u32 numEntries;
+		u64 liveBuffers;
+		u64 liveBytes;
+		u64 numHits;
+		u64 numMisses;
+	};
+	Usage getUsage() const;
+protected:
+	DataCache() : numHits(0), numMisses(0) {}
+
+	struct Key
+	{
+		WinString filename;
+		size_t offset;
+		size_t maxCount;
+		size_t padTo;
+
+		bool operator<(const Key& other) const
+		{
+			if (offset != other.offset)
+				return offset < other.offset;
+			if (maxCount != other.maxCount)
+				return maxCount < other.maxCount;
+			if (padTo != other.padTo)
+				return padTo < other.padTo;
+
+			return filename < other.filename;
+		}
+	};
+	struct Entry
+	{
+		FileStamp stamp;
+		SharedBytes dataBytes;
+	};
+
+	mutable std::mutex cacheMutex;
+	map<Key, Entry> entries;
+	u64 numHits;
+	u64 numMisses;
+};
@@ -0,0 +1,771 @@
+#include "Decompressor.h"
+#include <string.h>
+#include <algorithm>
+
+namespace
+{
+	//Compressed input, either a buffer that is all there already or pulled from a reader one window at a time
+	class ByteSource
+	{
+	public:
+		static constexpr size_t WINDOW_SIZE = 256*1024;
+
+		ByteSource(const u8* inBytes, size_t numInBytes) : readFunc(nullptr), bufPtr(inBytes), bufLen(numInBytes), bufPos(0) {}
+		ByteSource(const DecompressReadFunc& readFunc_) : readFunc(&readFunc_), bufPtr(nullptr), bufLen(0), bufPos(0) {}
+
+		//-1 once the input is over
+		int next()
+		{
+			if (bufPos >= bufLen && !refill())
+				return -1;
+
+			return bufPtr[bufPos++];
+		}
+
+		//up to maxLen bytes that can be used in place, empty once the input is over
+		size_t peek(const u8*& outPtr, size_t maxLen)
+		{
+			if (bufPos >= bufLen && !refill())
+				return 0;
+
+			outPtr = &bufPtr[bufPos];
+			return std::min(maxLen, bufLen-bufPos);
+		}
+		void skip(size_t numBytes) { bufPos += numBytes; }
+
+		//reads everything left, for formats that are only decoded from memory
+		void readRest(ByteVector& outBytes)
+		{
+			const u8* restPtr = nullptr;
+			size_t restLen = 0;
+			while ((restLen = peek(restPtr, size_t(-1))) > 0)
+			{
+				outBytes.insert(outBytes.end(), restPtr, restPtr+restLen);
+				skip(restLen);
+			}
+		}
+	protected:
+		bool refill()
+		{
+			if (readFunc == nullptr)
+				return false;
+
+			if (window.size() < WINDOW_SIZE)
+				window.resize(WINDOW_SIZE);
+
+			bufPtr = &window[0];
+			bufLen = (*readFunc)(&window[0], window.size());
+			bufPos = 0;
+			return bufLen > 0;
+		}
+
+		const DecompressReadFunc* readFunc;
+		ByteVector window;
+		const u8* bufPtr;
+		size_t bufLen;
+		size_t bufPos;
+	};
+
+	//CRC-32 as used by gzip (poly 0xEDB88320), not the CRC32C in Crc32c.h
+	u32 UpdateGzipCrc(u32 currCrc, const u8* data, size_t dataLen)
+	{
+		static const array<u32, 256> crcTable = []()
+		{
+			array<u32, 256> outTable;
+			for (u32 i=0; i<256; i++)
+			{
+				u32 currVal = i;
+				for (int bit=0; bit<8; bit++)
+					currVal = (currVal & 1) ? (currVal >> 1) ^ 0xEDB88320u : (currVal >> 1);
+
+				outTable[i] = currVal;
+			}
+			return outTable;
+		}();
+
+		currCrc = ~currCrc;
+		for (size_t i=0; i<dataLen; i++)
+			currCrc = crcTable[(currCrc ^ data[i]) & 0xFF] ^ (currCrc >> 8);
+
+		return ~currCrc;
+	}
+
+	//DEFLATE (RFC 1951) decoder, output goes straight onto the end of a ByteVector
+	//so back-references can point anywhere already produced
+	class Inflater
+	{
+	public:
+		Inflater(ByteSource& input_, ByteVector& outBuf_, size_t maxOutSize_)
+			: input(input_), bitBuf(0), bitCnt(0), overrun(false), outBuf(outBuf_), maxOutSize(maxOutSize_) {}
+
+		//returns 0 on success (or on reaching maxOutSize), negative on corrupt input
+		int run()
+		{
+			int lastBlock = 0;
+			do
+			{
+				lastBlock = bits(1);
+				const int blockType = bits(2);
+				int retVal = 0;
+				if (blockType == 0)
+					retVal = storedBlock();
+				else if (blockType == 1)
+					retVal = fixedBlock();
+				else if (blockType == 2)
+					retVal = dynamicBlock();
+				else
+					retVal = -1;
+
+				if (overrun)
+					return -2;
+				if (retVal != 0)
+					return retVal;
+				if (outputFull())
+					return 0;
+			}
+			while (!lastBlock);
+
+			return 0;
+		}
+
+		//once run() is done, the input is left at the first whole byte after the deflate stream
+	protected:
+		static constexpr int MAX_BITS = 15;
+		static constexpr int MAX_LCODES = 286;
+		static constexpr int MAX_DCODES = 30;
+		static constexpr int FIXED_LCODES = 288;
+
+		struct Huffman
+		{
+			short count[MAX_BITS+1];
+			short symbol[FIXED_LCODES];
+		};
+
+		int bits(int numBits)
+		{
+			u32 currVal = bitBuf;
+			while (bitCnt < numBits)
+			{
+				const int nextByte = input.next();
+				if (nextByte < 0)
+				{
+					overrun = true;
+					return 0;
+				}
+
+				currVal |= u32(nextByte) << bitCnt;
+				bitCnt += 8;
+			}
+
+			bitBuf = currVal >> numBits;
+			bitCnt -= numBits;
+			return int(currVal & ((1u << numBits) - 1));
+		}
+
+		bool outputFull() const { return maxOutSize != 0 && outBuf.size() >= maxOutSize; }
+
+		int storedBlock()
+		{
+			bitBuf = 0;
+			bitCnt = 0;
+
+			u8 lenBytes[4];
+			for (auto& currByte : lenBytes)
+			{
+				const int nextByte = input.next();
+				if (nextByte < 0)
+					return -2;
+
+				currByte = u8(nextByte);
+			}
+
+			const u32 blockLen = u32(lenBytes[0]) | (u32(lenBytes[1]) << 8);
+			const u32 blockLenCompl = u32(lenBytes[2]) | (u32(lenBytes[3]) << 8);
+			if (blockLen != (~blockLenCompl & 0xFFFF))
+				return -3;
+
+			size_t bytesLeft = blockLen;
+			while (bytesLeft > 0)
+			{
+				const u8* blockBytes = nullptr;
+				const size_t numAvail = input.peek(blockBytes, bytesLeft);
+				if (numAvail == 0)
+					return -2;
+
+				outBuf.insert(outBuf.end(), blockBytes, blockBytes+numAvail);
+				input.skip(numAvail);
+				bytesLeft -= numAvail;
+			}
+			return 0;
+		}
+
+		int decode(const Huffman& huff)
+		{
+			int code = 0, first = 0, index = 0;
+			for (int len=1; len<=MAX_BITS; len++)
+			{
+				code |= bits(1);
+				const int count = huff.count[len];
+				if (code - count < first)
+					return huff.symbol[index + (code - first)];
+
+				index += count;
+				first += count;
+				first <<= 1;
+				code <<= 1;
+				if (overrun)
+					return -10;
+			}
+
+			return -10;
+		}
+
+		//returns 0 for a complete code, positive for incomplete, negative for over-subscribed
+		static int construct(Huffman& huff, const short* lengths, int numSymbols)
+		{
+			for (int len=0; len<=MAX_BITS; len++)
+				huff.count[len] = 0;
+			for (int symbol=0; symbol<numSymbols; symbol++)
+				huff.count[lengths[symbol]]++;
+			if (huff.count[0] == numSymbols)
+				return 0;
+
+			int left = 1;
+			for (int len=1; len<=MAX_BITS; len++)
+			{
+				left <<= 1;
+				left -= huff.count[len];
+				if (left < 0)
+					return left;
+			}
+
+			short offs[MAX_BITS+1];
+			offs[1] = 0;
+			for (int len=1; len<MAX_BITS; len++)
+				offs[len+1] = offs[len] + huff.count[len];
+			for (int symbol=0; symbol<numSymbols; symbol++)
+			{
+				if (lengths[symbol] != 0)
+					huff.symbol[offs[lengths[symbol]]++] = (short)symbol;
+			}
+
+			return left;
+		}
+
+		int codes(const Huffman& lenCode, const Huffman& distCode)
+		{
+			static const short LENGTH_BASE[29] = { 3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+			static const short LENGTH_EXTRA[29] = { 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+			static const short DIST_BASE[30] = { 1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577 };
+			static const short DIST_EXTRA[30] = { 0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13 };
+
+			for (;;)
+			{
+				int symbol = decode(lenCode);
+				if (symbol < 0)
+					return symbol;
+				if (symbol < 256)
+				{
+					outBuf.push_back((u8)symbol);
+					if (outputFull())
+						return 0;
+				}
+				else if (symbol == 256)
+					return 0;
+				else
+				{
+					symbol -= 257;
+					if (symbol >= 29)
+						return -10;
+
+					const size_t copyLen = size_t(LENGTH_BASE[symbol]) + bits(LENGTH_EXTRA[symbol]);
+					symbol = decode(distCode);
+					if (symbol < 0)
+						return symbol;
+					if (symbol >= 30)
+						return -10;
+
+					const size_t copyDist = size_t(DIST_BASE[symbol]) + bits(DIST_EXTRA[symbol]);
+					if (overrun)
+						return -2;
+					if (copyDist > outBuf.size())
+						return -11;
+
+					//byte at a time, the source may overlap what we're producing
+					size_t srcPos = outBuf.size() - copyDist;
+					for (size_t i=0; i<copyLen; i++)
+						outBuf.push_back(outBuf[srcPos++]);
+
+					if (outputFull())
+						return 0;
+				}
+			}
+		}
+
+		int fixedBlock()
+		{
+			static Huffman lenCode, distCode;
+			static const bool builtTables = []()
+			{
+				short lengths[FIXED_LCODES];
+				int symbol = 0;
+				for (; symbol<144; symbol++)
+					lengths[symbol] = 8;
+				for (; symbol<256; symbol++)
+					lengths[symbol] = 9;
+				for (; symbol<280; symbol++)
+					lengths[symbol] = 7;
+				for (; symbol<FIXED_LCODES; symbol++)
+					lengths[symbol] = 8;
+				construct(lenCode, lengths, FIXED_LCODES);
+
+				for (symbol=0; symbol<MAX_DCODES; symbol++)
+					lengths[symbol] = 5;
+				construct(distCode, lengths, MAX_DCODES);
+				return true;
+			}();
+			(void)builtTables;
+
+			return codes(lenCode, distCode);
+		}
+
+		int dynamicBlock()
+		{
+			static const short CODELEN_ORDER[19] = { 16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15 };
+
+			const int numLen = bits(5) + 257;
+			const int numDist = bits(5) + 1;
+			const int numCode = bits(4) + 4;
+			if (numLen > MAX_LCODES || numDist > MAX_DCODES)
+				return -3;
+
+			short lengths[MAX_LCODES+MAX_DCODES];
+			int index = 0;
+			for (; index<numCode; index++)
+				lengths[CODELEN_ORDER[index]] = (short)bits(3);
+			for (; index<19; index++)
+				lengths[CODELEN_ORDER[index]] = 0;
+
+			Huffman lenCode, distCode;
+			if (construct(lenCode, lengths, 19) != 0)
+				return -4;
+
+			index = 0;
+			while (index < numLen + numDist)
+			{
+				int symbol = decode(lenCode);
+				if (symbol < 0)
+					return symbol;
+
+				if (symbol < 16)
+					lengths[index++] = (short)symbol;
+				else
+				{
+					short repeatLen = 0;
+					if (symbol == 16)
+					{
+						if (index == 0)
+							return -5;
+
+						repeatLen = lengths[index-1];
+						symbol = 3 + bits(2);
+					}
+					else if (symbol == 17)
+						symbol = 3 + bits(3);
+					else
+						symbol = 11 + bits(7);
+
+					if (index + symbol > numLen + numDist)
+						return -6;
+
+					while (symbol--)
+						lengths[index++] = repeatLen;
+				}
+			}
+
+			if (lengths[256] == 0)
+				return -9;
+
+			int retVal = construct(lenCode, lengths, numLen);
+			if (retVal < 0 || (retVal > 0 && numLen - lenCode.count[0] != 1))
+				return -7;
+
+			retVal = construct(distCode, lengths + numLen, numDist);
+			if (retVal < 0 || (retVal > 0 && numDist - distCode.count[0] != 1))
+				return -8;
+
+			return codes(lenCode, distCode);
+		}
+
+		ByteSource& input;
+		u32 bitBuf;
+		int bitCnt;
+		bool overrun;
+
+		ByteVector& outBuf;
+		size_t maxOutSize;
+	};
+
+	u32 ReadLE32(const u8* bytes)
+	{
+		return u32(bytes[0]) | (u32(bytes[1]) << 8) | (u32(bytes[2]) << 16) | (u32(bytes[3]) << 24);
+	}
+
+	//reads a little endian u32, false if the input ends first
+	bool ReadLE32(ByteSource& input, u32& outVal)
+	{
+		outVal = 0;
+		for (int i=0; i<4; i++)
+		{
+			const int nextByte = input.next();
+			if (nextByte < 0)
+				return false;
+
+			outVal |= u32(nextByte) << (i*8);
+		}
+		return true;
+	}
+
+	//skips a zero terminated header string, false if the input ends first
+	bool SkipCString(ByteSource& input)
+	{
+		int nextByte = 0;
+		while ((nextByte = input.next()) > 0) {}
+		return nextByte == 0;
+	}
+
+	bool DecompressGzip(ByteSource& input, ByteVector& outBuf, size_t maxOutSize, string& errorMsg)
+	{
+		size_t numMembers = 0;
+		for (;;)
+		{
+			enum { FLAG_HCRC = 0x02, FLAG_EXTRA = 0x04, FLAG_NAME = 0x08, FLAG_COMMENT = 0x10 };
+
+			u8 header[10];
+			size_t headerLen = 0;
+			for (; headerLen < sizeof(header); headerLen++)
+			{
+				const int nextByte = input.next();
+				if (nextByte < 0)
+					break;
+
+				header[headerLen] = u8(nextByte);
+				if (headerLen < 2 && header[headerLen] != ((headerLen == 0) ? 0x1F : 0x8B))
+					break;
+			}
+
+			//whatever follows the last member (usually nothing, sometimes zero padding) isn't ours
+			if (numMembers > 0 && (headerLen < 2 || (header[0] != 0x1F || header[1] != 0x8B)))
+				return true;
+			if (headerLen < sizeof(header))
+			{
+				errorMsg = "truncated gzip header";
+				return false;
+			}
+			if (header[2] != 8)
+			{
+				errorMsg = "unsupported gzip compression method";
+				return false;
+			}
+
+			const u8 flags = header[3];
+			bool headerOk = true;
+			if (flags & FLAG_EXTRA)
+			{
+				const int lenLo = input.next();
+				const int lenHi = input.next();
+				size_t extraLen = (lenLo >= 0 && lenHi >= 0) ? (size_t(lenLo) | (size_t(lenHi) << 8)) : 0;
+				headerOk = (lenLo >= 0 && lenHi >= 0);
+				while (headerOk && extraLen > 0)
+				{
+					headerOk = input.next() >= 0;
+					extraLen--;
+				}
+			}
+			if (headerOk && (flags & FLAG_NAME))
+				headerOk = SkipCString(input);
+			if (headerOk && (flags & FLAG_COMMENT))
+				headerOk = SkipCString(input);
+			if (headerOk && (flags & FLAG_HCRC))
+				headerOk = input.next() >= 0 && input.next() >= 0;
+
+			if (!headerOk)
+			{
+				errorMsg = "truncated gzip header";
+				return false;
+			}
+
+			const size_t memberStart = outBuf.size();
+			Inflater inflater(input, outBuf, maxOutSize);
+			const int inflateRes = inflater.run();
+			if (inflateRes != 0)
+			{
+				errorMsg = "corrupt deflate stream (error " + std::to_string(inflateRes) + ")";
+				return false;
+			}
+			if (maxOutSize != 0 && outBuf.size() >= maxOutSize)
+				return true; //stopped partway, so there's nothing to check the trailer against
+
+			u32 memberCrc = 0, memberSize = 0;
+			if (!ReadLE32(input, memberCrc) || !ReadLE32(input, memberSize))
+			{
+				errorMsg = "truncated gzip trailer";
+				return false;
+			}
+
+			//an empty member is valid, its crc32 is 0
+			const size_t memberLen = outBuf.size()-memberStart;
+			const u32 actualCrc = (memberLen > 0) ? UpdateGzipCrc(0, &outBuf[memberStart], memberLen) : 0;
+			if (memberSize != u32(memberLen))
+			{
+				errorMsg = "gzip size mismatch (trailer says " + std::to_string(memberSize) + " bytes, got " + std::to_string(memberLen) + ")";
+				return false;
+			}
+			if (memberCrc != actualCrc)
+			{
+				errorMsg = "gzip crc32 mismatch";
+				return false;
+			}
+
+			numMembers++;
+		}
+	}
+
+	bool DecompressLz4Block(const u8* blockBytes, size_t blockLen, ByteVector& outBuf, size_t maxOutSize)
+	{
+		size_t blockPos = 0;
+		while (blockPos < blockLen)
+		{
+			const u8 token = blockBytes[blockPos++];
+
+			size_t literalLen = token >> 4;
+			if (literalLen == 15)
+			{
+				u8 moreLen = 0;
+				do
+				{
+					if (blockPos >= blockLen)
+						return false;
+
+					moreLen = blockBytes[blockPos++];
+					literalLen += moreLen;
+				}
+				while (moreLen == 255);
+			}
+			if (blockPos + literalLen > blockLen)
+				return false;
+
+			outBuf.insert(outBuf.end(), &blockBytes[blockPos], &blockBytes[blockPos+literalLen]);
+			blockPos += literalLen;
+			if (blockPos >= blockLen) //last sequence has literals only
+				break;
+			if (maxOutSize != 0 && outBuf.size() >= maxOutSize)
+				return true;
+
+			if (blockPos + 2 > blockLen)
+				return false;
+
+			const size_t matchDist = size_t(blockBytes[blockPos]) | (size_t(blockBytes[blockPos+1]) << 8);
+			blockPos += 2;
+			if (matchDist == 0 || matchDist > outBuf.size())
+				return false;
+
+			size_t matchLen = token & 0x0F;
+			if (matchLen == 15)
+			{
+				u8 moreLen = 0;
+				do
+				{
+					if (blockPos >= blockLen)
+						return false;
+
+					moreLen = blockBytes[blockPos++];
+					matchLen += moreLen;
+				}
+				while (moreLen == 255);
+			}
+			matchLen += 4;
+
+			size_t srcPos = outBuf.size() - matchDist;
+			for (size_t i=0; i<matchLen; i++)
+				outBuf.push_back(outBuf[srcPos++]);
+		}
+
+		return true;
+	}
+
+	bool DecompressLz4(const u8* inBytes, size_t numInBytes, ByteVector& outBuf, size_t maxOutSize, string& errorMsg)
+	{
+		constexpr u32 LZ4_FRAME_MAGIC = 0x184D2204;
+		constexpr u32 LZ4_SKIPPABLE_MASK = 0xFFFFFFF0;
+		constexpr u32 LZ4_SKIPPABLE_MAGIC = 0x184D2A50;
+
+		size_t inPos = 0;
+		while (inPos + 4 <= numInBytes)
+		{
+			const u32 frameMagic = ReadLE32(&inBytes[inPos]);
+			inPos += 4;
+			if ((frameMagic & LZ4_SKIPPABLE_MASK) == LZ4_SKIPPABLE_MAGIC)
+			{
+				if (inPos + 4 > numInBytes)
+					break;
+
+				inPos += 4 + ReadLE32(&inBytes[inPos]);
+				continue;
+			}
+			if (frameMagic != LZ4_FRAME_MAGIC)
+			{
+				errorMsg = "unknown lz4 frame magic";
+				return false;
+			}
+			if (inPos + 3 > numInBytes)
+			{
+				errorMsg = "truncated lz4 frame header";
+				return false;
+			}
+
+			enum { FLG_DICTID = 0x01, FLG_CONTENT_CHECKSUM = 0x04, FLG_CONTENT_SIZE = 0x08, FLG_BLOCK_CHECKSUM = 0x10 };
+			const u8 frameFlags = inBytes[inPos];
+			if ((frameFlags >> 6) != 1)
+			{
+				errorMsg = "unsupported lz4 frame version";
+				return false;
+			}
+			inPos += 2; //FLG and BD
+			if (frameFlags & FLG_CONTENT_SIZE)
+			{
+				if (inPos + 8 > numInBytes)
+					break;
+
+				const u64 contentSize = u64(ReadLE32(&inBytes[inPos])) | (u64(ReadLE32(&inBytes[inPos+4])) << 32);
+				if (maxOutSize == 0 || contentSize < maxOutSize)
+					outBuf.reserve(outBuf.size() + size_t(contentSize));
+				else
+					outBuf.reserve(maxOutSize);
+
+				inPos += 8;
+			}
+			if (frameFlags & FLG_DICTID)
+			{
+				errorMsg = "lz4 frames using an external dictionary aren't supported";
+				return false;
+			}
+			inPos += 1; //header checksum
+
+			for (;;)
+			{
+				if (inPos + 4 > numInBytes)
+				{
+					errorMsg = "truncated lz4 block";
+					return false;
+				}
+
+				const u32 blockSize = ReadLE32(&inBytes[inPos]);
+				inPos += 4;
+				if (blockSize == 0) //end mark
+					break;
+
+				const bool uncompressed = (blockSize & 0x80000000u) != 0;
+				const size_t dataLen = blockSize & 0x7FFFFFFFu;
+				if (inPos + dataLen > numInBytes)
+				{
+					errorMsg = "truncated lz4 block";
+					return false;
+				}
+
+				if (uncompressed)
+					outBuf.insert(outBuf.end(), &inBytes[inPos], &inBytes[inPos+dataLen]);
+				else if (!DecompressLz4Block(&inBytes[inPos], dataLen, outBuf, maxOutSize))
+				{
+					errorMsg = "corrupt lz4 block";
+					return false;
+				}
+
+				if (maxOutSize != 0 && outBuf.size() >= maxOutSize)
+					return true;
+
+				inPos += dataLen;
+				if (frameFlags & FLG_BLOCK_CHECKSUM)
+					inPos += 4;
+			}
+
+			if (frameFlags & FLG_CONTENT_CHECKSUM)
+				inPos += 4;
+		}
+
+		return true;
+	}
+}
+
+CompressionType DetectCompression(const u8* headerBytes, size_t numBytes)
+{
+	if (numBytes >= 3 && headerBytes[0] == 0x1F && headerBytes[1] == 0x8B && headerBytes[2] == 8)
+		return CompressionType::Gzip;
+	if (numBytes >= 4 && ReadLE32(headerBytes) == 0x184D2204)
+		return CompressionType::Lz4;
+	if (numBytes >= 4 && ReadLE32(headerBytes) == 0xFD2FB528)
+		return CompressionType::Zstd;
+
+	return CompressionType::None;
+}
+
+const char* CompressionTypeName(CompressionType compType)
+{
+	switch (compType)
+	{
+	case CompressionType::Gzip:
+		return "gzip";
+	case CompressionType::Lz4:
+		return "lz4";
+	case CompressionType::Zstd:
+		return "zstd";
+	default:
+		return "uncompressed";
+	}
+}
+
+namespace
+{
+	bool DecompressSource(CompressionType compType, ByteSource& input, ByteVector& outBuf, size_t maxOutSize, string& errorMsg)
+	{
+		if (compType == CompressionType::Gzip)
+			return DecompressGzip(input, outBuf, maxOutSize, errorMsg);
+		if (compType == CompressionType::Zstd)
+		{
+			errorMsg = "zstd compressed input isn't supported, please decompress it first";
+			return false;
+		}
+
+		ByteVector inBytes;
+		input.readRest(inBytes);
+		if (compType == CompressionType::Lz4)
+			return DecompressLz4(inBytes.data(), inBytes.size(), outBuf, maxOutSize, errorMsg);
+
+		outBuf = std::move(inBytes);
+		return true;
+	}
+}
+
+bool DecompressBuffer(CompressionType compType, const u8* inBytes, size_t numInBytes, ByteVector& outBuf, size_t maxOutSize, string& errorMsg)
+{
+	outBuf.clear();
+
+	ByteSource input(inBytes, numInBytes);
+	const bool retVal = DecompressSource(compType, input, outBuf, maxOutSize, errorMsg);
+	if (retVal && maxOutSize != 0 && outBuf.size() > maxOutSize)
+		outBuf.resize(maxOutSize);
+
+	return retVal;
+}
+
+bool DecompressStream(CompressionType compType, const DecompressReadFunc& readFunc, ByteVector& outBuf, size_t maxOutSize, string& errorMsg)
+{
+	outBuf.clear();
+
+	ByteSource input(readFunc);
+	const bool retVal = DecompressSource(compType, input, outBuf, maxOutSize, errorMsg);
+	if (retVal && maxOutSize != 0 && outBuf.size() > maxOutSize)
+		outBuf.resize(maxOutSize);
+
+	return retVal;
+}
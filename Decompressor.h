@@ -0,0 +1,26 @@
+#pragma once
+
+#include "Types.h"
+#include <functional>
+
+enum class CompressionType
+{
+	None,
+	Gzip,
+	Lz4,
+	Zstd
+};
+
+//Looks at the magic bytes at the start of a file
+CompressionType DetectCompression(const u8* headerBytes, size_t numBytes);
+const char* CompressionTypeName(CompressionType compType);
+
+//Decompresses a whole in-memory .gz/.lz4 image into outBuf, stopping once maxOutSize bytes
+//have been produced (0 means no limit). Returns false and fills errorMsg if the input is bad.
+bool DecompressBuffer(CompressionType compType, const u8* inBytes, size_t numInBytes, ByteVector& outBuf, size_t maxOutSize, string& errorMsg);
+
+//Puts up to maxBytes of compressed input into outBytes and returns how many it put there, 0 once the input is over
+typedef std::function<size_t(u8* outBytes, size_t maxBytes)> DecompressReadFunc;
+//Same as DecompressBuffer, but pulls the compressed input through readFunc as it goes, so gzip never holds more than
+//a window of it in memory (lz4 input is still read in full first). gzip members have their CRC32 and ISIZE checked
+bool DecompressStream(CompressionType compType, const DecompressReadFunc& readFunc, ByteVector& outBuf, size_t maxOutSize, string& errorMsg);
\ No newline at end of file
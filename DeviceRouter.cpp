@@ -0,0 +1,187 @@
+#include "DeviceRouter.h"
+#include "AsyncLogger.h"
+#include <tchar.h>
+#include <fstream>
+#include <algorithm>
+#include <Shlwapi.h>
+
+namespace
+{
+	WinString ResolveRoutePath(const WinString& baseDir, const std::string& utf8Path)
+	{
+		WinString convPath = WidenUtf8(utf8Path);
+		if (baseDir.length() > 1)
+		{
+			TCHAR combinedPath[2048];
+			combinedPath[0] = 0;
+			if (PathCombine(combinedPath, baseDir.c_str(), convPath.c_str()) != nullptr)
+				convPath = combinedPath;
+		}
+
+		return convPath;
+	}
+}
+
+DeviceRouter::RouteKey DeviceRouter::MakeKey(const u8* deviceId, u32 numNibbles)
+{
+	RouteKey outKey;
+	outKey.hiBits = 0;
+	outKey.loBits = 0;
+	outKey.numNibbles = numNibbles;
+	for (size_t i=0; i<8; i++)
+	{
+		outKey.hiBits = (outKey.hiBits << 8) | deviceId[i];
+		outKey.loBits = (outKey.loBits << 8) | deviceId[8+i];
+	}
+
+	const u32 numBits = numNibbles*4;
+	if (numBits < 64)
+	{
+		outKey.hiBits &= (numBits == 0) ? 0 : ~u64(0) << (64-numBits);
+		outKey.loBits = 0;
+	}
+	else if (numBits < 128)
+		outKey.loBits &= (numBits == 64) ? 0 : ~u64(0) << (128-numBits);
+
+	return outKey;
+}
+
+bool DeviceRouter::ParseIdPattern(std::string idStr, u8* outIdBytes, u32& outNumDigits)
+{
+	memset(outIdBytes, 0, 0x10);
+	const bool isPrefix = (idStr.length() > 0 && idStr.back() == '*');
+	if (isPrefix)
+		idStr.pop_back();
+
+	if (idStr.length() > 0x10*2 || (!isPrefix && idStr.length() != 0x10*2))
+		return false;
+
+	for (size_t i=0; i<idStr.length(); i++)
+	{
+		const char currChar = idStr[i];
+		if (!isxdigit((unsigned char)currChar))
+			return false;
+
+		const u8 nibbleVal = (currChar <= '9') ? u8(currChar-'0') : u8((currChar|0x20)-'a'+10);
+		outIdBytes[i/2] |= (i%2 == 0) ? u8(nibbleVal << 4) : nibbleVal;
+	}
+
+	outNumDigits = (u32)idStr.length();
+	return true;
+}
+
+int DeviceRouter::load(const TCHAR* routesFilename, const ByteVector& mezzoBuf, bool usingNoMezzo)
+{
+	std::ifstream inputFile(routesFilename);
+	if (!inputFile.is_open())
+	{
+		LogPrint(LogLevel::Error, TEXT("Couldn't open routes file '%Ts' for reading\n"), routesFilename);
+		return -2;
+	}
+
+	WinString baseDir;
+	{
+		TCHAR absDirPath[2048];
+		absDirPath[0] = 0;
+
+		TCHAR* filePart = nullptr;
+		size_t pathLen = GetFullPathName(routesFilename, (unsigned int)array_countof(absDirPath)-1, absDirPath, &filePart);
+		if (filePart != nullptr)
+			pathLen = filePart-absDirPath;
+
+		baseDir = WinString(absDirPath, pathLen);
+	}
+
+	profiles.clear();
+	routes.clear();
+	prefixLengths.clear();
+	defaultProfile = nullptr;
+
+	int numRoutes = 0;
+	u32 lineNum = 0;
+	std::string currLine;
+	while (std::getline(inputFile, currLine))
+	{
+		lineNum++;
+		const auto commentPos = currLine.find(';');
+		if (commentPos != std::string::npos)
+			currLine.resize(commentPos);
+
+		vector<std::string> lineArgs;
+		SplitArguments(currLine, lineArgs);
+		if (lineArgs.size() == 0)
+			continue;
+		if (lineArgs.size() < 2 || lineArgs[1].length() == 0)
+		{
+			LogPrint(LogLevel::Error, TEXT("Route on line %u of '%Ts' has no payload\n"), lineNum, routesFilename);
+			return -1;
+		}
+
+		const std::string& matchStr = lineArgs[0];
+		const std::string& payloadStr = lineArgs[1];
+		const std::string iniStr = (lineArgs.size() > 2) ? lineArgs[2] : std::string();
+
+		const bool isDefault = (stricmp(matchStr.c_str(), "default") == 0);
+		u8 idBytes[0x10];
+		u32 numNibbles = 0;
+		if (!isDefault && !ParseIdPattern(matchStr, idBytes, numNibbles))
+		{
+			LogPrint(LogLevel::Error, TEXT("Invalid device id '%hs' on line %u of '%Ts'\n"), matchStr.c_str(), lineNum, routesFilename);
+			return -1;
+		}
+
+		const auto payloadFilename = ResolveRoutePath(baseDir, payloadStr);
+		const auto iniFilename = (iniStr.length() > 0) ? ResolveRoutePath(baseDir, iniStr) : WinString();
+
+		// ids sharing the same payload and ini share one profile
+		BootProfile* routeProfile = nullptr;
+		for (const auto& currProfile : profiles)
+		{
+			if (_tcsicmp(currProfile->payloadFilename.c_str(), payloadFilename.c_str()) == 0 && _tcsicmp(currProfile->iniFilename.c_str(), iniFilename.c_str()) == 0)
+			{
+				routeProfile = currProfile.get();
+				break;
+			}
+		}
+		if (routeProfile == nullptr)
+		{
+			std::unique_ptr<BootProfile> newProfile(new BootProfile());
+			newProfile->payloadFilename = payloadFilename;
+			newProfile->iniFilename = iniFilename;
+
+			const auto loadRes = BuildBootProfile(*newProfile, mezzoBuf, usingNoMezzo);
+			if (loadRes != 0)
+				return loadRes;
+
+			routeProfile = newProfile.get();
+			profiles.emplace_back(std::move(newProfile));
+		}
+
+		if (isDefault)
+			defaultProfile = routeProfile;
+		else
+		{
+			routes[MakeKey(idBytes, numNibbles)] = routeProfile;
+			if (std::find(prefixLengths.begin(), prefixLengths.end(), numNibbles) == prefixLengths.end())
+				prefixLengths.push_back(numNibbles);
+		}
+
+		numRoutes++;
+	}
+
+	std::sort(prefixLengths.begin(), prefixLengths.end(), [](u32 left, u32 right) { return left > right; });
+	LogPrint(LogLevel::Info, TEXT("Loaded %d device routes to %u prebuilt profiles from '%Ts'\n"), numRoutes, (u32)profiles.size(), routesFilename);
+	return numRoutes;
+}
+
+BootProfile* DeviceRouter::lookup(const u8* deviceId)
+{
+	for (const auto currLength : prefixLengths)
+	{
+		const auto foundIt = routes.find(MakeKey(deviceId, currLength));
+		if (foundIt != routes.end())
+			return foundIt->second;
+	}
+
+	return defaultProfile;
+}
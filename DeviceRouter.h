@@ -0,0 +1,50 @@
+#pragma once
+
+#include "RcmSession.h"
+#include <memory>
+
+//Picks a profile from the device id a session reads. Routes are hashed by id prefix, so a lookup
+//is one hash probe per distinct prefix length in the table, and nothing gets read or built after it
+class DeviceRouter : public ProfileSelector
+{
+public:
+	DeviceRouter() : defaultProfile(nullptr) {}
+
+	//Each line is "<device id|id prefix*|default> <payload> [ini]" in hex as the id gets printed, ';' starts a comment.
+	//Relative paths are from the routes file's directory. Returns the number of routes or negative on error
+	int load(const TCHAR* routesFilename, const ByteVector& mezzoBuf, bool usingNoMezzo);
+
+	//The profile with the longest matching prefix, then the file's default, nullptr if there's neither
+	BootProfile* lookup(const u8* deviceId);
+	bool select(const u8* deviceId, BootProfile*& outProfile) override
+	{
+		outProfile = lookup(deviceId);
+		return true;
+	}
+
+	//Parses a full hex device id or a prefix of one ending in *, outNumDigits is how many hex digits it covers
+	static bool ParseIdPattern(std::string idStr, u8* outIdBytes, u32& outNumDigits);
+	static bool IdMatches(const u8* deviceId, const u8* patternBytes, u32 numDigits) { return MakeKey(deviceId, numDigits) == MakeKey(patternBytes, numDigits); }
+
+	size_t numProfiles() const { return profiles.size(); }
+	bool empty() const { return profiles.size() == 0; }
+protected:
+	struct RouteKey
+	{
+		u64 hiBits;
+		u64 loBits;
+		u32 numNibbles;
+
+		bool operator==(const RouteKey& other) const { return hiBits == other.hiBits && loBits == other.loBits && numNibbles == other.numNibbles; }
+	};
+	struct RouteKeyHash
+	{
+		size_t operator()(const RouteKey& key) const { return std::hash<u64>()(key.hiBits ^ (key.loBits * 0x9E3779B97F4A7C15ull) ^ key.numNibbles); }
+	};
+	static RouteKey MakeKey(const u8* deviceId, u32 numNibbles);
+
+	vector<std::unique_ptr<BootProfile>> profiles;
+	unordered_map<RouteKey, BootProfile*, RouteKeyHash> routes;
+	vector<u32> prefixLengths; //distinct route lengths in hex digits, longest first
+	BootProfile* defaultProfile;
+};
@@ -0,0 +1,307 @@
+#include "EmulatedDevice.h"
+#include "CommandBatch.h"
+#include <stdio.h>
+#include <stdarg.h>
+#include <mutex>
+#include <algorithm>
+
+namespace
+{
+	//every live device, so a session that was only handed a KLST_DEVINFO finds its way back to one
+	std::mutex registryMutex;
+	vector<EmulatedRcmDevice*> registry;
+
+	const char DEVICE_PATH_PREFIX[] = "\\\\?\\emulated#";
+	const u32 LOW_BUFFER_ADDRESS = 0x40005000;
+	const u32 HIGH_BUFFER_ADDRESS = 0x40009000;
+}
+
+EmulatedRcmDevice::EmulatedRcmDevice(u32 index, u32 vid, u32 pid) : stage(Stage::Rcm), idRead(false), rcmPackets(0), recvAddress(0), recvRemaining(0), recvLength(0)
+{
+	memset(&deviceInfo, 0, sizeof(deviceInfo));
+	deviceInfo.Common.Vid = vid;
+	deviceInfo.Common.Pid = pid;
+	deviceInfo.DriverID = KUSB_DRVID_LIBUSBK;
+	deviceInfo.Connected = TRUE;
+	sprintf_s(deviceInfo.DevicePath, "%svid_%04x&pid_%04x#%u", DEVICE_PATH_PREFIX, vid, pid, index);
+
+	static const u8 ID_PREFIX[] = { 'E', 'M', 'U', 'L', 'A', 'T', 'E', 'D', 'R', 'C', 'M', 0 };
+	memcpy(deviceId, ID_PREFIX, sizeof(ID_PREFIX));
+	const u32 beIndex = _byteswap_ulong(index);
+	memcpy(&deviceId[sizeof(ID_PREFIX)], &beIndex, sizeof(beIndex));
+
+	std::lock_guard<std::mutex> registryLock(registryMutex);
+	registry.push_back(this);
+}
+
+EmulatedRcmDevice::~EmulatedRcmDevice()
+{
+	std::lock_guard<std::mutex> registryLock(registryMutex);
+	registry.erase(std::remove(registry.begin(), registry.end(), this), registry.end());
+}
+
+EmulatedRcmDevice* EmulatedRcmDevice::FindDevice(const char* devicePath)
+{
+	if (strncmp(devicePath, DEVICE_PATH_PREFIX, array_countof(DEVICE_PATH_PREFIX)-1) != 0)
+		return nullptr;
+
+	std::lock_guard<std::mutex> registryLock(registryMutex);
+	for (auto currDevice : registry)
+	{
+		if (strcmp(currDevice->deviceInfo.DevicePath, devicePath) == 0)
+			return currDevice;
+	}
+
+	return nullptr;
+}
+
+bool EmulatedRcmDevice::LoadDriverAPI(KLST_DEVINFO_HANDLE deviceInfo, KUSB_DRIVER_API& outApi, DriverIoctlFunc& outIoctl)
+{
+	if (deviceInfo == nullptr || FindDevice(deviceInfo->DevicePath) == nullptr)
+		return false;
+
+	memset(&outApi, 0, sizeof(outApi));
+	outApi.Init = UsbInit;
+	outApi.Free = UsbFree;
+	outApi.ReadPipe = UsbReadPipe;
+	outApi.WritePipe = UsbWritePipe;
+	outApi.AbortPipe = UsbAbortPipe;
+	outApi.GetOverlappedResult = UsbGetOverlappedResult;
+	outIoctl = DriverIoctl;
+	return true;
+}
+
+BOOL KUSB_API EmulatedRcmDevice::UsbInit(KUSB_HANDLE* outHandle, KLST_DEVINFO_HANDLE devInfo)
+{
+	auto theDevice = FindDevice(devInfo->DevicePath);
+	if (theDevice == nullptr)
+	{
+		SetLastError(ERROR_DEVICE_NOT_CONNECTED);
+		return FALSE;
+	}
+
+	*outHandle = (KUSB_HANDLE)theDevice;
+	return TRUE;
+}
+
+BOOL KUSB_API EmulatedRcmDevice::UsbFree(KUSB_HANDLE usbHandle)
+{
+	return TRUE;
+}
+
+BOOL KUSB_API EmulatedRcmDevice::UsbReadPipe(KUSB_HANDLE usbHandle, UCHAR pipeId, UCHAR* outBuf, UINT bufLength, UINT* lengthTransferred, LPOVERLAPPED overlapped)
+{
+	if (pipeId != 0x81)
+		return CompleteTransfer(-int(ERROR_INVALID_PARAMETER), lengthTransferred, overlapped);
+
+	return CompleteTransfer(((EmulatedRcmDevice*)usbHandle)->read(outBuf, bufLength), lengthTransferred, overlapped);
+}
+
+BOOL KUSB_API EmulatedRcmDevice::UsbWritePipe(KUSB_HANDLE usbHandle, UCHAR pipeId, UCHAR* data, UINT dataLength, UINT* lengthTransferred, LPOVERLAPPED overlapped)
+{
+	if (pipeId != 0x01)
+		return CompleteTransfer(-int(ERROR_INVALID_PARAMETER), lengthTransferred, overlapped);
+
+	return CompleteTransfer(((EmulatedRcmDevice*)usbHandle)->write(data, dataLength), lengthTransferred, overlapped);
+}
+
+BOOL KUSB_API EmulatedRcmDevice::UsbAbortPipe(KUSB_HANDLE usbHandle, UCHAR pipeId)
+{
+	// nothing is ever left pending
+	return TRUE;
+}
+
+BOOL KUSB_API EmulatedRcmDevice::UsbGetOverlappedResult(KUSB_HANDLE usbHandle, LPOVERLAPPED overlapped, UINT* lengthTransferred, BOOL wait)
+{
+	*lengthTransferred = (UINT)overlapped->InternalHigh;
+	if (overlapped->Internal != 0)
+	{
+		SetLastError((DWORD)overlapped->Internal);
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+BOOL EmulatedRcmDevice::CompleteTransfer(int retVal, UINT* lengthTransferred, LPOVERLAPPED overlapped)
+{
+	if (retVal < 0)
+	{
+		SetLastError(DWORD(-retVal));
+		return FALSE;
+	}
+
+	if (lengthTransferred != nullptr)
+		*lengthTransferred = (UINT)retVal;
+
+	// an overlapped call is already done by the time it returns, so its event goes up right away
+	if (overlapped != nullptr)
+	{
+		overlapped->Internal = 0;
+		overlapped->InternalHigh = (ULONG_PTR)retVal;
+		if (overlapped->hEvent != nullptr)
+			SetEvent(overlapped->hEvent);
+	}
+
+	return TRUE;
+}
+
+int EmulatedRcmDevice::DriverIoctl(KUSB_HANDLE usbHandle, DWORD ioctlCode, const void* inputBytes, size_t numInputBytes, void* outputBytes, size_t numOutputBytes)
+{
+	auto theDevice = (EmulatedRcmDevice*)usbHandle;
+	if (ioctlCode == libusbk::LIBUSB_IOCTL_GET_VERSION)
+	{
+		if (numOutputBytes < sizeof(libusbk::libusb_request))
+			return -int(ERROR_INSUFFICIENT_BUFFER);
+
+		auto& outRequest = *(libusbk::libusb_request*)outputBytes;
+		memset(&outRequest, 0, sizeof(outRequest));
+		outRequest.version.major = 3;
+		outRequest.version.minor = 0;
+		outRequest.version.micro = 7;
+		return (int)sizeof(outRequest);
+	}
+	else if (ioctlCode == libusbk::LIBUSB_IOCTL_GET_STATUS)
+	{
+		if (theDevice->stage != Stage::Rcm || theDevice->rcmPackets == 0)
+			return -int(ERROR_GEN_FAILURE);
+
+		// the status reply gets copied over the stack from the buffer the next packet would have gone to,
+		// only reaching the end of it exactly is what the real thing would run the payload from
+		const u32 bufferAddress = ((theDevice->rcmPackets % 2) != 0) ? HIGH_BUFFER_ADDRESS : LOW_BUFFER_ADDRESS;
+		if (numOutputBytes != RCMDeviceHacker::STACK_END - bufferAddress)
+			return -int(ERROR_GEN_FAILURE);
+
+		theDevice->stage = Stage::Payload;
+		theDevice->queueOutput("READY.\n");
+		return -int(ERROR_SEM_TIMEOUT);
+	}
+	else
+		return -int(ERROR_NOT_SUPPORTED);
+}
+
+int EmulatedRcmDevice::read(u8* outBuf, size_t bufLength)
+{
+	if (stage == Stage::Rcm)
+	{
+		// the id is all RCM sends, once
+		if (idRead)
+			return 0;
+
+		idRead = true;
+		const auto numBytes = std::min(bufLength, sizeof(deviceId));
+		memcpy(outBuf, deviceId, numBytes);
+		return (int)numBytes;
+	}
+
+	// nothing left to say reads as a zero length packet
+	if (pendingOutput.empty())
+		return 0;
+
+	auto& currOutput = pendingOutput.front();
+	const auto numBytes = std::min(bufLength, currOutput.length());
+	memcpy(outBuf, currOutput.data(), numBytes);
+	if (numBytes < currOutput.length())
+		currOutput.erase(0, numBytes);
+	else
+		pendingOutput.pop_front();
+
+	return (int)numBytes;
+}
+
+int EmulatedRcmDevice::write(const u8* data, size_t dataLength)
+{
+	if (stage == Stage::Rcm)
+	{
+		if (dataLength > RCMDeviceHacker::PACKET_SIZE)
+			return -int(ERROR_INVALID_PARAMETER);
+
+		rcmPackets++;
+		return (int)dataLength;
+	}
+	else if (stage == Stage::Booted)
+		return (int)dataLength;
+
+	size_t bytesTaken = 0;
+	while (bytesTaken < dataLength)
+	{
+		if (recvRemaining > 0)
+		{
+			const auto numBytes = std::min(dataLength-bytesTaken, (size_t)recvRemaining);
+			recvCrc.update(&data[bytesTaken], numBytes);
+			recvRemaining -= (u32)numBytes;
+			bytesTaken += numBytes;
+			if (recvRemaining == 0)
+				queueOutput("Emulated memloader got 0x%08x bytes at 0x%08x (crc32c 0x%08x)\n", recvLength, recvAddress, recvCrc.value());
+
+			continue;
+		}
+
+		cmdBytes.push_back(data[bytesTaken++]);
+		const auto cmdRes = runCommand();
+		if (cmdRes < 0)
+			return cmdRes;
+	}
+
+	return (int)bytesTaken;
+}
+
+int EmulatedRcmDevice::runCommand()
+{
+	if (cmdBytes.size() < CommandBatch::TAG_LENGTH)
+		return 0;
+
+	const string tagStr(cmdBytes.begin(), cmdBytes.begin()+CommandBatch::TAG_LENGTH);
+	size_t numArgBytes = 0;
+	if (tagStr == "RECV")
+		numArgBytes = 2*sizeof(u32);
+	else if (tagStr == "COPY")
+		numArgBytes = 5*sizeof(u32);
+	else if (tagStr == "BOOT")
+		numArgBytes = sizeof(u32);
+	else
+	{
+		// memloader would be out of sync from here on, so say so right away
+		cmdBytes.clear();
+		return -int(ERROR_INVALID_DATA);
+	}
+
+	if (cmdBytes.size() < CommandBatch::TAG_LENGTH+numArgBytes)
+		return 0;
+
+	u32 cmdArgs[5];
+	memcpy(cmdArgs, &cmdBytes[CommandBatch::TAG_LENGTH], numArgBytes);
+	for (size_t i=0; i<numArgBytes/sizeof(u32); i++)
+		cmdArgs[i] = _byteswap_ulong(cmdArgs[i]);
+
+	cmdBytes.clear();
+	if (tagStr == "RECV")
+	{
+		recvAddress = cmdArgs[0];
+		recvLength = cmdArgs[1];
+		recvRemaining = recvLength;
+		recvCrc.reset();
+		if (recvRemaining == 0)
+			queueOutput("Emulated memloader got 0x%08x bytes at 0x%08x (crc32c 0x%08x)\n", recvLength, recvAddress, recvCrc.value());
+	}
+	else if (tagStr == "COPY")
+		queueOutput("Emulated memloader copied 0x%08x bytes from 0x%08x to 0x%08x (type %u)\n", cmdArgs[2], cmdArgs[1], cmdArgs[3], cmdArgs[0]);
+	else
+	{
+		queueOutput("Emulated memloader booting 0x%08x\n", cmdArgs[0]);
+		stage = Stage::Booted;
+	}
+
+	return 0;
+}
+
+void EmulatedRcmDevice::queueOutput(const char* formatStr, ...)
+{
+	char lineBuf[256];
+	va_list args;
+	va_start(args, formatStr);
+	vsprintf_s(lineBuf, formatStr, args);
+	va_end(args);
+
+	pendingOutput.push_back(lineBuf);
+}
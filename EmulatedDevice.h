@@ -0,0 +1,55 @@
+#pragma once
+
+#include "Types.h"
+#include "RcmDevice.h"
+#include "Crc32c.h"
+#include <deque>
+
+//A Tegra in RCM mode that only exists inside this process, so sessions (and --fleet with many of them at once) can run without
+//any hardware. It answers the same KUSB_DRIVER_API calls and driver ioctls the real one does:
+//  - reports libusbK 3.0.7 and a device id made from its index
+//  - takes the upload, but only smashes if the host's idea of the current DMA buffer matches the packets it got
+//  - then acts like memloader: says READY., takes RECV, COPY and BOOT, and queues a line about each RECV and the BOOT for -r to show
+//It never asks for sections, as it has no ini of its own. Every call completes before it returns and one session at a time can use it
+class EmulatedRcmDevice
+{
+public:
+	EmulatedRcmDevice(u32 index, u32 vid, u32 pid);
+	~EmulatedRcmDevice();
+
+	KLST_DEVINFO_HANDLE getDeviceInfo() { return &deviceInfo; }
+
+	//Fills in the calls to use if deviceInfo (or a copy of it) belongs to a live emulated device, returns false for anything else
+	static bool LoadDriverAPI(KLST_DEVINFO_HANDLE deviceInfo, KUSB_DRIVER_API& outApi, DriverIoctlFunc& outIoctl);
+protected:
+	enum class Stage { Rcm, Payload, Booted };
+
+	static EmulatedRcmDevice* FindDevice(const char* devicePath);
+
+	static BOOL KUSB_API UsbInit(KUSB_HANDLE* outHandle, KLST_DEVINFO_HANDLE devInfo);
+	static BOOL KUSB_API UsbFree(KUSB_HANDLE usbHandle);
+	static BOOL KUSB_API UsbReadPipe(KUSB_HANDLE usbHandle, UCHAR pipeId, UCHAR* outBuf, UINT bufLength, UINT* lengthTransferred, LPOVERLAPPED overlapped);
+	static BOOL KUSB_API UsbWritePipe(KUSB_HANDLE usbHandle, UCHAR pipeId, UCHAR* data, UINT dataLength, UINT* lengthTransferred, LPOVERLAPPED overlapped);
+	static BOOL KUSB_API UsbAbortPipe(KUSB_HANDLE usbHandle, UCHAR pipeId);
+	static BOOL KUSB_API UsbGetOverlappedResult(KUSB_HANDLE usbHandle, LPOVERLAPPED overlapped, UINT* lengthTransferred, BOOL wait);
+	static int DriverIoctl(KUSB_HANDLE usbHandle, DWORD ioctlCode, const void* inputBytes, size_t numInputBytes, void* outputBytes, size_t numOutputBytes);
+	//retVal is a length or a negated win32 error, as with the RCMDeviceHacker calls
+	static BOOL CompleteTransfer(int retVal, UINT* lengthTransferred, LPOVERLAPPED overlapped);
+
+	int read(u8* outBuf, size_t bufLength);
+	int write(const u8* data, size_t dataLength);
+	int runCommand();
+	void queueOutput(const char* formatStr, ...);
+
+	KLST_DEVINFO deviceInfo;
+	u8 deviceId[0x10];
+	Stage stage;
+	bool idRead;
+	u32 rcmPackets; //everything written before the smash
+	std::deque<string> pendingOutput; //each one is what a read gets back
+	ByteVector cmdBytes; //the tag and arguments of the command that is coming in
+	u32 recvAddress;
+	u32 recvRemaining;
+	u32 recvLength;
+	Crc32c recvCrc;
+};
@@ -0,0 +1,183 @@
+#include "HotplugSource.h"
+#include "ScopeGuard.h"
+#include "AsyncLogger.h"
+#include <tchar.h>
+#include <stdio.h>
+#include <fstream>
+#include <sstream>
+#include <atomic>
+
+namespace
+{
+	//what the one started HotK source filters on and reports to
+	std::atomic<HotplugSink> usbkSink(nullptr);
+	u32 usbkVid = 0;
+	u32 usbkPid = 0;
+}
+
+void KUSB_API UsbkHotplugSource::HotPlugEventCallback(KHOT_HANDLE Handle, KLST_DEVINFO_HANDLE DeviceInfo, KLST_SYNC_FLAG NotificationType)
+{
+	const auto sink = usbkSink.load();
+	if (sink != nullptr && (NotificationType == KLST_SYNC_FLAG_ADDED || NotificationType == KLST_SYNC_FLAG_REMOVED) && DeviceInfo != nullptr &&
+		DeviceInfo->Common.Vid == usbkVid && DeviceInfo->Common.Pid == usbkPid)
+	{
+		sink((NotificationType == KLST_SYNC_FLAG_ADDED) ? HotplugEvent::Type::Attached : HotplugEvent::Type::Detached, DeviceInfo);
+	}
+}
+
+int UsbkHotplugSource::start(u32 vid, u32 pid, bool includeConnected, HotplugSink sink)
+{
+	stop();
+
+	KHOT_PARAMS hotParams;
+	memset(&hotParams, 0, sizeof(hotParams));
+	hotParams.OnHotPlug = HotPlugEventCallback;
+	hotParams.Flags = includeConnected ? KHOT_FLAG_PLUG_ALL_ON_INIT : KHOT_FLAG_NONE;
+
+	usbkVid = vid;
+	usbkPid = pid;
+	usbkSink = sink;
+	sprintf_s(hotParams.PatternMatch.DeviceID, "*VID_%04X&PID_%04X*", vid, pid);
+	LogPrint(LogLevel::Info, TEXT("Looking for devices matching the pattern %s\n"),
+		WinString(std::begin(hotParams.PatternMatch.DeviceID), std::end(hotParams.PatternMatch.DeviceID)).c_str());
+
+	if (!HotK_Init(&hotHandle, &hotParams))
+	{
+		const auto errorCode = GetLastError();
+		LogPrint(LogLevel::Error, TEXT("Hotplug listener init failed with win32 error %u\n"), errorCode);
+		hotHandle = nullptr;
+		usbkSink = nullptr;
+		return -4;
+	}
+
+	return 0;
+}
+
+void UsbkHotplugSource::stop()
+{
+	if (hotHandle != nullptr)
+	{
+		HotK_Free(hotHandle);
+		hotHandle = nullptr;
+		usbkSink = nullptr;
+	}
+}
+
+int ScriptedHotplugSource::start(u32 vid, u32 pid, bool includeConnected, HotplugSink sink)
+{
+	stop();
+
+	std::ifstream inputFile(scriptFilename.c_str());
+	if (!inputFile.is_open())
+	{
+		LogPrint(LogLevel::Error, TEXT("Couldn't open hotplug script '%Ts' for reading\n"), scriptFilename.c_str());
+		return -4;
+	}
+
+	steps.clear();
+	u32 lineNum = 0;
+	std::string currLine;
+	while (std::getline(inputFile, currLine))
+	{
+		lineNum++;
+		const auto commentPos = currLine.find(';');
+		if (commentPos != std::string::npos)
+			currLine.resize(commentPos);
+
+		std::istringstream lineStream(currLine);
+		std::string actionStr;
+		if (!(lineStream >> actionStr))
+			continue;
+
+		ScriptStep newStep;
+		newStep.waitMs = 0;
+		if (stricmp(actionStr.c_str(), "attach") == 0)
+			newStep.action = ScriptStep::Action::Attach;
+		else if (stricmp(actionStr.c_str(), "detach") == 0)
+			newStep.action = ScriptStep::Action::Detach;
+		else if (stricmp(actionStr.c_str(), "wait") == 0 && (lineStream >> newStep.waitMs))
+			newStep.action = ScriptStep::Action::Wait;
+		else
+		{
+			LogPrint(LogLevel::Error, TEXT("Invalid command '%hs' on line %u of hotplug script '%Ts'\n"), actionStr.c_str(), lineNum, scriptFilename.c_str());
+			return -1;
+		}
+
+		steps.push_back(newStep);
+	}
+
+	LogPrint(LogLevel::Info, TEXT("Playing %u hotplug events from '%Ts' for devices with VID_%04X&PID_%04X\n"), (u32)steps.size(), scriptFilename.c_str(), vid, pid);
+	stopping = false;
+	player = std::thread(&ScriptedHotplugSource::playScript, this, vid, pid, sink);
+	return 0;
+}
+
+void ScriptedHotplugSource::stop()
+{
+	if (!player.joinable())
+		return;
+
+	{
+		std::lock_guard<std::mutex> stopLock(stopMutex);
+		stopping = true;
+	}
+	stopCond.notify_all();
+	player.join();
+}
+
+void ScriptedHotplugSource::playScript(u32 vid, u32 pid, HotplugSink sink)
+{
+	KLST_DEVINFO currDevice;
+	memset(&currDevice, 0, sizeof(currDevice));
+	bool haveDevice = false;
+
+	for (const auto& currStep : steps)
+	{
+		if (currStep.action == ScriptStep::Action::Wait)
+		{
+			std::unique_lock<std::mutex> stopLock(stopMutex);
+			if (stopCond.wait_for(stopLock, std::chrono::milliseconds(currStep.waitMs), [this]() { return stopping; }))
+				return;
+
+			continue;
+		}
+
+		{
+			std::lock_guard<std::mutex> stopLock(stopMutex);
+			if (stopping)
+				return;
+		}
+
+		if (currStep.action == ScriptStep::Action::Detach)
+		{
+			if (haveDevice)
+			{
+				currDevice.Connected = FALSE;
+				sink(HotplugEvent::Type::Detached, &currDevice);
+			}
+
+			continue;
+		}
+
+		// a real device if there is one, so the whole session can run
+		KLST_HANDLE deviceList = nullptr;
+		KLST_DEVINFO_HANDLE foundInfo = nullptr;
+		if (LstK_Init(&deviceList, KLST_FLAG_NONE))
+		{
+			auto lstKgrd = MakeScopeGuard([&deviceList]() { LstK_Free(deviceList); });
+			if (LstK_FindByVidPid(deviceList, vid, pid, &foundInfo) && foundInfo != nullptr)
+				memcpy(&currDevice, foundInfo, sizeof(currDevice));
+		}
+		if (foundInfo == nullptr)
+		{
+			memset(&currDevice, 0, sizeof(currDevice));
+			currDevice.Common.Vid = (int)vid;
+			currDevice.Common.Pid = (int)pid;
+			sprintf_s(currDevice.DevicePath, "\\\\?\\scripted#vid_%04x&pid_%04x", vid, pid);
+		}
+
+		currDevice.Connected = TRUE;
+		haveDevice = true;
+		sink(HotplugEvent::Type::Attached, &currDevice);
+	}
+}
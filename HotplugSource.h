@@ -0,0 +1,82 @@
+#pragma once
+
+#include "Types.h"
+#include "WinHandle.h"
+#include "libusbk_int.h"
+#include <chrono>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+//What a hotplug source tells whoever is waiting for a device
+struct HotplugEvent
+{
+	enum class Type { Attached, Detached };
+
+	Type type = Type::Detached;
+	KLST_DEVINFO deviceInfo;
+	std::chrono::steady_clock::time_point eventTime;
+};
+
+//Gets called from whatever thread the source was notified on, deviceInfo only lives for the call
+typedef void (*HotplugSink)(HotplugEvent::Type eventType, KLST_DEVINFO_HANDLE deviceInfo);
+
+//Where device arrivals and removals come from. Consumers only ever see the events a source hands to its sink,
+//so anything that can produce them (the OS, a script) drives the wait, watch and serve modes the same way
+class HotplugSource
+{
+public:
+	virtual ~HotplugSource() {}
+
+	//Reports devices with this VID/PID from now on, the ones that are already connected first if includeConnected
+	virtual int start(u32 vid, u32 pid, bool includeConnected, HotplugSink sink) = 0;
+	virtual void stop() = 0;
+};
+
+//libusbK HotK notifications, which come straight from the device interface arrival without any polling.
+//HotK callbacks carry no context, so only one of these can be started at a time
+class UsbkHotplugSource : public HotplugSource
+{
+public:
+	UsbkHotplugSource() : hotHandle(nullptr) {}
+	~UsbkHotplugSource() { stop(); }
+
+	int start(u32 vid, u32 pid, bool includeConnected, HotplugSink sink) override;
+	void stop() override;
+protected:
+	static void KUSB_API HotPlugEventCallback(KHOT_HANDLE Handle, KLST_DEVINFO_HANDLE DeviceInfo, KLST_SYNC_FLAG NotificationType);
+
+	KHOT_HANDLE hotHandle;
+};
+
+//Plays synthetic events from a script file, for exercising the consumers and measuring their latency without
+//plugging anything in. One command per line, ';' starts a comment:
+//  attach  - the first connected device with the VID/PID, or a made up one (which then fails to open) if there is none
+//  detach  - the device from the last attach
+//  wait <ms>
+class ScriptedHotplugSource : public HotplugSource
+{
+public:
+	ScriptedHotplugSource(const TCHAR* scriptFilename_) : scriptFilename(scriptFilename_), stopping(false) {}
+	~ScriptedHotplugSource() { stop(); }
+
+	int start(u32 vid, u32 pid, bool includeConnected, HotplugSink sink) override;
+	void stop() override;
+protected:
+	struct ScriptStep
+	{
+		enum class Action { Attach, Detach, Wait };
+
+		Action action;
+		u32 waitMs;
+	};
+
+	void playScript(u32 vid, u32 pid, HotplugSink sink);
+
+	WinString scriptFilename;
+	vector<ScriptStep> steps;
+	std::thread player;
+	std::mutex stopMutex;
+	std::condition_variable stopCond;
+	bool stopping;
+};
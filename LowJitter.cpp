@@ -0,0 +1,119 @@
+#include "LowJitter.h"
+#include "AsyncLogger.h"
+#include <tchar.h>
+#include <math.h>
+
+LowJitterWindow::LowJitterWindow(const LowJitterSettings& settings) : threadHandle(GetCurrentThread()), cpuIndex(-1), prevAffinity(0),
+	prevPriority(GetThreadPriority(GetCurrentThread())), prevPriorityClass(GetPriorityClass(GetCurrentProcess())), realtimeClass(false),
+	unpinnedCpu(-1), pinErrorCode(0)
+{
+	const int wantedCpu = (settings.cpuIndex >= 0) ? settings.cpuIndex : (int)GetCurrentProcessorNumber();
+	if (wantedCpu < int(sizeof(DWORD_PTR)*8))
+	{
+		prevAffinity = SetThreadAffinityMask(threadHandle, DWORD_PTR(1) << wantedCpu);
+		if (prevAffinity != 0)
+			cpuIndex = wantedCpu;
+	}
+	if (cpuIndex < 0)
+	{
+		unpinnedCpu = wantedCpu;
+		pinErrorCode = GetLastError();
+	}
+
+	// without SeIncreaseBasePriorityPrivilege windows quietly hands out the high class instead
+	if (SetPriorityClass(GetCurrentProcess(), REALTIME_PRIORITY_CLASS))
+		realtimeClass = (GetPriorityClass(GetCurrentProcess()) == REALTIME_PRIORITY_CLASS);
+
+	SetThreadPriority(threadHandle, THREAD_PRIORITY_TIME_CRITICAL);
+}
+
+LowJitterWindow::~LowJitterWindow()
+{
+	locker.unlockAll();
+
+	SetThreadPriority(threadHandle, prevPriority);
+	SetPriorityClass(GetCurrentProcess(), prevPriorityClass);
+	if (prevAffinity != 0)
+		SetThreadAffinityMask(threadHandle, prevAffinity);
+
+	if (unpinnedCpu >= 0)
+		LogPrint(LogLevel::Error, TEXT("Couldn't pin the session to CPU %d (win32 error %u), it ran unpinned\n"), unpinnedCpu, pinErrorCode);
+	if (locker.getUnlockedBytes() > 0)
+		LogPrint(LogLevel::Error, TEXT("Couldn't lock %llu bytes in memory (win32 error %u), they may have page faulted\n"), (u64)locker.getUnlockedBytes(), locker.getLockErrorCode());
+}
+
+bool MemoryLocker::lockRange(const void* rangeStart, size_t numBytes)
+{
+	if (numBytes == 0)
+		return true;
+
+	SYSTEM_INFO sysInfo;
+	GetSystemInfo(&sysInfo);
+	const size_t pageSize = sysInfo.dwPageSize;
+	const size_t firstPage = size_t(rangeStart) & ~(pageSize-1);
+	const size_t lockSize = ((size_t(rangeStart)+numBytes+pageSize-1) & ~(pageSize-1)) - firstPage;
+
+	// a write would dirty pages the image shares between sessions, reading every page is enough to fault it in
+	volatile u8 touchedByte = 0;
+	for (size_t pageOffs=0; pageOffs<lockSize; pageOffs+=pageSize)
+		touchedByte += *(const volatile u8*)(firstPage+pageOffs);
+
+	// the default minimum working set only has room for a few dozen locked pages
+	SIZE_T currMinWorkingSet = 0, currMaxWorkingSet = 0;
+	if (GetProcessWorkingSetSize(GetCurrentProcess(), &currMinWorkingSet, &currMaxWorkingSet) &&
+		SetProcessWorkingSetSize(GetCurrentProcess(), currMinWorkingSet+lockSize, currMaxWorkingSet+lockSize))
+	{
+		grownBytes += lockSize;
+	}
+
+	if (!VirtualLock((void*)firstPage, lockSize))
+	{
+		lockErrorCode = GetLastError();
+		unlockedBytes += lockSize;
+		return false;
+	}
+
+	lockedRanges.emplace_back((void*)firstPage, lockSize);
+	lockedBytes += lockSize;
+	return true;
+}
+
+void MemoryLocker::unlockAll()
+{
+	for (const auto& currRange : lockedRanges)
+		VirtualUnlock(currRange.first, currRange.second);
+
+	lockedRanges.clear();
+	lockedBytes = 0;
+
+	// only take back what we added, another locker may still need the rest
+	SIZE_T currMinWorkingSet = 0, currMaxWorkingSet = 0;
+	if (grownBytes > 0 && GetProcessWorkingSetSize(GetCurrentProcess(), &currMinWorkingSet, &currMaxWorkingSet) &&
+		currMinWorkingSet > grownBytes && currMaxWorkingSet > grownBytes)
+	{
+		SetProcessWorkingSetSize(GetCurrentProcess(), currMinWorkingSet-grownBytes, currMaxWorkingSet-grownBytes);
+	}
+	grownBytes = 0;
+}
+
+void JitterStats::add(double durationUs)
+{
+	if (numSamples == 0 || durationUs < minUs)
+		minUs = durationUs;
+	if (numSamples == 0 || durationUs > maxUs)
+		maxUs = durationUs;
+
+	numSamples++;
+	sumUs += durationUs;
+	sumSquaresUs += durationUs*durationUs;
+}
+
+double JitterStats::stddev() const
+{
+	if (numSamples < 2)
+		return 0;
+
+	const double avgUs = mean();
+	const double variance = sumSquaresUs/numSamples - avgUs*avgUs;
+	return (variance > 0) ? sqrt(variance) : 0;
+}
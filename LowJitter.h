@@ -0,0 +1,87 @@
+#pragma once
+
+#include "Types.h"
+#include "WinHandle.h"
+#include <utility>
+
+//Keeps ranges resident until they are unlocked, growing the process working set by what they need and shrinking it back
+//by the same amount afterwards, so several of these can be alive at once. Failures are only counted, for the owner to report
+class MemoryLocker
+{
+public:
+	MemoryLocker() : unlockedBytes(0), lockErrorCode(0), lockedBytes(0), grownBytes(0) {}
+	~MemoryLocker() { unlockAll(); }
+
+	//Faults every page of the range in and locks it into the working set
+	bool lockRange(const void* rangeStart, size_t numBytes);
+	void unlockAll();
+
+	size_t getLockedBytes() const { return lockedBytes; }
+	size_t getUnlockedBytes() const { return unlockedBytes; } //asked to be locked but weren't, over the locker's whole life
+	DWORD getLockErrorCode() const { return lockErrorCode; } //from the last lockRange that failed
+
+	MemoryLocker(const MemoryLocker&) = delete;
+	MemoryLocker& operator=(const MemoryLocker&) = delete;
+protected:
+	vector<std::pair<void*, size_t>> lockedRanges; //page aligned
+	size_t unlockedBytes;
+	DWORD lockErrorCode;
+	size_t lockedBytes;
+	size_t grownBytes; //what the working set minimum and maximum got raised by
+};
+
+//Opt-in handling of the upload, high buffer switch and smash, where a page fault or a preemption
+//at the wrong moment shows up as a slow or failed smash on a busy host
+struct LowJitterSettings
+{
+	bool enabled = false;
+	int cpuIndex = -1; //-1 pins to whichever CPU the session is running on when the window opens
+};
+
+//For as long as it's alive: the calling thread is pinned to one CPU at time critical priority (in the realtime class
+//if the process is allowed to have it) and the ranges handed to lockRange stay resident. Everything gets undone on destruction,
+//and only then does it print what couldn't be done, so nothing waits on the console while the window is open
+class LowJitterWindow
+{
+public:
+	LowJitterWindow(const LowJitterSettings& settings);
+	~LowJitterWindow();
+
+	//Faults every page of the range in and locks it into the working set, growing the working set as needed
+	bool lockRange(const void* rangeStart, size_t numBytes) { return locker.lockRange(rangeStart, numBytes); }
+
+	int getCpuIndex() const { return cpuIndex; } //-1 if pinning failed
+	bool gotRealtimeClass() const { return realtimeClass; }
+	size_t getLockedBytes() const { return locker.getLockedBytes(); }
+
+	LowJitterWindow(const LowJitterWindow&) = delete;
+	LowJitterWindow& operator=(const LowJitterWindow&) = delete;
+protected:
+	HANDLE threadHandle;
+	int cpuIndex;
+	DWORD_PTR prevAffinity;
+	int prevPriority;
+	DWORD prevPriorityClass;
+	bool realtimeClass;
+	int unpinnedCpu; //the CPU pinning to failed, -1 if it didn't
+	DWORD pinErrorCode;
+	MemoryLocker locker;
+};
+
+//Spread of the durations of a repeated step like sending one packet, so runs with and without the window can be compared
+class JitterStats
+{
+public:
+	JitterStats() : numSamples(0), sumUs(0), sumSquaresUs(0), minUs(0), maxUs(0) {}
+
+	void add(double durationUs);
+	u32 count() const { return numSamples; }
+	double mean() const { return (numSamples > 0) ? sumUs/numSamples : 0; }
+	double stddev() const;
+	double minimum() const { return minUs; }
+	double maximum() const { return maxUs; }
+protected:
+	u32 numSamples;
+	double sumUs, sumSquaresUs;
+	double minUs, maxUs;
+};
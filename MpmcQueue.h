@@ -0,0 +1,100 @@
+#pragma once
+
+#include "Types.h"
+#include <atomic>
+
+//Bounded lock-free queue for any number of producers and consumers. Every cell carries a sequence
+//number telling whether it is free for the producer at that position or filled for the consumer,
+//so neither side ever takes a lock (safe to push from driver callbacks and console signal handlers)
+template<typename T, size_t CAPACITY>
+class MpmcQueue
+{
+	static_assert(CAPACITY >= 2 && (CAPACITY & (CAPACITY-1)) == 0, "MpmcQueue capacity must be a power of two");
+public:
+	MpmcQueue() : enqueuePos(0), dequeuePos(0), maxDepth(0)
+	{
+		for (size_t i=0; i<CAPACITY; i++)
+			cells[i].sequence.store(i, std::memory_order_relaxed);
+	}
+
+	MpmcQueue(const MpmcQueue&) = delete;
+	MpmcQueue& operator=(const MpmcQueue&) = delete;
+
+	//returns false if the queue is full
+	bool push(const T& newItem)
+	{
+		size_t pos = enqueuePos.load(std::memory_order_relaxed);
+		Cell* cell = nullptr;
+		for (;;)
+		{
+			cell = &cells[pos & (CAPACITY-1)];
+			const size_t seq = cell->sequence.load(std::memory_order_acquire);
+			const sptr diff = sptr(seq) - sptr(pos);
+			if (diff == 0)
+			{
+				if (enqueuePos.compare_exchange_weak(pos, pos+1, std::memory_order_relaxed))
+					break;
+			}
+			else if (diff < 0)
+				return false;
+			else
+				pos = enqueuePos.load(std::memory_order_relaxed);
+		}
+
+		cell->data = newItem;
+		cell->sequence.store(pos+1, std::memory_order_release);
+
+		const size_t currDepth = pos+1 - dequeuePos.load(std::memory_order_relaxed);
+		size_t prevMax = maxDepth.load(std::memory_order_relaxed);
+		while (currDepth > prevMax && !maxDepth.compare_exchange_weak(prevMax, currDepth, std::memory_order_relaxed)) {}
+
+		return true;
+	}
+
+	//returns false if the queue is empty
+	bool pop(T& outItem)
+	{
+		size_t pos = dequeuePos.load(std::memory_order_relaxed);
+		Cell* cell = nullptr;
+		for (;;)
+		{
+			cell = &cells[pos & (CAPACITY-1)];
+			const size_t seq = cell->sequence.load(std::memory_order_acquire);
+			const sptr diff = sptr(seq) - sptr(pos+1);
+			if (diff == 0)
+			{
+				if (dequeuePos.compare_exchange_weak(pos, pos+1, std::memory_order_relaxed))
+					break;
+			}
+			else if (diff < 0)
+				return false;
+			else
+				pos = dequeuePos.load(std::memory_order_relaxed);
+		}
+
+		outItem = cell->data;
+		cell->sequence.store(pos+CAPACITY, std::memory_order_release);
+		return true;
+	}
+
+	//only a snapshot while other threads are pushing or popping
+	size_t depth() const
+	{
+		const size_t enqueued = enqueuePos.load(std::memory_order_relaxed);
+		const size_t dequeued = dequeuePos.load(std::memory_order_relaxed);
+		return (enqueued > dequeued) ? enqueued-dequeued : 0;
+	}
+	size_t highWaterMark() const { return maxDepth.load(std::memory_order_relaxed); }
+	static constexpr size_t capacity() { return CAPACITY; }
+protected:
+	struct Cell
+	{
+		std::atomic<size_t> sequence;
+		T data;
+	};
+
+	Cell cells[CAPACITY];
+	alignas(64) std::atomic<size_t> enqueuePos;
+	alignas(64) std::atomic<size_t> dequeuePos;
+	std::atomic<size_t> maxDepth;
+};
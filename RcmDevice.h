@@ -0,0 +1,424 @@
+#pragma once
+
+#include "Types.h"
+#include "WinHandle.h"
+#include "libusbk_int.h"
+#include "Crc32c.h"
+#include <assert.h>
+#include <chrono>
+#include <utility>
+
+//Stands in for the driver's own ioctls (the version query and the smash) on a device that isn't behind libusbK.
+//Returns what BlockingIoctl does, the number of bytes received or a negated win32 error
+typedef int (*DriverIoctlFunc)(KUSB_HANDLE usbHandle, DWORD ioctlCode, const void* inputBytes, size_t numInputBytes, void* outputBytes, size_t numOutputBytes);
+
+//Talks to a Tegra in RCM mode: device id, payload upload and the stack smash, plus the plain transfers memloader uses afterwards
+class RCMDeviceHacker
+{
+public:
+	RCMDeviceHacker(KUSB_DRIVER_API& usbDriver_, KUSB_HANDLE usbHandle_, DriverIoctlFunc ioctlFunc_ = nullptr) : usbHandle(usbHandle_), usbDriver(&usbDriver_), 
+		ioctlFunc(ioctlFunc_), totalWritten(0), currentBuffer(0), 
+		busyPoll(false), zeroPacket(PACKET_SIZE, 0), smashBuffer(MAX_SMASH_LENGTH, 0) {}
+	~RCMDeviceHacker() 
+	{
+		if (usbHandle != nullptr)
+		{
+			usbDriver->Free(usbHandle);
+			usbHandle = nullptr;
+		}
+	}
+
+	static constexpr u32 PACKET_SIZE = 0x1000;
+	static constexpr int MAX_RESUME_ATTEMPTS = 3;
+	static constexpr u32 STACK_END = 0x40010000;
+	static constexpr u32 MAX_SMASH_LENGTH = STACK_END - 0x40005000; //from the low DMA buffer
+	static constexpr u32 BUSY_POLL_SPIN_US = 500; //longer than a packet normally takes, short enough not to starve the driver's DPC on the pinned CPU
+	static constexpr u32 BUSY_POLL_TIMEOUT_MS = 1000;
+	static constexpr u32 RESUME_TIMEOUT_MS = 5000; //for a single chunk after the smash, memloader takes whatever it was told to expect right away
+
+	struct TransferStats
+	{
+		u32 chunksResumed = 0;
+		u32 transfersRecovered = 0;
+		u32 transfersFailed = 0;
+	};
+
+	int getDriverVersion(libusbk::version_t& outVersion)
+	{
+		libusbk::libusb_request myRequest;
+		memset(&myRequest, 0, sizeof(myRequest));
+
+		const auto retVal = driverIoctl(libusbk::LIBUSB_IOCTL_GET_VERSION, &myRequest, sizeof(myRequest), &myRequest, sizeof(myRequest));
+		if (retVal > 0)
+			outVersion = myRequest.version;
+
+		return retVal;
+	}
+	int read(u8* outBuf, size_t outBufSize)
+	{
+		UINT lengthTransferred = 0;
+		const auto retVal = usbDriver->ReadPipe(usbHandle, 0x81, outBuf, (UINT)outBufSize, &lengthTransferred, nullptr);
+		if (retVal == FALSE)
+			return -int(GetLastError());
+		else
+			return int(lengthTransferred);
+	}
+	//Queues a read at the driver and returns without waiting for it, overlapped.hEvent has to be a manual reset event.
+	//Reads queued this way complete in the order they were started
+	int beginRead(u8* outBuf, size_t outBufSize, OVERLAPPED& overlapped)
+	{
+		ResetEvent(overlapped.hEvent);
+		UINT lengthTransferred = 0;
+		if (usbDriver->ReadPipe(usbHandle, 0x81, outBuf, (UINT)outBufSize, &lengthTransferred, &overlapped) == FALSE)
+		{
+			const auto errCode = GetLastError();
+			if (errCode != ERROR_IO_PENDING)
+				return -int(errCode);
+		}
+
+		return 0;
+	}
+	//Waits for a read started with beginRead to complete
+	int finishRead(OVERLAPPED& overlapped)
+	{
+		UINT lengthTransferred = 0;
+		if (usbDriver->GetOverlappedResult(usbHandle, &overlapped, &lengthTransferred, TRUE) == FALSE)
+			return -int(GetLastError());
+		else
+			return int(lengthTransferred);
+	}
+	//Cancels every queued read, each still has to be finished before its buffer goes away
+	void abortReads() { usbDriver->AbortPipe(usbHandle, 0x81); }
+	//Queues a write behind any already queued and returns without waiting for it, overlapped.hEvent has to be a manual reset event.
+	//Only for talking to the payload once it runs, it doesn't keep track of the RCM buffer switching
+	int beginWrite(const u8* data, size_t dataLen, OVERLAPPED& overlapped)
+	{
+		ResetEvent(overlapped.hEvent);
+		UINT lengthTransferred = 0;
+		if (usbDriver->WritePipe(usbHandle, 0x01, (u8*)data, (UINT)dataLen, &lengthTransferred, &overlapped) == FALSE)
+		{
+			const auto errCode = GetLastError();
+			if (errCode != ERROR_IO_PENDING)
+			{
+				stats.transfersFailed++;
+				return -int(errCode);
+			}
+		}
+
+		return 0;
+	}
+	//Waits for a write started with beginWrite to complete
+	int finishWrite(OVERLAPPED& overlapped)
+	{
+		UINT lengthTransferred = 0;
+		if (usbDriver->GetOverlappedResult(usbHandle, &overlapped, &lengthTransferred, TRUE) == FALSE)
+		{
+			stats.transfersFailed++;
+			return -int(GetLastError());
+		}
+		else
+			return int(lengthTransferred);
+	}
+	//Cancels every queued write, each still has to be finished before its data goes away
+	void abortWrites() { usbDriver->AbortPipe(usbHandle, 0x01); }
+	int write(const u8* data, size_t dataLen, size_t packetSize = PACKET_SIZE)
+	{
+		int bytesRemaining = (int)dataLen;
+		size_t bytesWritten = 0;
+		while (bytesRemaining > 0)
+		{
+			const size_t bytesToWrite = (bytesRemaining < (int)packetSize) ? bytesRemaining : (int)packetSize;
+			const auto retVal = writeSingleBuffer(&data[bytesWritten], bytesToWrite);
+			if (retVal < 0)
+				return retVal;
+			else if (retVal < (int)bytesToWrite)
+				return int(bytesWritten)+retVal;
+
+			bytesWritten += retVal;
+			bytesRemaining -= retVal;
+		}
+
+		return (int)bytesWritten;
+	}
+	//like write, but a chunk that goes out short or times out is finished from the last byte the device actually took,
+	//with up to MAX_RESUME_ATTEMPTS retries for every chunk. If a chunk still can't be finished, returns how many bytes did go out,
+	//so the caller knows the device is out of sync. Only for use after the smash, as every attempt flips the RCM DMA buffer tracking.
+	//With crc given, every chunk gets added to it while its write is in flight (each byte once, resumed or not)
+	int writeResumable(const u8* data, size_t dataLen, size_t packetSize = PACKET_SIZE, Crc32c* crc = nullptr)
+	{
+		size_t bytesWritten = 0;
+		size_t chunkEnd = std::min(dataLen, packetSize);
+		size_t crcEnd = 0;
+		int attemptsLeft = MAX_RESUME_ATTEMPTS;
+		bool resumed = false;
+		while (bytesWritten < dataLen)
+		{
+			OVERLAPPED overlapped;
+			size_t chunkWritten = 0;
+			auto retVal = beginChunkTimed(&data[bytesWritten], chunkEnd-bytesWritten, overlapped);
+			if (retVal >= 0)
+			{
+				if (crc != nullptr && crcEnd < chunkEnd)
+				{
+					crc->update(&data[crcEnd], chunkEnd-crcEnd);
+					crcEnd = chunkEnd;
+				}
+				retVal = finishChunkTimed(overlapped, chunkWritten);
+			}
+			bytesWritten += chunkWritten;
+			if (bytesWritten == chunkEnd)
+			{
+				chunkEnd = std::min(dataLen, chunkEnd+packetSize);
+				attemptsLeft = MAX_RESUME_ATTEMPTS;
+				continue;
+			}
+
+			const bool retryable = (retVal >= 0) || (-retVal == ERROR_SEM_TIMEOUT);
+			if (!retryable || attemptsLeft <= 0)
+			{
+				stats.transfersFailed++;
+				return retryable ? (int)bytesWritten : retVal;
+			}
+
+			attemptsLeft--;
+			resumed = true;
+			stats.chunksResumed++;
+		}
+
+		if (resumed)
+			stats.transfersRecovered++;
+
+		return (int)bytesWritten;
+	}
+	const TransferStats& getTransferStats() const { return stats; }
+	//Spin on write completions instead of sleeping until the driver signals them, so the next packet (or the smash) follows
+	//without a scheduler wakeup in between. A write still going after BUSY_POLL_SPIN_US gets waited on normally, and aborted
+	//if it doesn't complete within BUSY_POLL_TIMEOUT_MS. The smash itself always blocks, it normally only ends when its request times out
+	void setBusyPoll(bool enabled)
+	{
+		if (enabled && (pollEvent.get() == nullptr || pollEvent.get() == INVALID_HANDLE_VALUE))
+			pollEvent = CreateEvent(nullptr, TRUE, FALSE, nullptr);
+
+		busyPoll = enabled && pollEvent.get() != nullptr && pollEvent.get() != INVALID_HANDLE_VALUE;
+	}
+	//What the high buffer switch and the smash send from and receive into, allocated up front so they can be locked in memory
+	vector<std::pair<const void*, size_t>> getCriticalBuffers() const
+	{
+		vector<std::pair<const void*, size_t>> outBuffers;
+		outBuffers.emplace_back(zeroPacket.data(), zeroPacket.size());
+		outBuffers.emplace_back(smashBuffer.data(), smashBuffer.size());
+		return outBuffers;
+	}
+	int readDeviceId(u8* deviceIdBuf, size_t idBufSize)
+	{
+		if (idBufSize < 0x10)
+			return -int(ERROR_INSUFFICIENT_BUFFER);
+
+		return read(deviceIdBuf, 0x10);
+	}
+	int switchToHighBuffer()
+	{
+		if (currentBuffer == 0)
+		{
+			const auto writeRes = write(zeroPacket.data(), zeroPacket.size());
+			if (writeRes < 0)
+				return writeRes;
+
+			assert(currentBuffer != 0);
+			return writeRes;
+		}
+		else
+			return 0;
+	}
+	int smashTheStack(int length=-1)
+	{
+		if (length < 0)
+			length = STACK_END - getCurrentBufferAddress();
+		
+		if (length < 1)
+			return 0;
+		if (length > (int)smashBuffer.size())
+			smashBuffer.resize(length, 0);
+
+		libusbk::libusb_request rawRequest;
+		memset(&rawRequest, 0, sizeof(rawRequest));
+		rawRequest.timeout = 1000; //ms
+		rawRequest.status.index = 0;
+		rawRequest.status.recipient = 0x02; //RECIPIENT_ENDPOINT
+
+		const auto retVal = driverIoctl(libusbk::LIBUSB_IOCTL_GET_STATUS, &rawRequest, sizeof(rawRequest), &smashBuffer[0], length);
+		if (retVal < 0)
+		{
+			const auto theError = -retVal;
+			if (theError == ERROR_SEM_TIMEOUT) //timed out, which means it probably smashed
+				return length;
+
+			return theError;
+		}
+		else
+			return retVal;
+	}
+protected:
+	u32 getCurrentBufferAddress() const 
+	{
+		return (currentBuffer == 0) ? 0x40005000u : 0x40009000u;
+	}
+	u32 toggleBuffer()
+	{
+		const auto prevBuffer = currentBuffer;
+		currentBuffer = (currentBuffer == 0) ? 1u : 0u;
+		return prevBuffer;
+	}	
+	int writeSingleBuffer(const u8* data, size_t dataLen)
+	{
+		toggleBuffer();
+
+		if (busyPoll)
+			return busyPollWrite(data, dataLen);
+
+		UINT lengthTransferred = 0;
+		const auto retVal = usbDriver->WritePipe(usbHandle, 0x01, (u8*)data, (UINT)dataLen, &lengthTransferred, nullptr);
+		if (retVal == FALSE)
+			return -int(GetLastError());
+		else
+			return (int)lengthTransferred;
+	}
+	int busyPollWrite(const u8* data, size_t dataLen)
+	{
+		OVERLAPPED overlapped;
+		memset(&overlapped, 0, sizeof(overlapped));
+		ResetEvent(pollEvent.get());
+		overlapped.hEvent = pollEvent.get();
+
+		UINT lengthTransferred = 0;
+		if (usbDriver->WritePipe(usbHandle, 0x01, (u8*)data, (UINT)dataLen, &lengthTransferred, &overlapped) == FALSE)
+		{
+			const auto errCode = GetLastError();
+			if (errCode != ERROR_IO_PENDING)
+				return -int(errCode);
+		}
+
+		const auto pollStart = std::chrono::steady_clock::now();
+		while (usbDriver->GetOverlappedResult(usbHandle, &overlapped, &lengthTransferred, FALSE) == FALSE)
+		{
+			const auto errCode = GetLastError();
+			if (errCode != ERROR_IO_INCOMPLETE)
+				return -int(errCode);
+
+			// at time critical priority the spin would hold off the very DPC that completes the write, so a slow one gets slept on
+			if (std::chrono::steady_clock::now()-pollStart >= std::chrono::microseconds(BUSY_POLL_SPIN_US))
+			{
+				if (WaitForSingleObject(pollEvent.get(), BUSY_POLL_TIMEOUT_MS) == WAIT_TIMEOUT)
+				{
+					// the transfer has to be finished with before its OVERLAPPED goes out of scope
+					usbDriver->AbortPipe(usbHandle, 0x01);
+					usbDriver->GetOverlappedResult(usbHandle, &overlapped, &lengthTransferred, TRUE);
+					return -int(ERROR_SEM_TIMEOUT);
+				}
+				if (usbDriver->GetOverlappedResult(usbHandle, &overlapped, &lengthTransferred, TRUE) == FALSE)
+					return -int(GetLastError());
+
+				break;
+			}
+
+			YieldProcessor();
+		}
+
+		return (int)lengthTransferred;
+	}
+
+	//Starts writing one chunk overlapped, finishChunkTimed has to be called for it unless this fails
+	int beginChunkTimed(const u8* data, size_t dataLen, OVERLAPPED& overlapped)
+	{
+		toggleBuffer();
+
+		if (chunkEvent.get() == nullptr || chunkEvent.get() == INVALID_HANDLE_VALUE)
+		{
+			chunkEvent = CreateEvent(nullptr, TRUE, FALSE, nullptr);
+			if (chunkEvent.get() == nullptr || chunkEvent.get() == INVALID_HANDLE_VALUE)
+				return -int(GetLastError());
+		}
+
+		memset(&overlapped, 0, sizeof(overlapped));
+		ResetEvent(chunkEvent.get());
+		overlapped.hEvent = chunkEvent.get();
+
+		UINT lengthTransferred = 0;
+		if (usbDriver->WritePipe(usbHandle, 0x01, (u8*)data, (UINT)dataLen, &lengthTransferred, &overlapped) == FALSE)
+		{
+			const auto errCode = GetLastError();
+			if (errCode != ERROR_IO_PENDING)
+				return -int(errCode);
+		}
+
+		return 0;
+	}
+	//Waits for the chunk and aborts it if the device hasn't taken it within RESUME_TIMEOUT_MS. outWritten is what
+	//actually went out either way, unlike a blocking WritePipe which reports nothing for a transfer that failed
+	int finishChunkTimed(OVERLAPPED& overlapped, size_t& outWritten)
+	{
+		outWritten = 0;
+
+		UINT lengthTransferred = 0;
+		int retVal = 0;
+		if (WaitForSingleObject(overlapped.hEvent, RESUME_TIMEOUT_MS) == WAIT_TIMEOUT)
+		{
+			usbDriver->AbortPipe(usbHandle, 0x01);
+			retVal = -int(ERROR_SEM_TIMEOUT);
+		}
+		// the length gets filled in for an aborted or failed transfer too
+		if (usbDriver->GetOverlappedResult(usbHandle, &overlapped, &lengthTransferred, TRUE) == FALSE && retVal == 0)
+			retVal = -int(GetLastError());
+
+		outWritten = lengthTransferred;
+		return (retVal < 0) ? retVal : (int)lengthTransferred;
+	}
+
+	int driverIoctl(DWORD ioctlCode, const void* inputBytes, size_t numInputBytes, void* outputBytes, size_t numOutputBytes)
+	{
+		if (ioctlFunc != nullptr)
+			return ioctlFunc(usbHandle, ioctlCode, inputBytes, numInputBytes, outputBytes, numOutputBytes);
+
+		HANDLE masterHandle = INVALID_HANDLE_VALUE;
+		if (!libusbk_getInternals(usbHandle, &masterHandle) || masterHandle == nullptr || masterHandle == INVALID_HANDLE_VALUE)
+			return -int(ERROR_INVALID_HANDLE);
+
+		return BlockingIoctl(masterHandle, ioctlCode, inputBytes, numInputBytes, outputBytes, numOutputBytes);
+	}
+	static int BlockingIoctl(HANDLE driverHandle, DWORD ioctlCode, const void* inputBytes, size_t numInputBytes, void* outputBytes, size_t numOutputBytes)
+	{
+		WinHandle theEvent = CreateEvent(nullptr, TRUE, FALSE, nullptr);
+		if (theEvent.get() == nullptr || theEvent.get() == INVALID_HANDLE_VALUE)
+			return false;
+
+		OVERLAPPED overlapped;
+		memset(&overlapped, 0, sizeof(overlapped));
+		if (DeviceIoControl(driverHandle, ioctlCode, (LPVOID)inputBytes, (DWORD)numInputBytes, (LPVOID)outputBytes, (DWORD)numOutputBytes, nullptr, &overlapped) == FALSE)
+		{
+			const auto errCode = GetLastError();
+			if (errCode != ERROR_IO_PENDING)
+				return -int(errCode);
+		}
+
+		DWORD bytesReceived = 0;
+		if (GetOverlappedResult(driverHandle, &overlapped, &bytesReceived, TRUE) == FALSE)
+		{
+			const auto errCode = GetLastError();
+			return -int(errCode);
+		}
+
+		return (int)bytesReceived;
+	}
+
+	KUSB_HANDLE usbHandle;
+	KUSB_DRIVER_API* usbDriver;
+	DriverIoctlFunc ioctlFunc; //nullptr for the real driver
+	size_t totalWritten;
+	u32 currentBuffer;
+	TransferStats stats;
+	bool busyPoll;
+	WinHandle pollEvent; //waited on once spinning gives up
+	WinHandle chunkEvent; //for beginChunkTimed
+	ByteVector zeroPacket;
+	ByteVector smashBuffer;
+};
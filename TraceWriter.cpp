@@ -0,0 +1,164 @@
+#include "TraceWriter.h"
+#include "AsyncLogger.h"
+#include <tchar.h>
+#include <stdio.h>
+
+namespace
+{
+	void AppendJsonString(std::string& outStr, const char* srcStr)
+	{
+		outStr.push_back('"');
+		for (const char* currChar = srcStr; *currChar != 0; currChar++)
+		{
+			const unsigned char charVal = (unsigned char)*currChar;
+			if (charVal == '"' || charVal == '\\')
+			{
+				outStr.push_back('\\');
+				outStr.push_back((char)charVal);
+			}
+			else if (charVal < 0x20)
+			{
+				char escapeBuf[8];
+				sprintf_s(escapeBuf, "\\u%04x", (u32)charVal);
+				outStr.append(escapeBuf);
+			}
+			else
+				outStr.push_back((char)charVal);
+		}
+		outStr.push_back('"');
+	}
+}
+
+TraceWriter& TraceWriter::instance()
+{
+	static TraceWriter theWriter;
+	return theWriter;
+}
+
+std::string TraceWriter::NarrowUtf8(const TCHAR* srcStr)
+{
+	if (sizeof(TCHAR) == sizeof(char))
+		return std::string((const char*)srcStr);
+
+	char convChars[4096];
+	convChars[0] = 0;
+
+	const auto numChars = WideCharToMultiByte(CP_UTF8, 0, (const wchar_t*)srcStr, -1, convChars, (int)array_countof(convChars)-1, nullptr, nullptr);
+	if (numChars <= 0)
+		return std::string();
+
+	return std::string(convChars, numChars-1);
+}
+
+void TraceWriter::start(const TCHAR* filename, TimePoint originTime)
+{
+	std::lock_guard<std::mutex> eventsLock(eventsMutex);
+	outFilename = filename;
+	origin = originTime;
+	events.clear();
+	events.reserve(4096);
+	numDropped = 0;
+	active = true;
+}
+
+void TraceWriter::addSpan(const char* category, const char* name, TimePoint startTime, TimePoint endTime,
+						const u8* deviceId, const char* detail, u64 numBytes, int result)
+{
+	if (!enabled())
+		return;
+
+	Event newEvent;
+	newEvent.category = category;
+	newEvent.name = name;
+	if (detail != nullptr)
+		newEvent.detail = detail;
+
+	newEvent.durationUs = (u64)std::chrono::duration_cast<std::chrono::microseconds>(endTime - startTime).count();
+	newEvent.threadId = (u32)GetCurrentThreadId();
+	newEvent.hasDeviceId = (deviceId != nullptr);
+	if (newEvent.hasDeviceId)
+		memcpy(newEvent.deviceId, deviceId, sizeof(newEvent.deviceId));
+
+	newEvent.numBytes = numBytes;
+	newEvent.result = result;
+
+	std::lock_guard<std::mutex> eventsLock(eventsMutex);
+	if (events.size() >= MAX_EVENTS)
+	{
+		numDropped++;
+		return;
+	}
+
+	newEvent.startUs = (startTime > origin) ? (u64)std::chrono::duration_cast<std::chrono::microseconds>(startTime - origin).count() : 0;
+	events.emplace_back(std::move(newEvent));
+}
+
+bool TraceWriter::stop()
+{
+	if (!active.exchange(false))
+		return true;
+
+	std::lock_guard<std::mutex> eventsLock(eventsMutex);
+	const auto processId = (u32)GetCurrentProcessId();
+
+	std::string outStr;
+	outStr.reserve(events.size()*192 + 256);
+	outStr.append("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+
+	char lineBuf[256];
+	sprintf_s(lineBuf, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%u,\"args\":{\"name\":\"TegraRcmSmash\"}}", processId);
+	outStr.append(lineBuf);
+	for (const auto& currEvent : events)
+	{
+		outStr.append(",\n{\"name\":");
+		AppendJsonString(outStr, currEvent.name);
+		outStr.append(",\"cat\":");
+		AppendJsonString(outStr, currEvent.category);
+		sprintf_s(lineBuf, ",\"ph\":\"X\",\"ts\":%llu,\"dur\":%llu,\"pid\":%u,\"tid\":%u,\"args\":{",
+			(unsigned long long)currEvent.startUs, (unsigned long long)currEvent.durationUs, processId, currEvent.threadId);
+		outStr.append(lineBuf);
+
+		sprintf_s(lineBuf, "\"result\":%d,\"bytes\":%llu", currEvent.result, (unsigned long long)currEvent.numBytes);
+		outStr.append(lineBuf);
+		if (currEvent.hasDeviceId)
+		{
+			outStr.append(",\"device\":\"");
+			for (size_t i=0; i<sizeof(currEvent.deviceId); i++)
+			{
+				sprintf_s(lineBuf, "%02X", (u32)currEvent.deviceId[i]);
+				outStr.append(lineBuf);
+			}
+			outStr.push_back('"');
+		}
+		if (currEvent.detail.length() > 0)
+		{
+			outStr.append(",\"detail\":");
+			AppendJsonString(outStr, currEvent.detail.c_str());
+		}
+		outStr.append("}}");
+	}
+	outStr.append("\n]");
+	if (numDropped > 0)
+	{
+		sprintf_s(lineBuf, ",\"otherData\":{\"droppedEvents\":%llu}", (unsigned long long)numDropped);
+		outStr.append(lineBuf);
+	}
+	outStr.append("}\n");
+
+	const auto numEvents = events.size();
+	events.clear();
+	events.shrink_to_fit();
+
+	WinHandle fileHandle = CreateFile(outFilename.c_str(), GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+	DWORD bytesWritten = 0;
+	if (fileHandle.get() == INVALID_HANDLE_VALUE || WriteFile(fileHandle.get(), outStr.data(), (DWORD)outStr.size(), &bytesWritten, nullptr) == FALSE ||
+		bytesWritten != (DWORD)outStr.size())
+	{
+		const auto errorCode = GetLastError();
+		LogPrint(LogLevel::Error, TEXT("Couldn't write trace file '%Ts' (win32 error %u)\n"), outFilename.c_str(), errorCode);
+		return false;
+	}
+
+	LogPrint(LogLevel::Info, TEXT("Wrote %u trace events to '%Ts'%Ts\n"), (u32)numEvents, outFilename.c_str(), (numDropped > 0) ? TEXT(" (buffer filled up, later events were dropped)") : TEXT(""));
+	return true;
+}
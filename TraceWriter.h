@@ -0,0 +1,90 @@
+#pragma once
+
+#include "Types.h"
+#include "WinHandle.h"
+#include <chrono>
+#include <mutex>
+#include <atomic>
+
+//Process-wide collector of timed spans, written out as Chrome trace event JSON (chrome://tracing, Perfetto)
+//when stopped. Off unless started, and then every span costs one lock to append to a bounded buffer
+class TraceWriter
+{
+public:
+	static TraceWriter& instance();
+	typedef std::chrono::steady_clock::time_point TimePoint;
+
+	//Spans get timestamps relative to originTime, start it with the time the process began its work
+	void start(const TCHAR* filename, TimePoint originTime);
+	//Writes everything collected so far and stops collecting, returns false if the file couldn't be written
+	bool stop();
+	bool enabled() const { return active.load(std::memory_order_relaxed); }
+
+	//deviceId is 16 bytes or nullptr, detail is a UTF-8 name or path shown with the span
+	void addSpan(const char* category, const char* name, TimePoint startTime, TimePoint endTime,
+				const u8* deviceId = nullptr, const char* detail = nullptr, u64 numBytes = 0, int result = 0);
+
+	static std::string NarrowUtf8(const TCHAR* srcStr);
+protected:
+	TraceWriter() : active(false), numDropped(0) {}
+
+	static constexpr size_t MAX_EVENTS = 1024*1024;
+	struct Event
+	{
+		const char* category;
+		const char* name;
+		std::string detail;
+		u64 startUs;
+		u64 durationUs;
+		u32 threadId;
+		u8 deviceId[0x10];
+		bool hasDeviceId;
+		u64 numBytes;
+		int result;
+	};
+
+	std::atomic<bool> active;
+	std::mutex eventsMutex; //guards everything below
+	vector<Event> events;
+	u64 numDropped;
+	TimePoint origin;
+	WinString outFilename;
+};
+
+//Adds a span covering its own lifetime when tracing is on, costs one flag check when it's not
+class TraceSpan
+{
+public:
+	TraceSpan(const char* category_, const char* name_) : category(category_), name(name_), tracing(TraceWriter::instance().enabled())
+	{
+		if (tracing)
+			startTime = std::chrono::steady_clock::now();
+	}
+	TraceSpan(const char* category_, const char* name_, const TCHAR* detail_) : TraceSpan(category_, name_)
+	{
+		if (tracing && detail_ != nullptr)
+			detail = TraceWriter::NarrowUtf8(detail_);
+	}
+	~TraceSpan() { end(); }
+
+	//ends the span early, the destructor then does nothing
+	void end()
+	{
+		if (tracing)
+			TraceWriter::instance().addSpan(category, name, startTime, std::chrono::steady_clock::now(), nullptr, (detail.length() > 0) ? detail.c_str() : nullptr, numBytes, result);
+
+		tracing = false;
+	}
+
+	TraceSpan(const TraceSpan&) = delete;
+	TraceSpan& operator=(const TraceSpan&) = delete;
+
+	u64 numBytes = 0;
+	int result = 0;
+protected:
+	const char* category;
+	const char* name;
+	bool tracing;
+	std::string detail;
+	TraceWriter::TimePoint startTime;
+};
@@ -8,18 +8,17 @@
 #define strnicmp strncasecmp
 #endif
 
+//only for NULs inside a token now, the delimiters all come from scan_line
 static int find_next_char(const char* byteBuf, const int maxBytes, const char toFind)
 {
-	if (byteBuf == NULL || maxBytes == 0)
+	if (byteBuf == NULL || maxBytes <= 0)
 		return -1;
 
-	for (int i=0; i<maxBytes; i++)
-	{
-		if (byteBuf[i] == toFind)
-			return i;
-	}
+	const char* foundPos = (const char*)memchr(byteBuf, toFind, (size_t)maxBytes);
+	if (foundPos == NULL)
+		return -1;
 
-	return -1;
+	return (int)(foundPos - byteBuf);
 }
 
 static bool is_space(const char theChar)
@@ -47,27 +46,459 @@ static int trim_trailing_whitespace(char* textBytes, const int maxLen)
 	return realLen;
 }
 
-static char* my_strdup(const char* srcString, AllocatorFunc allocator)
+static char lower_char(char theChar)
+{
+	if (theChar >= 'A' && theChar <= 'Z')
+		theChar += 'a' - 'A';
+
+	return theChar;
+}
+
+//the input doesn't have to end in a NUL, so the last line's strings are only bounded by their length
+static int bounded_strlen(const char* textBytes, const int maxLen)
+{
+	const int nulPos = find_next_char(textBytes, maxLen, 0);
+	return (nulPos >= 0) ? nulPos : maxLen;
+}
+
+//case insensitive FNV-1a, so it agrees with names_equal
+static uint32_t hash_section_name(const char* nameStr, const int nameLen)
+{
+	uint32_t hashVal = 2166136261u;
+	for (int i=0; i<nameLen; i++)
+	{
+		hashVal ^= (uint8_t)lower_char(nameStr[i]);
+		hashVal *= 16777619u;
+	}
+	return hashVal;
+}
+
+//storedName is NUL terminated, nameStr is nameLen bytes without a NUL in them, so a shorter storedName
+//stops the compare at its own NUL before anything past it gets read
+static bool names_equal(const char* storedName, const char* nameStr, const int nameLen)
+{
+	return strnicmp(storedName, nameStr, (size_t)nameLen) == 0 && storedName[nameLen] == 0;
+}
+
+//where each delimiter first shows up in a line, relative to its start, or -1 if it doesn't.
+//only a ] after the colon counts, and nothing after the comment does
+typedef struct LineDelimiters_s
+{
+	int comment;
+	int colon;
+	int closing;
+	int equals;
+} LineDelimiters_t;
+
+//a line's delimiters are looked for 16 bytes at a time where SSE2 is always there, a byte at a time anywhere else
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define INIPARSE_HAVE_SSE2 1
+#include <emmintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define INIPARSE_SSE2_FUNC
+#else
+#define INIPARSE_SSE2_FUNC __attribute__((target("sse2")))
+#endif
+
+//a bit for each of the 16 bytes at blockBytes that is any delimiter, the newlines on their own in outNewlines
+INIPARSE_SSE2_FUNC static unsigned int find_delimiters(const char* blockBytes, unsigned int* outNewlines)
+{
+	const __m128i blockVec = _mm_loadu_si128((const __m128i*)blockBytes);
+	const __m128i newlineVec = _mm_cmpeq_epi8(blockVec, _mm_set1_epi8('\n'));
+	__m128i foundVec = _mm_or_si128(_mm_cmpeq_epi8(blockVec, _mm_set1_epi8(';')), _mm_cmpeq_epi8(blockVec, _mm_set1_epi8(':')));
+	foundVec = _mm_or_si128(foundVec, _mm_or_si128(_mm_cmpeq_epi8(blockVec, _mm_set1_epi8(']')), _mm_cmpeq_epi8(blockVec, _mm_set1_epi8('='))));
+	*outNewlines = (unsigned int)_mm_movemask_epi8(newlineVec);
+	return (unsigned int)_mm_movemask_epi8(_mm_or_si128(foundVec, newlineVec));
+}
+
+static int lowest_set_bit(const unsigned int bitMask)
+{
+#ifdef _MSC_VER
+	unsigned long bitIdx = 0;
+	_BitScanForward(&bitIdx, bitMask);
+	return (int)bitIdx;
+#else
+	return __builtin_ctz(bitMask);
+#endif
+}
+#else
+#define INIPARSE_HAVE_SSE2 0
+#endif
+
+//sorts out one delimiter, returns true if it ends the line
+static bool classify_delimiter(const char currChar, const int charPos, LineDelimiters_t* outDelims)
+{
+	if (currChar == '\n')
+		return true;
+	else if (outDelims->comment >= 0) //the rest of a comment only matters for where it ends
+		return false;
+
+	if (currChar == ';')
+		outDelims->comment = charPos;
+	else if (currChar == ':')
+	{
+		if (outDelims->colon < 0)
+			outDelims->colon = charPos;
+	}
+	else if (currChar == ']')
+	{
+		if (outDelims->colon >= 0 && outDelims->closing < 0)
+			outDelims->closing = charPos;
+	}
+	else if (currChar == '=')
+	{
+		if (outDelims->equals < 0)
+			outDelims->equals = charPos;
+	}
+	return false;
+}
+
+//a single pass over the line that sorts out every delimiter as it goes, instead of searching the line once for each of them.
+//with SSE2 each 16 byte block is compared against all of them at once and only the bytes that matched get looked at.
+//returns the position of the newline, or -1 if the line runs up to maxBytes
+static int scan_line(const char* lineBytes, const int maxBytes, LineDelimiters_t* outDelims)
+{
+	outDelims->comment = -1;
+	outDelims->colon = -1;
+	outDelims->closing = -1;
+	outDelims->equals = -1;
+
+	int i = 0;
+#if INIPARSE_HAVE_SSE2
+	for (; i+16 <= maxBytes; i+=16)
+	{
+		unsigned int newlineMask = 0;
+		unsigned int foundMask = find_delimiters(&lineBytes[i], &newlineMask);
+		if (outDelims->comment >= 0)
+			foundMask = newlineMask;
+
+		while (foundMask != 0)
+		{
+			const int charPos = i + lowest_set_bit(foundMask);
+			if (classify_delimiter(lineBytes[charPos], charPos, outDelims))
+				return charPos;
+
+			foundMask &= foundMask-1;
+			if (outDelims->comment >= 0)
+				foundMask &= newlineMask;
+		}
+	}
+#endif
+	for (; i<maxBytes; i++)
+	{
+		if (classify_delimiter(lineBytes[i], i, outDelims))
+			return i;
+	}
+	return -1;
+}
+
+//like strtoul, but never reads past maxLen. returns false if there was no number to parse
+static bool parse_value(const char* textBytes, const int maxLen, uint32_t* outValue)
+{
+	char valueBuf[64];
+	const char* valueStr = textBytes;
+	if (bounded_strlen(textBytes, maxLen) == maxLen)
+	{
+		//the value might run up to the end of an input without a NUL, any sensible spelling of a 32bit number fits
+		const int valueLen = (maxLen < (int)sizeof(valueBuf)) ? maxLen : (int)sizeof(valueBuf)-1;
+		memcpy(valueBuf, textBytes, (size_t)valueLen);
+		valueBuf[valueLen] = 0;
+		valueStr = valueBuf;
+	}
+
+	char* outPos = NULL;
+	*outValue = strtoul(valueStr, &outPos, 0);
+	return outPos != NULL && outPos != valueStr;
+}
+
+typedef struct SectionIndexSlot_s
+{
+	uint32_t hash;
+	const char* name;
+	void* node;
+} SectionIndexSlot_t;
+
+//open addressing table from section name to list node, one per section type
+typedef struct SectionIndex_s
+{
+	SectionIndexSlot_t* slots;
+	int capacity;
+	int count;
+	bool disabled; //an insert failed, so it's missing names and the list has to be walked from then on
+} SectionIndex_t;
+
+static void* section_index_find(const SectionIndex_t* index, const char* nameStr, const int nameLen, const uint32_t hashVal)
+{
+	if (index->capacity == 0)
+		return NULL;
+
+	const int mask = index->capacity-1;
+	for (int pos = (int)(hashVal & mask);; pos = (pos+1) & mask)
+	{
+		const SectionIndexSlot_t* currSlot = &index->slots[pos];
+		if (currSlot->node == NULL)
+			return NULL;
+		if (currSlot->hash == hashVal && names_equal(currSlot->name, nameStr, nameLen))
+			return currSlot->node;
+	}
+}
+
+static void section_index_free(SectionIndex_t* index, DeallocatorFunc deallocator)
+{
+	if (index->slots != NULL && deallocator != NULL)
+		deallocator(index->slots);
+
+	index->slots = NULL;
+	index->capacity = 0;
+	index->count = 0;
+}
+
+static bool section_index_insert(SectionIndex_t* index, const char* nameStr, const uint32_t hashVal, void* node, AllocatorFunc allocator, DeallocatorFunc deallocator)
+{
+	if (deallocator == NULL || index->disabled)
+		return false;
+
+	//keep the load factor at or below 1/2
+	if ((index->count+1)*2 > index->capacity)
+	{
+		const int newCapacity = (index->capacity > 0) ? index->capacity*2 : 64;
+		SectionIndexSlot_t* newSlots = (SectionIndexSlot_t*)allocator(sizeof(SectionIndexSlot_t)*newCapacity);
+		if (newSlots == NULL)
+		{
+			section_index_free(index, deallocator); //lookups go back to walking the list
+			index->disabled = true;
+			return false;
+		}
+
+		memset(newSlots, 0, sizeof(SectionIndexSlot_t)*newCapacity);
+		for (int i=0; i<index->capacity; i++)
+		{
+			const SectionIndexSlot_t* oldSlot = &index->slots[i];
+			if (oldSlot->node == NULL)
+				continue;
+
+			int pos = (int)(oldSlot->hash & (newCapacity-1));
+			while (newSlots[pos].node != NULL)
+				pos = (pos+1) & (newCapacity-1);
+
+			newSlots[pos] = *oldSlot;
+		}
+
+		if (index->slots != NULL)
+			deallocator(index->slots);
+
+		index->slots = newSlots;
+		index->capacity = newCapacity;
+	}
+
+	int pos = (int)(hashVal & (index->capacity-1));
+	while (index->slots[pos].node != NULL)
+		pos = (pos+1) & (index->capacity-1);
+
+	index->slots[pos].hash = hashVal;
+	index->slots[pos].name = nameStr;
+	index->slots[pos].node = node;
+	index->count++;
+	return true;
+}
+
+//without a deallocator there's no freeing a temporary index, so the plain form keeps a bloom filter of the section names
+//it has made nodes for on the stack instead. a name it has never seen can't be a redeclaration and skips the list walk,
+//so only repeated names (and the odd false positive) still walk. one filter serves all three types, each with its own seed
+#define SECTION_FILTER_BITS (1u << 18) //32KB
+#define SECTION_FILTER_PROBES 4
+
+typedef struct SectionFilter_s
+{
+	uint32_t words[SECTION_FILTER_BITS/32];
+} SectionFilter_t;
+
+enum { SECTION_SEED_LOAD = 0x4c4f4144, SECTION_SEED_COPY = 0x434f5059, SECTION_SEED_BOOT = 0x424f4f54 };
+
+//murmur3's finalizer, so the probe positions don't follow the low bits of the name hash
+static uint32_t mix_hash(uint32_t hashVal)
+{
+	hashVal ^= hashVal >> 16;
+	hashVal *= 0x85ebca6bu;
+	hashVal ^= hashVal >> 13;
+	hashVal *= 0xc2b2ae35u;
+	hashVal ^= hashVal >> 16;
+	return hashVal;
+}
+
+//probes with double hashing, returns true if every probed bit was already set. setBits sets them all too
+static bool section_filter_probe(SectionFilter_t* filter, const uint32_t nameHash, const uint32_t typeSeed, const bool setBits)
+{
+	const uint32_t firstHash = mix_hash(nameHash ^ typeSeed);
+	const uint32_t stepHash = mix_hash(firstHash + typeSeed) | 1;
+	bool allSet = true;
+	for (uint32_t i=0; i<SECTION_FILTER_PROBES; i++)
+	{
+		const uint32_t bitPos = (firstHash + i*stepHash) & (SECTION_FILTER_BITS-1);
+		const uint32_t bitMask = 1u << (bitPos & 31);
+		if ((filter->words[bitPos/32] & bitMask) == 0)
+		{
+			allSet = false;
+			if (!setBits)
+				break;
+
+			filter->words[bitPos/32] |= bitMask;
+		}
+	}
+	return allSet;
+}
+
+//where nodes and strings come from, either the allocator one at a time or a single preallocated arena
+typedef struct ParseStorage_s
+{
+	AllocatorFunc allocator;
+	const char* iniEnd;
+	char* arenaPos;
+	char* arenaEnd;
+} ParseStorage_t;
+
+#define ARENA_ALIGNMENT 8
+
+static void* storage_alloc(ParseStorage_t* storage, size_t numBytes)
+{
+	if (storage->arenaPos == NULL)
+		return storage->allocator(numBytes);
+
+	numBytes = (numBytes + ARENA_ALIGNMENT-1) & ~(size_t)(ARENA_ALIGNMENT-1);
+	if ((size_t)(storage->arenaEnd - storage->arenaPos) < numBytes)
+		return NULL;
+
+	void* outPtr = storage->arenaPos;
+	storage->arenaPos += numBytes;
+	return outPtr;
+}
+
+//the string is terminated in place by the parser unless it runs up to the end of the input
+static char* storage_strdup(ParseStorage_t* storage, char* srcString)
 {
 	if (srcString == NULL)
 		return NULL;
 
-	size_t srcLen = strlen(srcString);
-	char* dstString = (char*)allocator(srcLen+1);
-	memcpy(dstString, srcString, srcLen+1);
+	const size_t maxLen = (size_t)(storage->iniEnd - srcString);
+	const char* terminator = (const char*)memchr(srcString, 0, maxLen);
+	if (terminator != NULL && storage->arenaPos != NULL) //arena strings point right into the input
+		return srcString;
+
+	const size_t srcLen = (terminator != NULL) ? (size_t)(terminator - srcString) : maxLen;
+	char* dstString = (char*)storage_alloc(storage, srcLen+1);
+	if (dstString == NULL)
+		return NULL;
+
+	memcpy(dstString, srcString, srcLen);
+	dstString[srcLen] = 0;
 	return dstString;
 }
 
+//hands the section whose keys just ended to the visitor, if there is one
+static void emit_section(const IniSectionVisitor_t* visitor, const IniLoadSectionNode_t* loadNode, const IniCopySectionNode_t* copyNode, const IniBootSectionNode_t* bootNode, const bool redeclared)
+{
+	if (visitor == NULL)
+		return;
+
+	if (loadNode != NULL && visitor->onLoad != NULL)
+		visitor->onLoad(visitor->userData, &loadNode->curr, redeclared ? 1 : 0);
+	else if (copyNode != NULL && visitor->onCopy != NULL)
+		visitor->onCopy(visitor->userData, &copyNode->curr, redeclared ? 1 : 0);
+	else if (bootNode != NULL && visitor->onBoot != NULL)
+		visitor->onBoot(visitor->userData, &bootNode->curr, redeclared ? 1 : 0);
+}
+
+static IniParsedInfo_t parse_memloader_ini_impl(char* iniBytes, const int numBytes, AllocatorFunc allocator, DeallocatorFunc deallocator, void** outArena, const IniSectionVisitor_t* visitor, ErrPrintFunc printer);
+
 IniParsedInfo_t parse_memloader_ini(char* iniBytes, const int numBytes, AllocatorFunc allocator, ErrPrintFunc printer)
+{
+	return parse_memloader_ini_impl(iniBytes, numBytes, allocator, NULL, NULL, NULL, printer);
+}
+
+IniParsedInfo_t parse_memloader_ini_ex(char* iniBytes, const int numBytes, AllocatorFunc allocator, DeallocatorFunc deallocator, ErrPrintFunc printer)
+{
+	return parse_memloader_ini_impl(iniBytes, numBytes, allocator, deallocator, NULL, NULL, printer);
+}
+
+IniParsedInfo_t parse_memloader_ini_arena(char* iniBytes, const int numBytes, AllocatorFunc allocator, DeallocatorFunc deallocator, ErrPrintFunc printer, void** outArena)
+{
+	return parse_memloader_ini_impl(iniBytes, numBytes, allocator, deallocator, outArena, NULL, printer);
+}
+
+int parse_memloader_ini_stream(char* iniBytes, const int numBytes, const IniSectionVisitor_t* visitor, AllocatorFunc allocator, DeallocatorFunc deallocator, ErrPrintFunc printer)
+{
+	//the nodes are only kept around so a section declared twice merges like it does in the lists
+	void* arena = NULL;
+	IniParsedInfo_t info = parse_memloader_ini_impl(iniBytes, numBytes, allocator, deallocator, &arena, visitor, printer);
+	const int retVal = (numBytes > 0 && arena == NULL) ? -1 : 0;
+	free_memloader_arena(&info, &arena, deallocator);
+	return retVal;
+}
+
+static IniParsedInfo_t parse_memloader_ini_impl(char* iniBytes, const int numBytes, AllocatorFunc allocator, DeallocatorFunc deallocator, void** outArena, const IniSectionVisitor_t* visitor, ErrPrintFunc printer)
 {
 	IniParsedInfo_t out;
 	out.loads = NULL;
 	out.copies = NULL;
 	out.boots = NULL;
+	if (outArena != NULL)
+		*outArena = NULL;
+
+	ParseStorage_t storage;
+	storage.allocator = allocator;
+	storage.iniEnd = iniBytes + ((numBytes > 0) ? numBytes : 0);
+	storage.arenaPos = NULL;
+	storage.arenaEnd = NULL;
+	if (outArena != NULL && numBytes > 0)
+	{
+		//every section needs a [ so that bounds the node count, and at most one string per line
+		//has to be copied out (the one that runs into the end of the input)
+		size_t maxNodes = 0;
+		for (const char* currPos = iniBytes; currPos != NULL && currPos < storage.iniEnd; currPos++)
+		{
+			currPos = (const char*)memchr(currPos, '[', (size_t)(storage.iniEnd - currPos));
+			if (currPos == NULL)
+				break;
+
+			maxNodes++;
+		}
+
+		size_t maxNodeSize = sizeof(IniLoadSectionNode_t);
+		if (sizeof(IniCopySectionNode_t) > maxNodeSize)
+			maxNodeSize = sizeof(IniCopySectionNode_t);
+		if (sizeof(IniBootSectionNode_t) > maxNodeSize)
+			maxNodeSize = sizeof(IniBootSectionNode_t);
+
+		maxNodeSize = (maxNodeSize + ARENA_ALIGNMENT-1) & ~(size_t)(ARENA_ALIGNMENT-1);
+		const size_t arenaSize = maxNodes*maxNodeSize + (((size_t)numBytes + ARENA_ALIGNMENT) & ~(size_t)(ARENA_ALIGNMENT-1));
+		*outArena = allocator(arenaSize);
+		if (*outArena == NULL)
+		{
+			printer("Unable to allocate %u bytes for parsed ini data\n", (unsigned int)arenaSize);
+			return out;
+		}
+
+		storage.arenaPos = (char*)*outArena;
+		storage.arenaEnd = storage.arenaPos + arenaSize;
+	}
 
 	IniLoadSectionNode_t* currLoadNode = NULL;
 	IniCopySectionNode_t* currCopyNode = NULL;
 	IniBootSectionNode_t* currBootNode = NULL;
+	bool currRedeclared = false;
+	bool outOfMemory = false;
+
+	//tails for appending, indexes for finding a section that was already declared
+	IniLoadSectionNode_t* lastLoadNode = NULL;
+	IniCopySectionNode_t* lastCopyNode = NULL;
+	IniBootSectionNode_t* lastBootNode = NULL;
+	SectionIndex_t loadIndex = { NULL, 0, 0, false };
+	SectionIndex_t copyIndex = { NULL, 0, 0, false };
+	SectionIndex_t bootIndex = { NULL, 0, 0, false };
+	//also filled with an index, so it's still right if the index has to be given up halfway through
+	SectionFilter_t nameFilter;
+	memset(&nameFilter, 0, sizeof(nameFilter));
 
 	int currLine = -1;
 	int currPos = 0;	
@@ -77,7 +508,8 @@ IniParsedInfo_t parse_memloader_ini(char* iniBytes, const int numBytes, Allocato
 		char* const lineStart = &iniBytes[currPos];
 
 		char* currBytes = lineStart;
-		int lineLength = find_next_char(currBytes, bytesRemaining, '\n');
+		LineDelimiters_t lineDelims;
+		int lineLength = scan_line(currBytes, bytesRemaining, &lineDelims);
 		if (lineLength >= 0)
 		{
 			currBytes[lineLength] = 0;
@@ -93,20 +525,18 @@ IniParsedInfo_t parse_memloader_ini(char* iniBytes, const int numBytes, Allocato
 		currLine++;
 
 		//skip leading space
-		while (is_space(*currBytes) && lineLength > 0)
+		while (lineLength > 0 && is_space(*currBytes))
 		{
 			currBytes++;
 			lineLength--;
 		}
 
-		//trim comments
+		//trim comments, the delimiters are all past the leading space so they move with currBytes
+		const int lineOffset = (int)(currBytes - lineStart);
+		if (lineDelims.comment >= 0)
 		{
-			int semiColonPos = find_next_char(currBytes, lineLength, ';');
-			if (semiColonPos >= 0)
-			{
-				currBytes[semiColonPos] = 0;
-				lineLength = semiColonPos;
-			}
+			lineStart[lineDelims.comment] = 0;
+			lineLength = lineDelims.comment - lineOffset;
 		}
 		
 		lineLength = trim_trailing_whitespace(currBytes, lineLength);
@@ -120,16 +550,16 @@ IniParsedInfo_t parse_memloader_ini(char* iniBytes, const int numBytes, Allocato
 			lineLength--;
 
 			//skip leading space
-			while (is_space(*currBytes) && lineLength > 0)
+			while (lineLength > 0 && is_space(*currBytes))
 			{
 				currBytes++;
 				lineLength--;
 			}
 
-			int colonPos = find_next_char(currBytes, lineLength, ':');
+			const int colonPos = (lineDelims.colon >= 0) ? lineDelims.colon - (int)(currBytes - lineStart) : -1;
 			if (colonPos < 0)
 			{
-				printer("Cannot find : separator in section name '%s' on line %d, skipping\n", currBytes, currLine);
+				printer("Cannot find : separator in section name '%.*s' on line %d, skipping\n", bounded_strlen(currBytes, lineLength), currBytes, currLine);
 				continue;
 			}
 			currBytes[colonPos] = 0;
@@ -143,128 +573,204 @@ IniParsedInfo_t parse_memloader_ini(char* iniBytes, const int numBytes, Allocato
 			char* rightSide = currBytes+colonPos+1;
 			int rightSideLen = lineLength-colonPos-1;
 
-			while (is_space(*rightSide) && rightSideLen > 0)
+			while (rightSideLen > 0 && is_space(*rightSide))
 			{
 				rightSide++;
 				rightSideLen--;
 			}
-			int rightSideClosingPos = find_next_char(rightSide, rightSideLen, ']');
+			const int rightSideClosingPos = (lineDelims.closing >= 0) ? lineDelims.closing - (int)(rightSide - lineStart) : -1;
 			if (rightSideClosingPos < 0)
-				printer("No closing ] found for section '%s' on line %d, behaving as if it was there\n", rightSide, currLine);
+				printer("No closing ] found for section '%.*s' on line %d, behaving as if it was there\n", bounded_strlen(rightSide, rightSideLen), rightSide, currLine);
 			else
 			{
 				rightSide[rightSideClosingPos] = 0;
 				rightSideLen = rightSideClosingPos;
 			}
 			rightSideLen = trim_trailing_whitespace(rightSide, rightSideLen);
+			const int nameLen = bounded_strlen(rightSide, rightSideLen);
 
+			emit_section(visitor, currLoadNode, currCopyNode, currBootNode, currRedeclared);
+			currRedeclared = false;
 			currLoadNode = NULL;
 			currCopyNode = NULL;
 			currBootNode = NULL;
 			if (strnicmp(leftSide, "load", leftSideLen) == 0)
 			{
-				if (out.loads == NULL)
+				const uint32_t nameHash = hash_section_name(rightSide, nameLen);
+				if (loadIndex.capacity > 0)
+					currLoadNode = (IniLoadSectionNode_t*)section_index_find(&loadIndex, rightSide, nameLen, nameHash);
+				else if (section_filter_probe(&nameFilter, nameHash, SECTION_SEED_LOAD, false))
 				{
-					out.loads = allocator(sizeof(IniLoadSectionNode_t));
-					currLoadNode = out.loads;
-					memset(currLoadNode, 0, sizeof(IniLoadSectionNode_t));
-				}
-				else
-				{
-					IniLoadSectionNode_t* currNode = out.loads;
-					while (currNode->next != NULL) 
-					{ 
-						if (stricmp(currNode->curr.sectname, rightSide) == 0)
+					for (IniLoadSectionNode_t* currNode = out.loads; currNode != NULL && currNode->next != NULL; currNode = currNode->next)
+					{
+						if (names_equal(currNode->curr.sectname, rightSide, nameLen))
 						{
 							currLoadNode = currNode;
 							break;
 						}
-						currNode = currNode->next; 
 					}
+				}
+
+				//the original parser never compared against the newest section, so repeating its header has always started another one
+				const bool nameIndexed = (currLoadNode != NULL);
+				if (currLoadNode == lastLoadNode)
+					currLoadNode = NULL;
+
+				if (currLoadNode != NULL)
+					currRedeclared = true;
+				else
+				{
+					currLoadNode = storage_alloc(&storage, sizeof(IniLoadSectionNode_t));
 					if (currLoadNode == NULL)
 					{
-						currNode->next = allocator(sizeof(IniLoadSectionNode_t));
-						currLoadNode = currNode->next;
-						memset(currLoadNode, 0, sizeof(IniLoadSectionNode_t));
+						outOfMemory = true;
+						break;
 					}
-				}
+					memset(currLoadNode, 0, sizeof(IniLoadSectionNode_t));
+					currLoadNode->curr.sectname = storage_strdup(&storage, rightSide);
+					if (currLoadNode->curr.sectname == NULL)
+					{
+						if (storage.arenaPos == NULL && deallocator != NULL)
+							deallocator(currLoadNode);
 
-				if (currLoadNode->curr.sectname == NULL)
-					currLoadNode->curr.sectname = my_strdup(rightSide, allocator);
+						currLoadNode = NULL;
+						outOfMemory = true;
+						break;
+					}
+
+					if (lastLoadNode == NULL)
+						out.loads = currLoadNode;
+					else
+						lastLoadNode->next = currLoadNode;
+
+					lastLoadNode = currLoadNode;
+					section_filter_probe(&nameFilter, nameHash, SECTION_SEED_LOAD, true);
+					if (!nameIndexed)
+						section_index_insert(&loadIndex, currLoadNode->curr.sectname, nameHash, currLoadNode, allocator, deallocator);
+				}
 			}
 			else if (strnicmp(leftSide, "copy", leftSideLen) == 0)
 			{
-				if (out.copies == NULL)
-				{
-					out.copies = allocator(sizeof(IniCopySectionNode_t));
-					currCopyNode = out.copies;
-					memset(currCopyNode, 0, sizeof(IniCopySectionNode_t));
-				}
-				else
+				const uint32_t nameHash = hash_section_name(rightSide, nameLen);
+				if (copyIndex.capacity > 0)
+					currCopyNode = (IniCopySectionNode_t*)section_index_find(&copyIndex, rightSide, nameLen, nameHash);
+				else if (section_filter_probe(&nameFilter, nameHash, SECTION_SEED_COPY, false))
 				{
-					IniCopySectionNode_t* currNode = out.copies;
-					while (currNode->next != NULL)
+					for (IniCopySectionNode_t* currNode = out.copies; currNode != NULL && currNode->next != NULL; currNode = currNode->next)
 					{
-						if (stricmp(currNode->curr.sectname, rightSide) == 0)
+						if (names_equal(currNode->curr.sectname, rightSide, nameLen))
 						{
 							currCopyNode = currNode;
 							break;
 						}
-						currNode = currNode->next;
 					}
+				}
+
+				//the original parser never compared against the newest section, so repeating its header has always started another one
+				const bool nameIndexed = (currCopyNode != NULL);
+				if (currCopyNode == lastCopyNode)
+					currCopyNode = NULL;
+
+				if (currCopyNode != NULL)
+					currRedeclared = true;
+				else
+				{
+					currCopyNode = storage_alloc(&storage, sizeof(IniCopySectionNode_t));
 					if (currCopyNode == NULL)
 					{
-						currNode->next = allocator(sizeof(IniCopySectionNode_t));
-						currCopyNode = currNode->next;
-						memset(currCopyNode, 0, sizeof(IniCopySectionNode_t));
+						outOfMemory = true;
+						break;
+					}
+					memset(currCopyNode, 0, sizeof(IniCopySectionNode_t));
+					currCopyNode->curr.sectname = storage_strdup(&storage, rightSide);
+					if (currCopyNode->curr.sectname == NULL)
+					{
+						if (storage.arenaPos == NULL && deallocator != NULL)
+							deallocator(currCopyNode);
+
+						currCopyNode = NULL;
+						outOfMemory = true;
+						break;
 					}
-				}
 
-				if (currCopyNode->curr.sectname == NULL)
-					currCopyNode->curr.sectname = my_strdup(rightSide, allocator);
+					if (lastCopyNode == NULL)
+						out.copies = currCopyNode;
+					else
+						lastCopyNode->next = currCopyNode;
+
+					lastCopyNode = currCopyNode;
+					section_filter_probe(&nameFilter, nameHash, SECTION_SEED_COPY, true);
+					if (!nameIndexed)
+						section_index_insert(&copyIndex, currCopyNode->curr.sectname, nameHash, currCopyNode, allocator, deallocator);
+				}
 			}
 			else if (strnicmp(leftSide, "boot", leftSideLen) == 0)
 			{
-				if (out.boots == NULL)
-				{
-					out.boots = allocator(sizeof(IniBootSectionNode_t));
-					currBootNode = out.boots;
-					memset(currBootNode, 0, sizeof(IniBootSectionNode_t));
-				}
-				else
+				const uint32_t nameHash = hash_section_name(rightSide, nameLen);
+				if (bootIndex.capacity > 0)
+					currBootNode = (IniBootSectionNode_t*)section_index_find(&bootIndex, rightSide, nameLen, nameHash);
+				else if (section_filter_probe(&nameFilter, nameHash, SECTION_SEED_BOOT, false))
 				{
-					IniBootSectionNode_t* currNode = out.boots;
-					while (currNode->next != NULL)
+					for (IniBootSectionNode_t* currNode = out.boots; currNode != NULL && currNode->next != NULL; currNode = currNode->next)
 					{
-						if (stricmp(currNode->curr.sectname, rightSide) == 0)
+						if (names_equal(currNode->curr.sectname, rightSide, nameLen))
 						{
 							currBootNode = currNode;
 							break;
 						}
-						currNode = currNode->next;
 					}
+				}
+
+				//the original parser never compared against the newest section, so repeating its header has always started another one
+				const bool nameIndexed = (currBootNode != NULL);
+				if (currBootNode == lastBootNode)
+					currBootNode = NULL;
+
+				if (currBootNode != NULL)
+					currRedeclared = true;
+				else
+				{
+					currBootNode = storage_alloc(&storage, sizeof(IniBootSectionNode_t));
 					if (currBootNode == NULL)
 					{
-						currNode->next = allocator(sizeof(IniBootSectionNode_t));
-						currBootNode = currNode->next;
-						memset(currBootNode, 0, sizeof(IniBootSectionNode_t));
+						outOfMemory = true;
+						break;
+					}
+					memset(currBootNode, 0, sizeof(IniBootSectionNode_t));
+					currBootNode->curr.sectname = storage_strdup(&storage, rightSide);
+					if (currBootNode->curr.sectname == NULL)
+					{
+						if (storage.arenaPos == NULL && deallocator != NULL)
+							deallocator(currBootNode);
+
+						currBootNode = NULL;
+						outOfMemory = true;
+						break;
 					}
+
+					if (lastBootNode == NULL)
+						out.boots = currBootNode;
+					else
+						lastBootNode->next = currBootNode;
+
+					lastBootNode = currBootNode;
+					section_filter_probe(&nameFilter, nameHash, SECTION_SEED_BOOT, true);
+					if (!nameIndexed)
+						section_index_insert(&bootIndex, currBootNode->curr.sectname, nameHash, currBootNode, allocator, deallocator);
 				}
-				if (currBootNode->curr.sectname == NULL)
-					currBootNode->curr.sectname = my_strdup(rightSide, allocator);
 			}
 			else
 			{
-				printer("Unknown section type '%s' on line %d\n", rightSide, currLine);
+				printer("Unknown section type '%.*s' on line %d\n", nameLen, rightSide, currLine);
 				continue;
 			}
 		}
 		else //key=value
 		{
-			int equalsPos = find_next_char(currBytes, lineLength, '=');
+			const int equalsPos = (lineDelims.equals >= 0) ? lineDelims.equals - lineOffset : -1;
 			if (equalsPos < 0)
 			{
-				printer("Cannot find = separator in kv pair '%s' on line %d, skipping\n", currBytes, currLine);
+				printer("Cannot find = separator in kv pair '%.*s' on line %d, skipping\n", bounded_strlen(currBytes, lineLength), currBytes, currLine);
 				continue;
 			}
 			currBytes[equalsPos] = 0;
@@ -277,7 +783,7 @@ IniParsedInfo_t parse_memloader_ini(char* iniBytes, const int numBytes, Allocato
 			//right side processing
 			char* rightSide = currBytes+equalsPos+1;
 			int rightSideLen = lineLength-equalsPos-1;
-			while (is_space(*rightSide) && rightSideLen > 0)
+			while (rightSideLen > 0 && is_space(*rightSide))
 			{
 				rightSide++;
 				rightSideLen--;
@@ -301,13 +807,23 @@ IniParsedInfo_t parse_memloader_ini(char* iniBytes, const int numBytes, Allocato
 					continue;
 				}
 				else if (currKey == KEY_INPUTFILE)
-					currLoadNode->curr.filename = my_strdup(rightSide,allocator);
+				{
+					char* newFilename = storage_strdup(&storage, rightSide);
+					if (newFilename == NULL)
+					{
+						outOfMemory = true;
+						break;
+					}
+					if (currLoadNode->curr.filename != NULL && storage.arenaPos == NULL && deallocator != NULL)
+						deallocator(currLoadNode->curr.filename);
+
+					currLoadNode->curr.filename = newFilename;
+				}
 				else
 				{
-					char* outPos = NULL;
-					uint32_t theValue = strtoul(rightSide, &outPos, 0);
-					if (outPos == NULL || outPos == rightSide)
-						printer("Invalid value '%s' for LOAD section key '%s' on line %d, skipping\n", rightSide, leftSide, currLine);
+					uint32_t theValue = 0;
+					if (!parse_value(rightSide, rightSideLen, &theValue))
+						printer("Invalid value '%.*s' for LOAD section key '%s' on line %d, skipping\n", bounded_strlen(rightSide, rightSideLen), rightSide, leftSide, currLine);
 					else if (currKey == KEY_SKIPBYTES)
 						currLoadNode->curr.skip = theValue;
 					else if (currKey == KEY_COUNTBYTES)
@@ -334,10 +850,9 @@ IniParsedInfo_t parse_memloader_ini(char* iniBytes, const int numBytes, Allocato
 				}
 				else
 				{
-					char* outPos = NULL;
-					uint32_t theValue = strtoul(rightSide, &outPos, 0);
-					if (outPos == NULL || outPos == rightSide)
-						printer("Invalid value '%s' for COPY section key '%s' on line %d, skipping\n", rightSide, leftSide, currLine);
+					uint32_t theValue = 0;
+					if (!parse_value(rightSide, rightSideLen, &theValue))
+						printer("Invalid value '%.*s' for COPY section key '%s' on line %d, skipping\n", bounded_strlen(rightSide, rightSideLen), rightSide, leftSide, currLine);
 					else if (currKey == KEY_COMPTYPE)
 						currCopyNode->curr.compType = theValue;
 					else if (currKey == KEY_SRCADDR)
@@ -368,10 +883,9 @@ IniParsedInfo_t parse_memloader_ini(char* iniBytes, const int numBytes, Allocato
 				}
 				else
 				{
-					char* outPos = NULL;
-					uint32_t theValue = strtoul(rightSide, &outPos, 0);
-					if (outPos == NULL || outPos == rightSide)
-						printer("Invalid value '%s' for BOOT section key '%s' on line %d, skipping\n", rightSide, leftSide, currLine);
+					uint32_t theValue = 0;
+					if (!parse_value(rightSide, rightSideLen, &theValue))
+						printer("Invalid value '%.*s' for BOOT section key '%s' on line %d, skipping\n", bounded_strlen(rightSide, rightSideLen), rightSide, leftSide, currLine);
 					else if (currKey == KEY_PCADDR)
 						currBootNode->curr.pc = theValue;
 				}
@@ -384,9 +898,47 @@ IniParsedInfo_t parse_memloader_ini(char* iniBytes, const int numBytes, Allocato
 		}
 	}
 
+	if (outOfMemory)
+	{
+		printer("Unable to allocate memory for parsed ini data on line %d\n", currLine);
+		section_index_free(&loadIndex, deallocator);
+		section_index_free(&copyIndex, deallocator);
+		section_index_free(&bootIndex, deallocator);
+
+		//a partial result mustn't look like a whole one. without a deallocator what was parsed so far can't be given back
+		if (outArena != NULL && deallocator != NULL)
+			free_memloader_arena(&out, outArena, deallocator);
+		else if (deallocator != NULL)
+			free_memloader_info(&out, deallocator);
+
+		out.loads = NULL;
+		out.copies = NULL;
+		out.boots = NULL;
+		if (outArena != NULL)
+			*outArena = NULL;
+
+		return out;
+	}
+
+	emit_section(visitor, currLoadNode, currCopyNode, currBootNode, currRedeclared);
+
+	section_index_free(&loadIndex, deallocator);
+	section_index_free(&copyIndex, deallocator);
+	section_index_free(&bootIndex, deallocator);
 	return out;
 }
 
+void free_memloader_arena(IniParsedInfo_t* infoPtr, void** arenaPtr, DeallocatorFunc deallocator)
+{
+	if (*arenaPtr != NULL)
+		deallocator(*arenaPtr);
+
+	*arenaPtr = NULL;
+	infoPtr->loads = NULL;
+	infoPtr->copies = NULL;
+	infoPtr->boots = NULL;
+}
+
 void free_memloader_info(IniParsedInfo_t* infoPtr, DeallocatorFunc deallocator)
 {
 	if (infoPtr->loads != NULL)
@@ -59,11 +59,32 @@ typedef struct IniParsedInfo_s
 } IniParsedInfo_t;
 
 typedef void*(*AllocatorFunc)(size_t numBytes);
+typedef void(*DeallocatorFunc)(void* allocBytes);
 typedef int(*ErrPrintFunc)(const char* format, ...);
+//if memory runs out, all of these print it and return no sections at all (only the forms with a deallocator can free what they had parsed)
+//without a deallocator nothing temporary can be allocated, so it tells new section names apart with a fixed size filter on the stack
 IniParsedInfo_t parse_memloader_ini(char* iniBytes, const int numBytes, AllocatorFunc allocator, ErrPrintFunc printer);
+//same as above, but with a deallocator it can keep a temporary hash index of section names, making lookups constant time
+IniParsedInfo_t parse_memloader_ini_ex(char* iniBytes, const int numBytes, AllocatorFunc allocator, DeallocatorFunc deallocator, ErrPrintFunc printer);
+//puts all nodes in one allocation and points names straight into iniBytes (which must outlive the result). that allocation
+//goes in *outArena (which mustn't be NULL itself, it's NULL afterwards if there was nothing to parse or it couldn't be made), give it to free_memloader_arena instead of free_memloader_info
+IniParsedInfo_t parse_memloader_ini_arena(char* iniBytes, const int numBytes, AllocatorFunc allocator, DeallocatorFunc deallocator, ErrPrintFunc printer, void** outArena);
 
-typedef void(*DeallocatorFunc)(void* allocBytes);
 void free_memloader_info(IniParsedInfo_t* infoPtr, DeallocatorFunc deallocator);
+//a single deallocation, then infoPtr has no sections and arenaPtr is NULL
+void free_memloader_arena(IniParsedInfo_t* infoPtr, void** arenaPtr, DeallocatorFunc deallocator);
+
+//called once a section's last key has been parsed, redeclared is non-zero if a section with the same name
+//was already emitted and this is its merged state. the section is only valid for the duration of the call
+typedef struct IniSectionVisitor_s
+{
+	void* userData;
+	void(*onLoad)(void* userData, const IniLoadSection_t* section, int redeclared);
+	void(*onCopy)(void* userData, const IniCopySection_t* section, int redeclared);
+	void(*onBoot)(void* userData, const IniBootSection_t* section, int redeclared);
+} IniSectionVisitor_t;
+//streaming form, nothing is kept after it returns. returns 0, or -1 if the working memory couldn't be allocated
+int parse_memloader_ini_stream(char* iniBytes, const int numBytes, const IniSectionVisitor_t* visitor, AllocatorFunc allocator, DeallocatorFunc deallocator, ErrPrintFunc printer);
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,432 @@
+//Differential test and benchmark for iniparse.c. Every input is parsed by the original parser (iniparse_ref.c) and by the
+//current one in its plain, _ex (hash index) and arena forms, and the parsed sections and printed diagnostics have to match.
+//The current parser gets each input without a NUL after it, so ASan catches any read past the end.
+//  iniparse_test [inputs.ini...]	checks the given files, then a few thousand generated inis
+//  iniparse_test --bench			times each form on large generated inis
+#define _POSIX_C_SOURCE 199309L //clock_gettime
+#include "../iniparse.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <time.h>
+
+IniParsedInfo_t parse_memloader_ini_ref(char* iniBytes, const int numBytes, AllocatorFunc allocator, ErrPrintFunc printer);
+void free_memloader_info_ref(IniParsedInfo_t* infoPtr, DeallocatorFunc deallocator);
+
+#define NUM_GENERATED 3000
+
+//growable text, for both the diagnostics and the dumped sections
+typedef struct Text_s
+{
+	char* bytes;
+	size_t length;
+	size_t capacity;
+} Text_t;
+
+static void text_append(Text_t* text, const char* format, va_list args)
+{
+	va_list argsCopy;
+	va_copy(argsCopy, args);
+	const int needed = vsnprintf(NULL, 0, format, argsCopy);
+	va_end(argsCopy);
+	if (needed <= 0)
+		return;
+
+	if (text->length + (size_t)needed + 1 > text->capacity)
+	{
+		size_t newCapacity = (text->capacity > 0) ? text->capacity*2 : 4096;
+		while (newCapacity < text->length + (size_t)needed + 1)
+			newCapacity *= 2;
+
+		text->bytes = (char*)realloc(text->bytes, newCapacity);
+		text->capacity = newCapacity;
+	}
+	vsnprintf(&text->bytes[text->length], (size_t)needed+1, format, args);
+	text->length += (size_t)needed;
+}
+
+static void text_printf(Text_t* text, const char* format, ...)
+{
+	va_list args;
+	va_start(args, format);
+	text_append(text, format, args);
+	va_end(args);
+}
+
+static void text_clear(Text_t* text)
+{
+	text->length = 0;
+	if (text->bytes != NULL)
+		text->bytes[0] = 0;
+}
+
+static Text_t printedText;
+static int capture_printer(const char* format, ...)
+{
+	va_list args;
+	va_start(args, format);
+	text_append(&printedText, format, args);
+	va_end(args);
+	return 0;
+}
+static int silent_printer(const char* format, ...)
+{
+	(void)format;
+	return 0;
+}
+
+//the _ex and arena forms have to give back everything they allocate
+static long liveAllocations = 0;
+static void* counted_malloc(size_t numBytes)
+{
+	liveAllocations++;
+	return malloc(numBytes);
+}
+static void counted_free(void* allocBytes)
+{
+	if (allocBytes != NULL)
+		liveAllocations--;
+
+	free(allocBytes);
+}
+
+//fails every allocation after the first allocationsLeft, for the out of memory paths
+static long allocationsLeft = -1;
+static void* failing_malloc(size_t numBytes)
+{
+	if (allocationsLeft == 0)
+		return NULL;
+	if (allocationsLeft > 0)
+		allocationsLeft--;
+
+	return counted_malloc(numBytes);
+}
+
+static void dump_sections(const IniParsedInfo_t* info, Text_t* outText)
+{
+	for (const IniLoadSectionNode_t* currNode = info->loads; currNode != NULL; currNode = currNode->next)
+	{
+		text_printf(outText, "load '%s' if='%s' skip=%u count=%u dst=%u\n", currNode->curr.sectname,
+			(currNode->curr.filename != NULL) ? currNode->curr.filename : "(none)", currNode->curr.skip, currNode->curr.count, currNode->curr.dst);
+	}
+	for (const IniCopySectionNode_t* currNode = info->copies; currNode != NULL; currNode = currNode->next)
+	{
+		text_printf(outText, "copy '%s' type=%u src=%u srclen=%u dst=%u dstlen=%u\n", currNode->curr.sectname,
+			currNode->curr.compType, currNode->curr.src, currNode->curr.srclen, currNode->curr.dst, currNode->curr.dstlen);
+	}
+	for (const IniBootSectionNode_t* currNode = info->boots; currNode != NULL; currNode = currNode->next)
+		text_printf(outText, "boot '%s' pc=%u\n", currNode->curr.sectname, currNode->curr.pc);
+}
+
+enum { MODE_REF, MODE_PLAIN, MODE_EX, MODE_ARENA, MODE_COUNT };
+static const char* modeNames[MODE_COUNT] = { "original", "plain", "_ex", "arena" };
+
+//parses a private copy of the input, the parser writes into it. Only the original parser gets a NUL after the input
+static void parse_with(const int mode, const char* iniBytes, const int numBytes, Text_t* outSections, Text_t* outPrinted)
+{
+	char* parseBuf = (char*)malloc((size_t)numBytes + 1);
+	memcpy(parseBuf, iniBytes, (size_t)numBytes);
+	parseBuf[numBytes] = 0;
+	if (mode != MODE_REF)
+	{
+		//exact size, so ASan sees any read past the end
+		char* exactBuf = (char*)malloc((numBytes > 0) ? (size_t)numBytes : 1);
+		memcpy(exactBuf, parseBuf, (size_t)numBytes);
+		free(parseBuf);
+		parseBuf = exactBuf;
+	}
+
+	text_clear(&printedText);
+	IniParsedInfo_t info;
+	void* arena = NULL;
+	liveAllocations = 0;
+	if (mode == MODE_REF)
+		info = parse_memloader_ini_ref(parseBuf, numBytes, malloc, capture_printer);
+	else if (mode == MODE_PLAIN)
+		info = parse_memloader_ini(parseBuf, numBytes, malloc, capture_printer);
+	else if (mode == MODE_EX)
+		info = parse_memloader_ini_ex(parseBuf, numBytes, counted_malloc, counted_free, capture_printer);
+	else
+		info = parse_memloader_ini_arena(parseBuf, numBytes, counted_malloc, counted_free, capture_printer, &arena);
+
+	text_clear(outSections);
+	dump_sections(&info, outSections);
+	text_clear(outPrinted);
+	text_printf(outPrinted, "%s", (printedText.bytes != NULL) ? printedText.bytes : "");
+
+	if (mode == MODE_REF)
+		free_memloader_info_ref(&info, free);
+	else if (mode == MODE_PLAIN)
+		free_memloader_info(&info, free);
+	else if (mode == MODE_EX)
+		free_memloader_info(&info, counted_free);
+	else
+		free_memloader_arena(&info, &arena, counted_free);
+
+	if ((mode == MODE_EX || mode == MODE_ARENA) && liveAllocations != 0)
+	{
+		fprintf(stderr, "%s form left %ld allocations behind\n", modeNames[mode], liveAllocations);
+		exit(1);
+	}
+	free(parseBuf);
+}
+
+//returns false and prints the first difference if any form disagrees with the original parser
+static bool check_input(const char* inputName, const char* iniBytes, const int numBytes)
+{
+	Text_t refSections = { NULL, 0, 0 }, refPrinted = { NULL, 0, 0 };
+	Text_t currSections = { NULL, 0, 0 }, currPrinted = { NULL, 0, 0 };
+	parse_with(MODE_REF, iniBytes, numBytes, &refSections, &refPrinted);
+
+	bool allMatched = true;
+	for (int mode=MODE_PLAIN; mode<MODE_COUNT && allMatched; mode++)
+	{
+		parse_with(mode, iniBytes, numBytes, &currSections, &currPrinted);
+		const char* refStr = (refSections.bytes != NULL) ? refSections.bytes : "";
+		const char* currStr = (currSections.bytes != NULL) ? currSections.bytes : "";
+		const char* refMsgs = (refPrinted.bytes != NULL) ? refPrinted.bytes : "";
+		const char* currMsgs = (currPrinted.bytes != NULL) ? currPrinted.bytes : "";
+		if (strcmp(refStr, currStr) != 0 || strcmp(refMsgs, currMsgs) != 0)
+		{
+			fprintf(stderr, "%s: %s form differs from the original parser\n--- input ---\n%.*s\n--- original ---\n%s%s--- %s ---\n%s%s",
+				inputName, modeNames[mode], numBytes, iniBytes, refStr, refMsgs, modeNames[mode], currStr, currMsgs);
+			allMatched = false;
+		}
+	}
+
+	free(refSections.bytes);
+	free(refPrinted.bytes);
+	free(currSections.bytes);
+	free(currPrinted.bytes);
+	return allMatched;
+}
+
+//runs out of memory at every allocation in turn. Losing the hash index only slows the parse down, so the result has to be
+//either complete or empty, with nothing left allocated either way
+static bool check_out_of_memory(const char* iniBytes, const int numBytes)
+{
+	Text_t fullSections = { NULL, 0, 0 }, fullPrinted = { NULL, 0, 0 }, currSections = { NULL, 0, 0 };
+	parse_with(MODE_EX, iniBytes, numBytes, &fullSections, &fullPrinted);
+
+	bool allPassed = true;
+	for (int mode=MODE_EX; mode<MODE_COUNT && allPassed; mode++)
+	{
+		for (long failAt=0;; failAt++)
+		{
+			char* parseBuf = (char*)malloc((numBytes > 0) ? (size_t)numBytes : 1);
+			memcpy(parseBuf, iniBytes, (size_t)numBytes);
+			liveAllocations = 0;
+			allocationsLeft = failAt;
+			void* arena = NULL;
+			IniParsedInfo_t info = (mode == MODE_EX) ? parse_memloader_ini_ex(parseBuf, numBytes, failing_malloc, counted_free, silent_printer) :
+				parse_memloader_ini_arena(parseBuf, numBytes, failing_malloc, counted_free, silent_printer, &arena);
+			const bool ranOut = (allocationsLeft == 0);
+			allocationsLeft = -1;
+
+			text_clear(&currSections);
+			dump_sections(&info, &currSections);
+			const bool gotSections = (currSections.length > 0);
+			const bool complete = gotSections && fullSections.length == currSections.length && strcmp(fullSections.bytes, currSections.bytes) == 0;
+			if (mode == MODE_EX)
+				free_memloader_info(&info, counted_free);
+			else
+				free_memloader_arena(&info, &arena, counted_free);
+
+			free(parseBuf);
+			if (liveAllocations != 0 || (gotSections && !complete))
+			{
+				fprintf(stderr, "%s form failing allocation %ld: %ld allocations left behind, %s\n", modeNames[mode], failAt,
+					liveAllocations, gotSections ? "returned a partial result" : "returned nothing");
+				allPassed = false;
+				break;
+			}
+			if (!ranOut)
+				break;
+		}
+	}
+
+	free(fullSections.bytes);
+	free(fullPrinted.bytes);
+	free(currSections.bytes);
+	return allPassed;
+}
+
+//xorshift, so every run generates the same inputs
+static unsigned int randState = 0x12345678u;
+static unsigned int next_rand(void)
+{
+	randState ^= randState << 13;
+	randState ^= randState >> 17;
+	randState ^= randState << 5;
+	return randState;
+}
+static const char* pick(const char* const* choices, size_t numChoices)
+{
+	return choices[next_rand() % numChoices];
+}
+#define PICK(choices) pick(choices, sizeof(choices)/sizeof(choices[0]))
+
+//mostly well formed inis with names that repeat (in different case too), plus the kinds of damage real files have
+static void generate_ini(Text_t* outText)
+{
+	static const char* const sectionTypes[] = { "load", "copy", "boot", "LOAD", "Copy", "bOOt", "lo", "", "junk" };
+	static const char* const sectionNames[] = { "kernel", "KERNEL", "initrd", "dtb", "fdt", "atf", "a", "coreboot_part_1", "x y" };
+	static const char* const keyNames[] = { "if", "skip", "count", "dst", "type", "src", "srclen", "dstlen", "pc", "IF", "d", "bogus", "" };
+	static const char* const values[] = { "0x80000000", "123", "0", "-1", "0x", "nonsense", "4294967295", "99999999999", " 0x10 ", "kernel.bin", "C:\\path\\x.bin" };
+	static const char* const spaces[] = { "", "", "", " ", "\t", "  " };
+	static const char* const lineEnds[] = { "\n", "\n", "\n", "\r\n", " ; comment\n", "\t\n" };
+
+	text_clear(outText);
+	const unsigned int numLines = 1 + next_rand() % 40;
+	for (unsigned int i=0; i<numLines; i++)
+	{
+		const unsigned int lineKind = next_rand() % 10;
+		if (lineKind < 3)
+		{
+			text_printf(outText, "%s[%s%s%s:%s%s%s%s", PICK(spaces), PICK(spaces), PICK(sectionTypes), PICK(spaces),
+				PICK(spaces), PICK(sectionNames), PICK(spaces), (next_rand() % 8 == 0) ? "" : "]");
+			if (next_rand() % 25 == 0) //no colon at all
+				text_printf(outText, "[%s", PICK(sectionNames));
+		}
+		else if (lineKind < 8)
+			text_printf(outText, "%s%s%s=%s%s", PICK(spaces), PICK(keyNames), PICK(spaces), PICK(spaces), PICK(values));
+		else if (lineKind < 9)
+			text_printf(outText, "%s;%s", PICK(spaces), PICK(values));
+		else
+			text_printf(outText, "%s%s", PICK(spaces), PICK(values));
+
+		//the last line often has no newline, which is what the NUL-less buffers are about
+		if (i+1 < numLines || next_rand() % 2 == 0)
+			text_printf(outText, "%s", PICK(lineEnds));
+	}
+}
+
+static char* read_file(const char* filename, int* outSize)
+{
+	FILE* inFile = fopen(filename, "rb");
+	if (inFile == NULL)
+		return NULL;
+
+	fseek(inFile, 0, SEEK_END);
+	const long fileSize = ftell(inFile);
+	fseek(inFile, 0, SEEK_SET);
+	char* fileBytes = (char*)malloc((fileSize > 0) ? (size_t)fileSize : 1);
+	if (fileSize > 0 && fread(fileBytes, 1, (size_t)fileSize, inFile) != (size_t)fileSize)
+	{
+		fclose(inFile);
+		free(fileBytes);
+		return NULL;
+	}
+	fclose(inFile);
+	*outSize = (int)fileSize;
+	return fileBytes;
+}
+
+//thousands of sections with long names and comments, the shape that made the list walk quadratic
+static void generate_large_ini(Text_t* outText, const int numLoads, const int numCopies)
+{
+	text_clear(outText);
+	for (int i=0; i<numLoads; i++)
+	{
+		text_printf(outText, "[load:coreboot_chunk_section_number_%d] ; one chunk of the image, sent on request\n"
+			"if = coreboot/coreboot_image_split_part_%d.bin\nskip = 0x%x\ncount = 0x10000\ndst = 0x%x\n\n", i, i, i*0x10000, 0x80000000u + i*0x10000);
+	}
+	for (int i=0; i<numCopies; i++)
+		text_printf(outText, "[copy:relocation_step_%d]\ntype=1\nsrc=0x%x\nsrclen=0x1000\ndst=0x%x\ndstlen=0x2000\n", i, 0x90000000u + i*0x1000, 0xa0000000u + i*0x2000);
+
+	text_printf(outText, "[boot:start]\npc=0x80000000\n");
+}
+
+static double seconds_now(void)
+{
+	struct timespec currTime;
+	clock_gettime(CLOCK_MONOTONIC, &currTime);
+	return currTime.tv_sec + currTime.tv_nsec/1e9;
+}
+
+static int run_benchmark(void)
+{
+	static const int loadCounts[] = { 2000, 20000 };
+	Text_t iniText = { NULL, 0, 0 };
+	for (size_t sizeIdx=0; sizeIdx<sizeof(loadCounts)/sizeof(loadCounts[0]); sizeIdx++)
+	{
+		generate_large_ini(&iniText, loadCounts[sizeIdx], loadCounts[sizeIdx]/10);
+		printf("%d LOAD and %d COPY sections, %.2f MB:\n", loadCounts[sizeIdx], loadCounts[sizeIdx]/10, iniText.length/(1024.0*1024.0));
+		for (int mode=0; mode<MODE_COUNT; mode++)
+		{
+			char* parseBuf = (char*)malloc(iniText.length+1);
+			int numParses = 0;
+			double totalSecs = 0;
+			//the original parser is quadratic, so it gets fewer rounds on the big file
+			while (numParses < 3 || (totalSecs < 1.0 && numParses < 50))
+			{
+				memcpy(parseBuf, iniText.bytes, iniText.length+1);
+				const double startSecs = seconds_now();
+				IniParsedInfo_t info;
+				void* arena = NULL;
+				if (mode == MODE_REF)
+					info = parse_memloader_ini_ref(parseBuf, (int)iniText.length, malloc, silent_printer);
+				else if (mode == MODE_PLAIN)
+					info = parse_memloader_ini(parseBuf, (int)iniText.length, malloc, silent_printer);
+				else if (mode == MODE_EX)
+					info = parse_memloader_ini_ex(parseBuf, (int)iniText.length, malloc, free, silent_printer);
+				else
+					info = parse_memloader_ini_arena(parseBuf, (int)iniText.length, malloc, free, silent_printer, &arena);
+				totalSecs += seconds_now() - startSecs;
+				numParses++;
+
+				if (mode == MODE_REF)
+					free_memloader_info_ref(&info, free);
+				else if (mode == MODE_ARENA)
+					free_memloader_arena(&info, &arena, free);
+				else
+					free_memloader_info(&info, free);
+			}
+			free(parseBuf);
+
+			const double secsPerParse = totalSecs/numParses;
+			printf("  %-8s %10.2f ms per parse %10.1f MB/s\n", modeNames[mode], secsPerParse*1000.0, iniText.length/(1024.0*1024.0)/secsPerParse);
+		}
+	}
+	free(iniText.bytes);
+	return 0;
+}
+
+int main(int argc, char* argv[])
+{
+	if (argc > 1 && strcmp(argv[1], "--bench") == 0)
+		return run_benchmark();
+
+	int numFailed = 0;
+	for (int i=1; i<argc; i++)
+	{
+		int fileSize = 0;
+		char* fileBytes = read_file(argv[i], &fileSize);
+		if (fileBytes == NULL)
+		{
+			fprintf(stderr, "Couldn't read %s\n", argv[i]);
+			return 1;
+		}
+		if (!check_input(argv[i], fileBytes, fileSize) || !check_out_of_memory(fileBytes, fileSize))
+			numFailed++;
+
+		free(fileBytes);
+	}
+
+	Text_t iniText = { NULL, 0, 0 };
+	for (int i=0; i<NUM_GENERATED; i++)
+	{
+		generate_ini(&iniText);
+		char inputName[64];
+		snprintf(inputName, sizeof(inputName), "generated ini %d", i);
+		if (!check_input(inputName, (iniText.bytes != NULL) ? iniText.bytes : "", (int)iniText.length))
+			numFailed++;
+	}
+	free(iniText.bytes);
+	free(printedText.bytes);
+
+	printf("%d files and %d generated inis checked, %d differed\n", argc-1, NUM_GENERATED, numFailed);
+	return (numFailed == 0) ? 0 : 1;
+}